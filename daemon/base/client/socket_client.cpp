@@ -41,6 +41,59 @@ bool send_on_socket(int fd, const void *buf, size_t size) {
     return true;
 }
 
+bool send_fd_on_socket(int fd, int fd_to_send, const void *buf, size_t size) {
+    struct iovec iov = {(void *) buf, size};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd_to_send, sizeof(int));
+
+    // The descriptor is attached to the first chunk, the rest is sent as regular data
+    ssize_t bytes_sent = sendmsg(fd, &hdr, MSG_NOSIGNAL);
+    if (bytes_sent <= 0) {
+        perror("sendmsg");
+        return false;
+    }
+    return send_on_socket(fd, (char *)buf + bytes_sent, size - bytes_sent);
+}
+
+bool send_with_header_on_socket(int fd, const void *header, size_t header_size, const void *buf, size_t size) {
+    struct iovec iov[2] = {{(void *) header, header_size}, {(void *) buf, size}};
+
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = 2;
+
+    ssize_t bytes_sent = sendmsg(fd, &hdr, MSG_NOSIGNAL);
+    if (bytes_sent <= 0) {
+        perror("sendmsg");
+        return false;
+    }
+
+    // Partial send, finish whatever is left of each part
+    size_t sent = bytes_sent;
+    if (sent < header_size) {
+        if (!send_on_socket(fd, (char *)header + sent, header_size - sent)) return false;
+        sent = header_size;
+    }
+    return send_on_socket(fd, (char *)buf + (sent - header_size), size - (sent - header_size));
+}
+
 bool receive_on_socket(int fd, void *buf, size_t size) {
     size_t byte_offset = 0;
 
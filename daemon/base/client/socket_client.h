@@ -7,6 +7,16 @@ int initialize(const char *socket_path);
 
 bool send_on_socket(int fd, const void *buf, size_t size);
 
+/*
+* Same as send_on_socket, additionally passing fd_to_send to the peer as SCM_RIGHTS ancillary data.
+*/
+bool send_fd_on_socket(int fd, int fd_to_send, const void *buf, size_t size);
+
+/*
+* Same as send_on_socket, sending header followed by buf with a single system call whenever the socket allows it.
+*/
+bool send_with_header_on_socket(int fd, const void *header, size_t header_size, const void *buf, size_t size);
+
 bool receive_on_socket(int fd, void *buf, size_t size);
 
 void end(int fd);
@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "utils/logger.h"
+#include "server/poller.h"
+
+#define NO_SOCKET -1
+
+namespace hhal_daemon {
+
+static Logger &logger = Logger::get_instance();
+
+std::unique_ptr<Poller> Poller::create(Backend backend, int capacity) {
+  switch (backend) {
+    case Backend::POLL:
+      return std::unique_ptr<Poller>(new PollPoller(capacity));
+    case Backend::EPOLL: {
+      std::unique_ptr<EpollPoller> poller(new EpollPoller(capacity));
+      if (!poller->initialize())
+        return nullptr;
+      return std::unique_ptr<Poller>(poller.release());
+    }
+  }
+  return nullptr;
+}
+
+// poll
+
+PollPoller::PollPoller(int capacity) : pollfds(capacity) {
+  for (auto &pfd : pollfds) {
+    pfd.fd = NO_SOCKET;
+    pfd.events = 0;
+    pfd.revents = 0;
+  }
+}
+
+bool PollPoller::add(int idx, int fd) {
+  pollfds[idx].fd = fd;
+  pollfds[idx].events = POLLIN | POLLPRI;
+  pollfds[idx].revents = 0;
+  return true;
+}
+
+void PollPoller::remove(int idx) {
+  pollfds[idx].fd = NO_SOCKET;
+  pollfds[idx].events = 0;
+  pollfds[idx].revents = 0;
+}
+
+void PollPoller::set_write_interest(int idx, bool enabled) {
+  if (enabled)
+    pollfds[idx].events |= POLLOUT;
+  else
+    pollfds[idx].events &= ~POLLOUT;
+}
+
+void PollPoller::set_read_interest(int idx, bool enabled) {
+  if (enabled)
+    pollfds[idx].events |= POLLIN;
+  else
+    pollfds[idx].events &= ~POLLIN;
+}
+
+int PollPoller::wait(std::vector<event_t> &events, int timeout_ms) {
+  events.clear();
+  int ready = poll(pollfds.data(), pollfds.size(), timeout_ms);
+  if (ready < 0)
+    return -1;
+
+  for (int i = 0; i < (int) pollfds.size() && (int) events.size() < ready; i++) {
+    auto revents = pollfds[i].revents;
+    if (!revents)
+      continue;
+    pollfds[i].revents = 0;
+    events.push_back({
+        i,
+        (revents & POLLIN) != 0,
+        (revents & POLLOUT) != 0,
+        (revents & POLLHUP) != 0,
+        (revents & (POLLERR | POLLNVAL | POLLPRI)) != 0,
+    });
+  }
+  return events.size();
+}
+
+// epoll
+
+EpollPoller::EpollPoller(int capacity) : fds(capacity, NO_SOCKET) {}
+
+EpollPoller::~EpollPoller() {
+  if (epoll_fd != NO_SOCKET)
+    close(epoll_fd);
+}
+
+bool EpollPoller::initialize() {
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    logger.critical("poller (epoll_create1): {}", strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool EpollPoller::add(int idx, int fd) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  // Registered once for everything, with edge triggering there is no need to toggle write interest
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  ev.data.u32 = idx;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    logger.error("poller (epoll_ctl add): {}", strerror(errno));
+    return false;
+  }
+  fds[idx] = fd;
+  return true;
+}
+
+void EpollPoller::remove(int idx) {
+  if (fds[idx] == NO_SOCKET)
+    return;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fds[idx], nullptr) < 0) {
+    logger.error("poller (epoll_ctl del): {}", strerror(errno));
+  }
+  fds[idx] = NO_SOCKET;
+}
+
+int EpollPoller::wait(std::vector<event_t> &events, int timeout_ms) {
+  struct epoll_event ready[MAX_EVENTS_PER_WAIT];
+  events.clear();
+  int count = epoll_wait(epoll_fd, ready, MAX_EVENTS_PER_WAIT, timeout_ms);
+  if (count < 0)
+    return -1;
+
+  for (int i = 0; i < count; i++) {
+    auto revents = ready[i].events;
+    events.push_back({
+        (int)ready[i].data.u32,
+        (revents & EPOLLIN) != 0,
+        (revents & EPOLLOUT) != 0,
+        (revents & (EPOLLHUP | EPOLLRDHUP)) != 0,
+        (revents & EPOLLERR) != 0,
+    });
+  }
+  return count;
+}
+
+} // namespace hhal_daemon
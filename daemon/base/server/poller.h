@@ -0,0 +1,102 @@
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <memory>
+#include <poll.h>
+#include <vector>
+
+namespace hhal_daemon {
+
+/*
+* Readiness notification for the file descriptors of the Server, each one identified by a slot index.
+* Every registered descriptor is watched for reading by default, reading and writing interest can be toggled per slot.
+*/
+class Poller {
+
+public:
+  enum class Backend {
+    POLL,  // poll(2), scans every slot on each wake up. Level triggered.
+    EPOLL, // epoll(7), only reports ready slots. Edge triggered, the caller must read/write until EAGAIN.
+  };
+
+  struct event_t {
+    int idx;
+    bool readable;
+    bool writable;
+    bool hang_up; // Peer closed the connection, data may be left to read
+    bool error;
+  };
+
+  /*
+  * \param capacity Amount of slots, indexes go from 0 to capacity - 1.
+  * \returns nullptr if the backend could not be initialized.
+  */
+  static std::unique_ptr<Poller> create(Backend backend, int capacity);
+
+  virtual ~Poller() {}
+
+  virtual bool add(int idx, int fd) = 0;
+  virtual void remove(int idx) = 0;
+
+  /*
+  * \brief Whether a slot should be reported as writable.
+  * Edge triggered backends always report the transition to writable, so this only needs to be kept up to date for level triggered ones.
+  */
+  virtual void set_write_interest(int idx, bool enabled) = 0;
+
+  /*
+  * \brief Whether a slot should be reported as readable.
+  * Edge triggered backends ignore it, a caller that stops reading has to read again on its own when resuming.
+  */
+  virtual void set_read_interest(int idx, bool enabled) = 0;
+
+  /*
+  * \brief Wait for events, -1 timeout blocks until at least one is available.
+  * \returns Amount of events stored, or -1 on error (errno is set).
+  */
+  virtual int wait(std::vector<event_t> &events, int timeout_ms) = 0;
+
+  virtual bool is_edge_triggered() const = 0;
+};
+
+class PollPoller : public Poller {
+
+public:
+  PollPoller(int capacity);
+
+  bool add(int idx, int fd) override;
+  void remove(int idx) override;
+  void set_write_interest(int idx, bool enabled) override;
+  void set_read_interest(int idx, bool enabled) override;
+  int wait(std::vector<event_t> &events, int timeout_ms) override;
+  bool is_edge_triggered() const override { return false; }
+
+private:
+  std::vector<pollfd> pollfds;
+};
+
+class EpollPoller : public Poller {
+
+public:
+  EpollPoller(int capacity);
+  ~EpollPoller();
+
+  bool initialize();
+
+  bool add(int idx, int fd) override;
+  void remove(int idx) override;
+  void set_write_interest(int, bool) override {}
+  void set_read_interest(int, bool) override {}
+  int wait(std::vector<event_t> &events, int timeout_ms) override;
+  bool is_edge_triggered() const override { return true; }
+
+private:
+  static const int MAX_EVENTS_PER_WAIT = 64;
+
+  int epoll_fd = -1;
+  std::vector<int> fds; // Registered descriptor per slot, needed to unregister it
+};
+
+} // namespace hhal_daemon
+
+#endif // POLLER_H
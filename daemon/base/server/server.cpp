@@ -1,6 +1,8 @@
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -13,92 +15,288 @@
 
 namespace hhal_daemon {
 
+const size_t Server::STREAM_CHUNK_SIZE;
+
 static Logger &logger = Logger::get_instance();
 
 void Server::close_socket(int fd_idx) {
   logger.debug("close_socket: Closing socket {}", fd_idx);
-  if (fd_idx != listen_idx)
+  poller->remove(fd_idx);
+  if (fd_idx == listen_idx) {
+    close(listen_fd);
+    listen_fd = NO_SOCKET;
+  } else if (fd_idx == wake_idx) {
+    close(wake_fd);
+    wake_fd = NO_SOCKET;
+  } else {
+    if (close_listener)
+      close_listener(fd_idx, *this);
+    socket_stats_t stats = sockets[fd_idx]->get_stats(fd_idx);
+    closed_bytes_received += stats.bytes_received;
+    closed_bytes_sent += stats.bytes_sent;
+    closed_stalls += stats.stalls;
+    pending_output -= sockets[fd_idx]->pending_output();
+    if (stats.stalled)
+      stalled_sockets.erase(std::find(stalled_sockets.begin(), stalled_sockets.end(), fd_idx));
     sockets[fd_idx] = nullptr;
-  else
-    close(pollfds[fd_idx].fd);
-
-  pollfds[fd_idx].fd = NO_SOCKET;
-  pollfds[fd_idx].events = 0;
-  pollfds[fd_idx].revents = 0;
+    free_slots.push_back(fd_idx);
+  }
 }
 
 void Server::close_sockets() {
-  for (int i = 0; i < pollfds.size(); i++) {
-    if (pollfds[i].fd != NO_SOCKET) {
+  if (!poller)
+    return;
+  for (int i = 0; i < max_connections; i++) {
+    if (sockets[i]) {
       close_socket(i);
     }
   }
+  if (listen_fd != NO_SOCKET)
+    close_socket(listen_idx);
+  if (wake_fd != NO_SOCKET)
+    close_socket(wake_idx);
 }
 
-Server::AcceptConnectionExitCode Server::accept_new_connection() {
-  int server_fd = pollfds[listen_idx].fd;
-  int new_socket = accept(server_fd, nullptr, nullptr);
-  if (new_socket < 0) {
-    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-      logger.trace("accept: No connection available, trying again later");
-      return AcceptConnectionExitCode::OK;
-    } else {
-      logger.error("accept: {}", strerror(errno));
-      return AcceptConnectionExitCode::ERROR;
+Server::AcceptConnectionExitCode Server::accept_new_connections() {
+  // The listen socket may be edge triggered, so the whole backlog is accepted
+  while (true) {
+    int new_socket = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (new_socket < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        logger.trace("accept: No connection available, trying again later");
+        return AcceptConnectionExitCode::OK;
+      } else if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      } else {
+        logger.error("accept: {}", strerror(errno));
+        return AcceptConnectionExitCode::ERROR;
+      }
     }
-  }
-  int new_socket_idx = -1;
-  for (int i = 0; i < max_connections; i++) {
-    if (pollfds[i].fd == NO_SOCKET) {
-      new_socket_idx = i;
-      break;
+    if (free_slots.empty()) {
+      logger.error("accept: Connection limit reached, rejecting connection");
+      close(new_socket);
+      continue;
+    }
+    int new_socket_idx = free_slots.back();
+    free_slots.pop_back();
+
+    auto socket_msg_listener = [this, new_socket_idx](message_t msg) { return this->msg_listener(new_socket_idx, msg, *this); };
+    auto socket_data_listener = [this, new_socket_idx](packet_t packet) { return this->data_listener(new_socket_idx, packet, *this); };
+    Socket::socket_stream_listener_t socket_stream_listener = nullptr;
+    if (stream_listener) {
+      socket_stream_listener = [this, new_socket_idx](chunk_t chunk) { return this->stream_listener(new_socket_idx, chunk, *this); };
     }
+    sockets[new_socket_idx] = std::make_unique<Server::Socket>(new_socket, socket_msg_listener, socket_data_listener, socket_stream_listener);
+    is_dirty[new_socket_idx] = false;
+    is_pending_read[new_socket_idx] = false;
+
+    if (!poller->add(new_socket_idx, new_socket)) {
+      sockets[new_socket_idx] = nullptr;
+      free_slots.push_back(new_socket_idx);
+      continue;
+    }
+
+    connections_accepted++;
+    logger.info("accept: New connection on {} (fd = {})", new_socket_idx, new_socket);
   }
-  if (new_socket_idx == -1) {
-    logger.error("accept: Connection limit reached, rejecting connection");
-    close(new_socket);
-    return AcceptConnectionExitCode::OK;
+}
+
+void Server::send_on_socket(int id, message_t msg) {
+  sockets[id]->queue_message(msg);
+  pending_output += msg.size;
+  update_output_budget(id);
+  if (!is_dirty[id]) {
+    is_dirty[id] = true;
+    dirty_sockets.push_back(id);
   }
-  pollfds[new_socket_idx].fd = new_socket;
-  pollfds[new_socket_idx].events = POLLIN | POLLPRI;
-  pollfds[new_socket_idx].revents = 0;
+}
 
-  auto socket_msg_listener = [this, new_socket_idx](message_t msg) { return this->msg_listener(new_socket_idx, msg, *this); };
-  auto socket_data_listener = [this, new_socket_idx](packet_t packet) { return this->data_listener(new_socket_idx, packet, *this); };
-  sockets[new_socket_idx] = std::make_unique<Server::Socket>(new_socket, socket_msg_listener, socket_data_listener);
+void Server::send_copy_on_socket(int id, const void *buf, size_t size) {
+  sockets[id]->queue_copy(buf, size);
+  pending_output += size;
+  update_output_budget(id);
+  if (!is_dirty[id]) {
+    is_dirty[id] = true;
+    dirty_sockets.push_back(id);
+  }
+}
 
-  logger.info("accept: New connection on {} (fd = {})", new_socket_idx, new_socket);
-  return AcceptConnectionExitCode::OK;
+void Server::reserve_output(int id, size_t size) {
+  sockets[id]->reserve(size);
+  pending_output += size;
+  update_output_budget(id);
 }
 
-void Server::send_on_socket(int id, message_t msg) {
-  sockets[id]->queue_message(msg);
+void Server::release_output(int id, size_t size) {
+  sockets[id]->release(size);
+  pending_output -= size;
+  update_output_budget(id);
+}
+
+void Server::post(std::function<void()> completion) {
+  {
+    std::unique_lock<std::mutex> lock(completions_mutex);
+    completions.push_back(std::move(completion));
+  }
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+    logger.error("post (write): {}", strerror(errno));
+  }
 }
 
-void Server::check_for_writes() {
+void Server::run_completions() {
+  uint64_t count;
+  if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    logger.error("run_completions (read): {}", strerror(errno));
+  }
+
+  std::vector<std::function<void()>> ready;
+  {
+    std::unique_lock<std::mutex> lock(completions_mutex);
+    ready.swap(completions);
+  }
+  logger.trace("run_completions: Running {} completions", ready.size());
+  for (auto &completion : ready) {
+    completion();
+  }
+}
+
+Server::stats_t Server::get_stats() const {
+  stats_t stats = {closed_bytes_received, closed_bytes_sent, connections_accepted, closed_stalls, pending_output, {}};
   for (int i = 0; i < max_connections; i++) {
-    if (sockets[i] && sockets[i]->wants_to_write()) {
-      logger.trace("check_for_writes: Incoming data on socket {}", i);
-      pollfds[i].events |= POLLOUT;
-    } else {
-      pollfds[i].events &= ~POLLOUT;
+    if (!sockets[i])
+      continue;
+    socket_stats_t socket_stats = sockets[i]->get_stats(i);
+    stats.bytes_received += socket_stats.bytes_received;
+    stats.bytes_sent += socket_stats.bytes_sent;
+    stats.stalls += socket_stats.stalls;
+    stats.sockets.push_back(socket_stats);
+  }
+  return stats;
+}
+
+void Server::pause_receiving(int id) {
+  sockets[id]->set_paused(true);
+  update_read_interest(id);
+}
+
+void Server::resume_receiving(int id) {
+  sockets[id]->set_paused(false);
+  update_read_interest(id);
+}
+
+int Server::take_received_fd(int id) {
+  return sockets[id]->take_received_fd();
+}
+
+void Server::update_write_interest(int idx) {
+  poller->set_write_interest(idx, sockets[idx]->wants_to_write());
+}
+
+void Server::update_read_interest(int idx) {
+  bool reading = sockets[idx]->is_reading();
+  poller->set_read_interest(idx, reading);
+  // Edge triggered pollers do not report data that arrived in the meantime, and messages may be left in the buffer
+  if (reading && !is_pending_read[idx]) {
+    is_pending_read[idx] = true;
+    pending_reads.push_back(idx);
+  }
+}
+
+// Stops reading from connections whose responses are not being read by the client, so the memory held for them stays bounded
+void Server::update_output_budget(int idx) {
+  Socket &socket = *sockets[idx];
+  size_t pending = socket.pending_output();
+  bool over = (output_budget.per_connection > 0 && pending > output_budget.per_connection) ||
+              (output_budget.total > 0 && pending_output > output_budget.total && pending > 0);
+  if (over == socket.is_stalled())
+    return;
+
+  if (over) {
+    logger.debug("update_output_budget: {} bytes pending on socket {}, stop reading", pending, idx);
+    stalled_sockets.push_back(idx);
+  } else {
+    logger.debug("update_output_budget: {} bytes pending on socket {}, read again", pending, idx);
+    stalled_sockets.erase(std::find(stalled_sockets.begin(), stalled_sockets.end(), idx));
+  }
+  socket.set_stalled(over);
+  update_read_interest(idx);
+}
+
+// Any connection draining its output can bring the total back under budget
+void Server::update_stalled_sockets() {
+  std::vector<int> stalled = stalled_sockets;
+  for (int idx : stalled) {
+    update_output_budget(idx);
+  }
+}
+
+bool Server::send_queued(int idx) {
+  size_t pending = sockets[idx]->pending_output();
+  if (sockets[idx]->send_messages() == Socket::SendMessagesExitCode::ERROR)
+    return false;
+  pending_output -= pending - sockets[idx]->pending_output();
+  update_write_interest(idx);
+  update_output_budget(idx);
+  return true;
+}
+
+// Messages are sent right away, only connections whose socket buffer fills up wait to be reported as writable
+void Server::flush_writes() {
+  std::vector<int> flushing;
+  flushing.swap(dirty_sockets);
+  for (int idx : flushing) {
+    is_dirty[idx] = false;
+    if (!sockets[idx])
+      continue;
+    logger.trace("flush_writes: Sending queued messages on socket {}", idx);
+    if (!send_queued(idx)) {
+      logger.error("flush_writes: Send error on socket {}", idx);
+      close_socket(idx);
     }
   }
+  if (!stalled_sockets.empty())
+    update_stalled_sockets();
+}
+
+void Server::receive_on(int idx) {
+  switch (sockets[idx]->receive_messages()) {
+    case Socket::ReceiveMessagesExitCode::ERROR:
+      logger.error("server_loop: Receive error on socket {}", idx);
+      close_socket(idx);
+      break;
+    case Socket::ReceiveMessagesExitCode::HANG_UP:
+      logger.info("server_loop: Client closed connection on socket {}", idx);
+      close_socket(idx);
+      break;
+    case Socket::ReceiveMessagesExitCode::PENDING:
+      if (!is_pending_read[idx]) {
+        is_pending_read[idx] = true;
+        pending_reads.push_back(idx);
+      }
+      break;
+    case Socket::ReceiveMessagesExitCode::OK:
+      break;
+  }
 }
 
 Server::InitExitCode Server::initialize() {
   logger.info("initialize: Initializing server");
 
-  for (auto &pollfd : pollfds) {
-    pollfd.fd = NO_SOCKET;
-    pollfd.events = 0;
-    pollfd.revents = 0;
+  poller = Poller::create(backend, max_connections + 2);
+  if (!poller) {
+    logger.critical("initialize: Could not create the poller");
+    return InitExitCode::ERROR;
+  }
+
+  free_slots.clear();
+  for (int i = max_connections - 1; i >= 0; i--) {
+    free_slots.push_back(i);
   }
 
   int server_fd = -1;
-  pollfds[listen_idx].events = POLLIN | POLLPRI;
 
-  if ((server_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == 0) {
+  if ((server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
     logger.critical("initialize (socket): {}", strerror(errno));
     return InitExitCode::ERROR;
   }
@@ -117,12 +315,20 @@ Server::InitExitCode Server::initialize() {
     return InitExitCode::ERROR;
   }
 
-  if (listen(server_fd, 3) < 0) {
+  if (listen(server_fd, SOMAXCONN) < 0) {
     logger.critical("initialize (listen): {}", strerror(errno));
     return InitExitCode::ERROR;
   }
 
-  pollfds[listen_idx].fd = server_fd;
+  listen_fd = server_fd;
+  poller->add(listen_idx, listen_fd);
+
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd < 0) {
+    logger.critical("initialize (eventfd): {}", strerror(errno));
+    return InitExitCode::ERROR;
+  }
+  poller->add(wake_idx, wake_fd);
 
   initialized = true;
   return InitExitCode::OK;
@@ -130,86 +336,68 @@ Server::InitExitCode Server::initialize() {
 
 Server::StartExitCode Server::server_loop() {
   unsigned int loop = 0;
+  std::vector<Poller::event_t> events;
 
   while (running) {
-    check_for_writes();
-
-    int events = poll(pollfds.data(), pollfds.size(), -1 /* -1 == block until events are received */);
-    if (events == -1) {
-      logger.critical("server_loop (poll): {}", strerror(errno));
+    flush_writes();
+
+    // Connections that stopped reading because of their budget are served again without blocking
+    int timeout = pending_reads.empty() ? -1 /* -1 == block until events are received */ : 0;
+    if (poller->wait(events, timeout) < 0) {
+      if (errno == EINTR)
+        continue;
+      logger.critical("server_loop (wait): {}", strerror(errno));
       return StartExitCode::ERROR;
     }
 
-    for (int i = 0, events_left = events; i < pollfds.size() && events_left > 0; i++) {
-      if (pollfds[i].revents) {
-        auto socket_events = pollfds[i].revents;
-        if (socket_events & POLLIN) { // Ready to read
-          if (i == listen_idx) {      // Listen socket, new connection available
-            switch (accept_new_connection()) {
-              case Server::AcceptConnectionExitCode::ERROR:
-                logger.critical("server_loop ({}): Accept error, ending server", loop);
-                close_sockets();
-                return StartExitCode::ERROR;
-                break;
-              case Server::AcceptConnectionExitCode::OK:
-                break;
-            }
-          } else {
-            switch (sockets[i]->receive_messages()) {
-              case Socket::ReceiveMessagesExitCode::ERROR:
-                logger.error("server_loop ({}): Receive error", loop);
-                close_socket(i);
-                events_left--;
-                continue;
-                break;
-              case Socket::ReceiveMessagesExitCode::HANG_UP:
-                logger.info("server_loop ({}): Client closed connection on socket {}", loop, i);
-                close_socket(i);
-                events_left--;
-                continue;
-                break;
-              case Socket::ReceiveMessagesExitCode::OK:
-                break;
-            }
-          }
-        }
-        if (socket_events & POLLOUT) { // Ready to write
-          switch (sockets[i]->send_messages()) {
-            case Socket::SendMessagesExitCode::ERROR:
-              logger.error("server_loop ({}): Send error", loop);
-              close_socket(i);
-              events_left--;
-              continue;
-            case Socket::SendMessagesExitCode::OK:
-              break;
-          }
-        }
-        if (socket_events & POLLPRI) { // Exceptional condition (very rare)
-          logger.error("server_loop ({}): Exceptional condition on idx {}", loop, i);
-          close_socket(i);
-          events_left--;
-          continue;
-        }
-        if (socket_events & POLLERR) {                                // Error / read end of pipe is closed
-          logger.error("server_loop ({}): Error on idx {}", loop, i); // errno?
-          close_socket(i);
-          events_left--;
-          continue;
+    for (auto &event : events) {
+      int i = event.idx;
+      if (i == wake_idx) { // Work posted from other threads
+        run_completions();
+        continue;
+      }
+      if (i == listen_idx) { // Listen socket, new connection available
+        if (accept_new_connections() == AcceptConnectionExitCode::ERROR) {
+          logger.critical("server_loop ({}): Accept error, ending server", loop);
+          close_sockets();
+          return StartExitCode::ERROR;
         }
-        if (socket_events & POLLHUP) { // Other end closed connection, some data may be left to read
-          logger.error("server_loop ({}): Got hang up on {}", loop, i);
-          close_socket(i);
-          events_left--;
+        continue;
+      }
+      if (!sockets[i]) // Closed by an earlier event of this same wake up
+        continue;
+
+      if (event.readable || event.hang_up) { // Ready to read, or other end closed connection with some data possibly left to read
+        receive_on(i);
+        if (!sockets[i])
           continue;
-        }
-        if (socket_events & POLLNVAL) { // Invalid request, fd not open
-          logger.error("server_loop ({}): Socket {} at index {} is closed", loop, pollfds[i].fd, i);
+      }
+      if (event.writable) { // Ready to write
+        if (!send_queued(i)) {
+          logger.error("server_loop ({}): Send error", loop);
           close_socket(i);
-          events_left--;
           continue;
         }
-        pollfds[i].revents = 0;
-        events_left--;
+      }
+      if (event.error) { // Error, exceptional condition or invalid fd
+        logger.error("server_loop ({}): Error on idx {}", loop, i);
+        close_socket(i);
+        continue;
+      }
+      if (event.hang_up && !poller->is_edge_triggered()) { // Level triggered poll keeps reporting it, everything readable was already consumed
+        logger.error("server_loop ({}): Got hang up on {}", loop, i);
+        close_socket(i);
+        continue;
+      }
+    }
+
+    if (!pending_reads.empty()) {
+      std::vector<int> reading;
+      reading.swap(pending_reads);
+      for (int idx : reading) {
+        is_pending_read[idx] = false;
+        if (sockets[idx])
+          receive_on(idx);
       }
     }
     loop++;
@@ -225,8 +413,19 @@ Server::Server(
     std::string socket_path,
     int max_connections,
     msg_listener_t message_listener,
-    data_listener_t data_listener)
-    : socket_path(socket_path), max_connections(max_connections), msg_listener(message_listener), data_listener(data_listener) {
+    data_listener_t data_listener,
+    close_listener_t close_listener,
+    stream_listener_t stream_listener,
+    Poller::Backend backend,
+    output_budget_t output_budget)
+    : max_connections(max_connections),
+      msg_listener(message_listener),
+      data_listener(data_listener),
+      close_listener(close_listener),
+      stream_listener(stream_listener),
+      socket_path(socket_path),
+      backend(backend),
+      output_budget(output_budget) {
   logger.info("Creating server on [{}] with a maximum of {} connections", socket_path, max_connections);
 }
 
@@ -250,77 +449,133 @@ Server::StartExitCode Server::start() {
 Server::Socket::Socket(
     int fd,
     socket_msg_listener_t msg_listener,
-    socket_data_listener_t data_listener)
-    : fd(fd), msg_listener(msg_listener), data_listener(data_listener) {
-  sending_message.byte_offset = 0;
-  sending_message.msg.buf = nullptr;
-  sending_message.msg.size = 0;
-  sending_message.in_progress = false;
-
+    socket_data_listener_t data_listener,
+    socket_stream_listener_t stream_listener)
+    : fd(fd), msg_listener(msg_listener), data_listener(data_listener), stream_listener(stream_listener) {
   receiving_message.byte_offset = 0;
 
   receiving_data.byte_offset = 0;
+  receiving_data.data_offset = 0;
+  receiving_data.total_size = 0;
   receiving_data.data.buf = nullptr;
   receiving_data.data.size = 0;
   receiving_data.msg.buf = nullptr;
   receiving_data.msg.size = 0;
   receiving_data.waiting = false;
+  receiving_data.streaming = false;
 }
 
 Server::Socket::~Socket() {
   logger.debug("Destroying socket");
 
-  for (int i = 0; i < message_queue.size(); i++) {
-    message_t m = message_queue.front();
-    free(m.buf);
-    message_queue.pop();
-  }
-
-  if (sending_message.in_progress) {
-    free(sending_message.msg.buf);
+  for (auto &m : message_queue) {
+    if (!m.is_inline)
+      free(m.msg.buf);
   }
 
   if (receiving_data.waiting) {
     free(receiving_data.data.buf);
+    free(receiving_data.msg.buf);
+  }
+
+  while (!received_fds.empty()) {
+    close(received_fds.front());
+    received_fds.pop();
   }
 
   close(fd);
 }
 
+Server::socket_stats_t Server::Socket::get_stats(int id) const {
+  return {id, bytes_received, bytes_sent, message_queue.size(), queued_bytes, reserved_bytes, stalls, stalled};
+}
+
+int Server::Socket::take_received_fd() {
+  if (received_fds.empty())
+    return -1;
+  int received_fd = received_fds.front();
+  received_fds.pop();
+  return received_fd;
+}
+
 bool Server::Socket::wants_to_write() {
-  return !message_queue.empty() || sending_message.in_progress;
+  return !message_queue.empty();
+}
+
+void Server::Socket::queue_copy(const void *buf, size_t size) {
+  size_t offset = inline_data.size();
+  inline_data.insert(inline_data.end(), (const char *)buf, (const char *)buf + size);
+  message_queue.push_back({true, {nullptr, size}, offset});
+  queued_bytes += size;
 }
 
+// Queued messages go out together, inline messages queued one after the other are contiguous in the arena
 Server::Socket::SendMessagesExitCode Server::Socket::send_messages() {
   logger.trace("send: Sending data to {}", fd);
 
-  do {
-    if (!sending_message.in_progress && !message_queue.empty()) {
-      sending_message.msg = message_queue.front();
-      message_queue.pop();
-      sending_message.in_progress = true;
+  while (!message_queue.empty()) {
+    struct iovec iov[MAX_IOVECS];
+    int iov_count = 0;
+    size_t offset = sending_offset;
+    bool last_inline = false;
+    for (auto &m : message_queue) {
+      char *start = (m.is_inline ? inline_data.data() + m.inline_offset : (char *)m.msg.buf) + offset;
+      size_t len = m.msg.size - offset;
+      offset = 0;
+      if (last_inline && m.is_inline) {
+        iov[iov_count - 1].iov_len += len;
+      } else if (iov_count < MAX_IOVECS) {
+        iov[iov_count++] = {start, len};
+      } else {
+        break;
+      }
+      last_inline = m.is_inline;
     }
-    if (sending_message.in_progress) {
-      size_t bytes_to_send = sending_message.msg.size - sending_message.byte_offset;
-      ssize_t bytes_sent = send(fd, (char *)sending_message.msg.buf + sending_message.byte_offset, bytes_to_send, MSG_NOSIGNAL | MSG_DONTWAIT);
-      logger.trace("send: OFFSET {}", sending_message.byte_offset);
-      if (bytes_sent == 0 || (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
-        logger.trace("send: Can't send data right now, trying later");
+
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = iov;
+    hdr.msg_iovlen = iov_count;
+    ssize_t sent = sendmsg(fd, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      logger.trace("send: Can't send data right now, trying later");
+      break;
+    } else if (sent < 0) {
+      logger.error("send: {}", strerror(errno));
+      return SendMessagesExitCode::ERROR;
+    }
+    logger.trace("send: {} bytes sent in {} chunks", sent, iov_count);
+    bytes_sent += sent;
+    queued_bytes -= sent;
+
+    // Drop the messages sent completely, empty ones included
+    size_t left = sent;
+    while (!message_queue.empty()) {
+      queued_message_t &m = message_queue.front();
+      size_t remaining = m.msg.size - sending_offset;
+      if (left < remaining) {
+        sending_offset += left;
         break;
-      } else if (bytes_sent < 0) {
-        logger.error("send: {}", strerror(errno));
-        return SendMessagesExitCode::ERROR;
-      } else {
-        logger.trace("send: {} bytes sent", bytes_sent);
-        sending_message.byte_offset += bytes_sent;
-        if (sending_message.byte_offset == sending_message.msg.size) {
-          free(sending_message.msg.buf);
-          sending_message.in_progress = false;
-          sending_message.byte_offset = 0;
-        }
       }
+      left -= remaining;
+      if (!m.is_inline)
+        free(m.msg.buf);
+      message_queue.pop_front();
+      sending_offset = 0;
     }
-  } while (sending_message.in_progress || !message_queue.empty());
+    if (sent == 0 && !message_queue.empty()) {
+      logger.trace("send: Can't send data right now, trying later");
+      break;
+    }
+  }
+
+  if (message_queue.empty()) {
+    if (inline_data.capacity() > INLINE_DATA_KEEP) {
+      std::vector<char>().swap(inline_data);
+    } else {
+      inline_data.clear();
+    }
+  }
 
   return SendMessagesExitCode::OK;
 }
@@ -328,7 +583,18 @@ Server::Socket::SendMessagesExitCode Server::Socket::send_messages() {
 Server::Socket::ReceiveMessagesExitCode Server::Socket::receive_messages() {
   logger.trace("receive: Receiving data on socket {}", fd);
 
+  // Reads until the socket is drained, as edge triggered pollers will not report it again otherwise
+  size_t budget = READ_BUDGET;
   while (true) {
+    if (!is_reading())
+      return ReceiveMessagesExitCode::OK;
+    if (unparsed) {
+      unparsed = false;
+      if (consume_message_buffer() != ReceiveMessagesExitCode::OK)
+        return ReceiveMessagesExitCode::ERROR;
+      continue;
+    }
+
     const bool waiting_for_data = receiving_data.waiting;
     void *buf;
     size_t size_max;
@@ -341,9 +607,11 @@ Server::Socket::ReceiveMessagesExitCode Server::Socket::receive_messages() {
       size_max = BUFFER_SIZE - receiving_message.byte_offset;
     }
 
-    ssize_t bytes_read = recv(fd, buf, size_max, MSG_NOSIGNAL | MSG_DONTWAIT);
+    ssize_t bytes_read = receive(buf, std::min(size_max, budget));
     if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
       return ReceiveMessagesExitCode::OK;
+    } else if (bytes_read < 0 && errno == EINTR) {
+      continue;
     } else if (bytes_read < 0) {
       logger.error("receive (read): {}", strerror(errno));
       return ReceiveMessagesExitCode::ERROR;
@@ -353,31 +621,106 @@ Server::Socket::ReceiveMessagesExitCode Server::Socket::receive_messages() {
     }
 
     logger.trace("receive: {} bytes received", bytes_read);
+    bytes_received += bytes_read;
 
+    ReceiveMessagesExitCode ec;
     if (waiting_for_data) {
       receiving_data.byte_offset += bytes_read;
-      return consume_data_buffer();
+      ec = consume_data_buffer();
     } else {
       receiving_message.byte_offset += bytes_read;
-      return consume_message_buffer();
+      ec = consume_message_buffer();
+    }
+    if (ec != ReceiveMessagesExitCode::OK)
+      return ec;
+
+    budget -= bytes_read;
+    if (budget == 0)
+      return ReceiveMessagesExitCode::PENDING;
+  }
+}
+
+ssize_t Server::Socket::receive(void *buf, size_t size) {
+  // recvmsg instead of recv so that file descriptors sent by the client (SCM_RIGHTS) are picked up
+  struct iovec iov = {buf, size};
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * MAX_FDS_PER_MESSAGE)];
+    struct cmsghdr align;
+  } control;
+
+  struct msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.msg_iov = &iov;
+  hdr.msg_iovlen = 1;
+  hdr.msg_control = control.buf;
+  hdr.msg_controllen = sizeof(control.buf);
+
+  ssize_t bytes_read = recvmsg(fd, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  if (bytes_read <= 0)
+    return bytes_read;
+
+  if (hdr.msg_flags & MSG_CTRUNC) {
+    logger.warn("receive: Ancillary data truncated on socket {}, some file descriptors were lost", fd);
+  }
+
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      size_t fd_count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      int *fds = (int *)CMSG_DATA(cmsg);
+      for (size_t i = 0; i < fd_count; i++) {
+        logger.trace("receive: Got file descriptor {} on socket {}", fds[i], fd);
+        received_fds.push(fds[i]);
+      }
     }
   }
+  return bytes_read;
+}
+
+void Server::Socket::start_receiving_data(message_t msg, size_t size, bool streaming) {
+  size_t buffer_size = streaming ? std::min(size, STREAM_CHUNK_SIZE) : size;
+  receiving_data.waiting = true;
+  receiving_data.streaming = streaming;
+  receiving_data.data = {malloc(buffer_size), buffer_size};
+  receiving_data.data_offset = 0;
+  receiving_data.total_size = size;
+  void *msg_buf_copy = malloc(msg.size);
+  memcpy(msg_buf_copy, msg.buf, msg.size);
+  receiving_data.msg = {msg_buf_copy, msg.size};
 }
 
 Server::Socket::ReceiveMessagesExitCode Server::Socket::consume_data_buffer() {
   size_t offset = receiving_data.byte_offset;
   size_t expected_size = receiving_data.data.size;
-  if (offset == expected_size) {
+  if (offset != expected_size)
+    return ReceiveMessagesExitCode::OK;
+
+  receiving_data.byte_offset = 0;
+  DataListenerExitCode ec;
+  if (receiving_data.streaming) {
+    chunk_t chunk;
+    chunk.msg = receiving_data.msg;
+    chunk.data = receiving_data.data;
+    chunk.offset = receiving_data.data_offset;
+    chunk.last = chunk.offset + chunk.data.size == receiving_data.total_size;
+    ec = stream_listener(chunk);
+
+    if (chunk.last) {
+      free(receiving_data.msg.buf);
+      receiving_data.waiting = false;
+    } else {
+      receiving_data.data_offset += chunk.data.size;
+      size_t next_size = std::min(receiving_data.total_size - receiving_data.data_offset, STREAM_CHUNK_SIZE);
+      receiving_data.data = {malloc(next_size), next_size};
+    }
+  } else {
     packet_t packet;
     packet.msg = receiving_data.msg;
     packet.extra_data = {receiving_data.data.buf, receiving_data.data.size};
-    DataListenerExitCode ec = data_listener(packet);
-  
+    ec = data_listener(packet);
     receiving_data.waiting = false;
-    receiving_data.byte_offset = 0;
-
-    if (ec != DataListenerExitCode::OK) return ReceiveMessagesExitCode::ERROR;
   }
+
+  if (ec != DataListenerExitCode::OK) return ReceiveMessagesExitCode::ERROR;
   return ReceiveMessagesExitCode::OK;
 }
 
@@ -404,27 +747,32 @@ Server::Socket::ReceiveMessagesExitCode Server::Socket::consume_message_buffer()
         break;
       case MessageListenerExitCode::OK:
         if (res.expect_data > 0) {
-          receiving_data.waiting = true;
-          receiving_data.data = {malloc(res.expect_data), res.expect_data};
-          void *msg_buf_copy = malloc(res.bytes_consumed);
-          memcpy(msg_buf_copy, receiving_message.buf + buffer_start, res.bytes_consumed);
-          receiving_data.msg = {msg_buf_copy, res.bytes_consumed};
+          start_receiving_data({receiving_message.buf + buffer_start, res.bytes_consumed}, res.expect_data, res.stream_data && stream_listener);
         }
         buffer_start += res.bytes_consumed;
         break;
     }
-    // it is possible that we handle a variable_length_command, which means that whatever is left on the buffer needs to be handled as pure data
-    const bool data_in_buffer = receiving_data.waiting && buffer_start < receiving_message.byte_offset;
-    if (data_in_buffer) {
-      size_t data_to_transfer = receiving_message.byte_offset - buffer_start;
+    // it is possible that we handle a variable_length_command, which means that what follows it on the buffer needs to be handled as pure data.
+    // The client may have sent the data together with the command, and even further commands after it, so only the expected amount is taken.
+    // Streamed data may take several chunks from the buffer.
+    while (receiving_data.waiting && buffer_start < receiving_message.byte_offset) {
+      size_t data_to_transfer = std::min(receiving_message.byte_offset - buffer_start, receiving_data.data.size - receiving_data.byte_offset);
       logger.trace("consume_message_buffer: Moving {} bytes of message buffer data to variable data buffer", data_to_transfer);
       void *data_buffer = (char *)receiving_data.data.buf + receiving_data.byte_offset;
       memcpy(data_buffer, receiving_message.buf + buffer_start, data_to_transfer);
-      buffer_start = receiving_message.byte_offset;
+      buffer_start += data_to_transfer;
       receiving_data.byte_offset += data_to_transfer;
+      if (consume_data_buffer() != ReceiveMessagesExitCode::OK) {
+        return ReceiveMessagesExitCode::ERROR;
+      }
     }
-  } while (buffer_start < receiving_message.byte_offset && !more_data_needed);
+  } while (buffer_start < receiving_message.byte_offset && !more_data_needed && is_reading());
 
+  // Stopped reading, the rest is parsed once reading resumes
+  if (buffer_start < receiving_message.byte_offset && !more_data_needed) {
+    memmove(receiving_message.buf, receiving_message.buf + buffer_start, receiving_message.byte_offset - buffer_start);
+    unparsed = true;
+  }
   receiving_message.byte_offset -= buffer_start;
 
   return ReceiveMessagesExitCode::OK;
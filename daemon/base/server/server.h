@@ -3,11 +3,14 @@
 
 #include <functional>
 #include <memory>
-#include <poll.h>
+#include <mutex>
+#include <deque>
 #include <queue>
 #include <stdlib.h>
 #include <vector>
 
+#include "server/poller.h"
+
 namespace hhal_daemon {
 
 class Server {
@@ -44,6 +47,7 @@ public:
     MessageListenerExitCode exit_code; // Result of message listener operation
     size_t bytes_consumed;             // Amount of bytes consumed from the received buffer
     size_t expect_data;                // Amount of bytes that are expected to arrive following the parsed message
+    bool stream_data = false;          // Hand the expected data to the stream listener in chunks as it arrives
   };
 
   struct packet_t {
@@ -51,6 +55,44 @@ public:
     message_t extra_data; // Plain byte array
   };
 
+  struct chunk_t {
+    message_t msg;  // Message that asked for extra data to be read
+    message_t data; // Part of the extra data, at most STREAM_CHUNK_SIZE bytes
+    size_t offset;  // Position of the chunk in the extra data
+    bool last;      // Whether the chunk completes the extra data
+  };
+
+  static const size_t STREAM_CHUNK_SIZE = 1 << 20; // Size of the chunks extra data is streamed in
+
+  /*
+  * Limits on the output a connection can have pending, queued responses plus reserved ones.
+  * A connection over budget is not read from until its output drains, 0 disables a limit.
+  */
+  struct output_budget_t {
+    size_t per_connection;
+    size_t total; // Over every connection, only holds back those with some output pending
+  };
+
+  struct socket_stats_t {
+    int id;
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    size_t queued_messages; // Messages waiting to be sent
+    size_t queued_bytes;
+    size_t reserved_bytes;  // Output expected to be sent, see reserve_output
+    uint64_t stalls;        // Times reading stopped because of the output budget
+    bool stalled;
+  };
+
+  struct stats_t {
+    uint64_t bytes_received; // Over every connection, closed ones included
+    uint64_t bytes_sent;
+    uint64_t connections_accepted;
+    uint64_t stalls;         // Over every connection, closed ones included
+    size_t pending_output;   // Queued and reserved bytes of the open connections
+    std::vector<socket_stats_t> sockets; // Open connections
+  };
+
   /*
   * msg_listener_t DO NOT OWN the pointer in the received message.
   * If they need the data to exceed the scope of the function they should make their own copy.
@@ -71,7 +113,35 @@ public:
   */
   typedef std::function<Server::DataListenerExitCode(int, packet_t, Server &)> data_listener_t;
 
-  Server(std::string socket_path, int max_connections, msg_listener_t msg_listener, data_listener_t data_listener);
+  /*
+  * close_listener_t are notified right before a client connection is closed,
+  * so any state kept for the socket id can be released before the id is reused.
+  * 
+  * \param int Id of the socket being closed.
+  * \param Server& Reference to the server.
+  */
+  typedef std::function<void(int, Server &)> close_listener_t;
+
+  /*
+  * stream_listener_t receive the extra data of messages that asked for it to be streamed, one chunk at a time and in order.
+  * They DO NOT OWN the message, which stays valid until the last chunk is handled, and OWN the chunk data buffer.
+  * 
+  * \param int Id of the socket where the chunk was received.
+  * \param chunk_t Chunk received.
+  * \param Server& Reference to the server.
+  */
+  typedef std::function<Server::DataListenerExitCode(int, chunk_t, Server &)> stream_listener_t;
+
+  Server(
+    std::string socket_path,
+    int max_connections,
+    msg_listener_t msg_listener,
+    data_listener_t data_listener,
+    close_listener_t close_listener = nullptr,
+    stream_listener_t stream_listener = nullptr,
+    Poller::Backend backend = Poller::Backend::EPOLL,
+    output_budget_t output_budget = {0, 0}
+  );
   ~Server();
 
   InitExitCode initialize();
@@ -81,6 +151,49 @@ public:
   */
   void send_on_socket(int id, message_t msg);
 
+  /*
+  * \brief Same as send_on_socket, copying the bytes instead of taking ownership of a buffer.
+  * Meant for small messages, which are kept in a per socket arena and do not need an allocation of their own.
+  */
+  void send_copy_on_socket(int id, const void *buf, size_t size);
+
+  /*
+  * \brief Run the given function on the server loop thread, as soon as the loop is woken up.
+  * Can be called from any thread, it is the way for work done outside the loop to reach the sockets.
+  * Functions posted from the same thread run in the order they were posted.
+  */
+  void post(std::function<void()> completion);
+
+  /*
+  * \brief Traffic counters and the state of the open connections. Only from the server loop thread.
+  */
+  stats_t get_stats() const;
+
+  /*
+  * \brief Stop reading from the socket with the given id until resume_receiving is called.
+  * Messages already received are still handled. Only from the server loop thread, e.g. to bound the data buffered for a connection.
+  */
+  void pause_receiving(int id);
+
+  /*
+  * \brief Read again from a socket paused with pause_receiving. Only from the server loop thread.
+  */
+  void resume_receiving(int id);
+
+  /*
+  * \brief Count size bytes of a response that will be sent later toward the output budget of the socket with the given id.
+  * Lets commands whose responses are produced elsewhere hold back the connection before the responses exist.
+  * Only from the server loop thread, every reservation must be undone with release_output while the socket is open.
+  */
+  void reserve_output(int id, size_t size);
+  void release_output(int id, size_t size);
+
+  /*
+  * \brief Take ownership of the oldest file descriptor received through SCM_RIGHTS on the socket with the given id.
+  * \returns The file descriptor, or -1 if none is pending.
+  */
+  int take_received_fd(int id);
+
   /*
   * \brief Start the server loop, listening for incoming connections.
   */
@@ -102,15 +215,17 @@ private:
     };
 
     enum class ReceiveMessagesExitCode {
-      OK,
+      OK,      // Everything available was read
+      PENDING, // Stopped after the read budget, there may be more data to read
       HANG_UP,
       ERROR,
     };
 
     typedef std::function<Server::message_result_t(message_t)> socket_msg_listener_t;
     typedef std::function<Server::DataListenerExitCode(packet_t)> socket_data_listener_t;
+    typedef std::function<Server::DataListenerExitCode(chunk_t)> socket_stream_listener_t;
 
-    Socket(int fd, socket_msg_listener_t msg_listener, socket_data_listener_t data_listener);
+    Socket(int fd, socket_msg_listener_t msg_listener, socket_data_listener_t data_listener, socket_stream_listener_t stream_listener);
     ~Socket();
 
     bool wants_to_write();
@@ -118,16 +233,62 @@ private:
     ReceiveMessagesExitCode receive_messages();
 
     inline void queue_message(message_t msg) {
-      message_queue.push(msg);
+      message_queue.push_back({false, msg, 0});
+      queued_bytes += msg.size;
+    }
+
+    inline void reserve(size_t size) {
+      reserved_bytes += size;
+    }
+
+    inline void release(size_t size) {
+      reserved_bytes -= size;
+    }
+
+    // Output held for the socket, counted toward the budgets
+    inline size_t pending_output() const {
+      return queued_bytes + reserved_bytes;
+    }
+
+    void queue_copy(const void *buf, size_t size);
+
+    inline int get_fd() const {
+      return fd;
     }
 
+    int take_received_fd();
+
+    inline void set_paused(bool paused) {
+      this->paused = paused;
+    }
+
+    inline void set_stalled(bool stalled) {
+      if (stalled && !this->stalled)
+        stalls++;
+      this->stalled = stalled;
+    }
+
+    inline bool is_stalled() const {
+      return stalled;
+    }
+
+    inline bool is_reading() const {
+      return !paused && !stalled;
+    }
+
+    socket_stats_t get_stats(int id) const;
+
   private:
     static const int BUFFER_SIZE = 1024; // Fixed size of the receiving message buffer. Should be at least equal to the maximum size of the expected structured messages.
-
-    struct sending_message_t {
-      bool in_progress;   // Whether a message is currently being sent.
-      message_t msg;      // Message to send.
-      size_t byte_offset; // Position to read on the buffer.
+    static const int MAX_FDS_PER_MESSAGE = 4; // Maximum amount of file descriptors accepted as ancillary data on a single receive.
+    static const size_t READ_BUDGET = 1 << 20; // Bytes read on a single receive_messages call, so a big transfer does not starve other connections.
+    static const int MAX_IOVECS = 64; // Queued messages handed to a single sendmsg call.
+    static const size_t INLINE_DATA_KEEP = 1 << 16; // Arena capacity kept once drained, anything bigger is released.
+
+    struct queued_message_t {
+      bool is_inline;       // Whether the bytes are in inline_data instead of an owned buffer.
+      message_t msg;        // Owned message, freed once sent. Only the size is used for inline messages.
+      size_t inline_offset; // Position of the bytes in inline_data.
     };
 
     struct receiving_message_t {
@@ -139,24 +300,42 @@ private:
 
     struct receiving_data_t {
       bool waiting;       // Whether there is data currently being received.
+      bool streaming;     // Whether the data is handed to the stream listener in chunks.
       message_t msg;      // Message that asked for extra data to be retrieved.
-      message_t data;     // Extra data being received.
+      message_t data;     // Extra data being received, or its current chunk when streaming.
       size_t byte_offset; // Position to write on the data buffer.
+      size_t data_offset; // Position of the data buffer in the extra data.
+      size_t total_size;  // Amount of extra data expected.
     };
 
     const int fd;
 
-    std::queue<message_t> message_queue = std::queue<message_t>(); // Messages queued to send
-    sending_message_t sending_message;                             // Message in process of being sent to the client
+    std::deque<queued_message_t> message_queue; // Messages queued to send, sent together whenever the socket allows it
+    size_t sending_offset = 0;                  // Bytes of the first queued message already sent
+    std::vector<char> inline_data;              // Arena of the inline messages queued, reset once the queue is drained
 
     receiving_message_t receiving_message; // Message in process of being received from the client
     receiving_data_t receiving_data;       // Unstructured data being received
 
+    std::queue<int> received_fds; // File descriptors received as ancillary data, not yet claimed by a listener
+    bool paused = false;          // Nothing is read from the socket while set, see pause_receiving
+    bool stalled = false;         // Same, while the output is over budget
+    bool unparsed = false;        // Messages were left in the buffer when reading stopped
+
+    uint64_t bytes_received = 0;
+    uint64_t bytes_sent = 0;
+    size_t queued_bytes = 0;   // Bytes of the queued messages not sent yet
+    size_t reserved_bytes = 0;
+    uint64_t stalls = 0;
+
     const socket_msg_listener_t msg_listener;
     const socket_data_listener_t data_listener;
+    const socket_stream_listener_t stream_listener;
 
+    ssize_t receive(void *buf, size_t size);
     ReceiveMessagesExitCode consume_message_buffer();
     ReceiveMessagesExitCode consume_data_buffer();
+    void start_receiving_data(message_t msg, size_t size, bool streaming);
   };
 
   enum class AcceptConnectionExitCode {
@@ -166,23 +345,53 @@ private:
 
   const int max_connections;
   const int listen_idx = max_connections;
+  const int wake_idx = max_connections + 1; // eventfd written by post()
   const msg_listener_t msg_listener;
   const data_listener_t data_listener;
+  const close_listener_t close_listener;
+  const stream_listener_t stream_listener;
   const std::string socket_path;
+  const Poller::Backend backend;
+  const output_budget_t output_budget;
 
   bool running = false;
   bool initialized = false;
 
-  std::vector<pollfd> pollfds = std::vector<pollfd>(max_connections + 1); // Sockets to poll. Listen socket + client connections.
+  int listen_fd = -1;
+  int wake_fd = -1;
+  std::unique_ptr<Poller> poller; // Slots: client connections + listen socket + wake up eventfd.
 
   std::vector<std::unique_ptr<Server::Socket>> sockets = std::vector<std::unique_ptr<Server::Socket>>(max_connections);
+  std::vector<int> free_slots;        // Unused connection slots, as a stack
+  std::vector<int> dirty_sockets;     // Connections with messages queued since they were last flushed
+  std::vector<bool> is_dirty = std::vector<bool>(max_connections);
+  std::vector<int> pending_reads;     // Connections that ran out of read budget with data possibly left
+  std::vector<bool> is_pending_read = std::vector<bool>(max_connections);
+
+  uint64_t closed_bytes_received = 0; // Traffic of the connections already closed
+  uint64_t closed_bytes_sent = 0;
+  uint64_t connections_accepted = 0;
+  uint64_t closed_stalls = 0;
+
+  size_t pending_output = 0;       // Over every open connection
+  std::vector<int> stalled_sockets; // Connections not read from because of the output budget
+
+  std::mutex completions_mutex;
+  std::vector<std::function<void()>> completions; // Functions posted to the loop, not run yet
 
   StartExitCode server_loop();
   void end_server();
-  void check_for_writes();
-  AcceptConnectionExitCode accept_new_connection();
+  void flush_writes();
+  void update_write_interest(int idx);
+  void update_read_interest(int idx);
+  void update_output_budget(int idx);
+  void update_stalled_sockets();
+  bool send_queued(int idx); // false on a send error, the socket has to be closed
+  void receive_on(int idx);
+  AcceptConnectionExitCode accept_new_connections();
   void close_sockets();
   void close_socket(int fd_idx);
+  void run_completions();
 };
 
 } // namespace daemon
@@ -0,0 +1,110 @@
+/*
+* Per-message latency of the daemon against the amount of open connections.
+*
+* Opens an increasing amount of idle connections and, for each step, measures the round trip of small
+* commands (write + read of a sync register) from one active client. With an O(active) event loop the
+* latency should stay flat as connections are added.
+*
+* Usage: latency_bench [socket_path] [iterations] [connection counts...]
+* The daemon must be running with max_connections above the highest count.
+*/
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "hhal_client.h"
+#include "client/socket_client.h"
+
+using namespace hhal;
+using namespace hhal_daemon;
+
+#define KERNEL_ID 1
+#define EVENT_ID 1
+
+#define CHECK(x)                                            \
+    if ((x) != HHALClientExitCode::OK) {                    \
+        printf("latency_bench: %s failed\n", #x);           \
+        exit(EXIT_FAILURE);                                 \
+    }
+
+typedef std::chrono::steady_clock bench_clock;
+
+int main(int argc, char const *argv[]) {
+    const char *socket_path = argc > 1 ? argv[1] : "/tmp/mango_hhal_daemon";
+    int iterations = argc > 2 ? atoi(argv[2]) : 2000;
+    std::vector<int> connection_counts;
+    for (int i = 3; i < argc; i++) {
+        connection_counts.push_back(atoi(argv[i]));
+    }
+    if (connection_counts.empty()) {
+        connection_counts = {0, 8, 32, 128, 240};
+    }
+
+    HHALClient client(socket_path);
+
+    gn_kernel kernel;
+    kernel.id = KERNEL_ID;
+    kernel.termination_event = EVENT_ID;
+    CHECK(client.assign_kernel(Unit::GN, (hhal_kernel *) &kernel));
+    CHECK(client.allocate_kernel(KERNEL_ID));
+
+    gn_event event;
+    event.id = EVENT_ID;
+    event.kernels_in = {KERNEL_ID};
+    event.kernels_out = {KERNEL_ID};
+    CHECK(client.assign_event(Unit::GN, (hhal_event *) &event));
+    CHECK(client.allocate_event(EVENT_ID));
+
+    printf("%12s %12s %12s %12s\n", "connections", "mean (us)", "p50 (us)", "p99 (us)");
+
+    std::vector<int> idle;
+    std::vector<double> samples(iterations);
+    for (int count : connection_counts) {
+        while ((int) idle.size() < count) {
+            int fd = initialize(socket_path);
+            if (fd < 0) {
+                printf("latency_bench: could not open connection %zu\n", idle.size());
+                exit(EXIT_FAILURE);
+            }
+            idle.push_back(fd);
+        }
+        while ((int) idle.size() > count) {
+            end(idle.back());
+            idle.pop_back();
+        }
+
+        // Warm up
+        for (int i = 0; i < iterations / 10; i++) {
+            uint32_t value;
+            CHECK(client.write_sync_register(EVENT_ID, 1));
+            CHECK(client.read_sync_register(EVENT_ID, &value));
+        }
+
+        double total = 0;
+        for (int i = 0; i < iterations; i++) {
+            uint32_t value;
+            auto start = bench_clock::now();
+            CHECK(client.write_sync_register(EVENT_ID, 1));
+            CHECK(client.read_sync_register(EVENT_ID, &value));
+            auto elapsed = std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+            // Two messages per iteration
+            samples[i] = elapsed / 2;
+            total += samples[i];
+        }
+        std::sort(samples.begin(), samples.end());
+        printf("%12d %12.2f %12.2f %12.2f\n",
+            count, total / iterations, samples[iterations / 2], samples[(size_t) (iterations * 0.99)]);
+    }
+
+    for (int fd : idle) {
+        end(fd);
+    }
+
+    CHECK(client.release_event(EVENT_ID));
+    CHECK(client.deassign_event(EVENT_ID));
+    CHECK(client.release_kernel(KERNEL_ID));
+    CHECK(client.deassign_kernel(KERNEL_ID));
+    return 0;
+}
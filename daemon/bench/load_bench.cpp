@@ -0,0 +1,315 @@
+/*
+* Throughput and latency of the daemon under concurrent load, per operation type.
+*
+* Every client is a thread with its own HHALClient connection, sync register and buffers on the GN, picking
+* operations at random from a weighted mix until the step duration runs out. Each client count given runs as a
+* separate step, so scaling regressions of the server show up as throughput that stops growing or tail latency
+* that grows with the clients.
+*
+* Usage: load_bench [-s socket_path] [-c clients,...] [-t seconds] [-m mix] [-S small_size] [-L large_size] [-k kernel_path]
+*   -m  Weights of the operations, e.g. "reg_read=4,reg_write=4,small_read=1". Available operations:
+*       reg_read, reg_write, small_read, small_write, large_read, large_write, kernel_start, launch
+*       launch starts the same kernel as kernel_start through a launch prepared once per client
+*   -k  Binary the kernel_start and launch operations run on the emulated GN, /bin/true by default
+* The daemon must be running with max_connections above the highest client count.
+*/
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "hhal_client.h"
+#include "utils/metrics.h"
+
+using namespace hhal;
+using namespace hhal_daemon;
+
+#define CHECK(x)                                            \
+    if ((x) != HHALClientExitCode::OK) {                    \
+        printf("load_bench: %s failed\n", #x);              \
+        exit(EXIT_FAILURE);                                 \
+    }
+
+typedef std::chrono::steady_clock bench_clock;
+
+enum op_type {
+    REG_READ,
+    REG_WRITE,
+    SMALL_READ,
+    SMALL_WRITE,
+    LARGE_READ,
+    LARGE_WRITE,
+    KERNEL_START,
+    LAUNCH,
+    OP_COUNT,
+};
+
+static const char *const OP_NAMES[OP_COUNT] = {
+    "reg_read", "reg_write", "small_read", "small_write", "large_read", "large_write", "kernel_start", "launch",
+};
+
+struct bench_config_t {
+    const char *socket_path = "/tmp/mango_hhal_daemon";
+    std::vector<int> client_counts = {1, 4, 16};
+    int seconds = 5;
+    int weights[OP_COUNT] = {4, 4, 2, 2, 1, 1, 0, 0};
+    size_t small_size = 4 << 10;
+    size_t large_size = 4 << 20;
+    const char *kernel_path = "/bin/true";
+};
+
+struct op_stats_t {
+    LatencyHistogram latency; // Nanoseconds
+    std::atomic<uint64_t> errors;
+
+    op_stats_t(): errors(0) {}
+};
+
+// The emulated GN has few tiles, so all clients start the same kernel, set up once on its own connection
+#define KERNEL_ID 1
+#define KERNEL_EVENT_ID 1
+
+// Resource ids of a client, so clients do not share registers or buffers on the daemon.
+// Every buffer needs an event of its own, its register is set when the memory is allocated.
+struct client_ids_t {
+    int event;
+    int small_buffer;
+    int small_event;
+    int large_buffer;
+    int large_event;
+    int launch;
+
+    client_ids_t(int client): event(1000 + client),
+        small_buffer(2000 + client), small_event(3000 + client),
+        large_buffer(4000 + client), large_event(5000 + client),
+        launch(6000 + client) {}
+};
+
+static std::vector<int> parse_counts(const char *arg) {
+    std::vector<int> counts;
+    for (const char *p = arg; *p; ) {
+        counts.push_back(atoi(p));
+        const char *comma = strchr(p, ',');
+        if (!comma) break;
+        p = comma + 1;
+    }
+    return counts;
+}
+
+static bool parse_mix(const char *arg, int weights[OP_COUNT]) {
+    std::fill(weights, weights + OP_COUNT, 0);
+    std::string mix(arg);
+    size_t start = 0;
+    while (start < mix.size()) {
+        size_t end = mix.find(',', start);
+        if (end == std::string::npos) end = mix.size();
+        std::string item = mix.substr(start, end - start);
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        int op = std::find_if(OP_NAMES, OP_NAMES + OP_COUNT, [&](const char *n) { return name == n; }) - OP_NAMES;
+        if (op == OP_COUNT) {
+            printf("load_bench: unknown operation %s\n", name.c_str());
+            return false;
+        }
+        weights[op] = eq == std::string::npos ? 1 : atoi(item.c_str() + eq + 1);
+        start = end + 1;
+    }
+    return true;
+}
+
+static void setup_event(HHALClient &client, int event_id) {
+    gn_event event;
+    event.id = event_id;
+    event.kernels_in = {KERNEL_ID};
+    event.kernels_out = {KERNEL_ID};
+    CHECK(client.assign_event(Unit::GN, (hhal_event *) &event));
+    CHECK(client.allocate_event(event_id));
+}
+
+static void teardown_event(HHALClient &client, int event_id) {
+    CHECK(client.release_event(event_id));
+    CHECK(client.deassign_event(event_id));
+}
+
+static void setup_kernel(HHALClient &client, const bench_config_t &config) {
+    gn_kernel kernel;
+    kernel.id = KERNEL_ID;
+    kernel.termination_event = KERNEL_EVENT_ID;
+    CHECK(client.assign_kernel(Unit::GN, (hhal_kernel *) &kernel));
+    CHECK(client.allocate_kernel(KERNEL_ID));
+    setup_event(client, KERNEL_EVENT_ID);
+    CHECK(client.kernel_write(KERNEL_ID, {{Unit::GN, {source_type::BINARY, config.kernel_path}}}));
+}
+
+static void teardown_kernel(HHALClient &client) {
+    teardown_event(client, KERNEL_EVENT_ID);
+    CHECK(client.release_kernel(KERNEL_ID));
+    CHECK(client.deassign_kernel(KERNEL_ID));
+}
+
+static void setup_client(HHALClient &client, const client_ids_t &ids, const bench_config_t &config, const Arguments &arguments) {
+    for (int event_id : {ids.event, ids.small_event, ids.large_event}) {
+        setup_event(client, event_id);
+    }
+
+    struct { int id; size_t size; int event; } buffers[] = {
+        {ids.small_buffer, config.small_size, ids.small_event},
+        {ids.large_buffer, config.large_size, ids.large_event},
+    };
+    for (auto &buffer : buffers) {
+        gn_buffer info;
+        info.id = buffer.id;
+        info.size = buffer.size;
+        info.event = buffer.event;
+        info.kernels_in = {KERNEL_ID};
+        info.kernels_out = {};
+        CHECK(client.assign_buffer(Unit::GN, (hhal_buffer *) &info));
+        CHECK(client.allocate_memory(buffer.id));
+    }
+
+    CHECK(client.prepare_launch(ids.launch, KERNEL_ID, arguments));
+}
+
+static void teardown_client(HHALClient &client, const client_ids_t &ids) {
+    CHECK(client.release_launch(ids.launch));
+    for (int buffer : {ids.small_buffer, ids.large_buffer}) {
+        CHECK(client.release_memory(buffer));
+        CHECK(client.deassign_buffer(buffer));
+    }
+    for (int event_id : {ids.event, ids.small_event, ids.large_event}) {
+        teardown_event(client, event_id);
+    }
+}
+
+static HHALClientExitCode run_op(HHALClient &client, op_type op, const client_ids_t &ids, const bench_config_t &config,
+                                 std::vector<char> &data, const Arguments &arguments) {
+    uint32_t value;
+    switch (op) {
+    case REG_READ: return client.read_sync_register(ids.event, &value);
+    case REG_WRITE: return client.write_sync_register(ids.event, 1);
+    case SMALL_READ: return client.read_from_memory(ids.small_buffer, data.data(), config.small_size);
+    case SMALL_WRITE: return client.write_to_memory(ids.small_buffer, data.data(), config.small_size);
+    case LARGE_READ: return client.read_from_memory(ids.large_buffer, data.data(), config.large_size);
+    case LARGE_WRITE: return client.write_to_memory(ids.large_buffer, data.data(), config.large_size);
+    case KERNEL_START: return client.kernel_start(KERNEL_ID, arguments);
+    case LAUNCH: return client.launch(ids.launch);
+    default: return HHALClientExitCode::ERROR;
+    }
+}
+
+// Runs one step with the given amount of clients, returns the elapsed seconds
+static double run_step(const bench_config_t &config, int clients, std::vector<op_stats_t> &stats) {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int ready = 0;
+    bool go = false;
+    bench_clock::time_point deadline;
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < clients; i++) {
+        threads.emplace_back([&, i] {
+            HHALClient client(config.socket_path);
+            client_ids_t ids(i);
+            Arguments arguments;
+            arguments.add_buffer({ids.small_buffer});
+            setup_client(client, ids, config, arguments);
+            std::vector<char> data(std::max(config.small_size, config.large_size), (char) i);
+
+            std::discrete_distribution<int> pick(config.weights, config.weights + OP_COUNT);
+            std::mt19937 rng(i);
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready++;
+                cv.notify_all();
+                cv.wait(lock, [&] { return go; });
+            }
+            while (bench_clock::now() < deadline) {
+                op_type op = (op_type) pick(rng);
+                auto start = bench_clock::now();
+                HHALClientExitCode ec = run_op(client, op, ids, config, data, arguments);
+                auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - start);
+                stats[op].latency.record(elapsed.count());
+                if (ec != HHALClientExitCode::OK) stats[op].errors++;
+            }
+
+            teardown_client(client, ids);
+        });
+    }
+
+    auto start = bench_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&] { return ready == clients; });
+        start = bench_clock::now();
+        deadline = start + std::chrono::seconds(config.seconds);
+        go = true;
+    }
+    cv.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    // Measured until the deadline, the operations in flight then finish shortly after it
+    return std::chrono::duration<double>(deadline - start).count();
+}
+
+int main(int argc, char *argv[]) {
+    bench_config_t config;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:t:m:S:L:k:")) != -1) {
+        switch (opt) {
+        case 's': config.socket_path = optarg; break;
+        case 'c': config.client_counts = parse_counts(optarg); break;
+        case 't': config.seconds = atoi(optarg); break;
+        case 'm': if (!parse_mix(optarg, config.weights)) return EXIT_FAILURE; break;
+        case 'S': config.small_size = atol(optarg); break;
+        case 'L': config.large_size = atol(optarg); break;
+        case 'k': config.kernel_path = optarg; break;
+        default:
+            printf("Usage: load_bench [-s socket_path] [-c clients,...] [-t seconds] [-m mix] [-S small_size] [-L large_size] [-k kernel_path]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (std::all_of(config.weights, config.weights + OP_COUNT, [](int w) { return w <= 0; })) {
+        printf("load_bench: the operation mix is empty\n");
+        return EXIT_FAILURE;
+    }
+
+    HHALClient client(config.socket_path);
+    setup_kernel(client, config);
+
+    printf("%8s %-13s %10s %10s %10s %12s %12s %12s %12s\n",
+        "clients", "operation", "ops/s", "MB/s", "errors", "p50 (us)", "p99 (us)", "p999 (us)", "max (us)");
+    for (int clients : config.client_counts) {
+        std::vector<op_stats_t> stats(OP_COUNT);
+        double seconds = run_step(config, clients, stats);
+
+        uint64_t total = 0;
+        for (int op = 0; op < OP_COUNT; op++) {
+            const LatencyHistogram &latency = stats[op].latency;
+            uint64_t count = latency.count();
+            if (count == 0) continue;
+            total += count;
+            size_t op_bytes = op == SMALL_READ || op == SMALL_WRITE ? config.small_size :
+                              op == LARGE_READ || op == LARGE_WRITE ? config.large_size : 0;
+            printf("%8d %-13s %10.0f %10.1f %10llu %12.1f %12.1f %12.1f %12.1f\n",
+                clients, OP_NAMES[op], count / seconds, count * op_bytes / seconds / 1e6,
+                (unsigned long long) stats[op].errors.load(),
+                latency.quantile(0.5) / 1e3, latency.quantile(0.99) / 1e3,
+                latency.quantile(0.999) / 1e3, latency.quantile(1.0) / 1e3);
+        }
+        printf("%8d %-13s %10.0f\n", clients, "total", total / seconds);
+    }
+
+    teardown_kernel(client);
+    return 0;
+}
@@ -0,0 +1,352 @@
+#include <sys/socket.h>
+
+#include "hhal_async_client.h"
+#include "client/socket_client.h"
+#include "serialization.h"
+#include "hhal_command.h"
+#include "hhal_response.h"
+
+#define NO_SOCKET -1
+
+namespace hhal_daemon {
+
+static HHALAsyncClient::result_t ready_result(HHALClientExitCode ec) {
+    std::promise<HHALClientExitCode> promise;
+    promise.set_value(ec);
+    return promise.get_future();
+}
+
+HHALAsyncClient::HHALAsyncClient(const std::string socket_path): broken(false), next_request_id(0) {
+    socket_fd = initialize(socket_path.c_str());
+    if (socket_fd == NO_SOCKET) {
+        printf("HHALAsyncClient: Socket initialization failure\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Negotiated before the reader starts, its response is the only one without a response_header
+    negotiate_protocol_command cmd;
+    init_negotiate_protocol_command(cmd, protocol_version::TAGGED);
+    response_base res;
+    protocol_response protocol_res;
+    if (!send_on_socket(socket_fd, &cmd, sizeof(cmd)) ||
+        !receive_on_socket(socket_fd, &res, sizeof(res)) ||
+        res.type != response_type::PROTOCOL ||
+        !receive_on_socket(socket_fd, ((char *) &protocol_res) + sizeof(res), sizeof(protocol_res) - sizeof(res))) {
+        printf("HHALAsyncClient: Protocol negotiation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (protocol_res.version != protocol_version::TAGGED) {
+        printf("HHALAsyncClient: Daemon does not support tagged requests\n");
+        exit(EXIT_FAILURE);
+    }
+
+    reader = std::thread(&HHALAsyncClient::read_responses, this);
+}
+
+HHALAsyncClient::~HHALAsyncClient() {
+    // Wakes up the reader, which fails whatever is still in flight
+    shutdown(socket_fd, SHUT_RDWR);
+    reader.join();
+    end(socket_fd);
+}
+
+void HHALAsyncClient::fail_pending() {
+    std::map<uint64_t, pending_t> failed;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        broken = true;
+        failed.swap(pending);
+    }
+    for (auto &entry : failed) {
+        entry.second.promise.set_value(HHALClientExitCode::SEVERE_ERROR);
+    }
+}
+
+// Registers the request before sending it, its response may arrive before send returns
+HHALAsyncClient::result_t HHALAsyncClient::send_request(const void *cmd, size_t cmd_size, const void *payload, size_t payload_size,
+                                                        completion_t complete, void *dest, size_t dest_size) {
+    std::vector<char> frame(sizeof(request_header) + cmd_size);
+    memcpy(frame.data() + sizeof(request_header), cmd, cmd_size);
+
+    std::lock_guard<std::mutex> send_lock(send_mutex);
+    uint64_t request_id = next_request_id++;
+    init_request_header(*(request_header *) frame.data(), request_id);
+
+    result_t result;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        if (broken) return ready_result(HHALClientExitCode::SEVERE_ERROR);
+
+        pending_t &req = pending[request_id];
+        req.complete = std::move(complete);
+        req.dest = dest;
+        req.dest_size = dest_size;
+        result = req.promise.get_future();
+    }
+
+    if (!send_with_header_on_socket(socket_fd, frame.data(), frame.size(), payload, payload_size)) {
+        // The stream may hold part of the request, nothing sent on it can be trusted anymore
+        shutdown(socket_fd, SHUT_RDWR);
+        fail_pending();
+    }
+    return result;
+}
+
+void HHALAsyncClient::read_responses() {
+    while (true) {
+        response_header header;
+        response_base res;
+        if (!receive_on_socket(socket_fd, &header, sizeof(header)) || header.size < sizeof(res) ||
+            !receive_on_socket(socket_fd, &res, sizeof(res))) {
+            break;
+        }
+
+        pending_t req;
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex);
+            auto it = pending.find(header.request_id);
+            if (it == pending.end()) {
+                printf("HHALAsyncClient: Got response to unknown request %" PRIu64 "\n", header.request_id);
+                break;
+            }
+            req = std::move(it->second);
+            pending.erase(it);
+        }
+
+        size_t rest_size = header.size - sizeof(res);
+        std::vector<char> response;
+        if (res.type == response_type::ACK && req.dest != nullptr && rest_size == req.dest_size) {
+            if (!receive_on_socket(socket_fd, req.dest, rest_size)) {
+                req.promise.set_value(HHALClientExitCode::SEVERE_ERROR);
+                break;
+            }
+        } else {
+            response.resize(header.size);
+            memcpy(response.data(), &res, sizeof(res));
+            if (!receive_on_socket(socket_fd, response.data() + sizeof(res), rest_size)) {
+                req.promise.set_value(HHALClientExitCode::SEVERE_ERROR);
+                break;
+            }
+        }
+
+        HHALClientExitCode ec = HHALClientExitCode::OK;
+        if (res.type == response_type::ERROR) {
+            if (response.size() < sizeof(error_response)) {
+                ec = HHALClientExitCode::ERROR;
+            } else {
+                const error_response *error_res = (const error_response *) response.data();
+                ec = error_res->error_code == hhal::HHALExitCode::TIMEOUT ? HHALClientExitCode::TIMEOUT : HHALClientExitCode::ERROR;
+            }
+        } else if (req.dest != nullptr && response.size() > 0) {
+            // Read acknowledged without the expected amount of data
+            ec = HHALClientExitCode::ERROR;
+        } else if (req.complete) {
+            ec = req.complete(response);
+        }
+        req.promise.set_value(ec);
+    }
+
+    fail_pending();
+}
+
+// Kernel execution
+HHALAsyncClient::result_t HHALAsyncClient::kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources) {
+    serialized_object serialized = serialize(kernel_sources);
+
+    kernel_write_command cmd;
+    init_kernel_write_command(cmd, kernel_id, serialized.size);
+    return send_request(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::kernel_start(int kernel_id, const hhal::Arguments &arguments) {
+    serialized_object serialized = serialize(arguments);
+
+    kernel_start_command cmd;
+    init_kernel_start_command(cmd, kernel_id, serialized.size);
+    return send_request(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::prepare_launch(int launch_id, int kernel_id, const hhal::Arguments &arguments) {
+    serialized_object serialized = serialize(arguments);
+
+    prepare_launch_command cmd;
+    init_prepare_launch_command(cmd, launch_id, kernel_id, serialized.size);
+    return send_request(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::launch(int launch_id) {
+    launch_command cmd;
+    init_launch_command(cmd, launch_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::release_launch(int launch_id) {
+    release_launch_command cmd;
+    init_release_launch_command(cmd, launch_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::write_to_memory(int buffer_id, const void *source, size_t size) {
+    write_memory_command cmd;
+    init_write_memory_command(cmd, buffer_id, size);
+    return send_request(&cmd, sizeof(cmd), source, size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::read_from_memory(int buffer_id, void *dest, size_t size) {
+    read_memory_command cmd;
+    init_read_memory_command(cmd, buffer_id, size);
+    return send_request(&cmd, sizeof(cmd), nullptr, 0, nullptr, dest, size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::write_to_memory(int buffer_id, const void *source, size_t size, size_t offset) {
+    write_memory_range_command cmd;
+    init_write_memory_range_command(cmd, buffer_id, offset, size);
+    return send_request(&cmd, sizeof(cmd), source, size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::read_from_memory(int buffer_id, void *dest, size_t size, size_t offset) {
+    read_memory_range_command cmd;
+    init_read_memory_range_command(cmd, buffer_id, offset, size);
+    return send_request(&cmd, sizeof(cmd), nullptr, 0, nullptr, dest, size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
+    copy_buffer_command cmd;
+    init_copy_buffer_command(cmd, src_id, dst_id, src_offset, dst_offset, size);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::write_sync_register(int event_id, uint32_t data) {
+    write_register_command cmd;
+    init_write_register_command(cmd, event_id, data);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::read_sync_register(int event_id, uint32_t *data) {
+    read_register_command cmd;
+    init_read_register_command(cmd, event_id);
+    return send_request(&cmd, sizeof(cmd), nullptr, 0, [data](const std::vector<char> &response) {
+        const response_base *res = (const response_base *) response.data();
+        if (response.size() < sizeof(register_data_response) || res->type != response_type::REGISTER_DATA) {
+            printf("Got unknown response type\n");
+            return HHALClientExitCode::ERROR;
+        }
+        *data = ((const register_data_response *) res)->data;
+        return HHALClientExitCode::OK;
+    });
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::wait_sync_register(int event_id, uint32_t value, int timeout_ms) {
+    wait_register_command cmd;
+    init_wait_register_command(cmd, event_id, value, timeout_ms);
+    return send_request(&cmd, sizeof(cmd));
+}
+// -----------------------
+
+// Resource management
+HHALAsyncClient::result_t HHALAsyncClient::assign_kernel(hhal::Unit unit, hhal::hhal_kernel *info) {
+    size_t info_size = kernel_info_size(unit);
+    if (info_size == 0) return ready_result(HHALClientExitCode::ERROR);
+
+    assign_kernel_command cmd;
+    init_assign_kernel_command(cmd, unit, info_size);
+    return send_request(&cmd, sizeof(cmd), info, info_size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::assign_buffer(hhal::Unit unit, hhal::hhal_buffer *info) {
+    serialized_object serialized = serialize_buffer_info(unit, info);
+    if (serialized.buf == nullptr) return ready_result(HHALClientExitCode::ERROR);
+
+    assign_buffer_command cmd;
+    init_assign_buffer_command(cmd, unit, serialized.size);
+    return send_request(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::assign_event(hhal::Unit unit, hhal::hhal_event *info) {
+    serialized_object serialized = serialize_event_info(unit, info);
+    if (serialized.buf == nullptr) return ready_result(HHALClientExitCode::ERROR);
+
+    assign_event_command cmd;
+    init_assign_event_command(cmd, unit, serialized.size);
+    return send_request(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::deassign_kernel(int kernel_id) {
+    deassign_kernel_command cmd;
+    init_deassign_kernel_command(cmd, kernel_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::deassign_buffer(int buffer_id) {
+    deassign_buffer_command cmd;
+    init_deassign_buffer_command(cmd, buffer_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::deassign_event(int event_id) {
+    deassign_event_command cmd;
+    init_deassign_event_command(cmd, event_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::allocate_memory(int buffer_id) {
+    allocate_memory_command cmd;
+    init_allocate_memory_command(cmd, buffer_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::release_memory(int buffer_id) {
+    release_memory_command cmd;
+    init_release_memory_command(cmd, buffer_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::allocate_kernel(int kernel_id) {
+    allocate_kernel_command cmd;
+    init_allocate_kernel_command(cmd, kernel_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::release_kernel(int kernel_id) {
+    release_kernel_command cmd;
+    init_release_kernel_command(cmd, kernel_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::allocate_event(int event_id) {
+    allocate_event_command cmd;
+    init_allocate_event_command(cmd, event_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+HHALAsyncClient::result_t HHALAsyncClient::release_event(int event_id) {
+    release_event_command cmd;
+    init_release_event_command(cmd, event_id);
+    return send_request(&cmd, sizeof(cmd));
+}
+
+// Batching
+HHALAsyncClient::result_t HHALAsyncClient::submit(const HHALClientBatch &batch, std::vector<hhal::HHALExitCode> *results) {
+    if (results != nullptr) results->clear();
+    if (batch.count == 0) return ready_result(HHALClientExitCode::OK);
+
+    batch_command cmd;
+    init_batch_command(cmd, batch.count, batch.data.size());
+    return send_request(&cmd, sizeof(cmd), batch.data.data(), batch.data.size(), [results](const std::vector<char> &response) {
+        if (response.size() < sizeof(batch_response)) return HHALClientExitCode::ERROR;
+        const batch_response *batch_res = (const batch_response *) response.data();
+        if (response.size() - sizeof(batch_response) < batch_res->count * sizeof(hhal::HHALExitCode)) {
+            return HHALClientExitCode::ERROR;
+        }
+
+        const hhal::HHALExitCode *codes = (const hhal::HHALExitCode *) (response.data() + sizeof(batch_response));
+        HHALClientExitCode ec = HHALClientExitCode::OK;
+        for (uint32_t i = 0; i < batch_res->count; i++) {
+            if (codes[i] != hhal::HHALExitCode::OK) ec = HHALClientExitCode::ERROR;
+        }
+        if (results != nullptr) results->assign(codes, codes + batch_res->count);
+        return ec;
+    });
+}
+
+}
@@ -0,0 +1,107 @@
+#ifndef HHAL_ASYNC_CLIENT_H
+#define HHAL_ASYNC_CLIENT_H
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cinttypes>
+
+#include "hhal.h"
+#include "hhal_client.h"
+
+namespace hhal_daemon {
+
+/*
+* Client with several requests in flight over a single connection, using the TAGGED protocol.
+* Every call sends its request before returning, so argument buffers can be reused right away, and gives back
+* a future completed by a background reader thread once the response arrives. Output pointers must stay valid
+* until then.
+* The daemon starts the requests of a connection in the order they are sent, but answers them as they finish:
+* a wait_sync_register does not hold back the responses to requests sent after it.
+* Thread safe, requests may be sent from any thread.
+*/
+class HHALAsyncClient {
+    public:
+    typedef std::future<HHALClientExitCode> result_t;
+
+    // Exits if the daemon can not be reached or does not support tagged requests
+    HHALAsyncClient(const std::string socket_path);
+    // Requests still in flight complete with SEVERE_ERROR
+    ~HHALAsyncClient();
+
+    // Kernel execution
+    result_t kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources);
+    result_t kernel_start(int kernel_id, const hhal::Arguments &arguments);
+    result_t prepare_launch(int launch_id, int kernel_id, const hhal::Arguments &arguments);
+    result_t launch(int launch_id);
+    result_t release_launch(int launch_id);
+
+    result_t write_to_memory(int buffer_id, const void *source, size_t size);
+    result_t read_from_memory(int buffer_id, void *dest, size_t size);
+    // Transfer size bytes starting offset bytes past the base of the buffer
+    result_t write_to_memory(int buffer_id, const void *source, size_t size, size_t offset);
+    result_t read_from_memory(int buffer_id, void *dest, size_t size, size_t offset);
+    result_t copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size);
+
+    result_t write_sync_register(int event_id, uint32_t data);
+    result_t read_sync_register(int event_id, uint32_t *data);
+    // Completes once the register holds value, consuming it, or with TIMEOUT. A negative timeout waits forever.
+    result_t wait_sync_register(int event_id, uint32_t value, int timeout_ms = -1);
+    // -----------------------
+
+    // Resource management
+    result_t assign_kernel(hhal::Unit unit, hhal::hhal_kernel *info);
+    result_t assign_buffer(hhal::Unit unit, hhal::hhal_buffer *info);
+    result_t assign_event (hhal::Unit unit, hhal::hhal_event *info);
+
+    result_t deassign_kernel(int kernel_id);
+    result_t deassign_buffer(int buffer_id);
+    result_t deassign_event(int event_id);
+
+    result_t allocate_memory(int buffer_id);
+    result_t release_memory(int buffer_id);
+
+    result_t allocate_kernel(int kernel_id);
+    result_t release_kernel(int kernel_id);
+
+    result_t allocate_event(int event_id);
+    result_t release_event(int event_id);
+
+    // Batching
+    result_t submit(const HHALClientBatch &batch, std::vector<hhal::HHALExitCode> *results = nullptr);
+
+    private:
+    // Gives the result of a request from its response, only called for responses other than errors
+    typedef std::function<HHALClientExitCode(const std::vector<char> &response)> completion_t;
+
+    struct pending_t {
+        std::promise<HHALClientExitCode> promise;
+        completion_t complete;
+        // Data acknowledged by the response is read straight into it
+        void *dest;
+        size_t dest_size;
+    };
+
+    int socket_fd;
+    std::atomic<bool> broken;
+    uint64_t next_request_id;
+
+    std::mutex send_mutex;    // Keeps the bytes of each request together on the socket
+    std::mutex pending_mutex;
+    std::map<uint64_t, pending_t> pending;
+
+    std::thread reader;
+
+    result_t send_request(const void *cmd, size_t cmd_size, const void *payload = nullptr, size_t payload_size = 0,
+                          completion_t complete = nullptr, void *dest = nullptr, size_t dest_size = 0);
+    void read_responses();
+    void fail_pending();
+};
+
+}
+
+#endif
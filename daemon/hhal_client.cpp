@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include "hhal_client.h"
 #include "client/socket_client.h"
 #include "serialization.h"
@@ -25,16 +30,46 @@ bool receive_rest_of_response(int socket_fd, const response_base &res, void *big
     return receive_on_socket(socket_fd, ((char *) bigger_res) + sizeof(res), size - sizeof(res));
 }
 
-HHALClient::HHALClient(const std::string socket_path) {
+HHALClient::HHALClient(const std::string socket_path, protocol_version max_version):
+    protocol(protocol_version::LEGACY), shared_memory(nullptr), shared_memory_size(0) {
     socket_fd = initialize(socket_path.c_str());
     if (socket_fd == NO_SOCKET) {
         printf("HHALClient: Socket initialization failure\n");
         exit(EXIT_FAILURE);
     }
+    // Responses are expected in order, tagged requests are left to HHALAsyncClient
+    max_version = std::min(max_version, protocol_version::FRAMED);
+    if (max_version == protocol_version::LEGACY) return;
+
+    if (negotiate_protocol(max_version) == HHALClientExitCode::SEVERE_ERROR) {
+        // Daemons without protocol negotiation drop the connection on the unknown command
+        printf("HHALClient: Protocol negotiation failed, falling back to the legacy protocol\n");
+        socket_fd = initialize(socket_path.c_str());
+        if (socket_fd == NO_SOCKET) {
+            printf("HHALClient: Socket initialization failure\n");
+            exit(EXIT_FAILURE);
+        }
+        protocol = protocol_version::LEGACY;
+    }
 }
 
 HHALClient::~HHALClient() {
     close_socket();
+    release_shared_memory();
+}
+
+void HHALClient::release_shared_memory() {
+    if (shared_memory == nullptr) return;
+
+    munmap(shared_memory, shared_memory_size);
+    shared_memory = nullptr;
+    shared_memory_size = 0;
+}
+
+bool HHALClient::in_shared_memory(const void *addr, size_t size) const {
+    const char *begin = (const char *) shared_memory;
+    const char *p = (const char *) addr;
+    return shared_memory != nullptr && p >= begin && size <= shared_memory_size && (size_t) (p - begin) <= shared_memory_size - size;
 }
 
 void HHALClient::close_socket() {
@@ -44,26 +79,38 @@ void HHALClient::close_socket() {
     socket_fd = NO_SOCKET;
 }
 
-// Kernel execution
-HHALClientExitCode HHALClient::kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources) {
-    CHECK_OPEN_SOCKET
+protocol_version HHALClient::get_protocol_version() const {
+    return protocol;
+}
 
-    serialized_object serialized = serialize(kernel_sources);
+HHALClientExitCode HHALClient::negotiate_protocol(protocol_version max_version) {
+    CHECK_OPEN_SOCKET
 
-    kernel_write_command cmd;
-    init_kernel_write_command(cmd, kernel_id, serialized.size);
+    negotiate_protocol_command cmd;
+    init_negotiate_protocol_command(cmd, max_version);
     TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
     response_base res;
     TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
 
-    if (res.type == response_type::ERROR) {
-        error_response error_res;
-        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
-        return HHALClientExitCode::ERROR;
+    if (res.type != response_type::PROTOCOL) {
+        close_socket();
+        return HHALClientExitCode::SEVERE_ERROR;
     }
 
-    TRY_OR_CLOSE(send_on_socket(socket_fd, serialized.buf, serialized.size))
+    protocol_response protocol_res;
+    TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &protocol_res, sizeof(protocol_res)));
+    protocol = protocol_res.version;
+
+    return HHALClientExitCode::OK;
+}
+
+// Sends a command followed by its payload and waits for the final response.
+HHALClientExitCode HHALClient::send_command_with_payload(const void *cmd, size_t cmd_size, const void *payload, size_t payload_size) {
+    HHALClientExitCode ec = send_payload_command(cmd, cmd_size, payload, payload_size);
+    if (ec != HHALClientExitCode::OK) return ec;
+
+    response_base res;
     TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
 
     if (res.type == response_type::ERROR) {
@@ -75,6 +122,38 @@ HHALClientExitCode HHALClient::kernel_write(int kernel_id, const std::map<hhal::
     return HHALClientExitCode::OK;
 }
 
+// Sends a command followed by its payload, the caller receives the final response.
+// The legacy protocol needs an extra round trip to have the command acknowledged before sending the payload.
+HHALClientExitCode HHALClient::send_payload_command(const void *cmd, size_t cmd_size, const void *payload, size_t payload_size) {
+    if (protocol == protocol_version::LEGACY) {
+        response_base res;
+        TRY_OR_CLOSE(send_on_socket(socket_fd, cmd, cmd_size))
+        TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+
+        if (res.type == response_type::ERROR) {
+            error_response error_res;
+            TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
+            return HHALClientExitCode::ERROR;
+        }
+
+        TRY_OR_CLOSE(send_on_socket(socket_fd, payload, payload_size))
+    } else {
+        TRY_OR_CLOSE(send_with_header_on_socket(socket_fd, cmd, cmd_size, payload, payload_size))
+    }
+    return HHALClientExitCode::OK;
+}
+
+// Kernel execution
+HHALClientExitCode HHALClient::kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources) {
+    CHECK_OPEN_SOCKET
+
+    serialized_object serialized = serialize(kernel_sources);
+
+    kernel_write_command cmd;
+    init_kernel_write_command(cmd, kernel_id, serialized.size);
+    return send_command_with_payload(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
 HHALClientExitCode HHALClient::kernel_start(int kernel_id, const hhal::Arguments &arguments) {
     CHECK_OPEN_SOCKET
 
@@ -82,18 +161,27 @@ HHALClientExitCode HHALClient::kernel_start(int kernel_id, const hhal::Arguments
 
     kernel_start_command cmd;
     init_kernel_start_command(cmd, kernel_id, serialized.size);
-    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
+    return send_command_with_payload(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
 
-    response_base res;
-    TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+HHALClientExitCode HHALClient::prepare_launch(int launch_id, int kernel_id, const hhal::Arguments &arguments) {
+    CHECK_OPEN_SOCKET
 
-    if (res.type == response_type::ERROR) {
-        error_response error_res;
-        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
-        return HHALClientExitCode::ERROR;
-    }
+    serialized_object serialized = serialize(arguments);
+
+    prepare_launch_command cmd;
+    init_prepare_launch_command(cmd, launch_id, kernel_id, serialized.size);
+    return send_command_with_payload(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClient::launch(int launch_id) {
+    CHECK_OPEN_SOCKET
+
+    launch_command cmd;
+    init_launch_command(cmd, launch_id);
+    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
-    TRY_OR_CLOSE(send_on_socket(socket_fd, serialized.buf, serialized.size))
+    response_base res;
     TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
 
     if (res.type == response_type::ERROR) {
@@ -105,11 +193,11 @@ HHALClientExitCode HHALClient::kernel_start(int kernel_id, const hhal::Arguments
     return HHALClientExitCode::OK;
 }
 
-HHALClientExitCode HHALClient::write_to_memory(int buffer_id, const void *source, size_t size) {
+HHALClientExitCode HHALClient::release_launch(int launch_id) {
     CHECK_OPEN_SOCKET
 
-    write_memory_command cmd;
-    init_write_memory_command(cmd, buffer_id, size);
+    release_launch_command cmd;
+    init_release_launch_command(cmd, launch_id);
     TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
     response_base res;
@@ -121,24 +209,63 @@ HHALClientExitCode HHALClient::write_to_memory(int buffer_id, const void *source
         return HHALClientExitCode::ERROR;
     }
 
-    TRY_OR_CLOSE(send_on_socket(socket_fd, source, size))
-    TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+    return HHALClientExitCode::OK;
+}
 
-    if (res.type == response_type::ERROR) {
-        error_response error_res;
-        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
-        return HHALClientExitCode::ERROR;
+HHALClientExitCode HHALClient::write_to_memory(int buffer_id, const void *source, size_t size) {
+    CHECK_OPEN_SOCKET
+
+    if (in_shared_memory(source, size)) {
+        return write_to_memory_shared(buffer_id, (const char *) source - (const char *) shared_memory, size);
+    }
+    if (shared_memory != nullptr && size <= shared_memory_size) {
+        memcpy(shared_memory, source, size);
+        return write_to_memory_shared(buffer_id, 0, size);
     }
 
-    return HHALClientExitCode::OK;
+    write_memory_command cmd;
+    init_write_memory_command(cmd, buffer_id, size);
+    return send_command_with_payload(&cmd, sizeof(cmd), source, size);
 }
 
 HHALClientExitCode HHALClient::read_from_memory(int buffer_id, void *dest, size_t size) {
     CHECK_OPEN_SOCKET
 
+    if (in_shared_memory(dest, size)) {
+        return read_from_memory_shared(buffer_id, (char *) dest - (char *) shared_memory, size);
+    }
+    if (shared_memory != nullptr && size <= shared_memory_size) {
+        HHALClientExitCode ec = read_from_memory_shared(buffer_id, 0, size);
+        if (ec == HHALClientExitCode::OK) {
+            memcpy(dest, shared_memory, size);
+        }
+        return ec;
+    }
+
     read_memory_command cmd;
     init_read_memory_command(cmd, buffer_id, size);
-    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
+    return send_read_command(&cmd, sizeof(cmd), dest, size);
+}
+
+HHALClientExitCode HHALClient::write_to_memory(int buffer_id, const void *source, size_t size, size_t offset) {
+    CHECK_OPEN_SOCKET
+
+    write_memory_range_command cmd;
+    init_write_memory_range_command(cmd, buffer_id, offset, size);
+    return send_command_with_payload(&cmd, sizeof(cmd), source, size);
+}
+
+HHALClientExitCode HHALClient::read_from_memory(int buffer_id, void *dest, size_t size, size_t offset) {
+    CHECK_OPEN_SOCKET
+
+    read_memory_range_command cmd;
+    init_read_memory_range_command(cmd, buffer_id, offset, size);
+    return send_read_command(&cmd, sizeof(cmd), dest, size);
+}
+
+// The data follows the acknowledgement of a successful read
+HHALClientExitCode HHALClient::send_read_command(const void *cmd, size_t cmd_size, void *dest, size_t size) {
+    TRY_OR_CLOSE(send_on_socket(socket_fd, cmd, cmd_size))
 
     response_base res;
     TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
@@ -154,11 +281,11 @@ HHALClientExitCode HHALClient::read_from_memory(int buffer_id, void *dest, size_
     return HHALClientExitCode::OK;
 }
 
-HHALClientExitCode HHALClient::write_sync_register(int event_id, uint32_t data) {
+HHALClientExitCode HHALClient::copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
     CHECK_OPEN_SOCKET
 
-    write_register_command cmd;
-    init_write_register_command(cmd, event_id, data);
+    copy_buffer_command cmd;
+    init_copy_buffer_command(cmd, src_id, dst_id, src_offset, dst_offset, size);
     TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
     response_base res;
@@ -173,58 +300,81 @@ HHALClientExitCode HHALClient::write_sync_register(int event_id, uint32_t data)
     return HHALClientExitCode::OK;
 }
 
-HHALClientExitCode HHALClient::read_sync_register(int event_id, uint32_t *data) {
+// Shared memory data plane
+HHALClientExitCode HHALClient::register_shared_memory(size_t size) {
     CHECK_OPEN_SOCKET
 
-    read_register_command cmd;
-    init_read_register_command(cmd, event_id);
-    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
+    if (size == 0) return HHALClientExitCode::ERROR;
+
+    int fd = memfd_create("hhal_client_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        perror("HHALClient: memfd_create");
+        return HHALClientExitCode::ERROR;
+    }
+    if (ftruncate(fd, size) < 0) {
+        perror("HHALClient: ftruncate");
+        close(fd);
+        return HHALClientExitCode::ERROR;
+    }
+    // The daemon only maps regions that cannot be resized under it
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+        perror("HHALClient: fcntl(F_ADD_SEALS)");
+        close(fd);
+        return HHALClientExitCode::ERROR;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("HHALClient: mmap");
+        close(fd);
+        return HHALClientExitCode::ERROR;
+    }
+
+    register_shared_memory_command cmd;
+    init_register_shared_memory_command(cmd, size);
+    bool sent = send_fd_on_socket(socket_fd, fd, &cmd, sizeof(cmd));
+    // The daemon holds its own reference once the message is sent
+    close(fd);
+    if (!sent) {
+        munmap(addr, size);
+        close_socket();
+        return HHALClientExitCode::SEVERE_ERROR;
+    }
 
     response_base res;
-    TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+    if (!receive_on_socket(socket_fd, &res, sizeof(res))) {
+        munmap(addr, size);
+        close_socket();
+        return HHALClientExitCode::SEVERE_ERROR;
+    }
 
     if (res.type == response_type::ERROR) {
+        munmap(addr, size);
         error_response error_res;
         TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
         return HHALClientExitCode::ERROR;
-    } else if (res.type == response_type::REGISTER_DATA) {
-        register_data_response rd_res;
-        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &rd_res, sizeof(rd_res)));
-        *data = rd_res.data;
-    } else {
-        // Unknown response type
-        printf("Got unknown response type\n");
-        return HHALClientExitCode::ERROR;
     }
 
+    // The daemon dropped any previous region for this connection
+    release_shared_memory();
+    shared_memory = addr;
+    shared_memory_size = size;
+
     return HHALClientExitCode::OK;
 }
-// -----------------------
 
-// Resource management
-HHALClientExitCode HHALClient::assign_kernel(hhal::Unit unit, hhal::hhal_kernel *info) {
-    CHECK_OPEN_SOCKET
+void *HHALClient::get_shared_memory() const {
+    return shared_memory;
+}
 
+size_t HHALClient::get_shared_memory_size() const {
+    return shared_memory_size;
+}
 
-    size_t kernel_info_size;
-    switch (unit) {
-        case hhal::Unit::GN: {
-            // Already a POD
-            kernel_info_size = sizeof(hhal::gn_kernel);
-            break;
-        }
-        case hhal::Unit::NVIDIA: {
-            // Already a POD
-            kernel_info_size = sizeof(hhal::nvidia_kernel);
-            break;
-        }
-        default:
-            printf("Unknown unit type %d", static_cast<int>(unit));
-            return HHALClientExitCode::ERROR;
-    }
+HHALClientExitCode HHALClient::write_to_memory_shared(int buffer_id, size_t offset, size_t size) {
+    CHECK_OPEN_SOCKET
 
-    assign_kernel_command cmd;
-    init_assign_kernel_command(cmd, unit, kernel_info_size);
+    write_memory_shared_command cmd;
+    init_write_memory_shared_command(cmd, buffer_id, offset, size);
     TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
     response_base res;
@@ -236,8 +386,17 @@ HHALClientExitCode HHALClient::assign_kernel(hhal::Unit unit, hhal::hhal_kernel
         return HHALClientExitCode::ERROR;
     }
 
-    TRY_OR_CLOSE(send_on_socket(socket_fd, info, kernel_info_size))
-    printf("Done sending serialized kernel\n");
+    return HHALClientExitCode::OK;
+}
+
+HHALClientExitCode HHALClient::read_from_memory_shared(int buffer_id, size_t offset, size_t size) {
+    CHECK_OPEN_SOCKET
+
+    read_memory_shared_command cmd;
+    init_read_memory_shared_command(cmd, buffer_id, offset, size);
+    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
+
+    response_base res;
     TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
 
     if (res.type == response_type::ERROR) {
@@ -249,24 +408,11 @@ HHALClientExitCode HHALClient::assign_kernel(hhal::Unit unit, hhal::hhal_kernel
     return HHALClientExitCode::OK;
 }
 
-HHALClientExitCode HHALClient::assign_buffer(hhal::Unit unit, hhal::hhal_buffer *info) {
+HHALClientExitCode HHALClient::write_sync_register(int event_id, uint32_t data) {
     CHECK_OPEN_SOCKET
 
-    serialized_object serialized;
-    switch (unit) {
-        case hhal::Unit::GN:
-            serialized = serialize(*(hhal::gn_buffer *) info);
-            break;
-        case hhal::Unit::NVIDIA:
-            serialized = serialize(*(hhal::nvidia_buffer *) info);
-            break;
-        default:
-            printf("Unknown unit type %d", static_cast<int>(unit));
-            return HHALClientExitCode::ERROR;
-    }
-
-    assign_buffer_command cmd;
-    init_assign_buffer_command(cmd, unit, serialized.size);
+    write_register_command cmd;
+    init_write_register_command(cmd, event_id, data);
     TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
     response_base res;
@@ -278,41 +424,41 @@ HHALClientExitCode HHALClient::assign_buffer(hhal::Unit unit, hhal::hhal_buffer
         return HHALClientExitCode::ERROR;
     }
 
-    TRY_OR_CLOSE(send_on_socket(socket_fd, serialized.buf, serialized.size))
+    return HHALClientExitCode::OK;
+}
 
+HHALClientExitCode HHALClient::read_sync_register(int event_id, uint32_t *data) {
+    CHECK_OPEN_SOCKET
+
+    read_register_command cmd;
+    init_read_register_command(cmd, event_id);
+    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
+
+    response_base res;
     TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
 
     if (res.type == response_type::ERROR) {
         error_response error_res;
         TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
         return HHALClientExitCode::ERROR;
+    } else if (res.type == response_type::REGISTER_DATA) {
+        register_data_response rd_res;
+        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &rd_res, sizeof(rd_res)));
+        *data = rd_res.data;
+    } else {
+        // Unknown response type
+        printf("Got unknown response type\n");
+        return HHALClientExitCode::ERROR;
     }
 
     return HHALClientExitCode::OK;
 }
 
-HHALClientExitCode HHALClient::assign_event(hhal::Unit unit, hhal::hhal_event *info) {
+HHALClientExitCode HHALClient::wait_sync_register(int event_id, uint32_t value, int timeout_ms) {
     CHECK_OPEN_SOCKET
 
-    serialized_object serialized;
-    switch (unit) {
-        case hhal::Unit::GN:
-            serialized = serialize(*(hhal::gn_event *) info);
-            break;
-        case hhal::Unit::NVIDIA: {
-            // Already a POD
-            void *info_buf = malloc(sizeof(hhal::nvidia_event));
-            memcpy(info_buf, info, sizeof(hhal::nvidia_event));
-            serialized = {info_buf, sizeof(hhal::nvidia_event)};
-            break;
-        }
-        default:
-            printf("Unknown unit type %d", static_cast<int>(unit));
-            return HHALClientExitCode::ERROR;
-    }
-
-    assign_event_command cmd;
-    init_assign_event_command(cmd, unit, serialized.size);
+    wait_register_command cmd;
+    init_wait_register_command(cmd, event_id, value, timeout_ms);
     TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
 
     response_base res;
@@ -321,19 +467,45 @@ HHALClientExitCode HHALClient::assign_event(hhal::Unit unit, hhal::hhal_event *i
     if (res.type == response_type::ERROR) {
         error_response error_res;
         TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
-        return HHALClientExitCode::ERROR;
+        return error_res.error_code == hhal::HHALExitCode::TIMEOUT ? HHALClientExitCode::TIMEOUT : HHALClientExitCode::ERROR;
     }
 
-    TRY_OR_CLOSE(send_on_socket(socket_fd, serialized.buf, serialized.size))
-    TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+    return HHALClientExitCode::OK;
+}
+// -----------------------
 
-    if (res.type == response_type::ERROR) {
-        error_response error_res;
-        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
-        return HHALClientExitCode::ERROR;
-    }
+// Resource management
+HHALClientExitCode HHALClient::assign_kernel(hhal::Unit unit, hhal::hhal_kernel *info) {
+    CHECK_OPEN_SOCKET
 
-    return HHALClientExitCode::OK;
+    size_t info_size = kernel_info_size(unit);
+    if (info_size == 0) return HHALClientExitCode::ERROR;
+
+    assign_kernel_command cmd;
+    init_assign_kernel_command(cmd, unit, info_size);
+    return send_command_with_payload(&cmd, sizeof(cmd), info, info_size);
+}
+
+HHALClientExitCode HHALClient::assign_buffer(hhal::Unit unit, hhal::hhal_buffer *info) {
+    CHECK_OPEN_SOCKET
+
+    serialized_object serialized = serialize_buffer_info(unit, info);
+    if (serialized.buf == nullptr) return HHALClientExitCode::ERROR;
+
+    assign_buffer_command cmd;
+    init_assign_buffer_command(cmd, unit, serialized.size);
+    return send_command_with_payload(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClient::assign_event(hhal::Unit unit, hhal::hhal_event *info) {
+    CHECK_OPEN_SOCKET
+
+    serialized_object serialized = serialize_event_info(unit, info);
+    if (serialized.buf == nullptr) return HHALClientExitCode::ERROR;
+
+    assign_event_command cmd;
+    init_assign_event_command(cmd, unit, serialized.size);
+    return send_command_with_payload(&cmd, sizeof(cmd), serialized.buf, serialized.size);
 }
 
 HHALClientExitCode HHALClient::deassign_kernel(int kernel_id) {
@@ -507,4 +679,232 @@ HHALClientExitCode HHALClient::release_event(int event_id) {
     return HHALClientExitCode::OK;
 }
 
+// Batching
+HHALClientExitCode HHALClient::submit(const HHALClientBatch &batch, std::vector<hhal::HHALExitCode> *results) {
+    CHECK_OPEN_SOCKET
+
+    if (results != nullptr) results->clear();
+    if (batch.count == 0) return HHALClientExitCode::OK;
+
+    batch_command cmd;
+    init_batch_command(cmd, batch.count, batch.data.size());
+    HHALClientExitCode ec = send_payload_command(&cmd, sizeof(cmd), batch.data.data(), batch.data.size());
+    if (ec != HHALClientExitCode::OK) return ec;
+
+    response_base res;
+    TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+
+    if (res.type == response_type::ERROR) {
+        error_response error_res;
+        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
+        return HHALClientExitCode::ERROR;
+    }
+
+    batch_response batch_res;
+    TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &batch_res, sizeof(batch_res)));
+    std::vector<hhal::HHALExitCode> codes(batch_res.count);
+    TRY_OR_CLOSE(receive_on_socket(socket_fd, codes.data(), codes.size() * sizeof(hhal::HHALExitCode)));
+
+    ec = HHALClientExitCode::OK;
+    for (auto code : codes) {
+        if (code != hhal::HHALExitCode::OK) ec = HHALClientExitCode::ERROR;
+    }
+    if (results != nullptr) *results = std::move(codes);
+    return ec;
+}
+
+// Metrics
+HHALClientExitCode HHALClient::get_stats(std::string &stats) {
+    CHECK_OPEN_SOCKET
+
+    stats_command cmd;
+    init_stats_command(cmd);
+    TRY_OR_CLOSE(send_on_socket(socket_fd, &cmd, sizeof(cmd)))
+
+    response_base res;
+    TRY_OR_CLOSE(receive_on_socket(socket_fd, &res, sizeof(res)))
+
+    if (res.type == response_type::ERROR) {
+        error_response error_res;
+        TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &error_res, sizeof(error_res)));
+        return HHALClientExitCode::ERROR;
+    }
+
+    stats_response stats_res;
+    TRY_OR_CLOSE(receive_rest_of_response(socket_fd, res, &stats_res, sizeof(stats_res)));
+    stats.resize(stats_res.size);
+    TRY_OR_CLOSE(receive_on_socket(socket_fd, &stats[0], stats.size()));
+    return HHALClientExitCode::OK;
+}
+
+HHALClientBatch::HHALClientBatch(): count(0) {}
+
+size_t HHALClientBatch::size() const {
+    return count;
+}
+
+void HHALClientBatch::clear() {
+    data.clear();
+    count = 0;
+}
+
+// Commands and payloads are padded, so the daemon finds every command aligned
+HHALClientExitCode HHALClientBatch::record(const void *cmd, size_t cmd_size, const void *payload, size_t payload_size) {
+    size_t offset = data.size();
+    data.resize(offset + batch_padded_size(cmd_size) + batch_padded_size(payload_size));
+    memcpy(data.data() + offset, cmd, cmd_size);
+    if (payload_size > 0) {
+        memcpy(data.data() + offset + batch_padded_size(cmd_size), payload, payload_size);
+    }
+    count++;
+    return HHALClientExitCode::OK;
+}
+
+HHALClientExitCode HHALClientBatch::kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources) {
+    serialized_object serialized = serialize(kernel_sources);
+
+    kernel_write_command cmd;
+    init_kernel_write_command(cmd, kernel_id, serialized.size);
+    return record(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClientBatch::kernel_start(int kernel_id, const hhal::Arguments &arguments) {
+    serialized_object serialized = serialize(arguments);
+
+    kernel_start_command cmd;
+    init_kernel_start_command(cmd, kernel_id, serialized.size);
+    return record(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClientBatch::prepare_launch(int launch_id, int kernel_id, const hhal::Arguments &arguments) {
+    serialized_object serialized = serialize(arguments);
+
+    prepare_launch_command cmd;
+    init_prepare_launch_command(cmd, launch_id, kernel_id, serialized.size);
+    return record(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClientBatch::launch(int launch_id) {
+    launch_command cmd;
+    init_launch_command(cmd, launch_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::release_launch(int launch_id) {
+    release_launch_command cmd;
+    init_release_launch_command(cmd, launch_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::write_to_memory(int buffer_id, const void *source, size_t size) {
+    write_memory_command cmd;
+    init_write_memory_command(cmd, buffer_id, size);
+    return record(&cmd, sizeof(cmd), source, size);
+}
+
+HHALClientExitCode HHALClientBatch::write_to_memory(int buffer_id, const void *source, size_t size, size_t offset) {
+    write_memory_range_command cmd;
+    init_write_memory_range_command(cmd, buffer_id, offset, size);
+    return record(&cmd, sizeof(cmd), source, size);
+}
+
+HHALClientExitCode HHALClientBatch::write_to_memory_shared(int buffer_id, size_t offset, size_t size) {
+    write_memory_shared_command cmd;
+    init_write_memory_shared_command(cmd, buffer_id, offset, size);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
+    copy_buffer_command cmd;
+    init_copy_buffer_command(cmd, src_id, dst_id, src_offset, dst_offset, size);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::write_sync_register(int event_id, uint32_t data) {
+    write_register_command cmd;
+    init_write_register_command(cmd, event_id, data);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::assign_kernel(hhal::Unit unit, hhal::hhal_kernel *info) {
+    size_t info_size = kernel_info_size(unit);
+    if (info_size == 0) return HHALClientExitCode::ERROR;
+
+    assign_kernel_command cmd;
+    init_assign_kernel_command(cmd, unit, info_size);
+    return record(&cmd, sizeof(cmd), info, info_size);
+}
+
+HHALClientExitCode HHALClientBatch::assign_buffer(hhal::Unit unit, hhal::hhal_buffer *info) {
+    serialized_object serialized = serialize_buffer_info(unit, info);
+    if (serialized.buf == nullptr) return HHALClientExitCode::ERROR;
+
+    assign_buffer_command cmd;
+    init_assign_buffer_command(cmd, unit, serialized.size);
+    return record(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClientBatch::assign_event(hhal::Unit unit, hhal::hhal_event *info) {
+    serialized_object serialized = serialize_event_info(unit, info);
+    if (serialized.buf == nullptr) return HHALClientExitCode::ERROR;
+
+    assign_event_command cmd;
+    init_assign_event_command(cmd, unit, serialized.size);
+    return record(&cmd, sizeof(cmd), serialized.buf, serialized.size);
+}
+
+HHALClientExitCode HHALClientBatch::deassign_kernel(int kernel_id) {
+    deassign_kernel_command cmd;
+    init_deassign_kernel_command(cmd, kernel_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::deassign_buffer(int buffer_id) {
+    deassign_buffer_command cmd;
+    init_deassign_buffer_command(cmd, buffer_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::deassign_event(int event_id) {
+    deassign_event_command cmd;
+    init_deassign_event_command(cmd, event_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::allocate_memory(int buffer_id) {
+    allocate_memory_command cmd;
+    init_allocate_memory_command(cmd, buffer_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::release_memory(int buffer_id) {
+    release_memory_command cmd;
+    init_release_memory_command(cmd, buffer_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::allocate_kernel(int kernel_id) {
+    allocate_kernel_command cmd;
+    init_allocate_kernel_command(cmd, kernel_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::release_kernel(int kernel_id) {
+    release_kernel_command cmd;
+    init_release_kernel_command(cmd, kernel_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::allocate_event(int event_id) {
+    allocate_event_command cmd;
+    init_allocate_event_command(cmd, event_id);
+    return record(&cmd, sizeof(cmd));
+}
+
+HHALClientExitCode HHALClientBatch::release_event(int event_id) {
+    release_event_command cmd;
+    init_release_event_command(cmd, event_id);
+    return record(&cmd, sizeof(cmd));
+}
+
 }
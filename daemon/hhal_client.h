@@ -2,9 +2,12 @@
 #define HHAL_CLIENT_H
 
 #include <map>
+#include <string>
+#include <vector>
 #include <cinttypes>
 
 #include "hhal.h"
+#include "hhal_command.h"
 
 namespace hhal_daemon {
 
@@ -12,22 +15,113 @@ enum class HHALClientExitCode {
     OK,           // successful operation
     ERROR,        // generic error in the request
     SEVERE_ERROR, // error that leaves the client unusable
+    TIMEOUT,      // a wait was not satisfied in time
+};
+
+/*
+* Sequence of HHAL operations recorded to be sent to the daemon as a single command with HHALClient::submit.
+* Offers the HHALClient operations that only report a status, so code templated on the client can record into it.
+* Recording does not talk to the daemon, calls only fail if their arguments can not be encoded.
+*/
+class HHALClientBatch {
+    public:
+    HHALClientBatch();
+
+    // Kernel execution
+    HHALClientExitCode kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources);
+    HHALClientExitCode kernel_start(int kernel_id, const hhal::Arguments &arguments);
+    HHALClientExitCode prepare_launch(int launch_id, int kernel_id, const hhal::Arguments &arguments);
+    HHALClientExitCode launch(int launch_id);
+    HHALClientExitCode release_launch(int launch_id);
+
+    // The data is copied into the batch
+    HHALClientExitCode write_to_memory(int buffer_id, const void *source, size_t size);
+    HHALClientExitCode write_to_memory(int buffer_id, const void *source, size_t size, size_t offset);
+    HHALClientExitCode write_to_memory_shared(int buffer_id, size_t offset, size_t size);
+    HHALClientExitCode copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size);
+
+    HHALClientExitCode write_sync_register(int event_id, uint32_t data);
+    // -----------------------
+
+    // Resource management
+    HHALClientExitCode assign_kernel(hhal::Unit unit, hhal::hhal_kernel *info);
+    HHALClientExitCode assign_buffer(hhal::Unit unit, hhal::hhal_buffer *info);
+    HHALClientExitCode assign_event (hhal::Unit unit, hhal::hhal_event *info);
+
+    HHALClientExitCode deassign_kernel(int kernel_id);
+    HHALClientExitCode deassign_buffer(int buffer_id);
+    HHALClientExitCode deassign_event(int event_id);
+
+    HHALClientExitCode allocate_memory(int buffer_id);
+    HHALClientExitCode release_memory(int buffer_id);
+
+    HHALClientExitCode allocate_kernel(int kernel_id);
+    HHALClientExitCode release_kernel(int kernel_id);
+
+    HHALClientExitCode allocate_event(int event_id);
+    HHALClientExitCode release_event(int event_id);
+
+    // Amount of recorded operations
+    size_t size() const;
+    void clear();
+
+    private:
+    friend class HHALClient;
+    friend class HHALAsyncClient;
+
+    std::vector<char> data;
+    uint32_t count;
+
+    HHALClientExitCode record(const void *cmd, size_t cmd_size, const void *payload = nullptr, size_t payload_size = 0);
 };
 
 class HHALClient {
     public:
-    HHALClient(const std::string socket_path);
+    /*
+    * Connects to the daemon and agrees on the newest protocol version both sides support, up to max_version.
+    * Requests are answered in order, so TAGGED is never used. Daemons that do not know about protocol
+    * negotiation are talked to with the legacy protocol.
+    */
+    HHALClient(const std::string socket_path, protocol_version max_version = LATEST_PROTOCOL_VERSION);
     ~HHALClient();
 
+    protocol_version get_protocol_version() const;
+
     // Kernel execution
     HHALClientExitCode kernel_write(int kernel_id, const std::map<hhal::Unit, hhal::hhal_kernel_source> &kernel_sources);
     HHALClientExitCode kernel_start(int kernel_id, const hhal::Arguments &arguments);
+    // The arguments are sent and encoded by the daemon once, every launch then only sends the launch id.
+    // See HHAL::prepare_launch.
+    HHALClientExitCode prepare_launch(int launch_id, int kernel_id, const hhal::Arguments &arguments);
+    HHALClientExitCode launch(int launch_id);
+    HHALClientExitCode release_launch(int launch_id);
 
     HHALClientExitCode write_to_memory(int buffer_id, const void *source, size_t size);
     HHALClientExitCode read_from_memory(int buffer_id, void *dest, size_t size);
+    // Transfer size bytes starting offset bytes past the base of the buffer, always through the socket
+    HHALClientExitCode write_to_memory(int buffer_id, const void *source, size_t size, size_t offset);
+    HHALClientExitCode read_from_memory(int buffer_id, void *dest, size_t size, size_t offset);
+    // Done by the daemon, the data does not go through the client. See HHAL::copy_buffer.
+    HHALClientExitCode copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size);
+
+    // Shared memory data plane
+    // Once registered, write_to_memory and read_from_memory of up to get_shared_memory_size() bytes
+    // are moved through the region instead of the socket. Data placed directly in get_shared_memory()
+    // can be transferred without any copy with the *_shared variants.
+    HHALClientExitCode register_shared_memory(size_t size);
+    void *get_shared_memory() const;
+    size_t get_shared_memory_size() const;
+
+    HHALClientExitCode write_to_memory_shared(int buffer_id, size_t offset, size_t size);
+    HHALClientExitCode read_from_memory_shared(int buffer_id, size_t offset, size_t size);
 
     HHALClientExitCode write_sync_register(int event_id, uint32_t data);
     HHALClientExitCode read_sync_register(int event_id, uint32_t *data);
+    /*
+    * Blocks until the register holds value and consumes it, like a read. The daemon parks the wait, so nothing is polled over the socket.
+    * Returns TIMEOUT if it did not happen within timeout_ms, a negative timeout waits forever.
+    */
+    HHALClientExitCode wait_sync_register(int event_id, uint32_t value, int timeout_ms = -1);
     // -----------------------
 
     // Resource management
@@ -48,11 +142,32 @@ class HHALClient {
     HHALClientExitCode allocate_event(int event_id);
     HHALClientExitCode release_event(int event_id);
 
+    // Batching
+    /*
+    * Runs the operations of the batch on the daemon in order, with a single round trip.
+    * results, if given, receives the exit code of each operation. Returns ERROR if any of them failed.
+    */
+    HHALClientExitCode submit(const HHALClientBatch &batch, std::vector<hhal::HHALExitCode> *results = nullptr);
+
+    // Metrics
+    // Daemon wide counters and per command latency histograms, as a JSON object
+    HHALClientExitCode get_stats(std::string &stats);
+
     private:
 
     int socket_fd;
+    protocol_version protocol;
+
+    void *shared_memory;
+    size_t shared_memory_size;
 
     void close_socket();
+    HHALClientExitCode negotiate_protocol(protocol_version max_version);
+    HHALClientExitCode send_command_with_payload(const void *cmd, size_t cmd_size, const void *payload, size_t payload_size);
+    HHALClientExitCode send_payload_command(const void *cmd, size_t cmd_size, const void *payload, size_t payload_size);
+    HHALClientExitCode send_read_command(const void *cmd, size_t cmd_size, void *dest, size_t size);
+    void release_shared_memory();
+    bool in_shared_memory(const void *addr, size_t size) const;
 };
 
 }
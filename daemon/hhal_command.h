@@ -8,6 +8,24 @@
 
 namespace hhal_daemon {
 
+/*
+* Versions of the client/daemon protocol, agreed per connection with a NEGOTIATE_PROTOCOL command.
+* Connections that never negotiate use LEGACY.
+*/
+enum class protocol_version : uint32_t {
+    LEGACY = 0, // Commands carrying a payload are acknowledged before the payload is sent, and once more after it is handled
+    FRAMED = 1, // The payload directly follows its command, a single response is sent once it is handled
+    TAGGED = 2, // FRAMED, plus every command is preceded by a request_header and its response by a response_header
+                // carrying the same id, so responses may come back out of order
+};
+
+constexpr protocol_version LATEST_PROTOCOL_VERSION = protocol_version::TAGGED;
+
+// Precedes every command on connections using the TAGGED protocol
+struct request_header {
+    uint64_t request_id;
+};
+
 enum class command_type {
     // Kerner execution
     KERNEL_WRITE,
@@ -30,8 +48,50 @@ enum class command_type {
     RELEASE_MEMORY,
     RELEASE_KERNEL,
     RELEASE_EVENT,
+
+    // Shared memory data plane
+    REGISTER_SHARED_MEMORY,
+    WRITE_MEMORY_SHARED,
+    READ_MEMORY_SHARED,
+
+    // Connection setup
+    NEGOTIATE_PROTOCOL,
+
+    // Batching
+    BATCH,
+
+    // Event waiting
+    WAIT_REGISTER,
+
+    // Metrics
+    STATS,
+
+    // Prepared launches
+    PREPARE_LAUNCH,
+    LAUNCH,
+    RELEASE_LAUNCH,
+
+    // Partial transfers
+    WRITE_MEMORY_RANGE,
+    READ_MEMORY_RANGE,
+
+    // Device side copies
+    COPY_BUFFER,
+};
+
+// Names used by the metrics and tools, in command_type order
+static const char *const COMMAND_TYPE_NAMES[] = {
+    "KERNEL_WRITE", "KERNEL_START", "WRITE_MEMORY", "READ_MEMORY", "WRITE_REGISTER", "READ_REGISTER",
+    "ASSIGN_KERNEL", "ASSIGN_BUFFER", "ASSIGN_EVENT", "DEASSIGN_KERNEL", "DEASSIGN_BUFFER", "DEASSIGN_EVENT",
+    "ALLOCATE_MEMORY", "ALLOCATE_KERNEL", "ALLOCATE_EVENT", "RELEASE_MEMORY", "RELEASE_KERNEL", "RELEASE_EVENT",
+    "REGISTER_SHARED_MEMORY", "WRITE_MEMORY_SHARED", "READ_MEMORY_SHARED", "NEGOTIATE_PROTOCOL", "BATCH",
+    "WAIT_REGISTER", "STATS", "PREPARE_LAUNCH", "LAUNCH", "RELEASE_LAUNCH", "WRITE_MEMORY_RANGE", "READ_MEMORY_RANGE",
+    "COPY_BUFFER",
 };
 
+constexpr int COMMAND_TYPE_COUNT = sizeof(COMMAND_TYPE_NAMES) / sizeof(COMMAND_TYPE_NAMES[0]);
+static_assert(COMMAND_TYPE_COUNT == static_cast<int>(command_type::COPY_BUFFER) + 1, "Every command type needs a name");
+
 struct command_base {
     command_type type;
 };
@@ -134,6 +194,109 @@ struct release_event_command {
     int event_id;
 };
 
+// The memfd backing the region travels as SCM_RIGHTS ancillary data along with this command
+struct register_shared_memory_command {
+    command_type type;
+    size_t size;
+};
+
+// Offsets are relative to the start of the registered shared memory region
+struct write_memory_shared_command {
+    command_type type;
+    int buffer_id;
+    size_t offset;
+    size_t size;
+};
+
+struct read_memory_shared_command {
+    command_type type;
+    int buffer_id;
+    size_t offset;
+    size_t size;
+};
+
+// The daemon answers with the highest version it supports that is not newer than the requested one
+struct negotiate_protocol_command {
+    command_type type;
+    protocol_version version;
+};
+
+// Answered once the register holds value, consuming it like a read, or with a TIMEOUT error. Negative timeouts wait forever.
+struct wait_register_command {
+    command_type type;
+    int event_id;
+    uint32_t value;
+    int32_t timeout_ms;
+};
+
+// Answered with a stats_response
+struct stats_command {
+    command_type type;
+};
+
+// Followed by the serialized arguments, like kernel_start_command
+struct prepare_launch_command {
+    command_type type;
+    int launch_id;
+    int kernel_id;
+    size_t arguments_size;
+};
+
+struct launch_command {
+    command_type type;
+    int launch_id;
+};
+
+struct release_launch_command {
+    command_type type;
+    int launch_id;
+};
+
+// Offsets are relative to the base of the buffer, the size bytes of data follow a write like for WRITE_MEMORY
+struct write_memory_range_command {
+    command_type type;
+    int buffer_id;
+    size_t offset;
+    size_t size;
+};
+
+struct read_memory_range_command {
+    command_type type;
+    int buffer_id;
+    size_t offset;
+    size_t size;
+};
+
+struct copy_buffer_command {
+    command_type type;
+    int src_id;
+    int dst_id;
+    size_t src_offset;
+    size_t dst_offset;
+    size_t size;
+};
+
+/*
+* Followed by size bytes holding count commands, each one directly followed by its payload if it carries one.
+* Commands and payloads are padded to batch_padded_size, so every command starts aligned.
+* Only commands answered with a status can be batched, the daemon runs them in order and answers with a batch_response.
+*/
+struct batch_command {
+    command_type type;
+    uint32_t count;
+    size_t size;
+};
+
+constexpr size_t BATCH_ALIGNMENT = 8;
+
+inline size_t batch_padded_size(size_t size) {
+    return (size + BATCH_ALIGNMENT - 1) & ~(BATCH_ALIGNMENT - 1);
+}
+
+inline void init_request_header(request_header &header, uint64_t request_id) {
+    header.request_id = request_id;
+}
+
 inline void init_kernel_write_command(kernel_write_command &cmd, int kernel_id, size_t sources_size) {
     cmd.type = command_type::KERNEL_WRITE;
     cmd.kernel_id = kernel_id;
@@ -232,6 +395,86 @@ inline void init_release_event_command(release_event_command &cmd, int event_id)
     cmd.event_id = event_id;
 }
 
+inline void init_register_shared_memory_command(register_shared_memory_command &cmd, size_t size) {
+    cmd.type = command_type::REGISTER_SHARED_MEMORY;
+    cmd.size = size;
+}
+
+inline void init_write_memory_shared_command(write_memory_shared_command &cmd, int buffer_id, size_t offset, size_t size) {
+    cmd.type = command_type::WRITE_MEMORY_SHARED;
+    cmd.buffer_id = buffer_id;
+    cmd.offset = offset;
+    cmd.size = size;
+}
+
+inline void init_read_memory_shared_command(read_memory_shared_command &cmd, int buffer_id, size_t offset, size_t size) {
+    cmd.type = command_type::READ_MEMORY_SHARED;
+    cmd.buffer_id = buffer_id;
+    cmd.offset = offset;
+    cmd.size = size;
+}
+
+inline void init_negotiate_protocol_command(negotiate_protocol_command &cmd, protocol_version version) {
+    cmd.type = command_type::NEGOTIATE_PROTOCOL;
+    cmd.version = version;
+}
+
+inline void init_batch_command(batch_command &cmd, uint32_t count, size_t size) {
+    cmd.type = command_type::BATCH;
+    cmd.count = count;
+    cmd.size = size;
+}
+
+inline void init_wait_register_command(wait_register_command &cmd, int event_id, uint32_t value, int32_t timeout_ms) {
+    cmd.type = command_type::WAIT_REGISTER;
+    cmd.event_id = event_id;
+    cmd.value = value;
+    cmd.timeout_ms = timeout_ms;
+}
+
+inline void init_stats_command(stats_command &cmd) {
+    cmd.type = command_type::STATS;
+}
+
+inline void init_prepare_launch_command(prepare_launch_command &cmd, int launch_id, int kernel_id, size_t arguments_size) {
+    cmd.type = command_type::PREPARE_LAUNCH;
+    cmd.launch_id = launch_id;
+    cmd.kernel_id = kernel_id;
+    cmd.arguments_size = arguments_size;
+}
+
+inline void init_launch_command(launch_command &cmd, int launch_id) {
+    cmd.type = command_type::LAUNCH;
+    cmd.launch_id = launch_id;
+}
+
+inline void init_release_launch_command(release_launch_command &cmd, int launch_id) {
+    cmd.type = command_type::RELEASE_LAUNCH;
+    cmd.launch_id = launch_id;
+}
+
+inline void init_write_memory_range_command(write_memory_range_command &cmd, int buffer_id, size_t offset, size_t size) {
+    cmd.type = command_type::WRITE_MEMORY_RANGE;
+    cmd.buffer_id = buffer_id;
+    cmd.offset = offset;
+    cmd.size = size;
+}
+
+inline void init_read_memory_range_command(read_memory_range_command &cmd, int buffer_id, size_t offset, size_t size) {
+    cmd.type = command_type::READ_MEMORY_RANGE;
+    cmd.buffer_id = buffer_id;
+    cmd.offset = offset;
+    cmd.size = size;
+}
+
+inline void init_copy_buffer_command(copy_buffer_command &cmd, int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
+    cmd.type = command_type::COPY_BUFFER;
+    cmd.src_id = src_id;
+    cmd.dst_id = dst_id;
+    cmd.src_offset = src_offset;
+    cmd.dst_offset = dst_offset;
+    cmd.size = size;
+}
 
 } // namespace daemon
 
@@ -5,6 +5,7 @@
 #include <cinttypes>
 
 #include "hhal.h"
+#include "hhal_command.h"
 
 namespace hhal_daemon {
 
@@ -12,6 +13,15 @@ enum class response_type {
     ACK,
     REGISTER_DATA,
     ERROR,
+    PROTOCOL,
+    BATCH_RESULT,
+    STATS,
+};
+
+// Precedes every response on connections using the TAGGED protocol, size bytes of response follow it
+struct response_header {
+    uint64_t request_id;
+    uint64_t size;
 };
 
 struct response_base {
@@ -28,6 +38,28 @@ struct error_response {
     hhal::HHALExitCode error_code;
 };
 
+struct protocol_response {
+    response_type type;
+    protocol_version version;
+};
+
+// Followed by count hhal::HHALExitCode, the result of each batched command in order
+struct batch_response {
+    response_type type;
+    uint32_t count;
+};
+
+// Followed by size bytes of JSON text with the daemon metrics
+struct stats_response {
+    response_type type;
+    uint64_t size;
+};
+
+inline void init_response_header(response_header &header, uint64_t request_id, uint64_t size) {
+    header.request_id = request_id;
+    header.size = size;
+}
+
 inline void init_ack_response(response_base &res) {
     res.type = response_type::ACK;
 }
@@ -41,6 +73,21 @@ inline void init_error_response(error_response &res, hhal::HHALExitCode error_co
     res.type = response_type::ERROR;
     res.error_code = error_code;
 }
+
+inline void init_protocol_response(protocol_response &res, protocol_version version) {
+    res.type = response_type::PROTOCOL;
+    res.version = version;
+}
+
+inline void init_batch_response(batch_response &res, uint32_t count) {
+    res.type = response_type::BATCH_RESULT;
+    res.count = count;
+}
+
+inline void init_stats_response(stats_response &res, uint64_t size) {
+    res.type = response_type::STATS;
+    res.size = size;
+}
 }
 
 #endif
\ No newline at end of file
@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "hhal_server.h"
 #include "utils/logger.h"
-#include "utils/thread_pool.h"
 #include "serialization.h"
 #include "hhal_response.h"
 
@@ -13,24 +18,129 @@ namespace hhal_daemon {
 static Logger &logger = Logger::get_instance();
 static ThreadPool dump_thread(1);
 
-Server::message_t ack_message() {
-    response_base *response = (response_base *) malloc(sizeof(response_base));
-    init_ack_response(*response);
-    return {response, sizeof(response_base)};
+small_response_t ack_message() {
+    small_response_t response;
+    init_ack_response(response.res.base);
+    response.size = sizeof(response_base);
+    return response;
+}
+
+small_response_t error_message(hhal::HHALExitCode ec) {
+    small_response_t response;
+    init_error_response(response.res.error, ec);
+    response.size = sizeof(error_response);
+    return response;
+}
+
+small_response_t result_message(hhal::HHALExitCode ec) {
+    return ec == hhal::HHALExitCode::OK ? ack_message() : error_message(ec);
+}
+
+small_response_t register_data_message(uint32_t data) {
+    small_response_t response;
+    init_register_data_response(response.res.register_data, data);
+    response.size = sizeof(register_data_response);
+    return response;
+}
+
+small_response_t protocol_message(protocol_version version) {
+    small_response_t response;
+    init_protocol_response(response.res.protocol, version);
+    response.size = sizeof(protocol_response);
+    return response;
 }
 
-Server::message_t error_message(hhal::HHALExitCode ec) {
-    error_response *response = (error_response *) malloc(sizeof(error_response));
-    init_error_response(*response, ec);
-    return {response, sizeof(error_response)};
+// Wraps a buffer owned by someone else, so deserializing from it does not free it
+struct borrowed_object : serialized_object {
+    borrowed_object(void *buf, size_t size): serialized_object(buf, size) {}
+    ~borrowed_object() { buf = nullptr; }
+};
+
+// Size of the command struct, 0 for commands that can not be part of a batch
+// HHAL refuses these ids with a bare error, log why
+static bool id_in_range(const char *resource, int id) {
+    if (id >= 0 && id <= hhal::HHAL::MAX_ID) return true;
+    logger.error("{} id {} out of range, ids must be in [0, {}]", resource, id, hhal::HHAL::MAX_ID);
+    return false;
+}
+
+static std::vector<std::string> command_names() {
+    return std::vector<std::string>(COMMAND_TYPE_NAMES, COMMAND_TYPE_NAMES + COMMAND_TYPE_COUNT);
+}
+
+static size_t batched_command_size(command_type type) {
+    switch (type) {
+        case command_type::KERNEL_WRITE: return sizeof(kernel_write_command);
+        case command_type::KERNEL_START: return sizeof(kernel_start_command);
+        case command_type::WRITE_MEMORY: return sizeof(write_memory_command);
+        case command_type::WRITE_REGISTER: return sizeof(write_register_command);
+        case command_type::WRITE_MEMORY_SHARED: return sizeof(write_memory_shared_command);
+        case command_type::ASSIGN_KERNEL: return sizeof(assign_kernel_command);
+        case command_type::ASSIGN_BUFFER: return sizeof(assign_buffer_command);
+        case command_type::ASSIGN_EVENT: return sizeof(assign_event_command);
+        case command_type::DEASSIGN_KERNEL: return sizeof(deassign_kernel_command);
+        case command_type::DEASSIGN_BUFFER: return sizeof(deassign_buffer_command);
+        case command_type::DEASSIGN_EVENT: return sizeof(deassign_event_command);
+        case command_type::ALLOCATE_KERNEL: return sizeof(allocate_kernel_command);
+        case command_type::ALLOCATE_MEMORY: return sizeof(allocate_memory_command);
+        case command_type::ALLOCATE_EVENT: return sizeof(allocate_event_command);
+        case command_type::RELEASE_KERNEL: return sizeof(release_kernel_command);
+        case command_type::RELEASE_MEMORY: return sizeof(release_memory_command);
+        case command_type::RELEASE_EVENT: return sizeof(release_event_command);
+        case command_type::PREPARE_LAUNCH: return sizeof(prepare_launch_command);
+        case command_type::LAUNCH: return sizeof(launch_command);
+        case command_type::RELEASE_LAUNCH: return sizeof(release_launch_command);
+        case command_type::WRITE_MEMORY_RANGE: return sizeof(write_memory_range_command);
+        case command_type::COPY_BUFFER: return sizeof(copy_buffer_command);
+        default: return 0;
+    }
+}
+
+static size_t batched_payload_size(const command_base *cmd) {
+    switch (cmd->type) {
+        case command_type::KERNEL_WRITE: return ((const kernel_write_command *) cmd)->sources_size;
+        case command_type::KERNEL_START: return ((const kernel_start_command *) cmd)->arguments_size;
+        case command_type::WRITE_MEMORY: return ((const write_memory_command *) cmd)->size;
+        case command_type::ASSIGN_KERNEL: return ((const assign_kernel_command *) cmd)->size;
+        case command_type::ASSIGN_BUFFER: return ((const assign_buffer_command *) cmd)->size;
+        case command_type::ASSIGN_EVENT: return ((const assign_event_command *) cmd)->size;
+        case command_type::PREPARE_LAUNCH: return ((const prepare_launch_command *) cmd)->arguments_size;
+        case command_type::WRITE_MEMORY_RANGE: return ((const write_memory_range_command *) cmd)->size;
+        default: return 0;
+    }
 }
 
+// Tagged connections precede each command with a request header, the rest of the handling is the same for every protocol
 Server::message_result_t HHALServer::handle_command(int id, Server::message_t msg, Server &server) {
+    connection_ptr &conn = get_connection(id);
+    Server::message_result_t res;
+    if (conn->protocol != protocol_version::TAGGED) {
+        conn->request_id = 0;
+        res = dispatch_command(id, msg, server);
+    } else {
+        if (msg.size < sizeof(request_header)) {
+            return {Server::MessageListenerExitCode::INSUFFICIENT_DATA, 0, 0};
+        }
+        conn->request_id = ((request_header *) msg.buf)->request_id;
+        res = dispatch_command(id, {(char *) msg.buf + sizeof(request_header), msg.size - sizeof(request_header)}, server);
+        if (res.exit_code == Server::MessageListenerExitCode::OK) {
+            res.bytes_consumed += sizeof(request_header);
+        }
+    }
+    if (res.exit_code == Server::MessageListenerExitCode::OK) {
+        metrics.command_received(static_cast<int>(conn->command));
+        record_trace(trace_record_type::COMMAND, id, msg.buf, res.bytes_consumed);
+    }
+    return res;
+}
+
+Server::message_result_t HHALServer::dispatch_command(int id, Server::message_t msg, Server &server) {
     logger.trace("Handling command");
     if (msg.size < sizeof(command_base)) {
         return {Server::MessageListenerExitCode::INSUFFICIENT_DATA, 0, 0}; // Need to read more data to determine a command
     }
     command_base *base = (command_base *) msg.buf;
+    get_connection(id)->command = base->type;
     switch (base->type) {
     case command_type::KERNEL_START:
         if (msg.size >= sizeof(kernel_start_command)) {
@@ -122,6 +232,71 @@ Server::message_result_t HHALServer::handle_command(int id, Server::message_t ms
             return handle_release_event(id, (release_event_command *)msg.buf, server);
         }
         break;
+    case command_type::REGISTER_SHARED_MEMORY:
+        if (msg.size >= sizeof(register_shared_memory_command)) {
+            return handle_register_shared_memory(id, (register_shared_memory_command *)msg.buf, server);
+        }
+        break;
+    case command_type::WRITE_MEMORY_SHARED:
+        if (msg.size >= sizeof(write_memory_shared_command)) {
+            return handle_write_to_memory_shared(id, (write_memory_shared_command *)msg.buf, server);
+        }
+        break;
+    case command_type::READ_MEMORY_SHARED:
+        if (msg.size >= sizeof(read_memory_shared_command)) {
+            return handle_read_from_memory_shared(id, (read_memory_shared_command *)msg.buf, server);
+        }
+        break;
+    case command_type::NEGOTIATE_PROTOCOL:
+        if (msg.size >= sizeof(negotiate_protocol_command)) {
+            return handle_negotiate_protocol(id, (negotiate_protocol_command *)msg.buf, server);
+        }
+        break;
+    case command_type::BATCH:
+        if (msg.size >= sizeof(batch_command)) {
+            return handle_batch(id, (batch_command *)msg.buf, server);
+        }
+        break;
+    case command_type::WAIT_REGISTER:
+        if (msg.size >= sizeof(wait_register_command)) {
+            return handle_wait_sync_register(id, (wait_register_command *)msg.buf, server);
+        }
+        break;
+    case command_type::STATS:
+        if (msg.size >= sizeof(stats_command)) {
+            return handle_stats(id, (stats_command *)msg.buf, server);
+        }
+        break;
+    case command_type::PREPARE_LAUNCH:
+        if (msg.size >= sizeof(prepare_launch_command)) {
+            return handle_prepare_launch(id, (prepare_launch_command *)msg.buf, server);
+        }
+        break;
+    case command_type::LAUNCH:
+        if (msg.size >= sizeof(launch_command)) {
+            return handle_launch(id, (launch_command *)msg.buf, server);
+        }
+        break;
+    case command_type::RELEASE_LAUNCH:
+        if (msg.size >= sizeof(release_launch_command)) {
+            return handle_release_launch(id, (release_launch_command *)msg.buf, server);
+        }
+        break;
+    case command_type::WRITE_MEMORY_RANGE:
+        if (msg.size >= sizeof(write_memory_range_command)) {
+            return handle_write_to_memory_range(id, (write_memory_range_command *)msg.buf, server);
+        }
+        break;
+    case command_type::READ_MEMORY_RANGE:
+        if (msg.size >= sizeof(read_memory_range_command)) {
+            return handle_read_from_memory_range(id, (read_memory_range_command *)msg.buf, server);
+        }
+        break;
+    case command_type::COPY_BUFFER:
+        if (msg.size >= sizeof(copy_buffer_command)) {
+            return handle_copy_buffer(id, (copy_buffer_command *)msg.buf, server);
+        }
+        break;
     default:
         logger.info("Received: unknown command");
         return {Server::MessageListenerExitCode::UNKNOWN_MESSAGE, 0, 0};
@@ -132,6 +307,12 @@ Server::message_result_t HHALServer::handle_command(int id, Server::message_t ms
 
 Server::DataListenerExitCode HHALServer::handle_data(int id, Server::packet_t packet, Server &server) {
     logger.trace("Received data, size: {}", packet.extra_data.size);
+    record_trace(trace_record_type::DATA, id, packet.extra_data.buf, packet.extra_data.size);
+    if (get_connection(id)->protocol == protocol_version::TAGGED) {
+        // The handlers own the command, drop the request header so it starts the buffer
+        packet.msg.size -= sizeof(request_header);
+        memmove(packet.msg.buf, (char *) packet.msg.buf + sizeof(request_header), packet.msg.size);
+    }
     command_base *base = (command_base *) packet.msg.buf;
     switch (base->type) {
         case command_type::KERNEL_START: {
@@ -140,9 +321,15 @@ Server::DataListenerExitCode HHALServer::handle_data(int id, Server::packet_t pa
         case command_type::KERNEL_WRITE: {
             return handle_kernel_write_data(id, (kernel_write_command *) base, packet.extra_data, server);
         }
+        case command_type::PREPARE_LAUNCH: {
+            return handle_prepare_launch_data(id, (prepare_launch_command *) base, packet.extra_data, server);
+        }
         case command_type::WRITE_MEMORY: {
             return handle_write_to_memory_data(id, (write_memory_command *) base, packet.extra_data, server); 
         }
+        case command_type::WRITE_MEMORY_RANGE: {
+            return handle_write_to_memory_range_data(id, (write_memory_range_command *) base, packet.extra_data, server);
+        }
         case command_type::ASSIGN_KERNEL: {
             return handle_assign_kernel_data(id, (assign_kernel_command *) base, packet.extra_data, server);
         }
@@ -152,6 +339,9 @@ Server::DataListenerExitCode HHALServer::handle_data(int id, Server::packet_t pa
         case command_type::ASSIGN_EVENT: {
             return handle_assign_event_data(id, (assign_event_command *) base, packet.extra_data, server);
         }
+        case command_type::BATCH: {
+            return handle_batch_data(id, (batch_command *) base, packet.extra_data, server);
+        }
         default: {
             logger.info("Data from unsupported command: {}", (char *)packet.extra_data.buf);
             free(packet.msg.buf);
@@ -161,342 +351,947 @@ Server::DataListenerExitCode HHALServer::handle_data(int id, Server::packet_t pa
     }
 }
 
-Server::DataListenerExitCode HHALServer::handle_kernel_start_data(int id, kernel_start_command *cmd, Server::message_t data, Server &server) {
-    auxiliary_allocations aux;
-    hhal::Arguments args = deserialize_arguments({data.buf, data.size}, aux);
-    logger.info("Starting kernel {}", cmd->kernel_id);
-    auto ec = hhal.kernel_start(cmd->kernel_id, args);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
+Server::DataListenerExitCode HHALServer::handle_stream(int id, Server::chunk_t chunk, Server &server) {
+    logger.trace("Received chunk, offset: {}, size: {}", chunk.offset, chunk.data.size);
+    record_trace(trace_record_type::DATA, id, chunk.data.buf, chunk.data.size);
+    command_base *base = (command_base *) chunk.msg.buf;
+    if (get_connection(id)->protocol == protocol_version::TAGGED) {
+        base = (command_base *) ((char *) chunk.msg.buf + sizeof(request_header));
     }
+    switch (base->type) {
+        case command_type::WRITE_MEMORY: {
+            auto cmd = (const write_memory_command *) base;
+            return handle_write_to_memory_chunk(id, cmd->buffer_id, 0, cmd->size, chunk, server);
+        }
+        case command_type::WRITE_MEMORY_RANGE: {
+            auto cmd = (const write_memory_range_command *) base;
+            return handle_write_to_memory_chunk(id, cmd->buffer_id, cmd->offset, cmd->size, chunk, server);
+        }
+        default: {
+            logger.info("Streamed data from unsupported command");
+            free(chunk.data.buf);
+            return Server::DataListenerExitCode::OPERATION_ERROR;
+        }
+    }
+}
+
+// Deserialization takes ownership of the data buffer
+Server::DataListenerExitCode HHALServer::handle_kernel_start_data(int id, kernel_start_command *cmd, Server::message_t data, Server &server) {
+    int kernel_id = cmd->kernel_id;
     free(cmd);
+    execute(id, [this, kernel_id, data](const request_t &req) {
+        auxiliary_allocations aux;
+        hhal::Arguments args = deserialize_arguments({data.buf, data.size}, aux);
+        logger.info("Starting kernel {}", kernel_id);
+        respond(req, result_message(hhal.kernel_start(kernel_id, args)));
+    });
     return Server::DataListenerExitCode::OK;
 }  
 
 Server::DataListenerExitCode HHALServer::handle_kernel_write_data(int id, kernel_write_command *cmd, Server::message_t data, Server &server) {
-    std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_images = 
-        deserialize_kernel_sources({data.buf, data.size});
-    auto ec = hhal.kernel_write(cmd->kernel_id, kernel_images);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int kernel_id = cmd->kernel_id;
     free(cmd);
+    execute(id, [this, kernel_id, data](const request_t &req) {
+        std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_images = 
+            deserialize_kernel_sources({data.buf, data.size});
+        respond(req, result_message(hhal.kernel_write(kernel_id, kernel_images)));
+    });
+    return Server::DataListenerExitCode::OK;
+}
+
+Server::DataListenerExitCode HHALServer::handle_prepare_launch_data(int id, prepare_launch_command *cmd, Server::message_t data, Server &server) {
+    int launch_id = cmd->launch_id;
+    int kernel_id = cmd->kernel_id;
+    free(cmd);
+    execute(id, [this, launch_id, kernel_id, data](const request_t &req) {
+        if (!id_in_range("Launch", launch_id)) {
+            free(data.buf);
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+        auxiliary_allocations aux;
+        hhal::Arguments args = deserialize_arguments({data.buf, data.size}, aux);
+        logger.info("Preparing launch {} of kernel {}", launch_id, kernel_id);
+        respond(req, result_message(hhal.prepare_launch(launch_id, kernel_id, args)));
+    });
     return Server::DataListenerExitCode::OK;
 }
 
 Server::DataListenerExitCode HHALServer::handle_write_to_memory_data(int id, write_memory_command *cmd, Server::message_t data, Server &server) {
+    int buffer_id = cmd->buffer_id;
+    free(cmd);
+    write_to_memory_data(id, buffer_id, 0, data);
+    return Server::DataListenerExitCode::OK;
+}
+
+Server::DataListenerExitCode HHALServer::handle_write_to_memory_range_data(int id, write_memory_range_command *cmd, Server::message_t data, Server &server) {
+    int buffer_id = cmd->buffer_id;
+    size_t offset = cmd->offset;
+    free(cmd);
+    write_to_memory_data(id, buffer_id, offset, data);
+    return Server::DataListenerExitCode::OK;
+}
+
+void HHALServer::write_to_memory_data(int id, int buffer_id, size_t offset, Server::message_t data) {
+    execute(id, [this, buffer_id, offset, data](const request_t &req) {
 #ifdef PROFILING_MODE
-    auto ref = profiling::Profiler::get_instance().start_buffer_write(cmd->buffer_id, data.size);
+        auto ref = profiling::Profiler::get_instance().start_buffer_write(buffer_id, data.size);
 #endif
-    auto ec = hhal.write_to_memory(cmd->buffer_id, data.buf, data.size);
+        auto ec = hhal.write_to_memory(buffer_id, data.buf, data.size, offset);
 #ifdef PROFILING_MODE
-    ref->finish();
+        ref->finish();
 #endif
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
-    free(cmd);
-    free(data.buf);
-    return Server::DataListenerExitCode::OK;
+        free(data.buf);
+        respond(req, result_message(ec));
+    });
 }
 
-Server::DataListenerExitCode HHALServer::handle_assign_kernel_data(int id, assign_kernel_command *cmd, Server::message_t data, Server &server) {
-    switch (cmd->unit) {
-        case hhal::Unit::GN: {
-            auto ec = hhal.assign_kernel(cmd->unit, (hhal::hhal_kernel *) data.buf);
-            if (ec != hhal::HHALExitCode::OK) {
-                server.send_on_socket(id, error_message(ec));
-            } else {
-                server.send_on_socket(id, ack_message());
+// Chunks are written in order by the executor, the response is sent once the last one is
+Server::DataListenerExitCode HHALServer::handle_write_to_memory_chunk(int id, int buffer_id, size_t offset, size_t total_size, Server::chunk_t chunk, Server &server) {
+    connection_ptr &conn = get_connection(id);
+    conn->stream_in_flight += chunk.data.size;
+    if (conn->stream_in_flight >= stream_window && !conn->receiving_paused) {
+        logger.trace("Pausing socket {}, {} streamed bytes in flight", id, conn->stream_in_flight);
+        conn->receiving_paused = true;
+        server.pause_receiving(id);
+    }
+
+    execute(id, [this, buffer_id, offset, total_size, chunk](const request_t &req) {
+        stream_write_t &stream = req.conn->stream;
+        if (chunk.offset == 0) {
+            stream.ec = hhal::HHALExitCode::OK;
+            if (!hhal.supports_offset_writes(buffer_id)) {
+                stream.staging = malloc(total_size);
+                if (stream.staging == nullptr) stream.ec = hhal::HHALExitCode::ERROR;
             }
-            free(cmd);
-            free(data.buf);
-            return Server::DataListenerExitCode::OK;
         }
-        case hhal::Unit::NVIDIA: {
-            // Already a POD
-            auto ec = hhal.assign_kernel(cmd->unit, (hhal::hhal_kernel *) data.buf);
-            if (ec != hhal::HHALExitCode::OK) {
-                server.send_on_socket(id, error_message(ec));
+        if (stream.ec == hhal::HHALExitCode::OK) {
+            if (stream.staging != nullptr) {
+                memcpy((char *) stream.staging + chunk.offset, chunk.data.buf, chunk.data.size);
             } else {
-                server.send_on_socket(id, ack_message());
+#ifdef PROFILING_MODE
+                auto ref = profiling::Profiler::get_instance().start_buffer_write(buffer_id, chunk.data.size);
+#endif
+                stream.ec = hhal.write_to_memory(buffer_id, chunk.data.buf, chunk.data.size, offset + chunk.offset);
+#ifdef PROFILING_MODE
+                ref->finish();
+#endif
             }
-            free(cmd);
-            free(data.buf);
-            return Server::DataListenerExitCode::OK;
         }
+        free(chunk.data.buf);
+        stream_chunk_done(req.conn, chunk.data.size);
+        if (!chunk.last) return;
+
+        if (stream.staging != nullptr) {
+            if (stream.ec == hhal::HHALExitCode::OK) {
+#ifdef PROFILING_MODE
+                auto ref = profiling::Profiler::get_instance().start_buffer_write(buffer_id, total_size);
+#endif
+                stream.ec = hhal.write_to_memory(buffer_id, stream.staging, total_size, offset);
+#ifdef PROFILING_MODE
+                ref->finish();
+#endif
+            }
+            free(stream.staging);
+            stream.staging = nullptr;
+        }
+        respond(req, result_message(stream.ec));
+    });
+    return Server::DataListenerExitCode::OK;
+}
+
+void HHALServer::stream_chunk_done(const connection_ptr &conn, size_t size) {
+    server.post([this, conn, size] {
+        conn->stream_in_flight -= size;
+        if (conn->receiving_paused && conn->stream_in_flight < stream_window) {
+            conn->receiving_paused = false;
+            // The socket id may already belong to another connection
+            if (!conn->closed) server.resume_receiving(conn->id);
+        }
+    });
+}
+
+Server::DataListenerExitCode HHALServer::handle_assign_kernel_data(int id, assign_kernel_command *cmd, Server::message_t data, Server &server) {
+    hhal::Unit unit = cmd->unit;
+    free(cmd);
+    switch (unit) {
+        case hhal::Unit::GN:
+        case hhal::Unit::NVIDIA:
+            execute(id, [this, unit, data](const request_t &req) {
+                // Already a POD
+                if (!id_in_range("Kernel", ((hhal::hhal_kernel *) data.buf)->id)) {
+                    free(data.buf);
+                    respond(req, error_message(hhal::HHALExitCode::ERROR));
+                    return;
+                }
+                auto ec = hhal.assign_kernel(unit, (hhal::hhal_kernel *) data.buf);
+                free(data.buf);
+                respond(req, result_message(ec));
+            });
+            return Server::DataListenerExitCode::OK;
         default:
-            logger.error("Received assign kernel command with unknown unit {}", cmd->unit);
-            free(cmd);
+            logger.error("Received assign kernel command with unknown unit {}", static_cast<int>(unit));
             free(data.buf);
             return Server::DataListenerExitCode::OPERATION_ERROR;
     }
 }
 
 Server::DataListenerExitCode HHALServer::handle_assign_buffer_data(int id, assign_buffer_command *cmd, Server::message_t data, Server &server) {
-    switch (cmd->unit) {
+    hhal::Unit unit = cmd->unit;
+    free(cmd);
+    switch (unit) {
         case hhal::Unit::GN: {
-            hhal::gn_buffer b = deserialize_gn_buffer({data.buf, data.size});
-            logger.debug("Received buffer data id: {}", b.id);
-            auto ec = hhal.assign_buffer(cmd->unit, (hhal::hhal_buffer *) &b);
-            if (ec != hhal::HHALExitCode::OK) {
-                server.send_on_socket(id, error_message(ec));
-            } else {
-                server.send_on_socket(id, ack_message());
-            }
-            free(cmd);
+            execute(id, [this, unit, data](const request_t &req) {
+                hhal::gn_buffer b = deserialize_gn_buffer({data.buf, data.size});
+                logger.debug("Received buffer data id: {}", b.id);
+                if (!id_in_range("Buffer", b.id)) {
+                    respond(req, error_message(hhal::HHALExitCode::ERROR));
+                    return;
+                }
+                respond(req, result_message(hhal.assign_buffer(unit, (hhal::hhal_buffer *) &b)));
+            });
             return Server::DataListenerExitCode::OK;
         }
         case hhal::Unit::NVIDIA: {
-            hhal::nvidia_buffer b = deserialize_nvidia_buffer({data.buf, data.size});
-            auto ec = hhal.assign_buffer(cmd->unit, (hhal::hhal_buffer *) &b);
-            if (ec != hhal::HHALExitCode::OK) {
-                server.send_on_socket(id, error_message(ec));
-            } else {
-                server.send_on_socket(id, ack_message());
-            }
-            free(cmd);
+            execute(id, [this, unit, data](const request_t &req) {
+                hhal::nvidia_buffer b = deserialize_nvidia_buffer({data.buf, data.size});
+                if (!id_in_range("Buffer", b.id)) {
+                    respond(req, error_message(hhal::HHALExitCode::ERROR));
+                    return;
+                }
+                respond(req, result_message(hhal.assign_buffer(unit, (hhal::hhal_buffer *) &b)));
+            });
             return Server::DataListenerExitCode::OK;
         }
         default:
-            logger.error("Received assign buffer command with unknown unit {}", cmd->unit);
-            free(cmd);
+            logger.error("Received assign buffer command with unknown unit {}", static_cast<int>(unit));
             free(data.buf);
             return Server::DataListenerExitCode::OPERATION_ERROR;
     }
 }
 
 Server::DataListenerExitCode HHALServer::handle_assign_event_data(int id, assign_event_command *cmd, Server::message_t data, Server &server) {
-    switch (cmd->unit) {
+    hhal::Unit unit = cmd->unit;
+    free(cmd);
+    switch (unit) {
         case hhal::Unit::GN: {
-            hhal::gn_event e = deserialize_gn_event({data.buf, data.size});
-            logger.debug("Received event data id: {}", e.id);
-            auto ec = hhal.assign_event(cmd->unit, (hhal::hhal_event *) &e);
-            if (ec != hhal::HHALExitCode::OK) {
-                server.send_on_socket(id, error_message(ec));
-            } else {
-                server.send_on_socket(id, ack_message());
-            }
-            free(cmd);
+            execute(id, [this, unit, data](const request_t &req) {
+                hhal::gn_event e = deserialize_gn_event({data.buf, data.size});
+                logger.debug("Received event data id: {}", e.id);
+                if (!id_in_range("Event", e.id)) {
+                    respond(req, error_message(hhal::HHALExitCode::ERROR));
+                    return;
+                }
+                respond(req, result_message(hhal.assign_event(unit, (hhal::hhal_event *) &e)));
+            });
             return Server::DataListenerExitCode::OK;
         }
         case hhal::Unit::NVIDIA: {
-            // Already a POD
-            auto ec = hhal.assign_event(cmd->unit, (hhal::hhal_event *) data.buf);
-            if (ec != hhal::HHALExitCode::OK) {
-                server.send_on_socket(id, error_message(ec));
-            } else {
-                server.send_on_socket(id, ack_message());
-            }
-            free(cmd);
-            free(data.buf);
+            execute(id, [this, unit, data](const request_t &req) {
+                // Already a POD
+                if (!id_in_range("Event", ((hhal::hhal_event *) data.buf)->id)) {
+                    free(data.buf);
+                    respond(req, error_message(hhal::HHALExitCode::ERROR));
+                    return;
+                }
+                auto ec = hhal.assign_event(unit, (hhal::hhal_event *) data.buf);
+                free(data.buf);
+                respond(req, result_message(ec));
+            });
             return Server::DataListenerExitCode::OK;
         }
         default:
-            logger.error("Received assign event command with unknown unit {}", cmd->unit);
-            free(cmd);
+            logger.error("Received assign event command with unknown unit {}", static_cast<int>(unit));
             free(data.buf);
             return Server::DataListenerExitCode::OPERATION_ERROR;
     }
 }
 
+Server::DataListenerExitCode HHALServer::handle_batch_data(int id, batch_command *cmd, Server::message_t data, Server &server) {
+    uint32_t count = cmd->count;
+    free(cmd);
+    execute(id, [this, count, data](const request_t &req) {
+        std::vector<hhal::HHALExitCode> results;
+        results.reserve(count);
+        char *curr = (char *) data.buf;
+        char *end = curr + data.size;
+        while (results.size() < count) {
+            size_t remaining = end - curr;
+            if (remaining < sizeof(command_base)) break;
+            const command_base *batched = (const command_base *) curr;
+            size_t cmd_size = batched_command_size(batched->type);
+            if (cmd_size == 0 || batch_padded_size(cmd_size) > remaining) break;
+            curr += batch_padded_size(cmd_size);
+            remaining -= batch_padded_size(cmd_size);
+            size_t payload_size = batched_payload_size(batched);
+            if (payload_size > remaining || batch_padded_size(payload_size) > remaining) break;
+            int type = static_cast<int>(batched->type);
+            metrics.command_received(type);
+            auto started = Metrics::clock::now();
+            results.push_back(execute_batched_command(req.conn, batched, curr, payload_size));
+            metrics.task_executed(type, Metrics::clock::now() - started);
+            if (results.back() != hhal::HHALExitCode::OK) metrics.command_failed(type);
+            curr += batch_padded_size(payload_size);
+        }
+        if (results.size() < count) {
+            logger.error("Batch on socket {}: malformed command {} of {}, skipping the rest", req.conn->id, results.size(), count);
+            results.resize(count, hhal::HHALExitCode::ERROR);
+        }
+        free(data.buf);
+        respond(req, batch_result_message(results));
+    });
+    return Server::DataListenerExitCode::OK;
+}
+
 // Kernel Execution
 Server::message_result_t HHALServer::handle_kernel_start(int id, const kernel_start_command *cmd, Server &server) {
     logger.trace("Received: kernel start command");
-    server.send_on_socket(id, ack_message());
+    acknowledge_command(id, server);
     return {Server::MessageListenerExitCode::OK, sizeof(kernel_start_command), cmd->arguments_size};
 }
 
 Server::message_result_t HHALServer::handle_kernel_write(int id, const kernel_write_command *cmd, Server &server) {
     logger.trace("Received: kernel write command");
-    server.send_on_socket(id, ack_message());
+    acknowledge_command(id, server);
     return {Server::MessageListenerExitCode::OK, sizeof(kernel_write_command), cmd->sources_size};
 }
 
+Server::message_result_t HHALServer::handle_prepare_launch(int id, const prepare_launch_command *cmd, Server &server) {
+    logger.trace("Received: prepare launch command");
+    acknowledge_command(id, server);
+    return {Server::MessageListenerExitCode::OK, sizeof(prepare_launch_command), cmd->arguments_size};
+}
+
+Server::message_result_t HHALServer::handle_launch(int id, const launch_command *cmd, Server &server) {
+    logger.trace("Received: launch command");
+    int launch_id = cmd->launch_id;
+    execute(id, [this, launch_id](const request_t &req) {
+        respond(req, result_message(hhal.launch(launch_id)));
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(launch_command), 0};
+}
+
+Server::message_result_t HHALServer::handle_release_launch(int id, const release_launch_command *cmd, Server &server) {
+    logger.trace("Received: release launch command");
+    int launch_id = cmd->launch_id;
+    execute(id, [this, launch_id](const request_t &req) {
+        respond(req, result_message(hhal.release_launch(launch_id)));
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(release_launch_command), 0};
+}
+
 Server::message_result_t HHALServer::handle_write_to_memory(int id, const write_memory_command *cmd, Server &server) {
     logger.trace("Received: write to memory command");
-    server.send_on_socket(id, ack_message());
-    return {Server::MessageListenerExitCode::OK, sizeof(write_memory_command), cmd->size};
+    acknowledge_command(id, server);
+    // Large writes are streamed, so the daemon never holds a whole transfer and copying overlaps with receiving
+    bool stream = cmd->size > Server::STREAM_CHUNK_SIZE;
+    return {Server::MessageListenerExitCode::OK, sizeof(write_memory_command), cmd->size, stream};
 }
 
 Server::message_result_t HHALServer::handle_read_from_memory(int id, const read_memory_command *cmd, Server &server) {
     logger.trace("Received: read from memory command");
-    void *buf = malloc(cmd->size);
+    read_from_memory(id, cmd->buffer_id, 0, cmd->size);
+    return {Server::MessageListenerExitCode::OK, sizeof(read_memory_command), 0};
+}
+
+Server::message_result_t HHALServer::handle_write_to_memory_range(int id, const write_memory_range_command *cmd, Server &server) {
+    logger.trace("Received: write to memory range command");
+    acknowledge_command(id, server);
+    bool stream = cmd->size > Server::STREAM_CHUNK_SIZE;
+    return {Server::MessageListenerExitCode::OK, sizeof(write_memory_range_command), cmd->size, stream};
+}
+
+Server::message_result_t HHALServer::handle_read_from_memory_range(int id, const read_memory_range_command *cmd, Server &server) {
+    logger.trace("Received: read from memory range command");
+    read_from_memory(id, cmd->buffer_id, cmd->offset, cmd->size);
+    return {Server::MessageListenerExitCode::OK, sizeof(read_memory_range_command), 0};
+}
+
+Server::message_result_t HHALServer::handle_copy_buffer(int id, const copy_buffer_command *cmd, Server &server) {
+    logger.trace("Received: copy buffer command");
+    copy_buffer_command c = *cmd;
+    execute(id, [this, c](const request_t &req) {
+        respond(req, result_message(hhal.copy_buffer(c.src_id, c.dst_id, c.src_offset, c.dst_offset, c.size)));
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(copy_buffer_command), 0};
+}
+
+void HHALServer::read_from_memory(int id, int buffer_id, size_t offset, size_t size) {
+    execute(id, [this, buffer_id, offset, size](const request_t &req) {
+        // The data follows the acknowledgement in the same response
+        response_base *res = (response_base *) malloc(sizeof(response_base) + size);
 #ifdef PROFILING_MODE
-    auto ref = profiling::Profiler::get_instance().start_buffer_read(cmd->buffer_id, cmd->size);
+        auto ref = profiling::Profiler::get_instance().start_buffer_read(buffer_id, size);
 #endif
-    auto ec = hhal.read_from_memory(cmd->buffer_id, buf, cmd->size);
+        auto ec = hhal.read_from_memory(buffer_id, res + 1, size, offset);
 #ifdef PROFILING_MODE
-    ref->finish();
+        ref->finish();
 #endif
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-        server.send_on_socket(id, {buf, cmd->size});
-    }
-    return {Server::MessageListenerExitCode::OK, sizeof(read_memory_command), 0};
+        if (ec != hhal::HHALExitCode::OK) {
+            free(res);
+            respond(req, error_message(ec));
+        } else {
+            init_ack_response(*res);
+            respond(req, {res, sizeof(response_base) + size});
+        }
+    }, sizeof(response_base) + size);
 }
 
 Server::message_result_t HHALServer::handle_write_sync_register(int id, const write_register_command *cmd, Server &server) {
     logger.trace("Received: write sync register command");
-    auto ec = hhal.write_sync_register(cmd->event_id, cmd->data);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int event_id = cmd->event_id;
+    uint32_t data = cmd->data;
+    execute(id, [this, event_id, data](const request_t &req) {
+        respond(req, result_message(hhal.write_sync_register(event_id, data)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(write_register_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_read_sync_register(int id, const read_register_command *cmd, Server &server) {
     logger.trace("Received: read sync register command");
-    uint32_t val;
-    auto ec = hhal.read_sync_register(cmd->event_id, &val);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        logger.trace("Read register, got value {}", val);
-        register_data_response *res = (register_data_response *) malloc(sizeof(register_data_response));
-        init_register_data_response(*res, val);
-        server.send_on_socket(id, {res, sizeof(register_data_response)});
-    }
+    int event_id = cmd->event_id;
+    execute(id, [this, event_id](const request_t &req) {
+        uint32_t val;
+        auto ec = hhal.read_sync_register(event_id, &val);
+        if (ec != hhal::HHALExitCode::OK) {
+            respond(req, error_message(ec));
+        } else {
+            logger.trace("Read register, got value {}", val);
+            respond(req, register_data_message(val));
+        }
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(read_register_command), 0};
 }
 
+// The register is checked on the executor, if it does not match yet the wait is parked without holding a worker
+Server::message_result_t HHALServer::handle_wait_sync_register(int id, const wait_register_command *cmd, Server &server) {
+    logger.trace("Received: wait sync register command");
+    wait_register_command c = *cmd;
+    execute(id, [this, c](const request_t &req) {
+        waiter.wait(c.event_id, c.value, c.timeout_ms, req.conn.get(), [this, req](hhal::HHALExitCode ec) {
+            respond(req, result_message(ec));
+        });
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(wait_register_command), 0};
+}
+
 // Resource management
 Server::message_result_t HHALServer::handle_assign_kernel(int id, const assign_kernel_command *cmd, Server &server) {
     logger.trace("Received: assign kernel command");
-    server.send_on_socket(id, ack_message());
+    acknowledge_command(id, server);
     return {Server::MessageListenerExitCode::OK, sizeof(assign_kernel_command), cmd->size};
 }
 
 Server::message_result_t HHALServer::handle_assign_buffer(int id, const assign_buffer_command *cmd, Server &server) {
     logger.trace("Received: assign buffer command");
-    server.send_on_socket(id, ack_message());
+    acknowledge_command(id, server);
     return {Server::MessageListenerExitCode::OK, sizeof(assign_buffer_command), cmd->size};
 }
 
 Server::message_result_t HHALServer::handle_assign_event(int id, const assign_event_command *cmd, Server &server) {
     logger.trace("Received: assign event command");
-    server.send_on_socket(id, ack_message());
+    acknowledge_command(id, server);
     return {Server::MessageListenerExitCode::OK, sizeof(assign_event_command), cmd->size};
 }
 
 Server::message_result_t HHALServer::handle_deassign_kernel(int id, const deassign_kernel_command *cmd, Server &server) {
     logger.trace("Received: Deassign kernel command");
-    auto ec = hhal.deassign_kernel(cmd->kernel_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int kernel_id = cmd->kernel_id;
+    execute(id, [this, kernel_id](const request_t &req) {
+        respond(req, result_message(hhal.deassign_kernel(kernel_id)));
 #ifdef PROFILING_MODE
-    dump_thread.push_task([]{profiling::Profiler::get_instance().dump();});
+        dump_thread.push_task([]{profiling::Profiler::get_instance().dump();});
 #endif 
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(deassign_kernel_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_deassign_buffer(int id, const deassign_buffer_command *cmd, Server &server) {
     logger.trace("Received: Deassign buffer command");
-    auto ec = hhal.deassign_buffer(cmd->buffer_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int buffer_id = cmd->buffer_id;
+    execute(id, [this, buffer_id](const request_t &req) {
+        respond(req, result_message(hhal.deassign_buffer(buffer_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(deassign_buffer_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_deassign_event(int id, const deassign_event_command *cmd, Server &server) {
     logger.trace("Received: Deassign kernel command");
-    auto ec = hhal.deassign_event(cmd->event_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int event_id = cmd->event_id;
+    execute(id, [this, event_id](const request_t &req) {
+        respond(req, result_message(hhal.deassign_event(event_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(deassign_event_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_allocate_kernel(int id, const allocate_kernel_command *cmd, Server &server) {
     logger.trace("Received: allocate kernel command");
-    auto ec = hhal.allocate_kernel(cmd->kernel_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int kernel_id = cmd->kernel_id;
+    execute(id, [this, kernel_id](const request_t &req) {
+        respond(req, result_message(hhal.allocate_kernel(kernel_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(allocate_kernel_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_allocate_memory(int id, const allocate_memory_command *cmd, Server &server) {
     logger.trace("Received: allocate buffer command");
-    auto ec = hhal.allocate_memory(cmd->buffer_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int buffer_id = cmd->buffer_id;
+    execute(id, [this, buffer_id](const request_t &req) {
+        respond(req, result_message(hhal.allocate_memory(buffer_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(allocate_memory_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_allocate_event(int id, const allocate_event_command *cmd, Server &server) {
     logger.trace("Received: allocate event command");
-    auto ec = hhal.allocate_event(cmd->event_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int event_id = cmd->event_id;
+    execute(id, [this, event_id](const request_t &req) {
+        respond(req, result_message(hhal.allocate_event(event_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(allocate_event_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_release_kernel(int id, const release_kernel_command *cmd, Server &server) {
     logger.trace("Received: release kernel command");
-    auto ec = hhal.release_kernel(cmd->kernel_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int kernel_id = cmd->kernel_id;
+    execute(id, [this, kernel_id](const request_t &req) {
+        respond(req, result_message(hhal.release_kernel(kernel_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(release_kernel_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_release_memory(int id, const release_memory_command *cmd, Server &server) {
     logger.trace("Received: release memory command");
-    auto ec = hhal.release_memory(cmd->buffer_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int buffer_id = cmd->buffer_id;
+    execute(id, [this, buffer_id](const request_t &req) {
+        respond(req, result_message(hhal.release_memory(buffer_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(release_memory_command), 0};
 }
 
 Server::message_result_t HHALServer::handle_release_event(int id, const release_event_command *cmd, Server &server) {
     logger.trace("Received: release event command");
-    auto ec = hhal.release_event(cmd->event_id);
-    if (ec != hhal::HHALExitCode::OK) {
-        server.send_on_socket(id, error_message(ec));
-    } else {
-        server.send_on_socket(id, ack_message());
-    }
+    int event_id = cmd->event_id;
+    execute(id, [this, event_id](const request_t &req) {
+        respond(req, result_message(hhal.release_event(event_id)));
+    });
     return {Server::MessageListenerExitCode::OK, sizeof(release_event_command), 0};   
 }
 
-HHALServer::HHALServer(std::string socket_path): server(
-    socket_path, 10,
+// Shared memory data plane
+Server::message_result_t HHALServer::handle_register_shared_memory(int id, const register_shared_memory_command *cmd, Server &server) {
+    logger.trace("Received: register shared memory command");
+    // The descriptor has to be claimed while handling its message, later ones may arrive meanwhile
+    int fd = server.take_received_fd(id);
+    size_t size = cmd->size;
+    execute(id, [this, fd, size](const request_t &req) {
+        if (fd < 0) {
+            logger.error("Register shared memory: no file descriptor received on socket {}", req.conn->id);
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+
+        // A file shrunk after it is mapped would fault the copies from the region and take the daemon down
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+            logger.error("Register shared memory: the received file is not sealed against shrinking");
+            close(fd);
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+
+        struct stat fd_stat;
+        if (fstat(fd, &fd_stat) < 0 || (size_t) fd_stat.st_size < size || size == 0) {
+            logger.error("Register shared memory: region of {} bytes does not fit the received file", size);
+            close(fd);
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        // The mapping keeps the memory alive, the descriptor is no longer needed
+        close(fd);
+        if (addr == MAP_FAILED) {
+            logger.error("Register shared memory (mmap): {}", strerror(errno));
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+
+        if (req.conn->shared_memory.addr != nullptr) {
+            munmap(req.conn->shared_memory.addr, req.conn->shared_memory.size);
+        }
+        req.conn->shared_memory = {addr, size};
+        logger.debug("Registered {} bytes of shared memory for socket {}", size, req.conn->id);
+        respond(req, ack_message());
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(register_shared_memory_command), 0};
+}
+
+Server::message_result_t HHALServer::handle_write_to_memory_shared(int id, const write_memory_shared_command *cmd, Server &server) {
+    logger.trace("Received: write to memory from shared memory command");
+    write_memory_shared_command c = *cmd;
+    execute(id, [this, c](const request_t &req) {
+        const shared_memory_region &region = req.conn->shared_memory;
+        if (region.addr == nullptr || c.offset > region.size || c.size > region.size - c.offset) {
+            logger.error("Write to memory: range [{}, +{}) outside of the shared memory of socket {}", c.offset, c.size, req.conn->id);
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+        char *source = (char *) region.addr + c.offset;
+#ifdef PROFILING_MODE
+        auto ref = profiling::Profiler::get_instance().start_buffer_write(c.buffer_id, c.size);
+#endif
+        auto ec = hhal.write_to_memory(c.buffer_id, source, c.size);
+#ifdef PROFILING_MODE
+        ref->finish();
+#endif
+        respond(req, result_message(ec));
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(write_memory_shared_command), 0};
+}
+
+Server::message_result_t HHALServer::handle_read_from_memory_shared(int id, const read_memory_shared_command *cmd, Server &server) {
+    logger.trace("Received: read from memory into shared memory command");
+    read_memory_shared_command c = *cmd;
+    execute(id, [this, c](const request_t &req) {
+        const shared_memory_region &region = req.conn->shared_memory;
+        if (region.addr == nullptr || c.offset > region.size || c.size > region.size - c.offset) {
+            logger.error("Read from memory: range [{}, +{}) outside of the shared memory of socket {}", c.offset, c.size, req.conn->id);
+            respond(req, error_message(hhal::HHALExitCode::ERROR));
+            return;
+        }
+        char *dest = (char *) region.addr + c.offset;
+#ifdef PROFILING_MODE
+        auto ref = profiling::Profiler::get_instance().start_buffer_read(c.buffer_id, c.size);
+#endif
+        auto ec = hhal.read_from_memory(c.buffer_id, dest, c.size);
+#ifdef PROFILING_MODE
+        ref->finish();
+#endif
+        respond(req, result_message(ec));
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(read_memory_shared_command), 0};
+}
+
+// Connection setup
+Server::message_result_t HHALServer::handle_negotiate_protocol(int id, const negotiate_protocol_command *cmd, Server &server) {
+    logger.trace("Received: negotiate protocol command");
+    protocol_version version = std::min(cmd->version, LATEST_PROTOCOL_VERSION);
+    logger.debug("Using protocol version {} on socket {}", static_cast<uint32_t>(version), id);
+
+    // Answered with the protocol in use until now, the new one applies from the next command
+    execute(id, [this, version](const request_t &req) {
+        respond(req, protocol_message(version));
+    });
+    get_connection(id)->protocol = version;
+    return {Server::MessageListenerExitCode::OK, sizeof(negotiate_protocol_command), 0};
+}
+
+// Legacy clients wait for the command to be acknowledged before sending its payload.
+// Goes through the executor as well, so it is not sent ahead of responses to earlier commands.
+void HHALServer::acknowledge_command(int id, Server &server) {
+    if (get_connection(id)->protocol == protocol_version::LEGACY) {
+        execute(id, [this](const request_t &req) { respond(req, ack_message()); });
+    }
+}
+
+// Batching
+Server::message_result_t HHALServer::handle_batch(int id, const batch_command *cmd, Server &server) {
+    logger.trace("Received: batch command with {} commands", cmd->count);
+    acknowledge_command(id, server);
+    if (cmd->size == 0) {
+        // No data will follow, a non empty batch without commands is malformed
+        uint32_t count = cmd->count;
+        execute(id, [this, count](const request_t &req) {
+            respond(req, batch_result_message(std::vector<hhal::HHALExitCode>(count, hhal::HHALExitCode::ERROR)));
+        });
+    }
+    return {Server::MessageListenerExitCode::OK, sizeof(batch_command), cmd->size};
+}
+
+Server::message_t HHALServer::batch_result_message(const std::vector<hhal::HHALExitCode> &results) {
+    size_t results_size = results.size() * sizeof(hhal::HHALExitCode);
+    batch_response *res = (batch_response *) malloc(sizeof(batch_response) + results_size);
+    init_batch_response(*res, results.size());
+    memcpy(res + 1, results.data(), results_size);
+    return {res, sizeof(batch_response) + results_size};
+}
+
+// Metrics
+Server::message_result_t HHALServer::handle_stats(int id, const stats_command *cmd, Server &server) {
+    logger.trace("Received: stats command");
+    execute(id, [this](const request_t &req) {
+        // Built on the server loop, which owns the connection state it reports
+        this->server.post([this, req] {
+            std::string stats = stats_json();
+            stats_response *res = (stats_response *) malloc(sizeof(stats_response) + stats.size());
+            init_stats_response(*res, stats.size());
+            memcpy(res + 1, stats.data(), stats.size());
+            send_response(req, {res, sizeof(stats_response) + stats.size()});
+        });
+    });
+    return {Server::MessageListenerExitCode::OK, sizeof(stats_command), 0};
+}
+
+std::string HHALServer::stats_json() {
+    Server::stats_t stats = server.get_stats();
+    std::string out = "{\"bytes_received\":" + std::to_string(stats.bytes_received);
+    out += ",\"bytes_sent\":" + std::to_string(stats.bytes_sent);
+    out += ",\"connections_accepted\":" + std::to_string(stats.connections_accepted);
+    out += ",\"active_connections\":" + std::to_string(stats.sockets.size());
+    out += ",\"output_stalls\":" + std::to_string(stats.stalls);
+    out += ",\"pending_output\":" + std::to_string(stats.pending_output);
+    out += ",\"connections\":[";
+    for (size_t i = 0; i < stats.sockets.size(); i++) {
+        const Server::socket_stats_t &s = stats.sockets[i];
+        if (i > 0) out += ",";
+        out += "{\"id\":" + std::to_string(s.id);
+        out += ",\"bytes_received\":" + std::to_string(s.bytes_received);
+        out += ",\"bytes_sent\":" + std::to_string(s.bytes_sent);
+        out += ",\"queued_messages\":" + std::to_string(s.queued_messages);
+        out += ",\"queued_bytes\":" + std::to_string(s.queued_bytes);
+        out += ",\"reserved_bytes\":" + std::to_string(s.reserved_bytes);
+        out += ",\"output_stalls\":" + std::to_string(s.stalls);
+        out += ",\"stalled\":" + std::string(s.stalled ? "true" : "false") + "}";
+    }
+    out += "],\"commands\":";
+    metrics.to_json(out);
+    out += "}";
+    return out;
+}
+
+hhal::HHALExitCode HHALServer::execute_batched_command(const connection_ptr &conn, const command_base *cmd, void *payload, size_t payload_size) {
+    borrowed_object obj(payload, payload_size);
+    switch (cmd->type) {
+        case command_type::KERNEL_WRITE: {
+            auto c = (const kernel_write_command *) cmd;
+            std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_images = deserialize_kernel_sources(obj);
+            return hhal.kernel_write(c->kernel_id, kernel_images);
+        }
+        case command_type::KERNEL_START: {
+            auto c = (const kernel_start_command *) cmd;
+            auxiliary_allocations aux;
+            hhal::Arguments args = deserialize_arguments(obj, aux);
+            logger.info("Starting kernel {}", c->kernel_id);
+            return hhal.kernel_start(c->kernel_id, args);
+        }
+        case command_type::PREPARE_LAUNCH: {
+            auto c = (const prepare_launch_command *) cmd;
+            auxiliary_allocations aux;
+            hhal::Arguments args = deserialize_arguments(obj, aux);
+            return hhal.prepare_launch(c->launch_id, c->kernel_id, args);
+        }
+        case command_type::LAUNCH:
+            return hhal.launch(((const launch_command *) cmd)->launch_id);
+        case command_type::RELEASE_LAUNCH:
+            return hhal.release_launch(((const release_launch_command *) cmd)->launch_id);
+        case command_type::WRITE_MEMORY: {
+            auto c = (const write_memory_command *) cmd;
+            return hhal.write_to_memory(c->buffer_id, payload, payload_size);
+        }
+        case command_type::WRITE_MEMORY_RANGE: {
+            auto c = (const write_memory_range_command *) cmd;
+            return hhal.write_to_memory(c->buffer_id, payload, payload_size, c->offset);
+        }
+        case command_type::COPY_BUFFER: {
+            auto c = (const copy_buffer_command *) cmd;
+            return hhal.copy_buffer(c->src_id, c->dst_id, c->src_offset, c->dst_offset, c->size);
+        }
+        case command_type::WRITE_REGISTER: {
+            auto c = (const write_register_command *) cmd;
+            return hhal.write_sync_register(c->event_id, c->data);
+        }
+        case command_type::WRITE_MEMORY_SHARED: {
+            auto c = (const write_memory_shared_command *) cmd;
+            const shared_memory_region &region = conn->shared_memory;
+            if (region.addr == nullptr || c->offset > region.size || c->size > region.size - c->offset) {
+                logger.error("Write to memory: range [{}, +{}) outside of the shared memory of socket {}", c->offset, c->size, conn->id);
+                return hhal::HHALExitCode::ERROR;
+            }
+            return hhal.write_to_memory(c->buffer_id, (char *) region.addr + c->offset, c->size);
+        }
+        case command_type::ASSIGN_KERNEL: {
+            auto c = (const assign_kernel_command *) cmd;
+            // Already a POD for every unit
+            return hhal.assign_kernel(c->unit, (hhal::hhal_kernel *) payload);
+        }
+        case command_type::ASSIGN_BUFFER: {
+            auto c = (const assign_buffer_command *) cmd;
+            switch (c->unit) {
+                case hhal::Unit::GN: {
+                    hhal::gn_buffer b = deserialize_gn_buffer(obj);
+                    return hhal.assign_buffer(c->unit, (hhal::hhal_buffer *) &b);
+                }
+                case hhal::Unit::NVIDIA: {
+                    hhal::nvidia_buffer b = deserialize_nvidia_buffer(obj);
+                    return hhal.assign_buffer(c->unit, (hhal::hhal_buffer *) &b);
+                }
+                default:
+                    logger.error("Batched assign buffer command with unknown unit {}", static_cast<int>(c->unit));
+                    return hhal::HHALExitCode::ERROR;
+            }
+        }
+        case command_type::ASSIGN_EVENT: {
+            auto c = (const assign_event_command *) cmd;
+            switch (c->unit) {
+                case hhal::Unit::GN: {
+                    hhal::gn_event e = deserialize_gn_event(obj);
+                    return hhal.assign_event(c->unit, (hhal::hhal_event *) &e);
+                }
+                case hhal::Unit::NVIDIA: {
+                    // Already a POD
+                    return hhal.assign_event(c->unit, (hhal::hhal_event *) payload);
+                }
+                default:
+                    logger.error("Batched assign event command with unknown unit {}", static_cast<int>(c->unit));
+                    return hhal::HHALExitCode::ERROR;
+            }
+        }
+        case command_type::DEASSIGN_KERNEL: {
+            auto ec = hhal.deassign_kernel(((const deassign_kernel_command *) cmd)->kernel_id);
+#ifdef PROFILING_MODE
+            dump_thread.push_task([]{profiling::Profiler::get_instance().dump();});
+#endif
+            return ec;
+        }
+        case command_type::DEASSIGN_BUFFER:
+            return hhal.deassign_buffer(((const deassign_buffer_command *) cmd)->buffer_id);
+        case command_type::DEASSIGN_EVENT:
+            return hhal.deassign_event(((const deassign_event_command *) cmd)->event_id);
+        case command_type::ALLOCATE_KERNEL:
+            return hhal.allocate_kernel(((const allocate_kernel_command *) cmd)->kernel_id);
+        case command_type::ALLOCATE_MEMORY:
+            return hhal.allocate_memory(((const allocate_memory_command *) cmd)->buffer_id);
+        case command_type::ALLOCATE_EVENT:
+            return hhal.allocate_event(((const allocate_event_command *) cmd)->event_id);
+        case command_type::RELEASE_KERNEL:
+            return hhal.release_kernel(((const release_kernel_command *) cmd)->kernel_id);
+        case command_type::RELEASE_MEMORY:
+            return hhal.release_memory(((const release_memory_command *) cmd)->buffer_id);
+        case command_type::RELEASE_EVENT:
+            return hhal.release_event(((const release_event_command *) cmd)->event_id);
+        default:
+            // Filtered out by batched_command_size
+            return hhal::HHALExitCode::ERROR;
+    }
+}
+
+// Connections
+HHALServer::connection_t::connection_t(int id, ThreadPool &pool): id(id), executor(SerialExecutor::create(pool)) {}
+
+HHALServer::connection_t::~connection_t() {
+    if (shared_memory.addr != nullptr) {
+        munmap(shared_memory.addr, shared_memory.size);
+    }
+    // Left over by a streamed write the client did not finish
+    free(stream.staging);
+}
+
+void HHALServer::record_trace(trace_record_type type, int id, const void *buf, size_t size) {
+    if (trace.is_open() && !trace.record(type, id, buf, size)) {
+        logger.error("Could not write to the trace file, recording stopped");
+    }
+}
+
+HHALServer::connection_ptr &HHALServer::get_connection(int id) {
+    connection_ptr &conn = connections[id];
+    if (!conn) {
+        conn = std::make_shared<connection_t>(id, workers);
+    }
+    return conn;
+}
+
+void HHALServer::execute(int id, task_t task, size_t reserved_output) {
+    connection_ptr conn = get_connection(id);
+    request_t req = {conn, conn->request_id, conn->protocol == protocol_version::TAGGED, conn->command, reserved_output};
+    if (reserved_output > 0) {
+        server.reserve_output(id, reserved_output);
+    }
+    auto queued = Metrics::clock::now();
+    conn->executor->push_task([this, req, task, queued] {
+        int type = static_cast<int>(req.type);
+        auto started = Metrics::clock::now();
+        metrics.task_queued(type, started - queued);
+        task(req);
+        metrics.task_executed(type, Metrics::clock::now() - started);
+    });
+}
+
+void HHALServer::respond(const request_t &req, Server::message_t msg) {
+    server.post([this, req, msg] { send_response(req, msg); });
+}
+
+void HHALServer::send_response(const request_t &req, Server::message_t msg) {
+    const connection_ptr &conn = req.conn;
+    if (conn->closed) {
+        free(msg.buf);
+        return;
+    }
+    if (req.tagged) {
+        response_header header;
+        init_response_header(header, req.id, msg.size);
+        server.send_copy_on_socket(conn->id, &header, sizeof(header));
+    }
+    server.send_on_socket(conn->id, msg);
+    if (req.reserved_output > 0) {
+        server.release_output(conn->id, req.reserved_output);
+    }
+}
+
+void HHALServer::respond(const request_t &req, const small_response_t &res) {
+    if (res.res.base.type == response_type::ERROR) {
+        metrics.command_failed(static_cast<int>(req.type));
+    }
+    server.post([this, req, res] {
+        const connection_ptr &conn = req.conn;
+        if (conn->closed) return;
+        if (req.tagged) {
+            response_header header;
+            init_response_header(header, req.id, res.size);
+            server.send_copy_on_socket(conn->id, &header, sizeof(header));
+        }
+        server.send_copy_on_socket(conn->id, &res.res, res.size);
+        if (req.reserved_output > 0) {
+            server.release_output(conn->id, req.reserved_output);
+        }
+    });
+}
+
+void HHALServer::handle_close(int id, Server &server) {
+    record_trace(trace_record_type::CLOSE, id, nullptr, 0);
+    auto it = connections.find(id);
+    if (it == connections.end()) return;
+    // Commands still queued run to completion, their responses are dropped
+    connection_ptr conn = it->second;
+    conn->closed = true;
+    // Behind the queued commands, so waits they park are dropped as well
+    conn->executor->push_task([this, conn] { waiter.cancel(conn.get()); });
+    connections.erase(it);
+}
+
+HHALServer::HHALServer(std::string socket_path, const daemon_config_t &config): metrics(command_names()), stream_window(config.stream_window), server(
+    socket_path, config.max_connections,
     [this](int id, Server::message_t msg, Server &server) { return this->handle_command(id, msg, server); },
-    [this](int id, Server::packet_t packet, Server &server) { return this->handle_data(id, packet, server); }
-) {
+    [this](int id, Server::packet_t packet, Server &server) { return this->handle_data(id, packet, server); },
+    [this](int id, Server &server) { this->handle_close(id, server); },
+    [this](int id, Server::chunk_t chunk, Server &server) { return this->handle_stream(id, chunk, server); },
+    config.event_loop,
+    {config.connection_output_budget, config.total_output_budget}
+), waiter(
+    [this](int event_id, uint32_t value, bool *matched) {
+        return hhal.try_wait_sync_register(event_id, value, matched);
+    },
+    std::chrono::microseconds(config.event_poll_interval)
+), workers(config.worker_threads) {
     logger.info("HHAL server starting...");
+    hhal.set_event_listener([this](int event_id) { waiter.notify(event_id); });
+    if (!config.trace_path.empty()) {
+        if (trace.open(config.trace_path)) {
+            logger.info("Recording received commands to {}", config.trace_path);
+        } else {
+            logger.error("Could not open trace file {}, commands are not recorded", config.trace_path);
+        }
+    }
     Server::InitExitCode err = server.initialize();
     if (err != Server::InitExitCode::OK) {
         logger.error("HHAL server initialization error");
@@ -505,5 +1300,7 @@ HHALServer::HHALServer(std::string socket_path): server(
     server.start();
 }
 
-HHALServer::~HHALServer() {}
+HHALServer::~HHALServer() {
+    hhal.set_event_listener(nullptr);
+}
 } // namespace daemon
@@ -1,37 +1,136 @@
 #ifndef HHAL_SERVER_H
 #define HHAL_SERVER_H
 
+#include <map>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "server/server.h"
+#include "utils/config_reader.h"
+#include "utils/event_waiter.h"
+#include "utils/metrics.h"
+#include "utils/serial_executor.h"
+#include "utils/thread_pool.h"
+#include "utils/trace.h"
 #include "hhal.h"
 #include "hhal_command.h"
+#include "hhal_response.h"
 
 namespace hhal_daemon {
 
+// Fixed size response, carried by value and copied into the socket arena instead of allocated
+struct small_response_t {
+    size_t size;
+    union {
+        response_base base;
+        error_response error;
+        register_data_response register_data;
+        protocol_response protocol;
+    } res;
+};
+
 class HHALServer {
 
 public:
-    HHALServer(std::string socket_path);
+    HHALServer(std::string socket_path, const daemon_config_t &config);
     ~HHALServer();
 
 private:
-    hhal::HHAL hhal;
+    // Client owned memfd region mapped into the daemon, used to move buffer data without going through the socket
+    struct shared_memory_region {
+        void *addr;
+        size_t size;
+    };
+
+    // Large write being streamed in chunks, written to the buffer as they arrive or staged if the buffer can not take partial writes
+    struct stream_write_t {
+        void *staging;
+        hhal::HHALExitCode ec;
+    };
+
+    /*
+    * State of a client connection.
+    * Commands are parsed on the server loop and executed on the connection executor, so they run in order
+    * and their responses are sent in order, while different connections are served in parallel.
+    * Tasks keep the connection alive, so it may outlive the socket it belongs to.
+    */
+    struct connection_t {
+        const int id;
+        std::shared_ptr<SerialExecutor> executor;
+        protocol_version protocol = protocol_version::LEGACY; // Only used on the server loop
+        bool closed = false;                                  // Only used on the server loop
+        uint64_t request_id = 0;                              // Command being parsed, only used on the server loop
+        command_type command = command_type::KERNEL_WRITE;    // Command being parsed, only used on the server loop
+        size_t stream_in_flight = 0;                          // Streamed bytes not yet written, only used on the server loop
+        bool receiving_paused = false;                        // Only used on the server loop
+        shared_memory_region shared_memory = {nullptr, 0};    // Only used on the executor
+        stream_write_t stream = {nullptr, hhal::HHALExitCode::OK}; // Only used on the executor
+
+        connection_t(int id, ThreadPool &pool);
+        ~connection_t();
+    };
+
+    typedef std::shared_ptr<connection_t> connection_ptr;
+
+    // A command being executed, its responses carry its id if it came tagged
+    struct request_t {
+        connection_ptr conn;
+        uint64_t id;
+        bool tagged;
+        command_type type;
+        size_t reserved_output; // Response bytes counted toward the output budget until it is answered
+    };
+
+    typedef std::function<void(const request_t &)> task_t;
+
+    hhal::HHAL hhal; // Thread safe, called from the executors of every connection at once
+    Metrics metrics;
+    std::map<int, connection_ptr> connections; // Open connections by socket id
+    const size_t stream_window;                 // Streamed bytes buffered per connection before it stops being read
+    TraceWriter trace;                          // Received traffic, when enabled. Only used on the server loop
     Server server;
+    EventWaiter waiter; // Parked WAIT_REGISTER commands, answered from its thread
+    ThreadPool workers; // Declared after server, so workers are joined while they can still post to it
 
     Server::message_result_t handle_command(int id, Server::message_t msg, Server &server);
+    Server::message_result_t dispatch_command(int id, Server::message_t msg, Server &server);
 
     Server::DataListenerExitCode handle_data(int id, Server::packet_t packet, Server &server);
+    Server::DataListenerExitCode handle_stream(int id, Server::chunk_t chunk, Server &server);
+
+    void handle_close(int id, Server &server);
+
+    connection_ptr &get_connection(int id);
+    void record_trace(trace_record_type type, int id, const void *buf, size_t size);
+
+    // Run the task on the connection executor, as part of the command being handled.
+    // reserved_output is the size of the response, when big enough to count toward the output budget before it exists.
+    void execute(int id, task_t task, size_t reserved_output = 0);
+    // Queue the response to a request, from any thread. Dropped if the connection was closed meanwhile.
+    void respond(const request_t &req, Server::message_t msg);
+    void respond(const request_t &req, const small_response_t &res);
+    // Same as respond, from the server loop
+    void send_response(const request_t &req, Server::message_t msg);
 
     // Kernel Execution
     Server::message_result_t handle_kernel_start(int id, const kernel_start_command *cmd, Server &server);
     Server::message_result_t handle_kernel_write(int id, const kernel_write_command *cmd, Server &server);
+    Server::message_result_t handle_prepare_launch(int id, const prepare_launch_command *cmd, Server &server);
+    Server::message_result_t handle_launch(int id, const launch_command *cmd, Server &server);
+    Server::message_result_t handle_release_launch(int id, const release_launch_command *cmd, Server &server);
 
     Server::message_result_t handle_write_to_memory(int id, const write_memory_command *cmd, Server &server);
     Server::message_result_t handle_read_from_memory(int id, const read_memory_command *cmd, Server &server);
+    Server::message_result_t handle_write_to_memory_range(int id, const write_memory_range_command *cmd, Server &server);
+    Server::message_result_t handle_read_from_memory_range(int id, const read_memory_range_command *cmd, Server &server);
+    Server::message_result_t handle_copy_buffer(int id, const copy_buffer_command *cmd, Server &server);
+    // Queue a read answered with the data, offset bytes past the base of the buffer
+    void read_from_memory(int id, int buffer_id, size_t offset, size_t size);
 
     Server::message_result_t handle_write_sync_register(int id, const write_register_command *cmd, Server &server);
     Server::message_result_t handle_read_sync_register(int id, const read_register_command *cmd, Server &server);
+    Server::message_result_t handle_wait_sync_register(int id, const wait_register_command *cmd, Server &server);
 
     // Resource management
     Server::message_result_t handle_assign_kernel(int id, const assign_kernel_command *cmd, Server &server);
@@ -51,13 +150,42 @@ private:
     Server::message_result_t handle_release_memory(int id, const release_memory_command *cmd, Server &server);
     Server::message_result_t handle_release_event(int id, const release_event_command *cmd, Server &server);
 
+    // Shared memory data plane
+    Server::message_result_t handle_register_shared_memory(int id, const register_shared_memory_command *cmd, Server &server);
+    Server::message_result_t handle_write_to_memory_shared(int id, const write_memory_shared_command *cmd, Server &server);
+    Server::message_result_t handle_read_from_memory_shared(int id, const read_memory_shared_command *cmd, Server &server);
+
+    // Connection setup
+    Server::message_result_t handle_negotiate_protocol(int id, const negotiate_protocol_command *cmd, Server &server);
+    void acknowledge_command(int id, Server &server);
+
+    // Batching
+    Server::message_result_t handle_batch(int id, const batch_command *cmd, Server &server);
+    // Run one command of a batch, the payload is owned by the batch
+    hhal::HHALExitCode execute_batched_command(const connection_ptr &conn, const command_base *cmd, void *payload, size_t payload_size);
+    Server::message_t batch_result_message(const std::vector<hhal::HHALExitCode> &results);
+
+    // Metrics
+    Server::message_result_t handle_stats(int id, const stats_command *cmd, Server &server);
+    // Server and per command counters as a JSON object, only called on the server loop
+    std::string stats_json();
+
 
     Server::DataListenerExitCode handle_kernel_start_data(int id, kernel_start_command *cmd, Server::message_t data, Server &server);
     Server::DataListenerExitCode handle_kernel_write_data(int id, kernel_write_command *cmd, Server::message_t data, Server &server);
+    Server::DataListenerExitCode handle_prepare_launch_data(int id, prepare_launch_command *cmd, Server::message_t data, Server &server);
     Server::DataListenerExitCode handle_write_to_memory_data(int id, write_memory_command *cmd, Server::message_t data, Server &server);
+    Server::DataListenerExitCode handle_write_to_memory_range_data(int id, write_memory_range_command *cmd, Server::message_t data, Server &server);
+    // Queue a write of the whole payload, which it takes ownership of, offset bytes past the base of the buffer
+    void write_to_memory_data(int id, int buffer_id, size_t offset, Server::message_t data);
+    // Chunk offsets are relative to offset, the start of the streamed range in the buffer
+    Server::DataListenerExitCode handle_write_to_memory_chunk(int id, int buffer_id, size_t offset, size_t total_size, Server::chunk_t chunk, Server &server);
+    // Account for a streamed chunk written by the executor, reading the connection again if it was paused
+    void stream_chunk_done(const connection_ptr &conn, size_t size);
     Server::DataListenerExitCode handle_assign_kernel_data(int id, assign_kernel_command *cmd, Server::message_t data, Server &server);
     Server::DataListenerExitCode handle_assign_buffer_data(int id, assign_buffer_command *cmd, Server::message_t data, Server &server);
     Server::DataListenerExitCode handle_assign_event_data(int id, assign_event_command *cmd, Server::message_t data, Server &server);
+    Server::DataListenerExitCode handle_batch_data(int id, batch_command *cmd, Server::message_t data, Server &server);
 };
 
 } // namespace daemon
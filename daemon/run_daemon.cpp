@@ -35,5 +35,5 @@ int main(int argc, char const *argv[]) {
 
     logger.info("Server initialized, starting loop...");
 
-    HHALServer hhal_server(socket_path);
+    HHALServer hhal_server(socket_path, config);
 }
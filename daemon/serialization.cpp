@@ -1,6 +1,7 @@
 #include "serialization.h"
 #include <vector>
 #include <cstring>
+#include <cstdio>
 #include <assert.h>
 #include <stdlib.h>
 
@@ -371,4 +372,46 @@ hhal::nvidia_buffer deserialize_nvidia_buffer(const serialized_object &obj) {
     return res;
 }
 
+size_t kernel_info_size(hhal::Unit unit) {
+    switch (unit) {
+        case hhal::Unit::GN:
+            // Already a POD
+            return sizeof(hhal::gn_kernel);
+        case hhal::Unit::NVIDIA:
+            // Already a POD
+            return sizeof(hhal::nvidia_kernel);
+        default:
+            printf("Unknown unit type %d", static_cast<int>(unit));
+            return 0;
+    }
+}
+
+serialized_object serialize_buffer_info(hhal::Unit unit, hhal::hhal_buffer *info) {
+    switch (unit) {
+        case hhal::Unit::GN:
+            return serialize(*(hhal::gn_buffer *) info);
+        case hhal::Unit::NVIDIA:
+            return serialize(*(hhal::nvidia_buffer *) info);
+        default:
+            printf("Unknown unit type %d", static_cast<int>(unit));
+            return {};
+    }
+}
+
+serialized_object serialize_event_info(hhal::Unit unit, hhal::hhal_event *info) {
+    switch (unit) {
+        case hhal::Unit::GN:
+            return serialize(*(hhal::gn_event *) info);
+        case hhal::Unit::NVIDIA: {
+            // Already a POD
+            void *info_buf = malloc(sizeof(hhal::nvidia_event));
+            memcpy(info_buf, info, sizeof(hhal::nvidia_event));
+            return {info_buf, sizeof(hhal::nvidia_event)};
+        }
+        default:
+            printf("Unknown unit type %d", static_cast<int>(unit));
+            return {};
+    }
+}
+
 }
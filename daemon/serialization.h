@@ -57,6 +57,11 @@ namespace hhal_daemon {
     serialized_object serialize(const hhal::gn_event &event);
     serialized_object serialize(const hhal::nvidia_buffer &buffer);
 
+    // Payloads of the assign commands by unit. Unknown units give 0 or an empty object.
+    size_t kernel_info_size(hhal::Unit unit);
+    serialized_object serialize_buffer_info(hhal::Unit unit, hhal::hhal_buffer *info);
+    serialized_object serialize_event_info(hhal::Unit unit, hhal::hhal_event *info);
+
     hhal::Arguments deserialize_arguments(const serialized_object &obj, auxiliary_allocations &allocs);
     std::map<hhal::Unit, hhal::hhal_kernel_source> deserialize_kernel_sources(const serialized_object &obj);
     hhal::gn_kernel deserialize_gn_kernel(const serialized_object &obj);
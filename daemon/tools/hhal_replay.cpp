@@ -0,0 +1,392 @@
+/*
+* Replays a trace recorded by the daemon (trace_path in its config) against a daemon, and reports the round
+* trip of every command type.
+*
+* Each recorded connection is opened again and sent the same bytes, in the recorded order across connections.
+* Responses are read and checked on a thread per connection. Shared memory can not be replayed, as the file
+* descriptors are not part of the trace: registering fails and the *_SHARED commands are answered with errors.
+*
+* Usage: hhal_replay [-m] [-s socket_path] [-d daemon_binary] trace_file
+*   -m  Send as fast as possible instead of at the recorded pace
+*   -s  Socket of the daemon, /tmp/mango_hhal_daemon by default
+*   -d  Start a fresh daemon from the given binary on the socket, stopped once the replay is done
+*/
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "hhal_command.h"
+#include "hhal_response.h"
+#include "client/socket_client.h"
+#include "utils/metrics.h"
+#include "utils/trace.h"
+
+using namespace hhal_daemon;
+
+typedef std::chrono::steady_clock replay_clock;
+
+// Time responses are waited for once a connection is done sending, the recorded client may have closed without them
+#define CLOSE_GRACE_MS 2000
+#define POLL_INTERVAL_MS 100
+
+// Response the daemon owes to a sent command
+struct expected_t {
+    command_type type;
+    protocol_version protocol; // In use when the command was sent
+    size_t read_size;          // Data following an acknowledgement
+    bool last;                 // Ends the command, legacy payload commands are acknowledged first
+    replay_clock::time_point sent;
+};
+
+struct replay_stats_t {
+    std::mutex mutex;
+    LatencyHistogram round_trip[COMMAND_TYPE_COUNT];
+    uint64_t errors[COMMAND_TYPE_COUNT] = {};
+    replay_clock::time_point last_response;
+};
+
+class ReplayConnection {
+    public:
+    ReplayConnection(int fd, replay_stats_t &stats): fd(fd), stats(stats), reader([this] { read_responses(); }) {}
+
+    // Waits for the responses still expected, up to CLOSE_GRACE_MS without any arriving
+    ~ReplayConnection() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            sending_done = true;
+        }
+        cv.notify_one();
+        reader.join();
+        end(fd);
+    }
+
+    // Sends the bytes of a recorded command, expecting its responses
+    bool send_command(const std::vector<char> &data) {
+        const char *cmd = data.data();
+        size_t cmd_size = data.size();
+        uint64_t request_id = 0;
+        if (protocol == protocol_version::TAGGED) {
+            if (cmd_size < sizeof(request_header)) return false;
+            request_id = ((const request_header *) cmd)->request_id;
+            cmd += sizeof(request_header);
+            cmd_size -= sizeof(request_header);
+        }
+        if (cmd_size < sizeof(command_base)) return false;
+
+        expected_t expected = {((const command_base *) cmd)->type, protocol, 0, true, replay_clock::now()};
+        size_t payload_size = 0;
+        switch (expected.type) {
+        case command_type::KERNEL_WRITE:
+            payload_size = ((const kernel_write_command *) cmd)->sources_size;
+            break;
+        case command_type::KERNEL_START:
+            payload_size = ((const kernel_start_command *) cmd)->arguments_size;
+            break;
+        case command_type::PREPARE_LAUNCH:
+            payload_size = ((const prepare_launch_command *) cmd)->arguments_size;
+            break;
+        case command_type::WRITE_MEMORY:
+            payload_size = ((const write_memory_command *) cmd)->size;
+            break;
+        case command_type::WRITE_MEMORY_RANGE:
+            payload_size = ((const write_memory_range_command *) cmd)->size;
+            break;
+        case command_type::ASSIGN_KERNEL:
+        case command_type::ASSIGN_BUFFER:
+        case command_type::ASSIGN_EVENT:
+            payload_size = ((const assign_kernel_command *) cmd)->size;
+            break;
+        case command_type::BATCH:
+            // Answered with the results even without a payload
+            payload_size = std::max<size_t>(((const batch_command *) cmd)->size, 1);
+            break;
+        case command_type::READ_MEMORY:
+            expected.read_size = ((const read_memory_command *) cmd)->size;
+            break;
+        case command_type::READ_MEMORY_RANGE:
+            expected.read_size = ((const read_memory_range_command *) cmd)->size;
+            break;
+        case command_type::NEGOTIATE_PROTOCOL:
+            protocol = std::min(((const negotiate_protocol_command *) cmd)->version, LATEST_PROTOCOL_VERSION);
+            break;
+        default:
+            break;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (expected.protocol == protocol_version::TAGGED) {
+                tagged[request_id] = expected;
+            } else {
+                bool is_payload_command = expected.type == command_type::KERNEL_WRITE || expected.type == command_type::KERNEL_START ||
+                    expected.type == command_type::PREPARE_LAUNCH || expected.type == command_type::WRITE_MEMORY || expected.type == command_type::ASSIGN_KERNEL ||
+                    expected.type == command_type::ASSIGN_BUFFER || expected.type == command_type::ASSIGN_EVENT ||
+                    expected.type == command_type::BATCH || expected.type == command_type::WRITE_MEMORY_RANGE;
+                if (expected.protocol == protocol_version::LEGACY && is_payload_command) {
+                    expected_t ack = expected;
+                    ack.last = payload_size == 0;
+                    in_order.push_back(ack);
+                }
+                if (expected.protocol != protocol_version::LEGACY || !is_payload_command || payload_size > 0) {
+                    in_order.push_back(expected);
+                }
+            }
+        }
+        cv.notify_one();
+        return send_on_socket(fd, data.data(), data.size());
+    }
+
+    bool send_data(const std::vector<char> &data) {
+        return send_on_socket(fd, data.data(), data.size());
+    }
+
+    private:
+    const int fd;
+    replay_stats_t &stats;
+    protocol_version protocol = protocol_version::LEGACY; // Of the commands being sent
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<expected_t> in_order;         // Responses of LEGACY and FRAMED commands, in order
+    std::map<uint64_t, expected_t> tagged;  // Responses of TAGGED commands, by request id
+    bool sending_done = false;
+
+    std::thread reader; // Last, started once everything else is initialized
+
+    void complete(const expected_t &expected, response_type type) {
+        if (!expected.last) return;
+        std::unique_lock<std::mutex> lock(stats.mutex);
+        int idx = static_cast<int>(expected.type);
+        if (idx < 0 || idx >= COMMAND_TYPE_COUNT) return;
+        stats.last_response = replay_clock::now();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(stats.last_response - expected.sent);
+        stats.round_trip[idx].record(elapsed.count());
+        if (type == response_type::ERROR) stats.errors[idx]++;
+    }
+
+    // Reads the rest of a response whose type was already read, and whatever data follows it
+    bool skip_response(response_type type, size_t read_size) {
+        size_t rest = 0;
+        switch (type) {
+        case response_type::ACK: rest = read_size; break;
+        case response_type::ERROR: rest = sizeof(error_response) - sizeof(response_base); break;
+        case response_type::REGISTER_DATA: rest = sizeof(register_data_response) - sizeof(response_base); break;
+        case response_type::PROTOCOL: rest = sizeof(protocol_response) - sizeof(response_base); break;
+        case response_type::BATCH_RESULT: {
+            batch_response res;
+            if (!receive_on_socket(fd, (char *) &res + sizeof(response_base), sizeof(res) - sizeof(response_base))) return false;
+            rest = res.count * sizeof(hhal::HHALExitCode);
+            break;
+        }
+        case response_type::STATS: {
+            stats_response res;
+            if (!receive_on_socket(fd, (char *) &res + sizeof(response_base), sizeof(res) - sizeof(response_base))) return false;
+            rest = res.size;
+            break;
+        }
+        default:
+            return false;
+        }
+        std::vector<char> buf(std::min<size_t>(rest, 1 << 20));
+        while (rest > 0) {
+            size_t size = std::min(rest, buf.size());
+            if (!receive_on_socket(fd, buf.data(), size)) return false;
+            rest -= size;
+        }
+        return true;
+    }
+
+    // Gives up once the connection is done sending and nothing arrived for CLOSE_GRACE_MS
+    bool wait_readable() {
+        auto idle_since = replay_clock::now();
+        while (true) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, POLL_INTERVAL_MS) != 0) return true;
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!sending_done) {
+                idle_since = replay_clock::now();
+            } else if (replay_clock::now() - idle_since > std::chrono::milliseconds(CLOSE_GRACE_MS)) {
+                return false;
+            }
+        }
+    }
+
+    void read_responses() {
+        while (true) {
+            expected_t expected;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [this] { return !in_order.empty() || !tagged.empty() || sending_done; });
+                if (in_order.empty() && tagged.empty()) return;
+                // Responses of the protocol in use come first, commands switching it are answered with the old one
+                if (!in_order.empty()) expected = in_order.front();
+                else expected.protocol = protocol_version::TAGGED;
+            }
+
+            if (!wait_readable()) {
+                std::unique_lock<std::mutex> lock(mutex);
+                printf("hhal_replay: connection closed with %zu responses not received\n", in_order.size() + tagged.size());
+                return;
+            }
+
+            if (expected.protocol == protocol_version::TAGGED) {
+                response_header header;
+                response_base res;
+                if (!receive_on_socket(fd, &header, sizeof(header)) || !receive_on_socket(fd, &res, sizeof(res))) break;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    auto it = tagged.find(header.request_id);
+                    if (it == tagged.end()) {
+                        printf("hhal_replay: response to unknown request %llu\n", (unsigned long long) header.request_id);
+                        break;
+                    }
+                    expected = it->second;
+                    tagged.erase(it);
+                }
+                std::vector<char> rest(header.size - sizeof(res));
+                if (!rest.empty() && !receive_on_socket(fd, rest.data(), rest.size())) break;
+                complete(expected, res.type);
+            } else {
+                response_base res;
+                if (!receive_on_socket(fd, &res, sizeof(res)) || !skip_response(res.type, expected.read_size)) break;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    in_order.pop_front();
+                }
+                complete(expected, res.type);
+            }
+        }
+        printf("hhal_replay: connection lost while waiting for responses\n");
+    }
+};
+
+static pid_t start_daemon(const char *binary, const char *socket_path) {
+    unlink(socket_path);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(binary, binary, socket_path, (char *) nullptr);
+        _exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < 100 && pid > 0; i++) {
+        struct stat st;
+        if (stat(socket_path, &st) == 0) return pid;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *socket_path = "/tmp/mango_hhal_daemon";
+    const char *daemon_binary = nullptr;
+    bool max_speed = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "ms:d:")) != -1) {
+        switch (opt) {
+        case 'm': max_speed = true; break;
+        case 's': socket_path = optarg; break;
+        case 'd': daemon_binary = optarg; break;
+        default:
+            printf("Usage: hhal_replay [-m] [-s socket_path] [-d daemon_binary] trace_file\n");
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        printf("Usage: hhal_replay [-m] [-s socket_path] [-d daemon_binary] trace_file\n");
+        return EXIT_FAILURE;
+    }
+
+    TraceReader trace;
+    if (!trace.open(argv[optind])) {
+        printf("hhal_replay: %s is not a readable trace\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    pid_t daemon = -1;
+    if (daemon_binary != nullptr) {
+        daemon = start_daemon(daemon_binary, socket_path);
+        if (daemon < 0) {
+            printf("hhal_replay: could not start %s\n", daemon_binary);
+            return EXIT_FAILURE;
+        }
+    }
+
+    replay_stats_t stats;
+    std::map<int, std::unique_ptr<ReplayConnection>> connections; // By recorded connection id
+    std::vector<std::unique_ptr<ReplayConnection>> closed;        // Joined at the end, not to hold back the replay
+    uint64_t commands = 0, bytes = 0;
+    bool failed = false;
+
+    trace_record_header header;
+    std::vector<char> data;
+    auto start = replay_clock::now();
+    while (!failed && trace.next(header, data)) {
+        if (!max_speed) {
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(header.time_ns));
+        }
+
+        auto &conn = connections[header.connection];
+        if (header.type == trace_record_type::CLOSE) {
+            if (conn) closed.push_back(std::move(conn));
+            connections.erase(header.connection);
+            continue;
+        }
+        if (!conn) {
+            int fd = initialize(socket_path);
+            if (fd < 0) {
+                printf("hhal_replay: could not connect to %s\n", socket_path);
+                failed = true;
+                break;
+            }
+            conn.reset(new ReplayConnection(fd, stats));
+        }
+
+        if (header.type == trace_record_type::COMMAND) {
+            failed = !conn->send_command(data);
+            commands++;
+        } else {
+            failed = !conn->send_data(data);
+        }
+        bytes += data.size();
+    }
+    if (failed) {
+        printf("hhal_replay: send failed, stopping the replay\n");
+    }
+
+    auto sending_end = replay_clock::now();
+
+    // Waits for the responses still in flight, the time waiting for those that never come is not counted
+    connections.clear();
+    closed.clear();
+    double elapsed = std::chrono::duration<double>(std::max(sending_end, stats.last_response) - start).count();
+
+    if (daemon > 0) {
+        kill(daemon, SIGTERM);
+        waitpid(daemon, nullptr, 0);
+    }
+
+    printf("%llu commands, %llu bytes in %.3f s (%.0f commands/s)\n",
+        (unsigned long long) commands, (unsigned long long) bytes, elapsed, commands / elapsed);
+    printf("%-24s %10s %8s %12s %12s %12s\n", "command", "count", "errors", "p50 (us)", "p99 (us)", "max (us)");
+    for (int i = 0; i < COMMAND_TYPE_COUNT; i++) {
+        const LatencyHistogram &h = stats.round_trip[i];
+        if (h.count() == 0) continue;
+        printf("%-24s %10llu %8llu %12.1f %12.1f %12.1f\n", COMMAND_TYPE_NAMES[i],
+            (unsigned long long) h.count(), (unsigned long long) stats.errors[i],
+            h.quantile(0.5) / 1e3, h.quantile(0.99) / 1e3, h.quantile(1.0) / 1e3);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
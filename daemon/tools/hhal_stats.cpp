@@ -0,0 +1,26 @@
+/*
+* Dumps the metrics of a running daemon: traffic counters, open connections and, per command type,
+* the amount received and failed with histograms of the time spent queued and executing (in nanoseconds).
+*
+* Usage: hhal_stats [socket_path]
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "hhal_client.h"
+
+using namespace hhal_daemon;
+
+int main(int argc, char const *argv[]) {
+    const char *socket_path = argc > 1 ? argv[1] : "/tmp/mango_hhal_daemon";
+
+    HHALClient client(socket_path);
+    std::string stats;
+    if (client.get_stats(stats) != HHALClientExitCode::OK) {
+        printf("hhal_stats: could not get the daemon stats\n");
+        return EXIT_FAILURE;
+    }
+    printf("%s\n", stats.c_str());
+    return EXIT_SUCCESS;
+}
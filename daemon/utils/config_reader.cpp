@@ -1,5 +1,6 @@
 #include "utils/config_reader.h"
 #include "inih/INIReader.h"
+#include "server/server.h"
 
 namespace hhal_daemon {
 
@@ -8,6 +9,14 @@ ConfigReader::ExitCode ConfigReader::read_config(std::string path, daemon_config
 
   auto level_str = reader.Get("log", "level", "INFO");
   auto daemon_path = reader.Get("daemon", "path", "");
+  auto worker_threads = reader.GetInteger("daemon", "worker_threads", 0);
+  auto max_connections = reader.GetInteger("daemon", "max_connections", 10);
+  auto event_loop_str = reader.Get("daemon", "event_loop", "epoll");
+  auto event_poll_interval = reader.GetInteger("daemon", "event_poll_interval", 1000);
+  auto stream_window = reader.GetInteger("daemon", "stream_window", 4 << 20);
+  auto connection_output_budget = reader.GetInteger("daemon", "connection_output_budget", 64 << 20);
+  auto total_output_budget = reader.GetInteger("daemon", "total_output_budget", 1 << 30);
+  auto trace_path = reader.Get("daemon", "trace_path", "");
 
   Logger::Level level = Logger::Level::INFO;
   if (level_str == "TRACE")
@@ -29,6 +38,15 @@ ConfigReader::ExitCode ConfigReader::read_config(std::string path, daemon_config
 
   config.log_level = level;
   config.daemon_path = daemon_path;
+  config.worker_threads = worker_threads < 0 ? 0 : worker_threads;
+  config.max_connections = max_connections < 1 ? 1 : max_connections;
+  config.event_loop = event_loop_str == "poll" ? Poller::Backend::POLL : Poller::Backend::EPOLL;
+  config.event_poll_interval = event_poll_interval < 1 ? 1 : event_poll_interval;
+  // At least a chunk, otherwise reading would pause on every chunk
+  config.stream_window = stream_window < (long) Server::STREAM_CHUNK_SIZE ? Server::STREAM_CHUNK_SIZE : stream_window;
+  config.connection_output_budget = connection_output_budget < 0 ? 0 : connection_output_budget;
+  config.total_output_budget = total_output_budget < 0 ? 0 : total_output_budget;
+  config.trace_path = trace_path;
 
   return ExitCode::OK;
 }
@@ -1,4 +1,8 @@
+#ifndef CONFIG_READER_H
+#define CONFIG_READER_H
+
 #include "utils/logger.h"
+#include "server/poller.h"
 #include <string>
 
 namespace hhal_daemon {
@@ -6,6 +10,14 @@ namespace hhal_daemon {
 struct daemon_config_t {
   Logger::Level log_level;
   std::string daemon_path;
+  int worker_threads; // Threads executing client commands, 0 for one per hardware thread
+  int max_connections;
+  Poller::Backend event_loop;
+  int event_poll_interval; // Microseconds between checks of waited registers that change without notification
+  size_t stream_window;    // Bytes of a large write received ahead of the device, per connection
+  size_t connection_output_budget; // Response bytes pending per connection before it stops being read, 0 for no limit
+  size_t total_output_budget;      // Same, over every connection
+  std::string trace_path;          // File the received commands are recorded to, empty to disable
 };
 
 class ConfigReader {
@@ -24,3 +36,5 @@ private:
 };
 
 } // namespace daemon
+
+#endif // CONFIG_READER_H
@@ -0,0 +1,132 @@
+#include "utils/event_waiter.h"
+
+namespace hhal_daemon {
+
+EventWaiter::EventWaiter(check_t check, std::chrono::microseconds poll_interval)
+    : check(check), poll_interval(poll_interval), thread(&EventWaiter::run, this) {}
+
+EventWaiter::~EventWaiter() {
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_one();
+  thread.join();
+}
+
+void EventWaiter::wait(int event_id, uint32_t value, int timeout_ms, const void *owner, callback_t done) {
+  uint64_t seen;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    seen = notifications;
+  }
+
+  bool matched = false;
+  hhal::HHALExitCode ec = check(event_id, value, &matched);
+  if (ec != hhal::HHALExitCode::OK) {
+    done(ec);
+    return;
+  }
+  if (matched) {
+    done(hhal::HHALExitCode::OK);
+    return;
+  }
+  if (timeout_ms == 0) {
+    done(hhal::HHALExitCode::TIMEOUT);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (stopping) {
+    lock.unlock();
+    done(hhal::HHALExitCode::ERROR);
+    return;
+  }
+  waiter_t waiter = {event_id, value, timeout_ms > 0, clock::now() + std::chrono::milliseconds(timeout_ms), owner, done};
+  waiters.push_back(std::move(waiter));
+  // The register may have been written after it was checked, before the wait was parked
+  if (notifications != seen) {
+    notified.insert(event_id);
+  }
+  added = true;
+  lock.unlock();
+  cv.notify_one();
+}
+
+void EventWaiter::notify(int event_id) {
+  std::unique_lock<std::mutex> lock(mutex);
+  notifications++;
+  if (waiters.empty() && !checking) return;
+
+  notified.insert(event_id);
+  lock.unlock();
+  cv.notify_one();
+}
+
+void EventWaiter::cancel(const void *owner) {
+  std::unique_lock<std::mutex> lock(mutex);
+  waiters.remove_if([owner](const waiter_t &w) { return w.owner == owner; });
+}
+
+void EventWaiter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  clock::time_point next_poll = clock::now() + poll_interval;
+  while (!stopping) {
+    if (waiters.empty()) {
+      notified.clear();
+      cv.wait(lock, [this] { return stopping || !waiters.empty(); });
+      next_poll = clock::now() + poll_interval;
+      continue;
+    }
+
+    clock::time_point wake_up = next_poll;
+    for (const auto &w : waiters) {
+      if (w.has_deadline && w.deadline < wake_up) wake_up = w.deadline;
+    }
+    added = false;
+    cv.wait_until(lock, wake_up, [this] { return stopping || added || !notified.empty(); });
+    if (stopping) break;
+
+    clock::time_point now = clock::now();
+    bool poll = now >= next_poll;
+    if (poll) next_poll = now + poll_interval;
+
+    // Waits are checked without the lock, checking takes the HHAL locks and writers notify while holding them
+    std::list<waiter_t> to_check;
+    for (auto it = waiters.begin(); it != waiters.end();) {
+      auto next = std::next(it);
+      if (poll || notified.count(it->event_id) > 0 || (it->has_deadline && it->deadline <= now)) {
+        to_check.splice(to_check.end(), waiters, it);
+      }
+      it = next;
+    }
+    notified.clear();
+    if (to_check.empty()) continue;
+    checking = true;
+    lock.unlock();
+
+    std::list<waiter_t> still_waiting;
+    for (auto it = to_check.begin(); it != to_check.end();) {
+      auto next = std::next(it);
+      bool matched = false;
+      hhal::HHALExitCode ec = check(it->event_id, it->value, &matched);
+      if (ec != hhal::HHALExitCode::OK) {
+        it->done(ec);
+      } else if (matched) {
+        it->done(hhal::HHALExitCode::OK);
+      } else if (it->has_deadline && it->deadline <= now) {
+        it->done(hhal::HHALExitCode::TIMEOUT);
+      } else {
+        still_waiting.splice(still_waiting.end(), to_check, it);
+      }
+      it = next;
+    }
+    to_check.clear();
+
+    lock.lock();
+    checking = false;
+    waiters.splice(waiters.end(), still_waiting);
+  }
+}
+
+} // namespace hhal_daemon
@@ -0,0 +1,81 @@
+#ifndef EVENT_WAITER_H
+#define EVENT_WAITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cinttypes>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "hhal.h"
+
+namespace hhal_daemon {
+
+/*
+* Parks waits on sync registers until they hold a value or time out, so clients do not have to poll the daemon.
+* A parked wait is checked again when its register is notified as written, and every poll interval for
+* registers that change without a notification (GN registers written by kernels on the device).
+*/
+class EventWaiter {
+
+public:
+  typedef std::chrono::steady_clock clock;
+  // Consumes the register if it holds value, setting matched. Never called with the waiter lock held.
+  typedef std::function<hhal::HHALExitCode(int event_id, uint32_t value, bool *matched)> check_t;
+  // Receives OK once the register matched, TIMEOUT or ERROR otherwise
+  typedef std::function<void(hhal::HHALExitCode)> callback_t;
+
+  EventWaiter(check_t check, std::chrono::microseconds poll_interval);
+  ~EventWaiter();
+
+  /*
+  * \brief Wait for event_id to hold value. Thread safe.
+  * The register is checked right away, so the callback may run before returning, otherwise it runs on the waiter thread.
+  * \param timeout_ms Negative waits forever, 0 only checks once.
+  * \param owner Identifies the wait for cancel.
+  */
+  void wait(int event_id, uint32_t value, int timeout_ms, const void *owner, callback_t done);
+
+  /*
+  * \brief Check the waits on event_id again. Thread safe, meant to be called when the register is written.
+  */
+  void notify(int event_id);
+
+  /*
+  * \brief Drop the parked waits of owner without calling their callbacks.
+  * Waits being checked at that moment may still complete.
+  */
+  void cancel(const void *owner);
+
+private:
+  struct waiter_t {
+    int event_id;
+    uint32_t value;
+    bool has_deadline;
+    clock::time_point deadline;
+    const void *owner;
+    callback_t done;
+  };
+
+  check_t check;
+  const std::chrono::microseconds poll_interval;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::list<waiter_t> waiters;
+  std::set<int> notified;     // Events written since their waits were last checked
+  uint64_t notifications = 0; // Incremented on every notify, detects writes racing with a new wait
+  bool added = false;         // New waits were parked, the next wake up may have to be earlier
+  bool checking = false;      // Some waits are out of the list being checked
+  bool stopping = false;
+  std::thread thread;
+
+  void run();
+};
+
+} // namespace hhal_daemon
+
+#endif // EVENT_WAITER_H
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+
+#include "utils/metrics.h"
+
+namespace hhal_daemon {
+
+const int LatencyHistogram::SUB_BUCKET_BITS;
+const int LatencyHistogram::SUB_BUCKETS;
+const int LatencyHistogram::BUCKETS;
+
+LatencyHistogram::LatencyHistogram() : total(0), sum(0), max(0) {
+  for (auto &bucket : buckets) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+int LatencyHistogram::bucket_of(uint64_t value) {
+  if (value < SUB_BUCKETS)
+    return value;
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - SUB_BUCKET_BITS;
+  return ((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::bucket_lowest(int bucket) {
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+  int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+  return (uint64_t)(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+}
+
+void LatencyHistogram::record(uint64_t value) {
+  buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(value, std::memory_order_relaxed);
+  uint64_t current = max.load(std::memory_order_relaxed);
+  while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+uint64_t LatencyHistogram::count() const {
+  return total.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::quantile(double q) const {
+  uint64_t n = count();
+  if (n == 0)
+    return 0;
+  uint64_t target = std::max<uint64_t>(1, (uint64_t)std::ceil(q * n));
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS; i++) {
+    seen += buckets[i].load(std::memory_order_relaxed);
+    if (seen >= target)
+      return bucket_lowest(i);
+  }
+  return max.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::to_json(std::string &out) const {
+  out += "{\"count\":" + std::to_string(count());
+  out += ",\"sum\":" + std::to_string(sum.load(std::memory_order_relaxed));
+  out += ",\"max\":" + std::to_string(max.load(std::memory_order_relaxed));
+  out += ",\"p50\":" + std::to_string(quantile(0.5));
+  out += ",\"p90\":" + std::to_string(quantile(0.9));
+  out += ",\"p99\":" + std::to_string(quantile(0.99));
+  out += ",\"p999\":" + std::to_string(quantile(0.999));
+  out += ",\"buckets\":[";
+  bool first = true;
+  for (int i = 0; i < BUCKETS; i++) {
+    uint64_t n = buckets[i].load(std::memory_order_relaxed);
+    if (n == 0)
+      continue;
+    if (!first)
+      out += ",";
+    first = false;
+    out += "[" + std::to_string(bucket_lowest(i)) + "," + std::to_string(n) + "]";
+  }
+  out += "]}";
+}
+
+Metrics::command_metrics_t::command_metrics_t() : received(0), failed(0) {}
+
+Metrics::Metrics(std::vector<std::string> command_names)
+    : command_names(command_names), commands(new command_metrics_t[command_names.size()]) {}
+
+Metrics::command_metrics_t *Metrics::get(int type) {
+  if (type < 0 || (size_t)type >= command_names.size())
+    return nullptr;
+  return &commands[type];
+}
+
+void Metrics::command_received(int type) {
+  if (auto m = get(type))
+    m->received.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::command_failed(int type) {
+  if (auto m = get(type))
+    m->failed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::task_queued(int type, clock::duration latency) {
+  if (auto m = get(type))
+    m->queueing.record(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+}
+
+void Metrics::task_executed(int type, clock::duration latency) {
+  if (auto m = get(type))
+    m->execution.record(std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count());
+}
+
+void Metrics::to_json(std::string &out) const {
+  out += "{";
+  bool first = true;
+  for (size_t i = 0; i < command_names.size(); i++) {
+    const command_metrics_t &m = commands[i];
+    uint64_t received = m.received.load(std::memory_order_relaxed);
+    if (received == 0)
+      continue;
+    if (!first)
+      out += ",";
+    first = false;
+    out += "\"" + command_names[i] + "\":{\"received\":" + std::to_string(received);
+    out += ",\"failed\":" + std::to_string(m.failed.load(std::memory_order_relaxed));
+    out += ",\"queueing_ns\":";
+    m.queueing.to_json(out);
+    out += ",\"execution_ns\":";
+    m.execution.to_json(out);
+    out += "}";
+  }
+  out += "}";
+}
+
+} // namespace hhal_daemon
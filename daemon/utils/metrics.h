@@ -0,0 +1,85 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace hhal_daemon {
+
+/*
+* Latency histogram with log-linear buckets, in the spirit of HDR histograms.
+* Every power of two is split in SUB_BUCKETS linear buckets, so recorded values are kept within 12.5%.
+* Recording is lock free and can be done from any thread, reads see a possibly slightly inconsistent snapshot.
+*/
+class LatencyHistogram {
+
+public:
+  static const int SUB_BUCKET_BITS = 3;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  LatencyHistogram();
+
+  void record(uint64_t value);
+
+  uint64_t count() const;
+  // Lowest value recorded in the bucket holding the given quantile, 0 if empty
+  uint64_t quantile(double q) const;
+
+  // JSON object with count, sum, quantiles and the non empty buckets as [lowest value, count] pairs
+  void to_json(std::string &out) const;
+
+  static int bucket_of(uint64_t value);
+  static uint64_t bucket_lowest(int bucket);
+
+private:
+  std::atomic<uint64_t> buckets[BUCKETS];
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> sum;
+  std::atomic<uint64_t> max;
+};
+
+/*
+* Always on daemon counters, per command type. Thread safe.
+* Queueing is the time from a command being parsed to one of its tasks starting on a worker,
+* execution the time the task took. Commands whose work spans several tasks record each of them.
+*/
+class Metrics {
+
+public:
+  typedef std::chrono::steady_clock clock;
+
+  // Command types are indexes from 0 to command_count - 1, names are used for the output
+  Metrics(std::vector<std::string> command_names);
+
+  void command_received(int type);
+  void command_failed(int type);
+  void task_queued(int type, clock::duration latency);
+  void task_executed(int type, clock::duration latency);
+
+  // JSON object with an entry per command type that was received at least once
+  void to_json(std::string &out) const;
+
+private:
+  struct command_metrics_t {
+    std::atomic<uint64_t> received;
+    std::atomic<uint64_t> failed;
+    LatencyHistogram queueing;
+    LatencyHistogram execution;
+
+    command_metrics_t();
+  };
+
+  const std::vector<std::string> command_names;
+  std::unique_ptr<command_metrics_t[]> commands;
+
+  command_metrics_t *get(int type);
+};
+
+} // namespace hhal_daemon
+
+#endif // METRICS_H
@@ -0,0 +1,48 @@
+#include "utils/serial_executor.h"
+
+namespace hhal_daemon {
+
+std::shared_ptr<SerialExecutor> SerialExecutor::create(ThreadPool &pool) {
+  return std::shared_ptr<SerialExecutor>(new SerialExecutor(pool));
+}
+
+SerialExecutor::SerialExecutor(ThreadPool &pool) : pool(pool) {}
+
+void SerialExecutor::push_task(task_t task) {
+  std::unique_lock<std::mutex> lock(mutex);
+  tasks.push(std::move(task));
+  if (!scheduled) {
+    scheduled = true;
+    auto self = shared_from_this();
+    pool.push_task([self] { self->run_next(); });
+  }
+}
+
+bool SerialExecutor::is_idle() {
+  std::unique_lock<std::mutex> lock(mutex);
+  return !scheduled;
+}
+
+// Runs a single task and goes back to the end of the pool queue if more are pending,
+// so a busy connection does not keep a worker away from the others.
+void SerialExecutor::run_next() {
+  task_t task;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    task = std::move(tasks.front());
+    tasks.pop();
+  }
+
+  task();
+  task = nullptr;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (tasks.empty()) {
+    scheduled = false;
+  } else {
+    auto self = shared_from_this();
+    pool.push_task([self] { self->run_next(); });
+  }
+}
+
+} // namespace hhal_daemon
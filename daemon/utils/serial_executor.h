@@ -0,0 +1,48 @@
+#ifndef SERIAL_EXECUTOR_H
+#define SERIAL_EXECUTOR_H
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+
+#include "utils/thread_pool.h"
+
+namespace hhal_daemon {
+
+/*
+* Runs tasks on a shared ThreadPool one at a time, in the order they were pushed.
+* Different executors on the same pool run concurrently with each other.
+* Always handled through a shared_ptr, tasks waiting on the pool keep the executor alive.
+*/
+class SerialExecutor : public std::enable_shared_from_this<SerialExecutor> {
+
+public:
+  typedef std::function<void()> task_t;
+
+  static std::shared_ptr<SerialExecutor> create(ThreadPool &pool);
+
+  /*
+  * \brief Queue a task to run after every task previously pushed to this executor. Thread safe.
+  */
+  void push_task(task_t task);
+
+  /*
+  * \returns Whether there are no tasks queued or running.
+  */
+  bool is_idle();
+
+private:
+  SerialExecutor(ThreadPool &pool);
+
+  ThreadPool &pool;
+  std::mutex mutex;
+  std::queue<task_t> tasks;
+  bool scheduled = false; // Whether a run_next is queued on, or running in, the pool
+
+  void run_next();
+};
+
+} // namespace hhal_daemon
+
+#endif // SERIAL_EXECUTOR_H
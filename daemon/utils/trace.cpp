@@ -0,0 +1,95 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "utils/trace.h"
+
+namespace hhal_daemon {
+
+TraceWriter::~TraceWriter() {
+  close_file();
+}
+
+bool TraceWriter::open(const std::string &path) {
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  trace_file_header header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.version = TRACE_VERSION;
+  struct iovec iov = {&header, sizeof(header)};
+  if (!write_all(&iov, 1))
+    return false;
+  start = std::chrono::steady_clock::now();
+  return true;
+}
+
+bool TraceWriter::record(trace_record_type type, int connection, const void *buf, size_t size) {
+  trace_record_header header;
+  header.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  header.connection = connection;
+  header.type = type;
+  header.size = size;
+  struct iovec iov[2] = {{&header, sizeof(header)}, {(void *)buf, size}};
+  return write_all(iov, size > 0 ? 2 : 1);
+}
+
+bool TraceWriter::write_all(struct iovec *iov, int count) {
+  while (count > 0) {
+    ssize_t written = writev(fd, iov, count);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0) {
+      close_file();
+      return false;
+    }
+    while (count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0) {
+      iov->iov_base = (char *)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+void TraceWriter::close_file() {
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+}
+
+TraceReader::~TraceReader() {
+  if (file)
+    fclose(file);
+}
+
+bool TraceReader::open(const std::string &path) {
+  file = fopen(path.c_str(), "rbe");
+  if (!file)
+    return false;
+
+  trace_file_header header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != TRACE_VERSION) {
+    fclose(file);
+    file = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool TraceReader::next(trace_record_header &header, std::vector<char> &data) {
+  if (fread(&header, sizeof(header), 1, file) != 1)
+    return false;
+  data.resize(header.size);
+  return header.size == 0 || fread(data.data(), header.size, 1, file) == 1;
+}
+
+} // namespace hhal_daemon
@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cinttypes>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace hhal_daemon {
+
+/*
+* Binary trace of the traffic received by the daemon, replayed by tools/hhal_replay.
+* The file starts with a trace_file_header, followed by records made of a trace_record_header and size bytes.
+* Commands are stored as they came on the wire, request header included, and payloads follow their command
+* in one or more DATA records.
+*/
+enum class trace_record_type : uint32_t {
+  COMMAND, // Bytes of a parsed command
+  DATA,    // Part of the payload of the previous command of the connection
+  CLOSE,   // Connection closed, its id may be used by a later connection
+};
+
+struct trace_file_header {
+  char magic[8];
+  uint32_t version;
+};
+
+struct trace_record_header {
+  uint64_t time_ns; // Since the trace was opened
+  int32_t connection;
+  trace_record_type type;
+  uint64_t size;
+};
+
+static const char TRACE_MAGIC[8] = {'H', 'H', 'A', 'L', 'T', 'R', 'C', '\0'};
+static const uint32_t TRACE_VERSION = 1;
+
+/*
+* Appends records to a trace file. Not thread safe, the daemon only records from the server loop.
+* Every record is written right away with a single system call, so the trace survives the daemon being killed.
+* Recording stops on the first write error, record returns false and the writer is closed.
+*/
+class TraceWriter {
+
+public:
+  ~TraceWriter();
+
+  bool open(const std::string &path);
+  inline bool is_open() const {
+    return fd >= 0;
+  }
+
+  bool record(trace_record_type type, int connection, const void *buf, size_t size);
+
+private:
+  int fd = -1;
+  std::chrono::steady_clock::time_point start;
+
+  bool write_all(struct iovec *iov, int count);
+  void close_file();
+};
+
+class TraceReader {
+
+public:
+  ~TraceReader();
+
+  // false if the file can not be read or is not a trace
+  bool open(const std::string &path);
+
+  // false at the end of the trace, or if it is truncated
+  bool next(trace_record_header &header, std::vector<char> &data);
+
+private:
+  FILE *file = nullptr;
+};
+
+} // namespace hhal_daemon
+
+#endif // TRACE_H
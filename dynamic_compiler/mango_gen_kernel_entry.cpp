@@ -3,8 +3,12 @@
 #include <string>
 #include <fstream>
 #include <assert.h>
+#include <stddef.h>
 #include <types.h>
 
+#include "gn/executor_pool.h"
+#include "gn/types.h"
+
 struct parameter {
     bool pointer = false;
     std::string type;
@@ -100,31 +104,70 @@ bool generate_entrypoint(std::string file_path, std::string output_path, hhal::U
     std::ofstream out_file(output_path);
     //includes
     out_file << "#include \"dev/mango_hn.h\"\n"
-                "#include <stdlib.h>\n";
+                "#include <limits.h>\n"
+                "#include <stdlib.h>\n"
+                "#include <string.h>\n"
+                "#include <stdint.h>\n"
+                "#include <unistd.h>\n"
+                "#include <linux/futex.h>\n"
+                "#include <sys/mman.h>\n"
+                "#include <sys/syscall.h>\n";
     //extern kernel
     out_file << "extern " << kernel_proto << ";\n\n";
-    //main
-    out_file << "int main(int argc, char **argv) {\n"
-	            "\tmango_init(argv);\n";
+    //argument decoders, for the argument block written by HHAL, see gn/types.h, or the command line
+    out_file << "static char **mango_args_argv;\n"
+                "static char *mango_args_block;\n\n"
+                "static uint64_t mango_arg(int i) {\n"
+                "\tuint64_t word;\n"
+                "\tif (mango_args_block == NULL) return strtoull(mango_args_argv[" << arch_i << " + i], NULL, 16);\n"
+                "\tmemcpy(&word, mango_args_block + " << sizeof(hhal::gn_args_block_header) << " + 8 * i, sizeof(word));\n"
+                "\treturn word;\n"
+                "}\n\n"
+                "static double mango_arg_double(int i) {\n"
+                "\tdouble value;\n"
+                "\tif (mango_args_block == NULL) return strtod(mango_args_argv[" << arch_i << " + i], NULL);\n"
+                "\tmemcpy(&value, mango_args_block + " << sizeof(hhal::gn_args_block_header) << " + 8 * i, sizeof(value));\n"
+                "\treturn value;\n"
+                "}\n\n"
+                "static void mango_args_release(void) {\n"
+                "\tif (mango_args_block == NULL) return;\n"
+                "\tuint32_t *owner = (uint32_t *)(mango_args_block + " << offsetof(hhal::gn_args_block_header, owner) << ");\n"
+                "\t__atomic_store_n(owner, 0, __ATOMIC_RELEASE);\n"
+                "\tsyscall(SYS_futex, owner, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);\n"
+                "}\n\n";
+    //single run of the kernel, from its command line or an executor launch
+    //a launch with another amount of arguments is recorded as failed, and still terminated so nobody waits for it
+    out_file << "static int mango_run_kernel(int argc, char **argv) {\n"
+	            "\tmango_init(argv);\n"
+                "\tmango_args_argv = argv;\n"
+                "\tmango_args_block = NULL;\n"
+                "\tif (argc == " << arch_i + 2 << " && strcmp(argv[" << arch_i << "], \"" GN_ARGS_BLOCK_FLAG "\") == 0) {\n"
+                "\t\tmango_args_block = (char *)mango_memory_map(strtoul(argv[" << arch_i + 1 << "], NULL, 16));\n"
+                "\t\tif (*(uint32_t *)mango_args_block != " << params.size() << ") {\n"
+                "\t\t\tuint32_t *header = (uint32_t *)mango_args_block;\n"
+                "\t\t\t__atomic_store_n(&header[" << offsetof(hhal::gn_args_block_header, failed) / sizeof(uint32_t) << "], "
+                "__atomic_load_n(&header[" << offsetof(hhal::gn_args_block_header, owner) / sizeof(uint32_t) << "], __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);\n"
+                "\t\t\tmango_args_release();\n"
+                "\t\t\tmango_close(42);\n"
+                "\t\t\treturn 1;\n"
+                "\t\t}\n"
+                "\t}\n";
 
     //params
     for(unsigned int j = 0; j < params.size(); ++j) {
         parameter param = params[j];
         if(param.pointer) {
-            out_file << "\t" << param.join() << " = (" << param.type << ")mango_memory_map(strtol(argv[" << arch_i << "],NULL,16));\n";
+            out_file << "\t" << param.join() << " = (" << param.type << ")mango_memory_map(mango_arg(" << j << "));\n";
         } else if (param.type == "mango_event_t") {
             out_file << "\t" << param.join() << ";\n";
-            out_file << "\t" << param.name << ".vaddr = (uint32_t *)mango_memory_map(strtol(argv[" << arch_i << "],NULL,16));\n";
-        } else if (param.type == "float") {
-            out_file << "\t" << param.join() << " = strtof(argv[" << arch_i << "],NULL,16);\n";
-        } else if (param.type == "double") {
-            out_file << "\t" << param.join() << " = strtod(argv[" << arch_i << "],NULL,16);\n";
+            out_file << "\t" << param.name << ".vaddr = (uint32_t *)mango_memory_map(mango_arg(" << j << "));\n";
+        } else if (param.type == "float" || param.type == "double") {
+            out_file << "\t" << param.join() << " = (" << param.type << ")mango_arg_double(" << j << ");\n";
         } else if (check_int_type(param.type)) {
-            out_file << "\t" << param.join() << " = strtol(argv[" << arch_i << "],NULL,16);\n";
+            out_file << "\t" << param.join() << " = (" << param.type << ")mango_arg(" << j << ");\n";
         } else {
             assert(false && "Unrecognized type");
         }
-        ++arch_i;
     }
 
     //kernel call
@@ -136,9 +179,51 @@ bool generate_entrypoint(std::string file_path, std::string output_path, hhal::U
     }
     out_file << ");\n\n";
 
-    //mango close
+    //mango close, the argument block is free for the next launch once the kernel returned
+    out_file << "\tmango_args_release();\n";
     out_file << "\tmango_close(42);\n";
-    out_file << "}";
+    out_file << "\treturn 0;\n";
+    out_file << "}\n\n";
+
+    //executor loop, see gn/executor_pool.h
+    out_file << "struct mango_executor_mailbox {\n"
+                "\tuint32_t state;\n"
+                "\tuint32_t argc;\n"
+                "\tuint32_t size;\n"
+                "\tchar args[" << GN_EXECUTOR_ARGS_SIZE << "];\n"
+                "};\n\n";
+    out_file << "static int mango_executor(void) {\n"
+                "\tstruct mango_executor_mailbox *box = (struct mango_executor_mailbox *)mmap(NULL, sizeof(*box), "
+                "PROT_READ | PROT_WRITE, MAP_SHARED, " << GN_EXECUTOR_MAILBOX_FD << ", 0);\n"
+                "\tif (box == MAP_FAILED) return 1;\n"
+                "\tstatic char args[sizeof(box->args) + 1];\n"
+                "\tstatic char *argv[sizeof(box->args) + 1];\n"
+                "\tfor (;;) {\n"
+                "\t\tuint32_t state = __atomic_load_n(&box->state, __ATOMIC_ACQUIRE);\n"
+                "\t\tif (state == " << GN_EXECUTOR_IDLE << ") {\n"
+                "\t\t\tsyscall(SYS_futex, &box->state, FUTEX_WAIT, " << GN_EXECUTOR_IDLE << ", NULL, NULL, 0);\n"
+                "\t\t\tcontinue;\n"
+                "\t\t}\n"
+                "\t\tif (state != " << GN_EXECUTOR_LAUNCH << ") return 0;\n"
+                "\t\tuint32_t size = box->size < sizeof(box->args) ? box->size : sizeof(box->args);\n"
+                "\t\tmemcpy(args, box->args, size);\n"
+                "\t\targs[size] = '\\0';\n"
+                "\t\tint argc = 0;\n"
+                "\t\tfor (char *arg = args; argc < (int)box->argc && arg < args + size; arg += strlen(arg) + 1) argv[argc++] = arg;\n"
+                "\t\targv[argc] = NULL;\n"
+                "\t\tif (mango_run_kernel(argc, argv) != 0) return 1;\n"
+                "\t\tuint32_t launched = " << GN_EXECUTOR_LAUNCH << ";\n"
+                "\t\tif (!__atomic_compare_exchange_n(&box->state, &launched, " << GN_EXECUTOR_IDLE << ", 0, "
+                "__ATOMIC_RELEASE, __ATOMIC_RELAXED)) return 0;\n"
+                "\t}\n"
+                "}\n\n";
+
+    //main
+    out_file << "int main(int argc, char **argv) {\n"
+                "\tif (argc == 2 && strcmp(argv[1], \"" GN_EXECUTOR_FLAG "\") == 0)\n"
+                "\t\treturn mango_executor();\n"
+                "\treturn mango_run_kernel(argc, argv);\n"
+                "}";
     out_file.close();
 
     return true;
@@ -5,6 +5,8 @@
  * Generates an entrypoint for a kernel.
  * Requires the pragma: #pragma mango_gen_entrypoint
  *  which needs to be present before the mango_kernel pragma.
+ * The kernel can also be started as a GN kernel executor, see gn/executor_pool.h,
+ * and reads its arguments from the argument block when started with GN_ARGS_BLOCK_FLAG, see gn/types.h.
  * Returns true if an entrypoint was generated.
  */
 bool generate_entrypoint(std::string file_path, std::string output_path, hhal::Unit type);
@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <chrono>
+
+#include "gn/completion_watcher.h"
+
+// Bounds of the interval between checks while no watched register changes
+#define MIN_POLL_INTERVAL std::chrono::microseconds(20)
+#define MAX_POLL_INTERVAL std::chrono::microseconds(1000)
+
+namespace hhal {
+
+CompletionWatcher::~CompletionWatcher() {
+    stop();
+}
+
+void CompletionWatcher::watch(const volatile uint32_t *reg, uint32_t value, callback_t done) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopping) {
+        lock.unlock();
+        done(false);
+        return;
+    }
+    watches.push_back({reg, value, std::move(done)});
+    added = true;
+    if (!thread.joinable()) {
+        thread = std::thread(&CompletionWatcher::run, this);
+    }
+    cv.notify_one();
+}
+
+void CompletionWatcher::stop() {
+    std::vector<watch_t> pending;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        cv.notify_one();
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        pending.swap(watches);
+    }
+    for (auto &w: pending) {
+        w.done(false);
+    }
+}
+
+void CompletionWatcher::run() {
+    std::chrono::microseconds interval = MIN_POLL_INTERVAL;
+    std::vector<callback_t> completed;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (watches.empty()) {
+            cv.wait(lock, [this] { return stopping || !watches.empty(); });
+            interval = MIN_POLL_INTERVAL;
+            continue;
+        }
+
+        for (size_t i = 0; i < watches.size();) {
+            if (__atomic_load_n(watches[i].reg, __ATOMIC_ACQUIRE) == watches[i].value) {
+                completed.push_back(std::move(watches[i].done));
+                watches[i] = std::move(watches.back());
+                watches.pop_back();
+            } else {
+                ++i;
+            }
+        }
+
+        if (!completed.empty()) {
+            // Callbacks may start more kernels and watch them
+            lock.unlock();
+            for (auto &done: completed) {
+                done(true);
+            }
+            completed.clear();
+            lock.lock();
+            interval = MIN_POLL_INTERVAL;
+            continue;
+        }
+
+        added = false;
+        cv.wait_for(lock, interval, [this] { return stopping || added; });
+        interval = added ? MIN_POLL_INTERVAL : std::min(interval * 2, MAX_POLL_INTERVAL);
+    }
+}
+
+}
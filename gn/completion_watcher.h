@@ -0,0 +1,51 @@
+#ifndef GN_COMPLETION_WATCHER_H
+#define GN_COMPLETION_WATCHER_H
+
+#include <condition_variable>
+#include <cinttypes>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hhal {
+
+/*
+* Completes the kernels started on GN, which signal their termination by writing their termination event on the
+* device. Watched registers are checked from a single thread, backing off while none of them changes, so callers
+* can block on many kernels without polling themselves. The thread is started by the first watch.
+* Registers are only read, the termination event keeps its value for anybody else waiting on it.
+*/
+class CompletionWatcher {
+    public:
+        // Receives true once the register held the value, false if the watcher stopped before
+        typedef std::function<void(bool done)> callback_t;
+
+        ~CompletionWatcher();
+
+        // Calls done from the watcher thread once *reg holds value. Thread safe.
+        void watch(const volatile uint32_t *reg, uint32_t value, callback_t done);
+
+        // Fails the pending watches and joins the thread
+        void stop();
+
+    private:
+        struct watch_t {
+            const volatile uint32_t *reg;
+            uint32_t value;
+            callback_t done;
+        };
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::vector<watch_t> watches;
+        bool added = false;
+        bool stopping = false;
+        std::thread thread;
+
+        void run();
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gn/executor_pool.h"
+#include "gn/hnemu/logger.h"
+
+#define DEFAULT_EXECUTORS_PER_KERNEL 2
+// Time given to executors to finish their kernel once asked to exit, before they are killed
+#define EXIT_GRACE_PERIOD std::chrono::milliseconds(1000)
+
+extern char **environ;
+
+namespace hhal {
+
+extern ConsoleLogger log_hhal;
+
+ExecutorPool::ExecutorPool(ProcessWatcher &processes): processes(processes) {
+    const char *env = getenv("HHAL_GN_EXECUTORS");
+    executors_per_kernel = env != nullptr ? std::max(atoi(env), 0) : DEFAULT_EXECUTORS_PER_KERNEL;
+}
+
+ExecutorPool::~ExecutorPool() {
+    stop();
+}
+
+void ExecutorPool::load(int kernel_id, const std::string &image, bool supports_executors) {
+    kernel_executors loaded = {image, {}};
+    if (executors_per_kernel > 0 && supports_executors) {
+        for (int i = 0; i < executors_per_kernel; i++) {
+            executor_t executor;
+            if (spawn(image, executor)) {
+                loaded.executors.push_back(executor);
+            }
+        }
+        log_hhal.Debug("GNManager: kernel %d: %zu executors started for %s", kernel_id, loaded.executors.size(), image.c_str());
+    }
+
+    std::vector<executor_t> replaced;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = kernels.find(kernel_id);
+        if (it != kernels.end()) {
+            replaced.swap(it->second.executors);
+            kernels.erase(it);
+        }
+        if (!loaded.executors.empty()) {
+            kernels[kernel_id] = std::move(loaded);
+        }
+    }
+    terminate(replaced);
+}
+
+void ExecutorPool::unload(int kernel_id) {
+    std::vector<executor_t> unloaded;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = kernels.find(kernel_id);
+        if (it == kernels.end()) return;
+        unloaded.swap(it->second.executors);
+        kernels.erase(it);
+    }
+    terminate(unloaded);
+}
+
+bool ExecutorPool::launch(int kernel_id, const std::vector<std::string> &argv, exit_callback_t on_exit) {
+    // Arguments are passed as they are, each followed by a NUL, so they may hold spaces
+    std::string arguments;
+    for (const std::string &arg: argv) {
+        arguments.append(arg.c_str(), arg.size() + 1);
+    }
+    if (arguments.size() > GN_EXECUTOR_ARGS_SIZE) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = kernels.find(kernel_id);
+    if (it == kernels.end()) {
+        return false;
+    }
+
+    std::vector<executor_t> &executors = it->second.executors;
+    bool launched = false;
+    for (executor_t &executor: executors) {
+        gn_executor_mailbox *mailbox = executor.mailbox;
+        if (__atomic_load_n(&mailbox->state, __ATOMIC_ACQUIRE) != GN_EXECUTOR_IDLE) {
+            continue;
+        }
+        {
+            // Set before the launch is posted, so an executor exiting from now on reports it
+            std::lock_guard<std::mutex> status_lock(executor.status->mutex);
+            if (executor.status->exited) {
+                continue;
+            }
+            executor.status->on_exit = std::move(on_exit);
+        }
+        memcpy(mailbox->args, arguments.data(), arguments.size());
+        mailbox->argc = argv.size();
+        mailbox->size = arguments.size();
+        __atomic_store_n(&mailbox->state, GN_EXECUTOR_LAUNCH, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &mailbox->state, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+        launched = true;
+        break;
+    }
+
+    // Replace the executors that exited, such as those of kernels ending their process once done
+    for (size_t i = 0; i < executors.size();) {
+        executor_t &executor = executors[i];
+        if (executor.pid > 0 && !exited(executor)) {
+            ++i;
+            continue;
+        }
+        munmap(executor.mailbox, sizeof(gn_executor_mailbox));
+        if (spawn(it->second.image, executor)) {
+            ++i;
+        } else {
+            executors.erase(executors.begin() + i);
+        }
+    }
+    return launched;
+}
+
+void ExecutorPool::stop() {
+    std::map<int, kernel_executors> stopped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped.swap(kernels);
+    }
+    for (auto &kernel: stopped) {
+        terminate(kernel.second.executors);
+    }
+}
+
+bool ExecutorPool::spawn(const std::string &image, executor_t &executor) {
+    int fd = memfd_create("hhal_gn_executor", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, sizeof(gn_executor_mailbox)) < 0) {
+        log_hhal.Error("GNManager: executor mailbox: %s", strerror(errno));
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    void *mailbox = mmap(nullptr, sizeof(gn_executor_mailbox), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // Moved above the descriptor the executor expects, so dup2 always gives it a copy without FD_CLOEXEC
+    int shared_fd = fcntl(fd, F_DUPFD_CLOEXEC, GN_EXECUTOR_MAILBOX_FD + 1);
+    close(fd);
+    if (mailbox == MAP_FAILED || shared_fd < 0) {
+        log_hhal.Error("GNManager: executor mailbox: %s", strerror(errno));
+        if (mailbox != MAP_FAILED) munmap(mailbox, sizeof(gn_executor_mailbox));
+        if (shared_fd >= 0) close(shared_fd);
+        return false;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, shared_fd, GN_EXECUTOR_MAILBOX_FD);
+    char *argv[] = {const_cast<char *>(image.c_str()), const_cast<char *>(GN_EXECUTOR_FLAG), nullptr};
+    pid_t pid;
+    int err = posix_spawn(&pid, image.c_str(), &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(shared_fd);
+    if (err != 0) {
+        log_hhal.Error("GNManager: starting executor %s: %s", image.c_str(), strerror(err));
+        munmap(mailbox, sizeof(gn_executor_mailbox));
+        return false;
+    }
+
+    std::shared_ptr<executor_status> status = std::make_shared<executor_status>();
+    bool watched = processes.watch(pid, [status](bool reaped, const ProcessWatcher::process_exit &exit) {
+        exit_callback_t on_exit;
+        {
+            std::lock_guard<std::mutex> lock(status->mutex);
+            if (!reaped) {
+                status->unwatched = true;
+                return;
+            }
+            status->exited = true;
+            on_exit.swap(status->on_exit);
+        }
+        if (on_exit) {
+            on_exit(exit);
+        }
+        std::lock_guard<std::mutex> lock(status->mutex);
+        status->reported = true;
+    });
+    if (!watched) {
+        log_hhal.Error("GNManager: cannot watch executor %s", image.c_str());
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        munmap(mailbox, sizeof(gn_executor_mailbox));
+        return false;
+    }
+
+    executor.pid = pid;
+    executor.mailbox = static_cast<gn_executor_mailbox *>(mailbox);
+    executor.status = status;
+    return true;
+}
+
+bool ExecutorPool::exited(executor_t &executor) {
+    if (executor.pid <= 0) {
+        return true;
+    }
+    executor_status &status = *executor.status;
+    std::lock_guard<std::mutex> lock(status.mutex);
+    if (status.unwatched && !status.reported && waitpid(executor.pid, nullptr, WNOHANG) != 0) {
+        status.exited = status.reported = true;
+    }
+    return status.reported;
+}
+
+void ExecutorPool::terminate(std::vector<executor_t> &executors) {
+    for (executor_t &executor: executors) {
+        // A busy executor sees it once its kernel returns
+        __atomic_store_n(&executor.mailbox->state, GN_EXECUTOR_EXIT, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &executor.mailbox->state, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+    auto deadline = std::chrono::steady_clock::now() + EXIT_GRACE_PERIOD;
+    for (executor_t &executor: executors) {
+        bool killed = false;
+        while (!exited(executor)) {
+            if (!killed && std::chrono::steady_clock::now() > deadline) {
+                log_hhal.Warn("GNManager: killing executor %d, still running its kernel", executor.pid);
+                kill(executor.pid, SIGKILL);
+                killed = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        munmap(executor.mailbox, sizeof(gn_executor_mailbox));
+    }
+    executors.clear();
+}
+
+}
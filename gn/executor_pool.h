@@ -0,0 +1,106 @@
+#ifndef GN_EXECUTOR_POOL_H
+#define GN_EXECUTOR_POOL_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cinttypes>
+#include <sys/types.h>
+
+#include "gn/process_watcher.h"
+
+// Passed as the only argument to start a kernel image as an executor. Its presence in the image tells it supports it.
+#define GN_EXECUTOR_FLAG "--hhal-gn-executor-2"
+// Descriptor of the mailbox in the executor
+#define GN_EXECUTOR_MAILBOX_FD 3
+// Bytes of arguments an executor takes, each followed by a NUL. Longer launches start a new process.
+#define GN_EXECUTOR_ARGS_SIZE 4096
+
+// Mailbox states, the executor waits on state with a futex while it is GN_EXECUTOR_IDLE
+#define GN_EXECUTOR_IDLE 0
+#define GN_EXECUTOR_LAUNCH 1
+#define GN_EXECUTOR_EXIT 2
+
+namespace hhal {
+
+// Shared with one executor. Mirrored by the executor loop written by dynamic_compiler/mango_gen_kernel_entry.cpp.
+struct gn_executor_mailbox {
+    uint32_t state;
+    uint32_t argc;
+    // Bytes of args used
+    uint32_t size;
+    char args[GN_EXECUTOR_ARGS_SIZE];
+};
+
+/*
+* Processes started once per kernel image at kernel_write time, which run the kernel for every launch handed to
+* them instead of a new process being created. Launches are posted to an idle executor through a shared memory
+* mailbox holding the arguments the kernel gets on its command line, the executor goes back to idle once
+* the kernel returns. Only images built with the entry generated by the dynamic compiler can be executors, others,
+* and launches finding every executor of the kernel busy, are started as a new process by the caller.
+* Kernels run by an executor keep their static state from one launch to the next.
+* Executors are reaped by the process watcher, which reports their exit to the last launch they took.
+* The amount of executors per kernel is read from HHAL_GN_EXECUTORS, 0 disables them.
+* Thread safe.
+*/
+class ExecutorPool {
+    public:
+        // Receives how the executor ended, called from the process watcher thread
+        typedef std::function<void(const ProcessWatcher::process_exit &exit)> exit_callback_t;
+
+        explicit ExecutorPool(ProcessWatcher &processes);
+        ~ExecutorPool();
+
+        // Starts the executors of the kernel if the image supports them, replacing those of a previous image
+        void load(int kernel_id, const std::string &image, bool supports_executors);
+        void unload(int kernel_id);
+
+        /*
+        * Hands the launch to an idle executor of the kernel, false if there was none. on_exit is called once the
+        * executor exits, unless it took another launch before: a launch whose executor crashed never terminates.
+        */
+        bool launch(int kernel_id, const std::vector<std::string> &argv, exit_callback_t on_exit = nullptr);
+
+        // Stops every executor, waiting for the kernels they run
+        void stop();
+
+    private:
+        // Shared with the exit callback given to the process watcher
+        struct executor_status {
+            std::mutex mutex;
+            // Reaped by the process watcher, and on_exit returned since
+            bool exited = false;
+            bool reported = false;
+            // Left running by a stopped process watcher, reaped by the pool itself
+            bool unwatched = false;
+            exit_callback_t on_exit;
+        };
+
+        struct executor_t {
+            pid_t pid;
+            gn_executor_mailbox *mailbox;
+            std::shared_ptr<executor_status> status;
+        };
+
+        struct kernel_executors {
+            std::string image;
+            std::vector<executor_t> executors;
+        };
+
+        ProcessWatcher &processes;
+        int executors_per_kernel;
+        std::mutex mutex;
+        std::map<int, kernel_executors> kernels;
+
+        bool spawn(const std::string &image, executor_t &executor);
+        // Whether the executor exited and its exit was reported
+        static bool exited(executor_t &executor);
+        static void terminate(std::vector<executor_t> &executors);
+};
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gn/kernel_image.h"
+#include "gn/executor_pool.h"
+#include "gn/types.h"
+#include "gn/hnemu/logger.h"
+
+namespace hhal {
+
+extern ConsoleLogger log_hhal;
+
+static bool contains(const char *data, size_t size, const char *marker) {
+    return memmem(data, size, marker, strlen(marker)) != nullptr;
+}
+
+kernel_image_features scan_kernel_image(const std::string &path) {
+    kernel_image_features features = {false, false};
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        log_hhal.Debug("GNManager: kernel image %s: %s", path.c_str(), fd < 0 ? strerror(errno) : "empty");
+        if (fd >= 0) close(fd);
+        return features;
+    }
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        log_hhal.Debug("GNManager: kernel image %s: %s", path.c_str(), strerror(errno));
+        return features;
+    }
+    features.executors = contains(static_cast<const char *>(data), st.st_size, GN_EXECUTOR_FLAG);
+    features.args_block = contains(static_cast<const char *>(data), st.st_size, GN_ARGS_BLOCK_FLAG);
+    munmap(data, st.st_size);
+    return features;
+}
+
+}
@@ -0,0 +1,22 @@
+#ifndef GN_KERNEL_IMAGE_H
+#define GN_KERNEL_IMAGE_H
+
+#include <string>
+
+namespace hhal {
+
+// What the entry of a kernel image understands, told by the flags it holds, see GN_EXECUTOR_FLAG and GN_ARGS_BLOCK_FLAG
+struct kernel_image_features {
+    bool executors;
+    bool args_block;
+};
+
+/*
+* Looks for the flags in the image at kernel_write time. The file is mapped and searched in place, so it is never
+* copied whatever its size. An image that can not be read supports neither, its launches fail when it is started.
+*/
+kernel_image_features scan_kernel_image(const std::string &path);
+
+}
+
+#endif
@@ -3,12 +3,21 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <climits>
+#include <algorithm>
+#include <chrono>
+#include <memory>
 #include <sstream>
 
 #include "gn/manager.h"
+#include "gn/kernel_image.h"
 #include "gn/hnemu/hnemu.h"
 #include "gn/hnemu/hn_include/hn_errcode.h"
 
@@ -32,6 +41,17 @@
 
 #define UNUSED(x) ((void)x)
 
+// Longest a wait on a sync register sleeps without checking it, writes from outside this process do not wake it
+#define SYNC_WAIT_RECHECK std::chrono::milliseconds(1)
+
+// Copies the entry of id out of a handle table, failing the calling operation if it is unknown
+#define FIND_OR_FAIL(type, var, table, id, what)                                    \
+        type var;                                                                   \
+        if (!find_entry(table, id, var)) {                                          \
+            log_hhal.Error("GNManager: %s: unknown " what " %d", __func__, id);     \
+            return GNManagerExitCode::ERROR;                                        \
+        }
+
 namespace hhal {
 
 ConsoleLogger log_hhal;
@@ -40,6 +60,55 @@ addr_t *GNManager::mem;
 sem_t *GNManager::sem_id;
 int GNManager::f_mem;
 std::map<uint32_t, std::vector<addr_t>> GNManager::event_register_off;
+std::mutex GNManager::allocation_mtx;
+
+template <typename T>
+bool GNManager::find_entry(const HandleTable<T> &table, int id, T &entry) const {
+    shared_lock lock(resources_mtx);
+    const T *found = table.find(id);
+    if (found == nullptr) {
+        return false;
+    }
+    entry = *found;
+    return true;
+}
+
+// Holds the semaphore, if any, for its lifetime
+class semaphore_guard {
+    public:
+        explicit semaphore_guard(sem_t *sem) : sem(sem) {
+            if (sem != nullptr) sem_wait(sem);
+        }
+        ~semaphore_guard() {
+            if (sem != nullptr) sem_post(sem);
+        }
+
+    private:
+        sem_t *sem;
+};
+
+static std::string join_arguments(const std::vector<std::string> &argv) {
+    std::string joined;
+    for (const std::string &arg: argv) {
+        if (!joined.empty()) joined += ' ';
+        joined += arg;
+    }
+    return joined;
+}
+
+static void log_kernel_exit(int kernel_id, const ProcessWatcher::process_exit &exit) {
+    if (exit.status < 0) {
+        return;
+    }
+    double runtime_ms = std::chrono::duration<double, std::milli>(exit.runtime).count();
+    if (WIFSIGNALED(exit.status)) {
+        log_hhal.Warn("GNManager: kernel %d: process %d killed by signal %d after %.3f ms",
+                kernel_id, exit.pid, WTERMSIG(exit.status), runtime_ms);
+    } else {
+        log_hhal.Debug("GNManager: kernel %d: process %d exited with status %d after %.3f ms",
+                kernel_id, exit.pid, WEXITSTATUS(exit.status), runtime_ms);
+    }
+}
 
 GNManagerExitCode GNManager::initialize() {
 
@@ -49,9 +118,14 @@ GNManagerExitCode GNManager::initialize() {
     HNemu::instance()->get_num_clusters(&num_clusters);
     log_hhal.Info("GNManager: Num clusters: %d", num_clusters);
 
-    init_semaphore();
-    if (sem_id == NULL || sem_id == SEM_FAILED) {
-        return GNManagerExitCode::ERROR;
+    const char *sync_registers = getenv("HHAL_GN_SYNC_REGISTERS");
+    semaphore_sync = sync_registers != nullptr && strcmp(sync_registers, "semaphore") == 0;
+    if (semaphore_sync) {
+        log_hhal.Info("GNManager: sync registers accessed under the " MANGO_SEMAPHORE " semaphore");
+        init_semaphore();
+        if (sem_id == NULL || sem_id == SEM_FAILED) {
+            return GNManagerExitCode::ERROR;
+        }
     }
 
     mode_t old_mask = umask(0);
@@ -131,7 +205,11 @@ GNManagerExitCode GNManager::initialize() {
 GNManagerExitCode GNManager::finalize() {
     assert(initialized == true);
 
-    sem_close(sem_id);
+    completion_watcher.stop();
+    executors.stop();
+    if (semaphore_sync) {
+        sem_close(sem_id);
+    }
     close(f_mem);
 
     initialized = false;
@@ -140,55 +218,228 @@ GNManagerExitCode GNManager::finalize() {
 
 GNManagerExitCode GNManager::assign_kernel(gn_kernel *info) {
     log_hhal.Debug("GNManager: Assigning kernel %d", info->id);
-    kernel_info[info->id] = *info;
+    exclusive_lock lock(resources_mtx);
+    if (kernel_info.insert(info->id, *info) == nullptr) {
+        log_hhal.Error("GNManager: kernel id %d out of range", info->id);
+        return GNManagerExitCode::ERROR;
+    }
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::assign_buffer(gn_buffer *info) {
     log_hhal.Debug("GNManager: Assigning buffer %d, size=%zu", info->id, info->size);
-    buffer_info[info->id] = *info;
+    exclusive_lock lock(resources_mtx);
+    if (buffer_info.insert(info->id, *info) == nullptr) {
+        log_hhal.Error("GNManager: buffer id %d out of range", info->id);
+        return GNManagerExitCode::ERROR;
+    }
 
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::assign_event(gn_event *info) {
     log_hhal.Debug("GNManager: Assigning event %d", info->id);
-    event_info[info->id] = *info;
+    exclusive_lock lock(resources_mtx);
+    if (event_info.insert(info->id, *info) == nullptr) {
+        log_hhal.Error("GNManager: event id %d out of range", info->id);
+        return GNManagerExitCode::ERROR;
+    }
 
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::deassign_kernel(int kernel_id) {
     log_hhal.Debug("GNManager: Deassigning kernel %d", kernel_id);
-    kernel_info.erase(kernel_id);
+    exclusive_lock lock(resources_mtx);
+    if (!kernel_info.erase(kernel_id)) {
+        log_hhal.Error("GNManager: Unknown kernel %d", kernel_id);
+        return GNManagerExitCode::ERROR;
+    }
+    kernel_images.erase(kernel_id);
+    lock.unlock();
+    executors.unload(kernel_id);
+    release_args_block(kernel_id);
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::deassign_buffer(int buffer_id) {
     log_hhal.Debug("GNManager: Deassigning buffer %d", buffer_id);
-    buffer_info.erase(buffer_id);
+    exclusive_lock lock(resources_mtx);
+    if (!buffer_info.erase(buffer_id)) {
+        log_hhal.Error("GNManager: Unknown buffer %d", buffer_id);
+        return GNManagerExitCode::ERROR;
+    }
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::deassign_event(int event_id) {
     log_hhal.Debug("GNManager: Deassigning event %d", event_id);
-    event_info.erase(event_id);
+    exclusive_lock lock(resources_mtx);
+    if (!event_info.erase(event_id)) {
+        log_hhal.Error("GNManager: Unknown event %d", event_id);
+        return GNManagerExitCode::ERROR;
+    }
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::kernel_write(int kernel_id, std::string image_path) {
     assert(initialized == true);
     assert(image_path.size() > 0);
-    gn_kernel &info = kernel_info[kernel_id];
-    kernel_images[info.id] = image_path;
+    FIND_OR_FAIL(gn_kernel, info, kernel_info, kernel_id, "kernel");
+    kernel_image_features features = scan_kernel_image(image_path);
+    if (!features.args_block) {
+        release_args_block(info.id);
+    } else if (allocate_args_block(info.id) != GNManagerExitCode::OK) {
+        return GNManagerExitCode::ERROR;
+    }
+    {
+        exclusive_lock lock(resources_mtx);
+        kernel_images.insert(info.id, image_path);
+    }
+    executors.load(info.id, image_path, features.executors);
 
-    log_hhal.Debug("GNManager: kernel_write: cluster=%d,  image_path=%s",
-            allocated_kernel_info[kernel_id].cluster_id, image_path.c_str());
+    log_hhal.Debug("GNManager: kernel_write: kernel=%d,  image_path=%s",
+            info.id, image_path.c_str());
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::kernel_start(int kernel_id, const Arguments &arguments) {
-    gn_kernel &info = kernel_info[kernel_id];
+    kernel_launch launch;
+    GNManagerExitCode ec;
+    ec = get_launch(kernel_id, arguments, launch);
+    if (ec != GNManagerExitCode::OK) {
+        return GNManagerExitCode::ERROR;
+    }
+    ec = kernel_start_launch(kernel_id, launch);
+    if (ec != GNManagerExitCode::OK) {
+        return GNManagerExitCode::ERROR;
+    }
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::prepare_launch(int launch_id, int kernel_id, const Arguments &arguments) {
+    kernel_launch launch;
+    GNManagerExitCode ec = get_launch(kernel_id, arguments, launch);
+    if (ec != GNManagerExitCode::OK) {
+        return GNManagerExitCode::ERROR;
+    }
+    log_hhal.Info("GNManager: Prepared launch %d, kernel argument string:\n%s", launch_id, join_arguments(launch.argv).c_str());
+    exclusive_lock lock(resources_mtx);
+    if (prepared_launches.insert(launch_id, {kernel_id, launch}) == nullptr) {
+        log_hhal.Error("GNManager: launch id %d out of range", launch_id);
+        return GNManagerExitCode::ERROR;
+    }
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::launch(int launch_id) {
+    FIND_OR_FAIL(prepared_launch, prepared, prepared_launches, launch_id, "launch");
+    return kernel_start_launch(prepared.kernel_id, prepared.launch);
+}
+
+GNManagerExitCode GNManager::release_launch(int launch_id) {
+    exclusive_lock lock(resources_mtx);
+    if (!prepared_launches.erase(launch_id)) {
+        log_hhal.Error("GNManager: release_launch: unknown launch %d", launch_id);
+        return GNManagerExitCode::ERROR;
+    }
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::kernel_start(int kernel_id, const Arguments &arguments, completion_t on_completion) {
+    kernel_launch launch;
+    GNManagerExitCode ec = get_launch(kernel_id, arguments, launch);
+    if (ec != GNManagerExitCode::OK) {
+        return GNManagerExitCode::ERROR;
+    }
+    return kernel_start_watched(kernel_id, launch, on_completion);
+}
+
+GNManagerExitCode GNManager::launch(int launch_id, completion_t on_completion) {
+    FIND_OR_FAIL(prepared_launch, prepared, prepared_launches, launch_id, "launch");
+    return kernel_start_watched(prepared.kernel_id, prepared.launch, on_completion);
+}
+
+GNManagerExitCode GNManager::kernel_start_watched(int kernel_id, const kernel_launch &launch, completion_t on_completion) {
+    FIND_OR_FAIL(gn_kernel, info, kernel_info, kernel_id, "kernel");
+    FIND_OR_FAIL(allocated_kernel, allocated, allocated_kernel_info, kernel_id, "kernel");
+    FIND_OR_FAIL(allocated_event, event, allocated_event_info, info.termination_event, "event");
+    int reg_address = event.physical_addr;
+    reg_address -= event.cluster_id * MANGO_REG_SIZE * 4;
+    reg_address /= ADDR_SIZE;
+
+    // Waits for the previous launch to be done with the argument block, before its termination is cleared
+    uint32_t ticket;
+    GNManagerExitCode ec = write_args_block(kernel_id, launch, &ticket);
+    if (ec != GNManagerExitCode::OK) {
+        return ec;
+    }
+    // A termination left over from a previous run would complete the launch right away
+    uint32_t stale;
+    ec = read_sync_register(info.termination_event, &stale);
+    if (ec != GNManagerExitCode::OK) {
+        abandon_args_block(launch.args_block_addr, ticket);
+        return ec;
+    }
+
+    /*
+    * A launch run by an executor completes with its termination event, or with the exit of the executor if that
+    * comes first: kernels may end their executor once done, one that crashed or was killed did not run to the end.
+    */
+    uint32_t block_addr = launch.args_block_addr;
+    std::shared_ptr<std::atomic<bool>> completed = std::make_shared<std::atomic<bool>>(false);
+    auto complete = [this, kernel_id, block_addr, ticket, on_completion, completed](bool done) {
+        if (completed->exchange(true)) {
+            return;
+        }
+        done = done && !args_block_failed(kernel_id, block_addr, ticket);
+        on_completion(done ? GNManagerExitCode::OK : GNManagerExitCode::ERROR);
+    };
+    auto on_exit = [this, kernel_id, block_addr, ticket, complete](const ProcessWatcher::process_exit &exit) {
+        abandon_args_block(block_addr, ticket);
+        log_kernel_exit(kernel_id, exit);
+        complete(WIFEXITED(exit.status) && WEXITSTATUS(exit.status) == 0);
+    };
+    if (executors.launch(kernel_id, launch.argv, on_exit)) {
+        log_hhal.Debug("GNManager: kernel_start: cluster=%d,  unit=%d, executor argument_string=%s",
+                allocated.cluster_id, allocated.unit_id, join_arguments(launch.argv).c_str());
+        completion_watcher.watch(mem + reg_address, 1, complete);
+        return GNManagerExitCode::OK;
+    }
+
+    /*
+    * The kernel writes its termination event before its process exits, so the exit is enough to complete it. The
+    * register is left for its readers to consume: the kernel succeeded if it exited with status 0 and its entry did
+    * not reject the argument block.
+    */
+    bool started = processes.spawn(launch.argv, [this, kernel_id, block_addr, ticket, on_completion](bool exited, const ProcessWatcher::process_exit &exit) {
+        abandon_args_block(block_addr, ticket);
+        if (!exited) {
+            on_completion(GNManagerExitCode::ERROR);
+            return;
+        }
+        log_kernel_exit(kernel_id, exit);
+        bool failed = args_block_failed(kernel_id, block_addr, ticket);
+        if (!failed && (!WIFEXITED(exit.status) || WEXITSTATUS(exit.status) != 0)) {
+            log_hhal.Error("GNManager: kernel %d did not exit successfully", kernel_id);
+            failed = true;
+        }
+        on_completion(failed ? GNManagerExitCode::ERROR : GNManagerExitCode::OK);
+    });
+    if (!started) {
+        abandon_args_block(launch.args_block_addr, ticket);
+        return GNManagerExitCode::ERROR;
+    }
+    log_hhal.Debug("GNManager: kernel_start: cluster=%d,  unit=%d, argument_string=%s",
+            allocated.cluster_id, allocated.unit_id, join_arguments(launch.argv).c_str());
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::get_launch(int kernel_id, const Arguments &arguments, kernel_launch &launch) {
+    FIND_OR_FAIL(gn_kernel, info, kernel_info, kernel_id, "kernel");
+    allocated_buffer block;
+    launch.args_block = find_entry(args_blocks, kernel_id, block);
+    launch.args_block_addr = launch.args_block ? block.physical_addr : 0;
 
     Arguments full_args;
     auto event = info.termination_event;
@@ -201,40 +452,216 @@ GNManagerExitCode GNManager::kernel_start(int kernel_id, const Arguments &argume
         full_args.add_event({event});
     }
 
-    full_args.add_arguments(arguments);
+    if (!launch.args_block) {
+        full_args.add_arguments(arguments);
+        return get_launch_arguments(kernel_id, full_args, launch.argv);
+    }
 
-    std::string str_args;
-    GNManagerExitCode ec;
-    ec = get_string_arguments(kernel_id, full_args, str_args);
+    GNManagerExitCode ec = get_launch_arguments(kernel_id, full_args, launch.argv);
     if (ec != GNManagerExitCode::OK) {
+        return ec;
+    }
+    std::stringstream ss;
+    ss << "0x" << std::hex << block.physical_addr;
+    launch.argv.push_back(GN_ARGS_BLOCK_FLAG);
+    launch.argv.push_back(ss.str());
+    return encode_arguments(arguments, launch.words);
+}
+
+GNManagerExitCode GNManager::encode_arguments(const Arguments &args, std::vector<uint64_t> &words) {
+    words.clear();
+    if (args.get_args().size() > GN_ARGS_BLOCK_MAX_ARGS) {
+        log_hhal.Error("GNManager: %zu arguments, the argument block holds %zu", args.get_args().size(), GN_ARGS_BLOCK_MAX_ARGS);
         return GNManagerExitCode::ERROR;
     }
-    log_hhal.Info("GNManager: Kernel argument string:\n%s", str_args.c_str());
-    ec = kernel_start_string_args(kernel_id, str_args);
-    if (ec != GNManagerExitCode::OK) {
+
+    for (const auto &arg : args.get_args()) {
+        uint64_t word;
+        switch (arg.type) {
+            case ArgumentType::BUFFER: {
+                FIND_OR_FAIL(allocated_buffer, buffer, allocated_buffer_info, arg.buffer.id, "buffer");
+                word = buffer.physical_addr;
+                break;
+            }
+            case ArgumentType::EVENT: {
+                FIND_OR_FAIL(allocated_event, event, allocated_event_info, arg.event.id, "event");
+                word = event.physical_addr;
+                break;
+            }
+            case ArgumentType::SCALAR: {
+                const scalar_arg &scalar = arg.scalar;
+                if (scalar.type == ScalarType::FLOAT && (scalar.size == sizeof(float) || scalar.size == sizeof(double))) {
+                    double value = scalar.size == sizeof(float) ? scalar.afloat : scalar.adouble;
+                    memcpy(&word, &value, sizeof(word));
+                } else if (scalar.type == ScalarType::INT && scalar.size == sizeof(int8_t)) {
+                    word = scalar.aint8;
+                } else if (scalar.type == ScalarType::INT && scalar.size == sizeof(int16_t)) {
+                    word = scalar.aint16;
+                } else if (scalar.type == ScalarType::INT && scalar.size == sizeof(int32_t)) {
+                    word = scalar.aint32;
+                } else if (scalar.type == ScalarType::INT && scalar.size == sizeof(int64_t)) {
+                    word = scalar.aint64;
+                } else if (scalar.type == ScalarType::UINT && scalar.size == sizeof(uint8_t)) {
+                    word = scalar.uint8;
+                } else if (scalar.type == ScalarType::UINT && scalar.size == sizeof(uint16_t)) {
+                    word = scalar.uint16;
+                } else if (scalar.type == ScalarType::UINT && scalar.size == sizeof(uint32_t)) {
+                    word = scalar.uint32;
+                } else if (scalar.type == ScalarType::UINT && scalar.size == sizeof(uint64_t)) {
+                    word = scalar.uint64;
+                } else {
+                    log_hhal.Error("GNManager: Unknown scalar size %zu", scalar.size);
+                    return GNManagerExitCode::ERROR;
+                }
+                break;
+            }
+            default:
+                log_hhal.Error("GNManager: Unknown argument");
+                return GNManagerExitCode::ERROR;
+        }
+        words.push_back(word);
+    }
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::allocate_args_block(int kernel_id) {
+    allocated_buffer block;
+    if (find_entry(args_blocks, kernel_id, block)) {
+        return GNManagerExitCode::OK;
+    }
+
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
+    allocated_kernel kernel;
+    uint32_t unit = find_entry(allocated_kernel_info, kernel_id, kernel) ? kernel.unit_id : 0;
+    uint32_t mem_tile;
+    addr_t phy_addr;
+    block.cluster_id = GN_DEFAULT_CLUSTER;
+    block.size = GN_ARGS_BLOCK_SIZE;
+    if (find_memory(block.cluster_id, unit, block.size, &mem_tile, &phy_addr) != GNManagerExitCode::OK ||
+        HNemu::instance()->allocate_memory(block.cluster_id, mem_tile, phy_addr, block.size) != HN_SUCCEEDED) {
+        log_hhal.Error("GNManager: cannot allocate the argument block of kernel %d", kernel_id);
         return GNManagerExitCode::ERROR;
     }
+    block.mem_tile = mem_tile;
+    block.physical_addr = phy_addr;
+    // The device memory keeps whatever was left there, the block starts free
+    memset(mem + phy_addr / ADDR_SIZE, 0, sizeof(gn_args_block_header));
+
+    exclusive_lock lock(resources_mtx);
+    args_blocks.insert(kernel_id, block);
+    log_hhal.Debug("GNManager: kernel %d: argument block at phy_addr=0x%x", kernel_id, phy_addr);
     return GNManagerExitCode::OK;
 }
 
-GNManagerExitCode GNManager::kernel_start_string_args(int kernel_id, std::string arguments) {
+void GNManager::release_args_block(int kernel_id) {
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
+    allocated_buffer block;
+    {
+        exclusive_lock lock(resources_mtx);
+        const allocated_buffer *found = args_blocks.find(kernel_id);
+        if (found == nullptr) {
+            return;
+        }
+        block = *found;
+        args_blocks.erase(kernel_id);
+    }
+    HNemu::instance()->release_memory(block.cluster_id, block.mem_tile, block.physical_addr, block.size);
+}
+
+/*
+* Launches of a kernel share its block, so a launch waits for the previous one to be done with it: the kernel frees
+* it right before writing its termination event, and the process watcher once the process or the executor that ran
+* the launch exited, so a launch that crashed holding the block does not keep it.
+* The block is claimed atomically, concurrent launches of the kernel take it one after the other.
+*/
+GNManagerExitCode GNManager::write_args_block(int kernel_id, const kernel_launch &launch, uint32_t *ticket) {
+    *ticket = 0;
+    if (!launch.args_block) {
+        return GNManagerExitCode::OK;
+    }
+    FIND_OR_FAIL(allocated_buffer, block, args_blocks, kernel_id, "argument block");
+    if (block.physical_addr != launch.args_block_addr) {
+        log_hhal.Error("GNManager: launch of kernel %d prepared for a previous image", kernel_id);
+        return GNManagerExitCode::ERROR;
+    }
+
+    char *dest = reinterpret_cast<char*>(mem + block.physical_addr / ADDR_SIZE);
+    gn_args_block_header *header = reinterpret_cast<gn_args_block_header*>(dest);
+    do {
+        *ticket = ++args_block_tickets;
+    } while (*ticket == 0);
+    for (;;) {
+        uint32_t owner = 0;
+        if (__atomic_compare_exchange_n(&header->owner, &owner, *ticket, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        log_hhal.Trace("GNManager: kernel %d: argument block held by launch %u", kernel_id, owner);
+        // Kernels in other processes wake the futex as well, the timeout only covers a missed wake up
+        timespec ts = {0, std::chrono::duration_cast<std::chrono::nanoseconds>(SYNC_WAIT_RECHECK).count()};
+        syscall(SYS_futex, &header->owner, FUTEX_WAIT, owner, &ts, nullptr, 0);
+    }
+
+    header->count = static_cast<uint32_t>(launch.words.size());
+    memcpy(dest + sizeof(*header), launch.words.data(), launch.words.size() * sizeof(uint64_t));
+    return GNManagerExitCode::OK;
+}
+
+bool GNManager::args_block_failed(int kernel_id, uint32_t block_addr, uint32_t ticket) {
+    if (ticket == 0) {
+        return false;
+    }
+    const gn_args_block_header *header = reinterpret_cast<const gn_args_block_header*>(mem + block_addr / ADDR_SIZE);
+    if (__atomic_load_n(&header->failed, __ATOMIC_ACQUIRE) != ticket) {
+        return false;
+    }
+    log_hhal.Error("GNManager: kernel %d rejected the arguments of its launch, the image may be out of date", kernel_id);
+    return true;
+}
+
+void GNManager::abandon_args_block(uint32_t block_addr, uint32_t ticket) {
+    if (ticket == 0) {
+        return;
+    }
+    uint32_t *owner = &reinterpret_cast<gn_args_block_header*>(mem + block_addr / ADDR_SIZE)->owner;
+    if (__atomic_compare_exchange_n(owner, &ticket, 0, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        syscall(SYS_futex, owner, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+
+GNManagerExitCode GNManager::kernel_start_launch(int kernel_id, const kernel_launch &launch) {
     assert(initialized == true);
-    assert(arguments.size() > 0);
-    auto &info = allocated_kernel_info[kernel_id];
-
-    pid_t pid;
-    pid = fork();
-    if (!pid){ /* child, executor */
-        if(arguments[0] != '/') {
-            arguments.insert(0, "./");
+    assert(launch.argv.size() > 0);
+    FIND_OR_FAIL(allocated_kernel, info, allocated_kernel_info, kernel_id, "kernel");
+    uint32_t ticket;
+    GNManagerExitCode ec = write_args_block(kernel_id, launch, &ticket);
+    if (ec != GNManagerExitCode::OK) {
+        return ec;
+    }
+
+    uint32_t block_addr = launch.args_block_addr;
+    auto on_exit = [this, kernel_id, block_addr, ticket](const ProcessWatcher::process_exit &exit) {
+        abandon_args_block(block_addr, ticket);
+        log_kernel_exit(kernel_id, exit);
+    };
+    if (executors.launch(kernel_id, launch.argv, on_exit)) {
+        log_hhal.Debug("GNManager: kernel_start: cluster=%d,  unit=%d, executor argument_string=%s",
+                info.cluster_id, info.unit_id, join_arguments(launch.argv).c_str());
+        return GNManagerExitCode::OK;
+    }
+
+    bool started = processes.spawn(launch.argv, [this, kernel_id, block_addr, ticket](bool exited, const ProcessWatcher::process_exit &exit) {
+        abandon_args_block(block_addr, ticket);
+        if (exited) {
+            log_kernel_exit(kernel_id, exit);
+            args_block_failed(kernel_id, block_addr, ticket);
         }
-        printf("system(%s);\n", arguments.c_str());
-        auto ret = system(arguments.c_str());
-        UNUSED(ret);
-        exit(0);
+    });
+    if (!started) {
+        abandon_args_block(launch.args_block_addr, ticket);
+        return GNManagerExitCode::ERROR;
     }
     log_hhal.Debug("GNManager: kernel_start: cluster=%d,  unit=%d, argument_string=%s",
-            info.cluster_id, info.unit_id, arguments.c_str());
+            info.cluster_id, info.unit_id, join_arguments(launch.argv).c_str());
     return GNManagerExitCode::OK;
 }
 
@@ -242,7 +669,7 @@ GNManagerExitCode GNManager::write_to_memory(int buffer_id, const void *source,
     assert(initialized == true);
     assert(source != NULL);
     assert(size > 0);
-    auto &info = allocated_buffer_info[buffer_id];
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
 
     size_t offset = info.physical_addr / ADDR_SIZE;
 
@@ -253,11 +680,29 @@ GNManagerExitCode GNManager::write_to_memory(int buffer_id, const void *source,
     return GNManagerExitCode::OK;
 }
 
+GNManagerExitCode GNManager::write_to_memory(int buffer_id, const void *source, size_t size, size_t offset) {
+    assert(initialized == true);
+    assert(source != NULL);
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
+    size_t buf_size = info.size;
+    if (offset > buf_size || size > buf_size - offset) {
+        log_hhal.Error("GNManager: write_to_memory: range out of buffer %d: offset=%zu, size=%zu, buffer size=%zu",
+                       buffer_id, offset, size, buf_size);
+        return GNManagerExitCode::ERROR;
+    }
+
+    char *dest = reinterpret_cast<char*>(mem + info.physical_addr / ADDR_SIZE) + offset;
+    memcpy(dest, source, size);
+    log_hhal.Debug("GNManager: write_to_memory: cluster=%d,  memory=%d, dest_address=0x%x, offset=%zu, size=%zu",
+                   info.cluster_id, info.mem_tile, info.physical_addr, offset, size);
+    return GNManagerExitCode::OK;
+}
+
 GNManagerExitCode GNManager::read_from_memory(int buffer_id, void *dest, size_t size) {
     assert(initialized == true);
     assert(dest != NULL);
     assert(size > 0);
-    auto &info = allocated_buffer_info[buffer_id];
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
 
     size_t offset = info.physical_addr / ADDR_SIZE;
 
@@ -268,22 +713,107 @@ GNManagerExitCode GNManager::read_from_memory(int buffer_id, void *dest, size_t
     return GNManagerExitCode::OK;
 }
 
+GNManagerExitCode GNManager::read_from_memory(int buffer_id, void *dest, size_t size, size_t offset) {
+    assert(initialized == true);
+    assert(dest != NULL);
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
+    size_t buf_size = info.size;
+    if (offset > buf_size || size > buf_size - offset) {
+        log_hhal.Error("GNManager: read_from_memory: range out of buffer %d: offset=%zu, size=%zu, buffer size=%zu",
+                       buffer_id, offset, size, buf_size);
+        return GNManagerExitCode::ERROR;
+    }
+
+    const char *source = reinterpret_cast<const char*>(mem + info.physical_addr / ADDR_SIZE) + offset;
+    memcpy(dest, source, size);
+    log_hhal.Debug("GNManager: read_from_memory: cluster=%d,  memory=%d, source_address=0x%x, offset=%zu, size=%zu",
+                   info.cluster_id, info.mem_tile, info.physical_addr, offset, size);
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::write_region(int buffer_id, const void *source, const memory_region &region) {
+    assert(initialized == true);
+    assert(source != NULL);
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
+    size_t extent;
+    if (!buffer_extent(region, &extent) || extent > info.size) {
+        log_hhal.Error("GNManager: write_region: region out of buffer %d: offset=%zu, buffer size=%zu",
+                       buffer_id, region.offset, info.size);
+        return GNManagerExitCode::ERROR;
+    }
+
+    char *base = reinterpret_cast<char*>(mem + info.physical_addr / ADDR_SIZE);
+    copy_region(base, static_cast<char*>(const_cast<void*>(source)), region, true);
+    log_hhal.Debug("GNManager: write_region: cluster=%d,  memory=%d, dest_address=0x%x, offset=%zu, rows=%zu, slices=%zu",
+                   info.cluster_id, info.mem_tile, info.physical_addr, region.offset, region.rows, region.slices);
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::read_region(int buffer_id, void *dest, const memory_region &region) {
+    assert(initialized == true);
+    assert(dest != NULL);
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
+    size_t extent;
+    if (!buffer_extent(region, &extent) || extent > info.size) {
+        log_hhal.Error("GNManager: read_region: region out of buffer %d: offset=%zu, buffer size=%zu",
+                       buffer_id, region.offset, info.size);
+        return GNManagerExitCode::ERROR;
+    }
+
+    char *base = reinterpret_cast<char*>(mem + info.physical_addr / ADDR_SIZE);
+    copy_region(base, static_cast<char*>(dest), region, false);
+    log_hhal.Debug("GNManager: read_region: cluster=%d,  memory=%d, source_address=0x%x, offset=%zu, rows=%zu, slices=%zu",
+                   info.cluster_id, info.mem_tile, info.physical_addr, region.offset, region.rows, region.slices);
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
+    assert(initialized == true);
+    void *source, *dest;
+    if (buffer_address(src_id, src_offset, size, &source) != GNManagerExitCode::OK ||
+        buffer_address(dst_id, dst_offset, size, &dest) != GNManagerExitCode::OK) {
+        return GNManagerExitCode::ERROR;
+    }
+
+    memmove(dest, source, size);
+    log_hhal.Debug("GNManager: copy_buffer: src=%d, src_offset=%zu, dst=%d, dst_offset=%zu, size=%zu",
+                   src_id, src_offset, dst_id, dst_offset, size);
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::buffer_address(int buffer_id, size_t offset, size_t size, void **address) {
+    assert(initialized == true);
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
+    size_t buf_size = info.size;
+    if (offset > buf_size || size > buf_size - offset) {
+        log_hhal.Error("GNManager: buffer_address: range out of buffer %d: offset=%zu, size=%zu, buffer size=%zu",
+                       buffer_id, offset, size, buf_size);
+        return GNManagerExitCode::ERROR;
+    }
+
+    *address = reinterpret_cast<char*>(mem + info.physical_addr / ADDR_SIZE) + offset;
+    return GNManagerExitCode::OK;
+}
+
 GNManagerExitCode GNManager::write_sync_register(int event_id, uint32_t data) {
     assert(initialized == true);
-    auto &info = allocated_event_info[event_id];
+    FIND_OR_FAIL(allocated_event, info, allocated_event_info, event_id, "event");
     int reg_address = info.physical_addr;
     reg_address -= info.cluster_id * MANGO_REG_SIZE * 4;
     reg_address /= ADDR_SIZE;
 
-    sem_wait(sem_id);
-
-    if (reg_address % 8 != 0) {
-        mem[reg_address] += data;
-    } else {
-        mem[reg_address] = data;
+    {
+        semaphore_guard guard(semaphore_sync ? sem_id : nullptr);
+        if (reg_address % 8 != 0) {
+            __atomic_fetch_add(&mem[reg_address], data, __ATOMIC_SEQ_CST);
+        } else {
+            __atomic_store_n(&mem[reg_address], data, __ATOMIC_SEQ_CST);
+        }
+    }
+    // Ordered after the write, a waiter either sees the new value or is counted here
+    if (sync_waiters.load() > 0) {
+        syscall(SYS_futex, &mem[reg_address], FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
     }
-
-    sem_post(sem_id);
     log_hhal.Trace("GNManager: write_sync_register: cluster=%d, phy_addr=%p, reg_address=0x%x, data=%d",
                    info.cluster_id, info.physical_addr, reg_address, data);
     return GNManagerExitCode::OK;
@@ -291,25 +821,21 @@ GNManagerExitCode GNManager::write_sync_register(int event_id, uint32_t data) {
 
 GNManagerExitCode GNManager::read_sync_register(int event_id, uint32_t *data) {
     assert(initialized == true);
-    auto &info = allocated_event_info[event_id];
+    FIND_OR_FAIL(allocated_event, info, allocated_event_info, event_id, "event");
     int reg_address = info.physical_addr;
     reg_address -= info.cluster_id * MANGO_REG_SIZE * 4;
     reg_address /= ADDR_SIZE;
 
     log_hhal.Trace("GNManager: read_sync_register: id=%d, reg_address=%d", event_id, reg_address);
 
-    sem_wait(sem_id);
-
-    log_hhal.Trace("GNManager: read_sync_register: id=%d, got semaphore", event_id);
     log_hhal.Trace("GNManager: read_sync_register: reading effective event addr=%p", mem + reg_address);
 
-    uint32_t result = mem[reg_address];
-    log_hhal.Trace("GNManager: read_sync_register: id=%d, read result, data=%d", event_id, result);
-    mem[reg_address] = 0;
-    log_hhal.Trace("GNManager: read_sync_register: id=%d zeroed out event register", event_id);
-
-    sem_post(sem_id);
-    log_hhal.Trace("GNManager: read_sync_register: id=%d, released semaphore ", event_id);
+    uint32_t result;
+    {
+        semaphore_guard guard(semaphore_sync ? sem_id : nullptr);
+        // Zeroed out in the same step, so no write landing in between is lost
+        result = __atomic_exchange_n(&mem[reg_address], 0, __ATOMIC_ACQ_REL);
+    }
 
     log_hhal.Trace("GNManager: read_sync_register: cluster=%d, phy_addr=%p, reg_address=%d, data=%d",
                    info.cluster_id, info.physical_addr, reg_address, result);
@@ -318,7 +844,69 @@ GNManagerExitCode GNManager::read_sync_register(int event_id, uint32_t *data) {
     return GNManagerExitCode::OK;
 }
 
+GNManagerExitCode GNManager::try_wait_sync_register(int event_id, uint32_t value, bool *matched) {
+    assert(initialized == true);
+    FIND_OR_FAIL(allocated_event, info, allocated_event_info, event_id, "event");
+    int reg_address = info.physical_addr;
+    reg_address -= info.cluster_id * MANGO_REG_SIZE * 4;
+    reg_address /= ADDR_SIZE;
+
+    uint32_t current = value;
+    {
+        semaphore_guard guard(semaphore_sync ? sem_id : nullptr);
+        *matched = __atomic_compare_exchange_n(&mem[reg_address], &current, 0, false,
+                                               __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+    }
+
+    log_hhal.Trace("GNManager: try_wait_sync_register: id=%d, reg_address=%d, data=%d, expected=%d",
+                   event_id, reg_address, current, value);
+    return GNManagerExitCode::OK;
+}
+
+GNManagerExitCode GNManager::wait_sync_register(int event_id, uint32_t value, int timeout_ms) {
+    assert(initialized == true);
+    FIND_OR_FAIL(allocated_event, info, allocated_event_info, event_id, "event");
+    int reg_address = info.physical_addr;
+    reg_address -= info.cluster_id * MANGO_REG_SIZE * 4;
+    reg_address /= ADDR_SIZE;
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    GNManagerExitCode ec = GNManagerExitCode::TIMEOUT;
+    sync_waiters.fetch_add(1);
+    for (;;) {
+        uint32_t current = value;
+        bool matched;
+        {
+            semaphore_guard guard(semaphore_sync ? sem_id : nullptr);
+            matched = __atomic_compare_exchange_n(&mem[reg_address], &current, 0, false,
+                                                  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        }
+        if (matched) {
+            ec = GNManagerExitCode::OK;
+            break;
+        }
+
+        std::chrono::nanoseconds sleep = SYNC_WAIT_RECHECK;
+        if (timeout_ms >= 0) {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining <= std::chrono::nanoseconds::zero()) {
+                break;
+            }
+            sleep = std::min<std::chrono::nanoseconds>(sleep, remaining);
+        }
+        // Returns right away if the register no longer holds current
+        timespec ts = {0, static_cast<long>(sleep.count())};
+        syscall(SYS_futex, &mem[reg_address], FUTEX_WAIT, current, &ts, nullptr, 0);
+    }
+    sync_waiters.fetch_sub(1);
+
+    log_hhal.Trace("GNManager: wait_sync_register: id=%d, reg_address=%d, expected=%d, timed out=%d",
+                   event_id, reg_address, value, ec == GNManagerExitCode::TIMEOUT);
+    return ec;
+}
+
 GNManagerExitCode GNManager::allocate_kernel(int kernel_id){
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
     std::vector<uint32_t> tiles_dst(1);
     auto status = find_units_set(GN_DEFAULT_CLUSTER, 1, tiles_dst);
     if (status != GNManagerExitCode::OK){
@@ -334,37 +922,38 @@ GNManagerExitCode GNManager::allocate_kernel(int kernel_id){
         return GNManagerExitCode::ERROR;
     }
 
-    allocated_kernel_info[kernel_id] = {GN_DEFAULT_CLUSTER, tiles_dst[0]};
+    exclusive_lock lock(resources_mtx);
+    allocated_kernel_info.insert(kernel_id, {GN_DEFAULT_CLUSTER, tiles_dst[0]});
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::release_kernel(int kernel_id){
-    std::vector<uint32_t> tiles_dst = { allocated_kernel_info[kernel_id].unit_id };
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
+    FIND_OR_FAIL(allocated_kernel, alloc, allocated_kernel_info, kernel_id, "kernel");
+    std::vector<uint32_t> tiles_dst = { alloc.unit_id };
 
     auto status = release_units_set(GN_DEFAULT_CLUSTER, tiles_dst);
     if (status != GNManagerExitCode::OK){
         log_hhal.Error("GNManager: release_kernel: tile release failed");
         return GNManagerExitCode::ERROR;
     }
+    exclusive_lock lock(resources_mtx);
     allocated_kernel_info.erase(kernel_id);
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::allocate_memory(int buffer_id){
-    gn_buffer &info = buffer_info[buffer_id];
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
+    FIND_OR_FAIL(gn_buffer, info, buffer_info, buffer_id, "buffer");
 
     allocated_buffer alloc_info;
     alloc_info.cluster_id = GN_DEFAULT_CLUSTER;
     
     uint32_t mem_tile;
     addr_t phy_addr;
-    uint32_t default_unit;
-
-    if (info.kernels_in.size() != 0) {
-        default_unit = allocated_kernel_info[info.kernels_in.back()].unit_id;
-    } else {
-        default_unit = allocated_kernel_info[info.kernels_out.back()].unit_id;
-    }
+    int default_kernel = info.kernels_in.size() != 0 ? info.kernels_in.back() : info.kernels_out.back();
+    FIND_OR_FAIL(allocated_kernel, default_alloc, allocated_kernel_info, default_kernel, "kernel");
+    uint32_t default_unit = default_alloc.unit_id;
 
     log_hhal.Debug("GNManager: allocate_memory: Finding memory for cluster=%d, unit=%d, size=%zu", alloc_info.cluster_id, default_unit, info.size);
     auto status = find_memory(alloc_info.cluster_id, default_unit, info.size, &mem_tile, &phy_addr);
@@ -375,7 +964,11 @@ GNManagerExitCode GNManager::allocate_memory(int buffer_id){
     log_hhal.Debug("GNManager: allocate_memory: buffer=%d, memory=%d, phy_addr=0x%x", info.id, mem_tile, phy_addr);
     alloc_info.mem_tile = mem_tile;
     alloc_info.physical_addr = phy_addr;
-    allocated_buffer_info[info.id] = alloc_info;
+    alloc_info.size = info.size;
+    {
+        exclusive_lock lock(resources_mtx);
+        allocated_buffer_info.insert(info.id, alloc_info);
+    }
 
     int hn_status = HNemu::instance()->allocate_memory(alloc_info.cluster_id, alloc_info.mem_tile, alloc_info.physical_addr, info.size);
     
@@ -392,7 +985,7 @@ GNManagerExitCode GNManager::allocate_memory(int buffer_id){
     GNManagerExitCode ec;
     uint32_t value;
     auto et_id = info.event;
-    auto &ev_info = allocated_event_info[et_id];
+    FIND_OR_FAIL(allocated_event, ev_info, allocated_event_info, et_id, "event");
     log_hhal.Debug("GNManager: allocate_memory: setting buffer event to WRITE, event %d, phy_addr 0x%x", et_id, ev_info.physical_addr);
     ec = read_sync_register(et_id, &value); 
     if (ec != GNManagerExitCode::OK) return ec;
@@ -406,8 +999,9 @@ GNManagerExitCode GNManager::allocate_memory(int buffer_id){
 }
 
 GNManagerExitCode GNManager::release_memory(int buffer_id){
-    auto &info = allocated_buffer_info[buffer_id];
-    size_t buf_size = buffer_info[buffer_id].size;
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
+    FIND_OR_FAIL(allocated_buffer, info, allocated_buffer_info, buffer_id, "buffer");
+    size_t buf_size = info.size;
     int status = HNemu::instance()->release_memory(info.cluster_id, info.mem_tile, info.physical_addr, buf_size);
     if (status != HN_SUCCEEDED){
         log_hhal.Error("GNManager: memory free failed: cluster=%d, memory=%d, phy_addr=0x%x, size=%d",
@@ -416,19 +1010,25 @@ GNManagerExitCode GNManager::release_memory(int buffer_id){
     }
     log_hhal.Debug("GNManager: memory released: cluster=%d, memory=%d, phy_addr=0x%x, size=%d",
                     info.cluster_id, info.mem_tile, info.physical_addr, buf_size);
+    exclusive_lock lock(resources_mtx);
+    allocated_buffer_info.erase(buffer_id);
     return GNManagerExitCode::OK;
 }
 
 GNManagerExitCode GNManager::allocate_event(int event_id){
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
     addr_t phy_addr;
     auto status = get_synch_register_addr(GN_DEFAULT_CLUSTER, &phy_addr, 1);
     if (status != GNManagerExitCode::OK) {
         log_hhal.Debug("GNManager: allocate_event: event %d allocation failed", event_id);
         return GNManagerExitCode::ERROR;
     }
-    allocated_event_info[event_id] = {GN_DEFAULT_CLUSTER, phy_addr};
+    {
+        exclusive_lock lock(resources_mtx);
+        allocated_event_info.insert(event_id, {GN_DEFAULT_CLUSTER, phy_addr});
+    }
 
-    log_hhal.Debug("GNManager: allocate_event: event=%d, phy_addr=0x%x", event_id, allocated_event_info[event_id].physical_addr);
+    log_hhal.Debug("GNManager: allocate_event: event=%d, phy_addr=0x%x", event_id, phy_addr);
 
     log_hhal.Debug("GNManager: allocate_event: preparing sync register %d", event_id);
 
@@ -448,8 +1048,11 @@ GNManagerExitCode GNManager::allocate_event(int event_id){
 }
 
 GNManagerExitCode GNManager::release_event(int event_id){
-    release_synch_register_addr(GN_DEFAULT_CLUSTER, allocated_event_info[event_id].physical_addr);
+    std::lock_guard<std::mutex> allocation_lock(allocation_mtx);
+    FIND_OR_FAIL(allocated_event, info, allocated_event_info, event_id, "event");
+    release_synch_register_addr(GN_DEFAULT_CLUSTER, info.physical_addr);
     log_hhal.Debug("GNManager: release_event: event=%d released", event_id);
+    exclusive_lock lock(resources_mtx);
     allocated_event_info.erase(event_id);
     return GNManagerExitCode::OK;
 }
@@ -565,7 +1168,7 @@ GNManagerExitCode GNManager::release_units_set(uint32_t cluster, const std::vect
     return GNManagerExitCode::OK;
 }
 
-GNManagerExitCode GNManager::get_string_arguments(int kernel_id, Arguments &args, std::string &str_args) {
+GNManagerExitCode GNManager::get_launch_arguments(int kernel_id, Arguments &args, std::vector<std::string> &argv) {
 	std::stringstream ss;
 
 	//get full memory size
@@ -578,40 +1181,48 @@ GNManagerExitCode GNManager::get_string_arguments(int kernel_id, Arguments &args
         }
     }
 
-    gn_kernel &info = kernel_info[kernel_id];
-
-    if (kernel_images.find(info.id) == kernel_images.end()) {
+    std::string image;
+    if (!find_entry(kernel_images, kernel_id, image)) {
         log_hhal.Error("GNManager: No kernel path");
         assert(false && "No kernel path");
         return GNManagerExitCode::ERROR;
     }
 
-    ss << kernel_images[info.id];
-    ss << " 0x" << std::hex << mem_size;
+    argv.clear();
+    argv.push_back(image);
+    ss << "0x" << std::hex << mem_size;
+    argv.push_back(ss.str());
 
 	for (const auto &arg : args.get_args()) {
+        ss.str("");
         switch (arg.type) {
             case ArgumentType::BUFFER:
-                ss << " 0x" << std::hex << allocated_buffer_info[arg.buffer.id].physical_addr;
+            {
+                FIND_OR_FAIL(allocated_buffer, buffer, allocated_buffer_info, arg.buffer.id, "buffer");
+                ss << "0x" << buffer.physical_addr;
                 break;
+            }
             case ArgumentType::EVENT:
-                ss << " 0x" << std::hex << allocated_event_info[arg.event.id].physical_addr;
+            {
+                FIND_OR_FAIL(allocated_event, event, allocated_event_info, arg.event.id, "event");
+                ss << "0x" << event.physical_addr;
                 break;
+            }
             case ArgumentType::SCALAR:
                 switch (arg.scalar.type) {
                     case ScalarType::INT: {
                         switch (arg.scalar.size) {
                             case sizeof(int8_t):
-                                ss << " " << arg.scalar.aint8;
+                                ss << arg.scalar.aint8;
                                 break;
                             case sizeof(int16_t):
-                                ss << " " << arg.scalar.aint16;
+                                ss << arg.scalar.aint16;
                                 break;
                             case sizeof(int32_t):
-                                ss << " " << arg.scalar.aint32;
+                                ss << arg.scalar.aint32;
                                 break;
                             case sizeof(int64_t):
-                                ss << " " << arg.scalar.aint64;
+                                ss << arg.scalar.aint64;
                                 break;
                             default:
                                 log_hhal.Error("GNManager: Unknown scalar int size");
@@ -622,16 +1233,16 @@ GNManagerExitCode GNManager::get_string_arguments(int kernel_id, Arguments &args
                     case ScalarType::UINT: {
                         switch (arg.scalar.size) {
                             case sizeof(uint8_t):
-                                ss << " " << arg.scalar.uint8;
+                                ss << arg.scalar.uint8;
                                 break;
                             case sizeof(uint16_t):
-                                ss << " " << arg.scalar.uint16;
+                                ss << arg.scalar.uint16;
                                 break;
                             case sizeof(uint32_t):
-                                ss << " " << arg.scalar.uint32;
+                                ss << arg.scalar.uint32;
                                 break;
                             case sizeof(uint64_t):
-                                ss << " " << arg.scalar.uint64;
+                                ss << arg.scalar.uint64;
                                 break;
                             default:
                                 log_hhal.Error("GNManager: Unknown scalar int size");
@@ -648,8 +1259,8 @@ GNManagerExitCode GNManager::get_string_arguments(int kernel_id, Arguments &args
                 log_hhal.Error("GNManager: Unknown argument");
                 return GNManagerExitCode::ERROR;
         }
+        argv.push_back(ss.str());
 	}
-    str_args = ss.str();
 
 	return GNManagerExitCode::OK;
 }
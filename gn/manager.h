@@ -1,14 +1,23 @@
 #ifndef GN_MANAGER_H
 #define GN_MANAGER_H
 
+#include <atomic>
+#include <functional>
 #include <map>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <cstdint>
 #include <semaphore.h>
 
 #include "arguments.h"
+#include "types.h"
 
+#include "gn/completion_watcher.h"
+#include "gn/executor_pool.h"
+#include "gn/process_watcher.h"
 #include "gn/types.h"
+#include "handle_table.h"
 
 typedef struct hhal_tile_description {
     int total_tiles;
@@ -25,10 +34,15 @@ typedef uint32_t addr_t;
 enum class GNManagerExitCode {
     OK,
     ERROR,
+    TIMEOUT,
 };
 
 class GNManager {
     public:
+        // Called from a watcher thread, with ERROR if it stopped before the kernel terminated, or if the process of
+        // the kernel exited without writing the termination event
+        typedef std::function<void(GNManagerExitCode)> completion_t;
+
         GNManagerExitCode initialize();
         GNManagerExitCode finalize();
 
@@ -42,6 +56,13 @@ class GNManager {
 
         GNManagerExitCode kernel_write(int kernel_id, std::string image_path);
         GNManagerExitCode kernel_start(int kernel_id, const Arguments &arguments);
+        GNManagerExitCode prepare_launch(int launch_id, int kernel_id, const Arguments &arguments);
+        GNManagerExitCode launch(int launch_id);
+        GNManagerExitCode release_launch(int launch_id);
+        // Clear the termination event of the kernel and call on_completion once the kernel writes it, or once its
+        // process exits when it is not run by an executor
+        GNManagerExitCode kernel_start(int kernel_id, const Arguments &arguments, completion_t on_completion);
+        GNManagerExitCode launch(int launch_id, completion_t on_completion);
 
         GNManagerExitCode allocate_kernel(int kernel_id);
         GNManagerExitCode release_kernel(int kernel_id);
@@ -51,9 +72,20 @@ class GNManager {
         GNManagerExitCode release_event(int event_id);
 
         GNManagerExitCode write_to_memory(int buffer_id, const void *source, size_t size);
+        GNManagerExitCode write_to_memory(int buffer_id, const void *source, size_t size, size_t offset);
         GNManagerExitCode read_from_memory(int buffer_id, void *dest, size_t size);
+        GNManagerExitCode read_from_memory(int buffer_id, void *dest, size_t size, size_t offset);
+        GNManagerExitCode write_region(int buffer_id, const void *source, const memory_region &region);
+        GNManagerExitCode read_region(int buffer_id, void *dest, const memory_region &region);
+        // Ranges may overlap when both are in the same buffer
+        GNManagerExitCode copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size);
+        // Where a range of the buffer is mapped on the host, for transfers from and to other units
+        GNManagerExitCode buffer_address(int buffer_id, size_t offset, size_t size, void **address);
         GNManagerExitCode write_sync_register(int event_id, uint32_t data);
         GNManagerExitCode read_sync_register(int event_id, uint32_t *data);
+        GNManagerExitCode try_wait_sync_register(int event_id, uint32_t value, bool *matched);
+        // Blocks until the register holds value and consumes it, TIMEOUT after timeout_ms unless negative
+        GNManagerExitCode wait_sync_register(int event_id, uint32_t value, int timeout_ms);
 
     private:
         struct allocated_kernel {
@@ -70,21 +102,53 @@ class GNManager {
             int cluster_id;
             uint32_t physical_addr;
             int mem_tile;
+            size_t size;
         };
 
         int num_clusters;
         bool initialized = false;
+        // Compatibility mode, sync registers are accessed under the system wide semaphore as well, for processes that
+        // update them under it without atomic operations. Set with HHAL_GN_SYNC_REGISTERS=semaphore.
+        bool semaphore_sync = false;
+        // Threads blocked in wait_sync_register, which writes have to wake
+        std::atomic<int> sync_waiters{0};
         int max_buffers = 2048;
         int max_kernels = 2048;
 
-        std::map<int, gn_kernel> kernel_info;
-        std::map<int, allocated_kernel> allocated_kernel_info;
-        std::map<int, gn_event> event_info;
-        std::map<int, allocated_event> allocated_event_info;
-        std::map<int, gn_buffer> buffer_info;
-        std::map<int, allocated_buffer> allocated_buffer_info;
+        typedef std::shared_lock<std::shared_timed_mutex> shared_lock;
+        typedef std::unique_lock<std::shared_timed_mutex> exclusive_lock;
+
+        // Guards the tables below. Held shared to copy an entry out, so operations on resources run in parallel,
+        // and exclusive only while an entry is inserted or erased.
+        mutable std::shared_timed_mutex resources_mtx;
+
+        HandleTable<gn_kernel> kernel_info;
+        HandleTable<allocated_kernel> allocated_kernel_info;
+        HandleTable<gn_event> event_info;
+        HandleTable<allocated_event> allocated_event_info;
+        HandleTable<gn_buffer> buffer_info;
+        HandleTable<allocated_buffer> allocated_buffer_info;
+
+        HandleTable<std::string> kernel_images;
+        // Argument blocks of the kernels written with an image decoding them, kept until the kernel is deassigned
+        HandleTable<allocated_buffer> args_blocks;
+        // Source of the tickets launches hold the argument block with, never 0
+        std::atomic<uint32_t> args_block_tickets{0};
+
+        // Command line of a launch, and the words written to the argument block before it starts if the kernel decodes one
+        struct kernel_launch {
+            std::vector<std::string> argv;
+            bool args_block;
+            uint32_t args_block_addr;
+            std::vector<uint64_t> words;
+        };
 
-        std::map<int, std::string> kernel_images;
+        // Kernel launches built once by prepare_launch
+        struct prepared_launch {
+            int kernel_id;
+            kernel_launch launch;
+        };
+        HandleTable<prepared_launch> prepared_launches;
         
         std::map<uint32_t, hhal_tile_description_t> tiles;
 
@@ -92,10 +156,33 @@ class GNManager {
         static sem_t *sem_id;
         static int f_mem;
         static std::map<uint32_t, std::vector<addr_t>> event_register_off;
+        // Serializes allocations and releases, which go through the tile, memory and sync register allocators
+        static std::mutex allocation_mtx;
         static void init_semaphore(void);
 
-        GNManagerExitCode get_string_arguments(int kernel_id, Arguments &args, std::string &str_args);
-        GNManagerExitCode kernel_start_string_args(int kernel_id, std::string arguments);
+        CompletionWatcher completion_watcher;
+        // Reaps the executors as well, so it outlives them
+        ProcessWatcher processes;
+        ExecutorPool executors{processes};
+
+        template <typename T>
+        bool find_entry(const HandleTable<T> &table, int id, T &entry) const;
+
+        GNManagerExitCode get_launch_arguments(int kernel_id, Arguments &args, std::vector<std::string> &argv);
+        // Launch of the kernel, with the termination events GN expects before the user arguments
+        GNManagerExitCode get_launch(int kernel_id, const Arguments &arguments, kernel_launch &launch);
+        GNManagerExitCode encode_arguments(const Arguments &args, std::vector<uint64_t> &words);
+        GNManagerExitCode allocate_args_block(int kernel_id);
+        void release_args_block(int kernel_id);
+        // Waits for the argument block to be free, then claims it for the launch and writes its arguments
+        GNManagerExitCode write_args_block(int kernel_id, const kernel_launch &launch, uint32_t *ticket);
+        // Frees the block if the launch with ticket still holds it, for launches that failed or whose process ended
+        void abandon_args_block(uint32_t block_addr, uint32_t ticket);
+        // Whether the kernel of the launch with ticket terminated without running, having rejected its arguments
+        bool args_block_failed(int kernel_id, uint32_t block_addr, uint32_t ticket);
+        GNManagerExitCode kernel_start_launch(int kernel_id, const kernel_launch &launch);
+        // Starts the kernel with its termination event cleared beforehand, and watched afterwards
+        GNManagerExitCode kernel_start_watched(int kernel_id, const kernel_launch &launch, completion_t on_completion);
         GNManagerExitCode find_memory(uint32_t cluster, uint32_t unit, uint32_t size, uint32_t *memory, addr_t *phy_addr);
         GNManagerExitCode find_units_set(uint32_t cluster, uint32_t num_tiles, std::vector<uint32_t> &tiles_dst);
         GNManagerExitCode reserve_units_set(uint32_t cluster, const std::vector<uint32_t> &tiles);
@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "gn/process_watcher.h"
+#include "gn/hnemu/logger.h"
+
+#define MAX_EVENTS 64
+// Interval between checks of the processes without a pidfd
+#define POLL_INTERVAL_MS 1
+
+extern char **environ;
+
+namespace hhal {
+
+extern ConsoleLogger log_hhal;
+
+static int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+ProcessWatcher::~ProcessWatcher() {
+    stop();
+}
+
+bool ProcessWatcher::spawn(const std::vector<std::string> &argv, callback_t done) {
+    std::vector<char *> args;
+    for (const std::string &arg: argv) {
+        args.push_back(const_cast<char *>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping || !start_thread()) {
+            return false;
+        }
+    }
+
+    pid_t pid;
+    int err = posix_spawn(&pid, args[0], nullptr, nullptr, args.data(), environ);
+    if (err != 0) {
+        log_hhal.Error("GNManager: starting %s: %s", args[0], strerror(err));
+        return false;
+    }
+    add(pid, std::move(done));
+    return true;
+}
+
+bool ProcessWatcher::watch(pid_t pid, callback_t done) {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping || !start_thread()) {
+            return false;
+        }
+    }
+    add(pid, std::move(done));
+    return true;
+}
+
+void ProcessWatcher::add(pid_t pid, callback_t done) {
+    process_t process = {pid, std::chrono::steady_clock::now(), std::move(done)};
+    // The process is not reaped before it is watched, so the pidfd is valid even if it already exited
+    int fd = pidfd_open(pid);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopping) {
+        lock.unlock();
+        if (fd >= 0) close(fd);
+        process.done(false, {pid, 0, std::chrono::steady_clock::now() - process.start});
+        return;
+    }
+    if (fd >= 0) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0) {
+            watched.emplace(fd, std::move(process));
+            return;
+        }
+        close(fd);
+    }
+    polled.push_back(std::move(process));
+    uint64_t wake = 1;
+    ssize_t res = write(wake_fd, &wake, sizeof(wake));
+    (void) res;
+}
+
+void ProcessWatcher::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+        if (wake_fd >= 0) {
+            uint64_t wake = 1;
+            ssize_t res = write(wake_fd, &wake, sizeof(wake));
+            (void) res;
+        }
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    std::vector<process_t> pending;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto &w: watched) {
+            close(w.first);
+            pending.push_back(std::move(w.second));
+        }
+        watched.clear();
+        for (auto &p: polled) {
+            pending.push_back(std::move(p));
+        }
+        polled.clear();
+        if (epoll_fd >= 0) close(epoll_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        epoll_fd = wake_fd = -1;
+    }
+    for (auto &p: pending) {
+        p.done(false, {p.pid, 0, std::chrono::steady_clock::now() - p.start});
+    }
+}
+
+bool ProcessWatcher::start_thread() {
+    if (thread.joinable()) {
+        return true;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    if (epoll_fd < 0 || wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+        log_hhal.Error("GNManager: process watcher: %s", strerror(errno));
+        if (epoll_fd >= 0) close(epoll_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        epoll_fd = wake_fd = -1;
+        return false;
+    }
+    thread = std::thread(&ProcessWatcher::run, this);
+    return true;
+}
+
+void ProcessWatcher::run() {
+    epoll_event events[MAX_EVENTS];
+    std::vector<std::pair<callback_t, process_exit>> exited;
+
+    // Reaps the process if it exited
+    auto reap = [&exited](process_t &process) {
+        int status;
+        pid_t res = waitpid(process.pid, &status, WNOHANG);
+        if (res == 0) {
+            return false;
+        }
+        if (res < 0) {
+            log_hhal.Error("GNManager: reaping process %d: %s", process.pid, strerror(errno));
+            status = -1;
+        }
+        exited.emplace_back(std::move(process.done),
+                            process_exit{process.pid, status, std::chrono::steady_clock::now() - process.start});
+        return true;
+    };
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        int timeout = polled.empty() ? -1 : POLL_INTERVAL_MS;
+        lock.unlock();
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        lock.lock();
+        if (n < 0 && errno != EINTR) {
+            log_hhal.Error("GNManager: process watcher: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                uint64_t wake;
+                ssize_t res = read(wake_fd, &wake, sizeof(wake));
+                (void) res;
+                continue;
+            }
+            auto it = watched.find(fd);
+            if (it != watched.end() && reap(it->second)) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                watched.erase(it);
+            }
+        }
+        for (size_t i = 0; i < polled.size();) {
+            if (reap(polled[i])) {
+                polled[i] = std::move(polled.back());
+                polled.pop_back();
+            } else {
+                ++i;
+            }
+        }
+
+        if (!exited.empty()) {
+            // Callbacks may start more processes
+            lock.unlock();
+            for (auto &e: exited) {
+                e.first(true, e.second);
+            }
+            exited.clear();
+            lock.lock();
+        }
+    }
+}
+
+}
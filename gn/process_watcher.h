@@ -0,0 +1,69 @@
+#ifndef GN_PROCESS_WATCHER_H
+#define GN_PROCESS_WATCHER_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+namespace hhal {
+
+/*
+* Starts the kernels that run as a process of their own and reaps them, as well as the executors of ExecutorPool.
+* Processes are started with posix_spawn, which does not copy the address space of the caller, straight from their
+* argv without going through a shell. Their pidfds are waited on from a single thread, started by the first process,
+* which reaps every process once it exits and reports how it ended. Processes are polled instead when the kernel has
+* no pidfds.
+*/
+class ProcessWatcher {
+    public:
+        struct process_exit {
+            pid_t pid;
+            // As returned by waitpid
+            int status;
+            std::chrono::steady_clock::duration runtime;
+        };
+
+        // Receives true once the process exited and was reaped, false if the watcher stopped before
+        typedef std::function<void(bool exited, const process_exit &exit)> callback_t;
+
+        ~ProcessWatcher();
+
+        // Starts argv[0] and calls done from the watcher thread once it exits. Thread safe.
+        bool spawn(const std::vector<std::string> &argv, callback_t done);
+        // Same for pid, a child started by the caller, which leaves reaping it to the watcher. Thread safe.
+        bool watch(pid_t pid, callback_t done);
+
+        // Fails the pending processes, which are left running, and joins the thread
+        void stop();
+
+    private:
+        struct process_t {
+            pid_t pid;
+            std::chrono::steady_clock::time_point start;
+            callback_t done;
+        };
+
+        std::mutex mutex;
+        // Processes by pidfd, and those without one
+        std::map<int, process_t> watched;
+        std::vector<process_t> polled;
+        int epoll_fd = -1;
+        // Wakes the thread when a process is added or the watcher stops
+        int wake_fd = -1;
+        bool stopping = false;
+        std::thread thread;
+
+        bool start_thread();
+        // Watches a process started while the thread was running
+        void add(pid_t pid, callback_t done);
+        void run();
+};
+
+}
+
+#endif
@@ -26,6 +26,29 @@ struct gn_event {
     std::vector<int> kernels_out;
 };
 
+/*
+* Kernels whose image holds GN_ARGS_BLOCK_FLAG get their arguments in a block of device memory instead of on their
+* command line, which ends with the flag and the address of the block after the termination events.
+* The block is a gn_args_block_header followed by one 64 bit word per argument: addresses and integers extended to
+* 64 bits, and floating point values as a double. Decoded by the entry written by dynamic_compiler/mango_gen_kernel_entry.cpp.
+* A kernel has one block, held by one launch at a time: HHAL claims it before writing the arguments of a launch, and
+* the kernel releases it right before writing its termination event. A kernel given a different amount of arguments
+* than it takes records the ticket of the launch as failed, and still releases the block and terminates.
+*/
+#define GN_ARGS_BLOCK_FLAG "--hhal-gn-args-block-2"
+#define GN_ARGS_BLOCK_SIZE 512
+
+struct gn_args_block_header {
+    uint32_t count;
+    // Ticket of the launch holding the block, 0 when free. Waited on with a futex, the kernel wakes it once it clears it.
+    uint32_t owner;
+    // Ticket of the last launch whose kernel rejected its arguments
+    uint32_t failed;
+    uint32_t reserved;
+};
+
+#define GN_ARGS_BLOCK_MAX_ARGS ((GN_ARGS_BLOCK_SIZE - sizeof(gn_args_block_header)) / sizeof(uint64_t))
+
 }
 
 #endif
\ No newline at end of file
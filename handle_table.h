@@ -0,0 +1,91 @@
+#ifndef HHAL_HANDLE_TABLE_H
+#define HHAL_HANDLE_TABLE_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace hhal {
+
+/*
+* Table of resources keyed by their id, replacing std::map for the id lookups done by every HHAL call.
+* Ids index slots directly, grouped in pages allocated the first time one of their ids is used, so lookups are
+* two array accesses and stored values never move. Ids outside of [0, MAX_ID] are refused.
+* Not synchronized.
+*/
+template <typename T>
+class HandleTable {
+    public:
+        static const int PAGE_BITS = 10;
+        static const int PAGE_SIZE = 1 << PAGE_BITS;
+        static const int MAX_ID = (1 << 24) - 1;
+
+        HandleTable(): count(0) {}
+
+        // Stores the value under id, replacing any previous one. Returns nullptr if the id is out of range.
+        T *insert(int id, const T &value) {
+            if (id < 0 || id > MAX_ID) return nullptr;
+            size_t page = id >> PAGE_BITS;
+            if (page >= pages.size()) {
+                pages.resize(page + 1);
+            }
+            if (!pages[page]) {
+                pages[page].reset(new slot_t[PAGE_SIZE]);
+            }
+            slot_t &slot = pages[page][id & (PAGE_SIZE - 1)];
+            if (!slot.occupied) {
+                slot.occupied = true;
+                count++;
+            }
+            slot.value = value;
+            return &slot.value;
+        }
+
+        // Returns false if there was nothing stored under id
+        bool erase(int id) {
+            slot_t *slot = find_slot(id);
+            if (slot == nullptr || !slot->occupied) return false;
+            slot->occupied = false;
+            slot->value = T();
+            count--;
+            return true;
+        }
+
+        // nullptr for unknown ids
+        T *find(int id) {
+            slot_t *slot = find_slot(id);
+            return slot != nullptr && slot->occupied ? &slot->value : nullptr;
+        }
+
+        const T *find(int id) const {
+            return const_cast<HandleTable *>(this)->find(id);
+        }
+
+        bool contains(int id) const {
+            return find(id) != nullptr;
+        }
+
+        size_t size() const {
+            return count;
+        }
+
+    private:
+        struct slot_t {
+            bool occupied = false;
+            T value;
+        };
+
+        std::vector<std::unique_ptr<slot_t[]>> pages;
+        size_t count;
+
+        slot_t *find_slot(int id) {
+            if (id < 0 || id > MAX_ID) return nullptr;
+            size_t page = id >> PAGE_BITS;
+            if (page >= pages.size() || !pages[page]) return nullptr;
+            return &pages[page][id & (PAGE_SIZE - 1)];
+        }
+};
+
+}
+
+#endif
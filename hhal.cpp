@@ -8,6 +8,8 @@
 #include "gn/manager.h"
 #endif
 
+#include <mutex>
+
 #include "dynamic_compiler/compiler.h"
 
 #define GN_MANAGER      impl->gn_manager
@@ -45,8 +47,12 @@ class HHAL::Impl {
         GNManager gn_manager;
 #endif
         dynamic_compiler::Compiler compiler;
+        // The compiler keeps its kernel cache unsynchronized
+        std::mutex compiler_mtx;
 };
 
+const int HHAL::MAX_ID;
+
 HHAL::HHAL() {
     impl = new HHAL::Impl;
 #ifdef ENABLE_GN
@@ -69,67 +75,145 @@ HHAL::~HHAL() {
     printf("HHAL: Destroyed\n");
 }
 
+bool HHAL::find_unit(const HandleTable<Unit> &table, int id, Unit &unit) const {
+    std::shared_lock<std::shared_timed_mutex> lock(units_mtx);
+    const Unit *found = table.find(id);
+    if (found == nullptr) {
+        return false;
+    }
+    unit = *found;
+    return true;
+}
+
+bool HHAL::insert_unit(HandleTable<Unit> &table, int id, Unit unit) {
+    std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+    if (table.contains(id)) {
+        printf("[Error] HHAL: Id %d already in use\n", id);
+        return false;
+    }
+    if (table.insert(id, unit) == nullptr) {
+        printf("[Error] HHAL: Id %d out of range\n", id);
+        return false;
+    }
+    return true;
+}
+
+void HHAL::erase_unit(HandleTable<Unit> &table, int id) {
+    std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+    table.erase(id);
+}
+
+bool HHAL::take_unit(HandleTable<Unit> &table, int id, Unit &unit) {
+    std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+    const Unit *found = table.find(id);
+    if (found == nullptr) {
+        return false;
+    }
+    unit = *found;
+    table.erase(id);
+    return true;
+}
+
 HHALExitCode HHAL::assign_kernel(Unit unit, hhal_kernel *info) {
-    kernel_to_unit[info->id] = unit;
-    switch (unit) {
+    if (!insert_unit(kernel_to_unit, info->id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    // The manager call returns through the exit code macros, the id is only kept if it succeeds
+    HHALExitCode exit_code = [&]() {
+        switch (unit) {
 #ifdef ENABLE_GN
-        case Unit::GN:
-            MAP_GN_EXIT_CODE(GN_MANAGER.assign_kernel((gn_kernel *) info));
-            break;
+            case Unit::GN:
+                MAP_GN_EXIT_CODE(GN_MANAGER.assign_kernel((gn_kernel *) info));
+                break;
 #endif
 #ifdef ENABLE_NVIDIA
-        case Unit::NVIDIA:
-            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.assign_kernel((nvidia_kernel *)info));
-            break;
+            case Unit::NVIDIA:
+                MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.assign_kernel((nvidia_kernel *)info));
+                break;
 #endif
-        default:
-            return HHALExitCode::ERROR;
+            default:
+                return HHALExitCode::ERROR;
+        }
+        return HHALExitCode::ERROR;
+    }();
+    if (exit_code != HHALExitCode::OK) {
+        erase_unit(kernel_to_unit, info->id);
     }
-    return HHALExitCode::ERROR;
+    return exit_code;
 }
 
 HHALExitCode HHAL::assign_buffer(Unit unit, hhal_buffer *info) {
-    buffer_to_unit[info->id] = unit;
-    switch (unit) {
+    if (!insert_unit(buffer_to_unit, info->id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    {
+        buffer_users users;
+        if (unit == Unit::GN) {
+            users = {((gn_buffer *) info)->kernels_in, ((gn_buffer *) info)->kernels_out};
+        } else {
+            users = {((nvidia_buffer *) info)->kernels_in, ((nvidia_buffer *) info)->kernels_out};
+        }
+        std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+        buffer_kernels.insert(info->id, users);
+    }
+    HHALExitCode exit_code = [&]() {
+        switch (unit) {
 #ifdef ENABLE_GN
-        case Unit::GN:
-            MAP_GN_EXIT_CODE(GN_MANAGER.assign_buffer((gn_buffer *) info));
-            break;
+            case Unit::GN:
+                MAP_GN_EXIT_CODE(GN_MANAGER.assign_buffer((gn_buffer *) info));
+                break;
 #endif
 #ifdef ENABLE_NVIDIA
-        case Unit::NVIDIA:
-            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.assign_buffer((nvidia_buffer *) info));
-            break;
+            case Unit::NVIDIA:
+                MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.assign_buffer((nvidia_buffer *) info));
+                break;
 #endif
-        default:
-            return HHALExitCode::ERROR;
+            default:
+                return HHALExitCode::ERROR;
+        }
+        return HHALExitCode::ERROR;
+    }();
+    if (exit_code != HHALExitCode::OK) {
+        erase_unit(buffer_to_unit, info->id);
+        std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+        buffer_kernels.erase(info->id);
     }
-    return HHALExitCode::ERROR;
+    return exit_code;
 }
 
 HHALExitCode HHAL::assign_event(Unit unit, hhal_event *info) {
-    event_to_unit[info->id] = unit;
-    switch (unit) {
+    if (!insert_unit(event_to_unit, info->id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    HHALExitCode exit_code = [&]() {
+        switch (unit) {
 #ifdef ENABLE_GN
-        case Unit::GN:
-            MAP_GN_EXIT_CODE(GN_MANAGER.assign_event((gn_event *) info));
-            break;
+            case Unit::GN:
+                MAP_GN_EXIT_CODE(GN_MANAGER.assign_event((gn_event *) info));
+                break;
 #endif
 #ifdef ENABLE_NVIDIA
-        case Unit::NVIDIA:
-            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.assign_event((nvidia_event *) info));
-            break;
+            case Unit::NVIDIA:
+                MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.assign_event((nvidia_event *) info));
+                break;
 #endif
-        default:
-            return HHALExitCode::ERROR;
+            default:
+                return HHALExitCode::ERROR;
+        }
+        return HHALExitCode::ERROR;
+    }();
+    if (exit_code != HHALExitCode::OK) {
+        erase_unit(event_to_unit, info->id);
     }
-    return HHALExitCode::ERROR;
+    return exit_code;
 }
 
 HHALExitCode HHAL::deassign_kernel(int kernel_id) {
     printf("Kernel id %d deassigned\n", kernel_id);
-    Unit unit = kernel_to_unit[kernel_id];
-    kernel_to_unit.erase(kernel_id);
+    Unit unit;
+    if (!take_unit(kernel_to_unit, kernel_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
     switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
@@ -149,8 +233,14 @@ HHALExitCode HHAL::deassign_kernel(int kernel_id) {
 
 HHALExitCode HHAL::deassign_buffer(int buffer_id) {
     printf("Buffer id %d deassigned\n", buffer_id);
-    Unit unit = buffer_to_unit[buffer_id];
-    buffer_to_unit.erase(buffer_id);
+    Unit unit;
+    if (!take_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+        buffer_kernels.erase(buffer_id);
+    }
     switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
@@ -170,8 +260,10 @@ HHALExitCode HHAL::deassign_buffer(int buffer_id) {
 
 HHALExitCode HHAL::deassign_event(int event_id) {
     printf("Event id %d deassigned\n", event_id);
-    Unit unit = event_to_unit[event_id];
-    event_to_unit.erase(event_id);
+    Unit unit;
+    if (!take_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
     switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
@@ -191,7 +283,10 @@ HHALExitCode HHAL::deassign_event(int event_id) {
 
 HHALExitCode HHAL::kernel_write(int kernel_id, const std::map<Unit, hhal_kernel_source> &kernel_sources) {
     std::string kernel_path; // path to the final kernel binary file
-    hhal::Unit unit_type = kernel_to_unit[kernel_id];
+    hhal::Unit unit_type;
+    if (!find_unit(kernel_to_unit, kernel_id, unit_type)) {
+        return HHALExitCode::ERROR;
+    }
     auto it = kernel_sources.find(unit_type);
     if (it == kernel_sources.end()) {
         printf("No kernel source for %s\n", unit_to_string(unit_type));
@@ -204,15 +299,18 @@ HHALExitCode HHAL::kernel_write(int kernel_id, const std::map<Unit, hhal_kernel_
         case source_type::BINARY:
             kernel_path = source.path_or_string;
             break;
-        case source_type::SOURCE: 
+        case source_type::SOURCE: {
+            std::lock_guard<std::mutex> lock(impl->compiler_mtx);
             kernel_path = COMPILER.get_binary(source.path_or_string, unit_type);
             if (kernel_path == "") {
                 return HHALExitCode::ERROR;
             }
             break;
+        }
         case source_type::STRING: {
             switch (unit_type) {
                 case Unit::GN: {
+                    std::lock_guard<std::mutex> lock(impl->compiler_mtx);
                     std::string saved_file = dynamic_compiler::save_to_file(source.path_or_string);
                     kernel_path = COMPILER.get_binary(saved_file, unit_type);
                     if (kernel_path == "") {
@@ -229,7 +327,7 @@ HHALExitCode HHAL::kernel_write(int kernel_id, const std::map<Unit, hhal_kernel_
             return HHALExitCode::ERROR;
     } 
 
-    switch (kernel_to_unit[kernel_id]) {
+    switch (unit_type) {
 #ifdef ENABLE_GN
         case Unit::GN: 
             MAP_GN_EXIT_CODE(GN_MANAGER.kernel_write(kernel_id, kernel_path));
@@ -248,7 +346,11 @@ HHALExitCode HHAL::kernel_write(int kernel_id, const std::map<Unit, hhal_kernel_
 
 HHALExitCode HHAL::kernel_start(int kernel_id, const Arguments &arguments) {
     printf("Starting kernel\n");
-    switch (kernel_to_unit[kernel_id]) {
+    Unit unit;
+    if (!find_unit(kernel_to_unit, kernel_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.kernel_start(kernel_id, arguments));
@@ -265,8 +367,149 @@ HHALExitCode HHAL::kernel_start(int kernel_id, const Arguments &arguments) {
     return HHALExitCode::ERROR;
 }
 
+HHALExitCode HHAL::kernel_start_async(int kernel_id, const Arguments &arguments, completion_t on_completion) {
+    Unit unit;
+    if (!find_unit(kernel_to_unit, kernel_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.kernel_start(kernel_id, arguments, [on_completion](GNManagerExitCode ec) {
+                on_completion(ec == GNManagerExitCode::OK ? HHALExitCode::OK : HHALExitCode::ERROR);
+            }));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.kernel_start(kernel_id, arguments, [on_completion](NvidiaManagerExitCode ec) {
+                on_completion(ec == NvidiaManagerExitCode::OK ? HHALExitCode::OK : HHALExitCode::ERROR);
+            }));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+std::future<HHALExitCode> HHAL::kernel_start_async(int kernel_id, const Arguments &arguments) {
+    // Shared, as completion callbacks have to be copyable
+    auto promise = std::make_shared<std::promise<HHALExitCode>>();
+    std::future<HHALExitCode> future = promise->get_future();
+    HHALExitCode ec = kernel_start_async(kernel_id, arguments, [promise](HHALExitCode result) {
+        promise->set_value(result);
+    });
+    if (ec != HHALExitCode::OK) {
+        promise->set_value(ec);
+    }
+    return future;
+}
+
+HHALExitCode HHAL::launch_async(int launch_id, completion_t on_completion) {
+    Unit unit;
+    if (!find_unit(launch_to_unit, launch_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.launch(launch_id, [on_completion](GNManagerExitCode ec) {
+                on_completion(ec == GNManagerExitCode::OK ? HHALExitCode::OK : HHALExitCode::ERROR);
+            }));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.launch(launch_id, [on_completion](NvidiaManagerExitCode ec) {
+                on_completion(ec == NvidiaManagerExitCode::OK ? HHALExitCode::OK : HHALExitCode::ERROR);
+            }));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::prepare_launch(int launch_id, int kernel_id, const Arguments &arguments) {
+    Unit unit;
+    if (!find_unit(kernel_to_unit, kernel_id, unit) || !insert_unit(launch_to_unit, launch_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    HHALExitCode exit_code = [&]() {
+        switch (unit) {
+#ifdef ENABLE_GN
+            case Unit::GN:
+                MAP_GN_EXIT_CODE(GN_MANAGER.prepare_launch(launch_id, kernel_id, arguments));
+                break;
+#endif
+#ifdef ENABLE_NVIDIA
+            case Unit::NVIDIA:
+                MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.prepare_launch(launch_id, kernel_id, arguments));
+                break;
+#endif
+            default:
+                break;
+        }
+        return HHALExitCode::ERROR;
+    }();
+    if (exit_code != HHALExitCode::OK) {
+        erase_unit(launch_to_unit, launch_id);
+    }
+    return exit_code;
+}
+
+HHALExitCode HHAL::launch(int launch_id) {
+    Unit unit;
+    if (!find_unit(launch_to_unit, launch_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.launch(launch_id));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.launch(launch_id));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::release_launch(int launch_id) {
+    Unit unit;
+    if (!take_unit(launch_to_unit, launch_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.release_launch(launch_id));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.release_launch(launch_id));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
 HHALExitCode HHAL::allocate_memory(int buffer_id) {
-    switch (buffer_to_unit[buffer_id]) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.allocate_memory(buffer_id));
@@ -284,7 +527,11 @@ HHALExitCode HHAL::allocate_memory(int buffer_id) {
 }
 
 HHALExitCode HHAL::release_memory(int buffer_id) {
-    switch (buffer_to_unit[buffer_id]) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.release_memory(buffer_id));
@@ -302,7 +549,11 @@ HHALExitCode HHAL::release_memory(int buffer_id) {
 }
 
 HHALExitCode HHAL::allocate_kernel(int kernel_id) {
-    switch (kernel_to_unit[kernel_id]) {
+    Unit unit;
+    if (!find_unit(kernel_to_unit, kernel_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.allocate_kernel(kernel_id));
@@ -320,7 +571,11 @@ HHALExitCode HHAL::allocate_kernel(int kernel_id) {
 }
 
 HHALExitCode HHAL::release_kernel(int kernel_id) {
-    switch (kernel_to_unit[kernel_id]) {
+    Unit unit;
+    if (!find_unit(kernel_to_unit, kernel_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.release_kernel(kernel_id));
@@ -338,7 +593,11 @@ HHALExitCode HHAL::release_kernel(int kernel_id) {
 }
 
 HHALExitCode HHAL::write_to_memory(int buffer_id, const void *source, size_t size) {
-    switch (buffer_to_unit[buffer_id]) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.write_to_memory(buffer_id, source, size));
@@ -355,8 +614,39 @@ HHALExitCode HHAL::write_to_memory(int buffer_id, const void *source, size_t siz
     return HHALExitCode::ERROR;
 }
 
+HHALExitCode HHAL::write_to_memory(int buffer_id, const void *source, size_t size, size_t offset) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.write_to_memory(buffer_id, source, size, offset));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.write_to_memory(buffer_id, source, size, offset));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+bool HHAL::supports_offset_writes(int buffer_id) {
+    Unit unit;
+    return find_unit(buffer_to_unit, buffer_id, unit) && unit == Unit::GN;
+}
+
 HHALExitCode HHAL::read_from_memory(int buffer_id, void *dest, size_t size) {
-    switch (buffer_to_unit[buffer_id]) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.read_from_memory(buffer_id, dest, size));
@@ -373,13 +663,128 @@ HHALExitCode HHAL::read_from_memory(int buffer_id, void *dest, size_t size) {
     return HHALExitCode::ERROR;
 }
 
-HHALExitCode HHAL::write_sync_register(int event_id, uint32_t data) {
-    switch (event_to_unit[event_id]) {
+HHALExitCode HHAL::read_from_memory(int buffer_id, void *dest, size_t size, size_t offset) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.read_from_memory(buffer_id, dest, size, offset));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.read_from_memory(buffer_id, dest, size, offset));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::write_region(int buffer_id, const void *source, const memory_region &region) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
-            MAP_GN_EXIT_CODE(GN_MANAGER.write_sync_register(event_id, data));
+            MAP_GN_EXIT_CODE(GN_MANAGER.write_region(buffer_id, source, region));
             break;
 #endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.write_region(buffer_id, source, region));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::read_region(int buffer_id, void *dest, const memory_region &region) {
+    Unit unit;
+    if (!find_unit(buffer_to_unit, buffer_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.read_region(buffer_id, dest, region));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.read_region(buffer_id, dest, region));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
+    Unit src_unit, dst_unit;
+    if (!find_unit(buffer_to_unit, src_id, src_unit) || !find_unit(buffer_to_unit, dst_id, dst_unit)) {
+        return HHALExitCode::ERROR;
+    }
+    if (src_unit == dst_unit) {
+        switch (src_unit) {
+#ifdef ENABLE_GN
+            case Unit::GN:
+                MAP_GN_EXIT_CODE(GN_MANAGER.copy_buffer(src_id, dst_id, src_offset, dst_offset, size));
+                break;
+#endif
+#ifdef ENABLE_NVIDIA
+            case Unit::NVIDIA:
+                MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.copy_buffer(src_id, dst_id, src_offset, dst_offset, size));
+                break;
+#endif
+            default:
+                break;
+        }
+        return HHALExitCode::ERROR;
+    }
+#if defined(ENABLE_GN) && defined(ENABLE_NVIDIA)
+    void *gn_range;
+    if (src_unit == Unit::GN) {
+        if (GN_MANAGER.buffer_address(src_id, src_offset, size, &gn_range) != GNManagerExitCode::OK) {
+            return HHALExitCode::ERROR;
+        }
+        MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.write_to_memory(dst_id, gn_range, size, dst_offset));
+    } else {
+        if (GN_MANAGER.buffer_address(dst_id, dst_offset, size, &gn_range) != GNManagerExitCode::OK) {
+            return HHALExitCode::ERROR;
+        }
+        MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.read_from_memory(src_id, gn_range, size, src_offset));
+    }
+#endif
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::write_sync_register(int event_id, uint32_t data) {
+    Unit unit;
+    if (!find_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN: {
+            // NVIDIA notifies through its event registry, GN registers are plain memory
+            GNManagerExitCode ec = GN_MANAGER.write_sync_register(event_id, data);
+            if (ec == GNManagerExitCode::OK && event_listener) {
+                event_listener(event_id);
+            }
+            MAP_GN_EXIT_CODE(ec);
+            break;
+        }
+#endif
 #ifdef ENABLE_NVIDIA
         case Unit::NVIDIA:
             MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.write_sync_register(event_id, data));
@@ -392,7 +797,11 @@ HHALExitCode HHAL::write_sync_register(int event_id, uint32_t data) {
 }
 
 HHALExitCode HHAL::read_sync_register(int event_id, uint32_t *data) {
-    switch (event_to_unit[event_id]) {
+    Unit unit;
+    if (!find_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.read_sync_register(event_id, data));
@@ -409,8 +818,73 @@ HHALExitCode HHAL::read_sync_register(int event_id, uint32_t *data) {
     return HHALExitCode::ERROR;
 }
 
+HHALExitCode HHAL::try_wait_sync_register(int event_id, uint32_t value, bool *matched) {
+    Unit unit;
+    if (!find_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN:
+            MAP_GN_EXIT_CODE(GN_MANAGER.try_wait_sync_register(event_id, value, matched));
+            break;
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA:
+            MAP_NVIDIA_EXIT_CODE(NVIDIA_MANAGER.try_wait_sync_register(event_id, value, matched));
+            break;
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+HHALExitCode HHAL::wait_sync_register(int event_id, uint32_t value, int timeout_ms) {
+    Unit unit;
+    if (!find_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
+#ifdef ENABLE_GN
+        case Unit::GN: {
+            GNManagerExitCode ec = GN_MANAGER.wait_sync_register(event_id, value, timeout_ms);
+            if (ec == GNManagerExitCode::TIMEOUT) {
+                return HHALExitCode::TIMEOUT;
+            }
+            MAP_GN_EXIT_CODE(ec);
+            break;
+        }
+#endif
+#ifdef ENABLE_NVIDIA
+        case Unit::NVIDIA: {
+            NvidiaManagerExitCode ec = NVIDIA_MANAGER.wait_sync_register(event_id, value, timeout_ms);
+            if (ec == NvidiaManagerExitCode::TIMEOUT) {
+                return HHALExitCode::TIMEOUT;
+            }
+            MAP_NVIDIA_EXIT_CODE(ec);
+            break;
+        }
+#endif
+        default:
+            break;
+    }
+    return HHALExitCode::ERROR;
+}
+
+void HHAL::set_event_listener(event_listener_t listener) {
+    event_listener = listener;
+#ifdef ENABLE_NVIDIA
+    NVIDIA_MANAGER.set_event_listener(listener);
+#endif
+}
+
 HHALExitCode HHAL::allocate_event(int event_id) {
-    switch (event_to_unit[event_id]) {
+    Unit unit;
+    if (!find_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.allocate_event(event_id));
@@ -428,7 +902,11 @@ HHALExitCode HHAL::allocate_event(int event_id) {
 }
 
 HHALExitCode HHAL::release_event(int event_id) {
-    switch (event_to_unit[event_id]) {
+    Unit unit;
+    if (!find_unit(event_to_unit, event_id, unit)) {
+        return HHALExitCode::ERROR;
+    }
+    switch (unit) {
 #ifdef ENABLE_GN
         case Unit::GN:
             MAP_GN_EXIT_CODE(GN_MANAGER.release_event(event_id));
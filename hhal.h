@@ -1,9 +1,16 @@
 #ifndef HHAL_H
 #define HHAL_H
 
+#include <functional>
+#include <future>
 #include <map>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
 
 #include "arguments.h"
+#include "handle_table.h"
+#include "task_graph.h"
 #include "types.h"
 
 #include "gn/types.h"
@@ -14,8 +21,21 @@ namespace hhal {
 enum class HHALExitCode {
     OK,
     ERROR,
+    TIMEOUT, // A wait was not satisfied in time
 };
 
+typedef std::function<void(int event_id)> event_listener_t;
+typedef std::function<void(HHALExitCode)> completion_t;
+
+/*
+* Thread safety: every method can be called concurrently from several threads. Id lookups only take shared
+* locks and copy what they need, so kernel starts, memory transfers and sync register operations on different
+* resources run in parallel; assigning, deassigning, allocating and releasing briefly serialize with each other.
+* GN sync registers are updated with atomic operations, they are only serialized by the semaphore shared with the
+* kernels on the device with HHAL_GN_SYNC_REGISTERS=semaphore.
+* Calls on the same resource are not ordered against each other: a resource must not be released or deassigned
+* while other threads still operate on it. set_event_listener is not synchronized, set it before sharing HHAL.
+*/
 class HHAL {
     public:
         HHAL();
@@ -25,14 +45,81 @@ class HHAL {
         HHALExitCode kernel_write(int kernel_id, const std::map<Unit, hhal_kernel_source> &kernel_sources);
         HHALExitCode kernel_start(int kernel_id, const Arguments &arguments);
 
+        /*
+        * Prepared launches resolve and encode the arguments of a kernel once, so starting it again with the same
+        * arguments only costs a lookup. Launch ids are chosen by the caller, like the ids of other resources.
+        * Buffer and event locations are taken when preparing: prepare again after reallocating any of them.
+        */
+        HHALExitCode prepare_launch(int launch_id, int kernel_id, const Arguments &arguments);
+        HHALExitCode launch(int launch_id);
+        HHALExitCode release_launch(int launch_id);
+
+        /*
+        * Asynchronous starts: on_completion is called once the kernel terminated, or with ERROR if it could not run,
+        * from the NVIDIA pool thread that ran it or from the GN completion watcher thread. It is only called if the
+        * start returned OK. The termination event is still written; on GN it is cleared before the kernel starts.
+        */
+        HHALExitCode kernel_start_async(int kernel_id, const Arguments &arguments, completion_t on_completion);
+        // The future holds ERROR right away if the kernel could not be started
+        std::future<HHALExitCode> kernel_start_async(int kernel_id, const Arguments &arguments);
+        HHALExitCode launch_async(int launch_id, completion_t on_completion);
+
+        /*
+        * Task graphs: prepare_graph derives the dependencies between the tasks of the graph and prepares its kernels
+        * once, run_graph then starts every task as soon as the ones it depends on are done, on any unit, and returns
+        * once all of them are. Kernels are started asynchronously, see kernel_start_async. Graph ids are chosen by the caller.
+        * run_graph fails while the same graph runs on another thread. After a TIMEOUT the kernels already started keep
+        * running, the next run of the graph waits for them before starting any task.
+        */
+        HHALExitCode prepare_graph(int graph_id, const TaskGraph &graph);
+        // Returns TIMEOUT if the graph is not done within timeout_ms, a negative timeout waits forever
+        HHALExitCode run_graph(int graph_id, int timeout_ms = -1);
+        HHALExitCode release_graph(int graph_id);
+
         HHALExitCode write_to_memory(int buffer_id, const void *source, size_t size);
         HHALExitCode read_from_memory(int buffer_id, void *dest, size_t size);
+        // Transfer size bytes starting offset bytes past the base of the buffer, the range must fit in the buffer
+        HHALExitCode write_to_memory(int buffer_id, const void *source, size_t size, size_t offset);
+        HHALExitCode read_from_memory(int buffer_id, void *dest, size_t size, size_t offset);
+        // Transfer the rows of a 2D or 3D region, see memory_region
+        HHALExitCode write_region(int buffer_id, const void *source, const memory_region &region);
+        HHALExitCode read_region(int buffer_id, void *dest, const memory_region &region);
+        /*
+        * Copies size bytes between two buffers, of the same unit or not, without going through the caller.
+        * GN buffers are copied within the device memory, including overlapping ranges of one buffer, and the
+        * NVIDIA side of a copy between units transfers straight from or to the GN mapping.
+        */
+        HHALExitCode copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size);
+        /*
+        * Whether writes at a non zero offset go straight to the device. NVIDIA transfers always start at the buffer
+        * base, so NVIDIA offset writes read back the start of the buffer first and are better done at once.
+        */
+        bool supports_offset_writes(int buffer_id);
 
         HHALExitCode write_sync_register(int event_id, uint32_t data);
         HHALExitCode read_sync_register(int event_id, uint32_t *data);
+        // Consumes the register like read_sync_register if it holds value, otherwise leaves it untouched
+        HHALExitCode try_wait_sync_register(int event_id, uint32_t value, bool *matched);
+        /*
+        * Blocks until the register holds value, then consumes it like read_sync_register. Returns TIMEOUT if it does
+        * not within timeout_ms, a negative timeout waits forever. Waits on GN sleep on the register itself, woken by
+        * writes from this process and checking it every millisecond for writes from kernels and other processes.
+        */
+        HHALExitCode wait_sync_register(int event_id, uint32_t value, int timeout_ms);
+
+        /*
+        * The listener is called after a sync register is written through HHAL or by a finished NVIDIA kernel,
+        * possibly from an internal thread. GN registers written by kernels on the device are not reported.
+        */
+        void set_event_listener(event_listener_t listener);
         // -----------------------
 
-        // Resource management
+        /*
+        * Resource management. The ids of kernels, buffers and events, like launch and graph ids, index tables
+        * directly: they must be in [0, MAX_ID], assigning or preparing an id out of range or already in use fails.
+        */
+        static const int MAX_ID = HandleTable<Unit>::MAX_ID;
+
         HHALExitCode assign_kernel(Unit unit, hhal_kernel *info);
         HHALExitCode assign_buffer(Unit unit, hhal_buffer *info);
         HHALExitCode assign_event (Unit unit, hhal_event *info);
@@ -57,9 +144,32 @@ class HHAL {
         // Pointer to forward declared class to avoid including implementation dependent headers
         Impl *impl;
 
-        std::map<int, Unit> kernel_to_unit;
-        std::map<int, Unit> buffer_to_unit;
-        std::map<int, Unit> event_to_unit;
+        // Guards the tables below
+        mutable std::shared_timed_mutex units_mtx;
+
+        HandleTable<Unit> kernel_to_unit;
+        HandleTable<Unit> buffer_to_unit;
+        HandleTable<Unit> event_to_unit;
+        HandleTable<Unit> launch_to_unit;
+
+        // What task graphs are derived from, recorded when buffers are assigned
+        struct buffer_users {
+            std::vector<int> kernels_in;
+            std::vector<int> kernels_out;
+        };
+        HandleTable<buffer_users> buffer_kernels;
+
+        struct prepared_graph;
+        HandleTable<std::shared_ptr<prepared_graph>> graphs;
+
+        event_listener_t event_listener;
+
+        bool find_unit(const HandleTable<Unit> &table, int id, Unit &unit) const;
+        // Fails if the id is out of range or already in use
+        bool insert_unit(HandleTable<Unit> &table, int id, Unit unit);
+        void erase_unit(HandleTable<Unit> &table, int id);
+        // Looks up and erases in one step, so only one of concurrent deassigns finds the id
+        bool take_unit(HandleTable<Unit> &table, int id, Unit &unit);
 };
 
 }
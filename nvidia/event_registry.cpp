@@ -1,3 +1,4 @@
+#include <chrono>
 #include <cstdio>
 
 #include "nvidia/event_registry.h"
@@ -19,6 +20,7 @@ namespace hhal {
             return EventRegistryExitCode::ERROR;
         }
         registers.erase(event_id);
+        written.notify_all();
         return EventRegistryExitCode::OK;
     }
 
@@ -42,6 +44,51 @@ namespace hhal {
             return EventRegistryExitCode::ERROR;
         }
         it->second = data;
+        listener_t notify = listener;
+        lck.unlock();
+        written.notify_all();
+
+        if (notify) notify(event_id);
+        return EventRegistryExitCode::OK;
+    }
+
+    EventRegistryExitCode EventRegistry::try_read_event(int event_id, uint32_t value, bool *matched) {
+        std::unique_lock<std::mutex> lck(registers_mtx);
+        auto it = registers.find(event_id);
+        if (it == registers.end()) {
+            printf("[Error] EventRegistry: Event %d not present\n", event_id);
+            return EventRegistryExitCode::ERROR;
+        }
+        *matched = it->second == value;
+        if (*matched) {
+            it->second = 0;
+        }
         return EventRegistryExitCode::OK;
     }
+
+    EventRegistryExitCode EventRegistry::wait_event(int event_id, uint32_t value, int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        std::unique_lock<std::mutex> lck(registers_mtx);
+        for (;;) {
+            auto it = registers.find(event_id);
+            if (it == registers.end()) {
+                printf("[Error] EventRegistry: Event %d not present\n", event_id);
+                return EventRegistryExitCode::ERROR;
+            }
+            if (it->second == value) {
+                it->second = 0;
+                return EventRegistryExitCode::OK;
+            }
+            if (timeout_ms < 0) {
+                written.wait(lck);
+            } else if (written.wait_until(lck, deadline) == std::cv_status::timeout) {
+                return EventRegistryExitCode::TIMEOUT;
+            }
+        }
+    }
+
+    void EventRegistry::set_listener(listener_t listener) {
+        std::unique_lock<std::mutex> lck(registers_mtx);
+        this->listener = listener;
+    }
 }
@@ -1,8 +1,10 @@
 #ifndef EVENT_REGISTRY_H
 #define EVENT_REGISTRY_H
 
+#include <condition_variable>
 #include <mutex>
 #include <cinttypes>
+#include <functional>
 #include <map>
 
 namespace hhal {
@@ -10,19 +12,32 @@ namespace hhal {
 enum class EventRegistryExitCode {
     OK,
     ERROR,
+    TIMEOUT,
 };
 
 class EventRegistry {
     public:
+        typedef std::function<void(int event_id)> listener_t;
+
         EventRegistryExitCode add_event(int event_id);
         EventRegistryExitCode remove_event(int event_id);
 
         EventRegistryExitCode read_event(int event_id, uint32_t *data);
         EventRegistryExitCode write_event(int event_id, uint32_t data);
+        // Reads and clears the event only if it holds value
+        EventRegistryExitCode try_read_event(int event_id, uint32_t value, bool *matched);
+        // Blocks until the event holds value and clears it, TIMEOUT after timeout_ms unless negative
+        EventRegistryExitCode wait_event(int event_id, uint32_t value, int timeout_ms);
+
+        // Called after every write, outside of the registry lock
+        void set_listener(listener_t listener);
 
     private:
         std::mutex registers_mtx;
+        // Notified on every write and removal
+        std::condition_variable written;
         std::map<int, uint32_t> registers;
+        listener_t listener;
 
 };
 }
@@ -10,46 +10,89 @@
 #include "nvidia/manager.h"
 #include "kernel_arguments.h"
 
+// Copies the entry of id out of a handle table, failing the calling operation if it is unknown
+#define FIND_OR_FAIL(type, var, table, id, what)                                \
+        type var;                                                               \
+        if (!find_entry(table, id, var)) {                                      \
+            printf("NvidiaManager: %s: Unknown " what " %d\n", __func__, id);   \
+            return NvidiaManagerExitCode::ERROR;                                \
+        }
+
 namespace hhal {
 
+    template <typename T>
+    bool NvidiaManager::find_entry(const HandleTable<T> &table, int id, T &entry) const {
+        shared_lock lock(resources_mtx);
+        const T *found = table.find(id);
+        if (found == nullptr) {
+            return false;
+        }
+        entry = *found;
+        return true;
+    }
+
     NvidiaManagerExitCode NvidiaManager::assign_kernel(nvidia_kernel *info) {
         printf("NvidiaManager: Assigning kernel %d, mem_id=%d\n", info->id, info->mem_id);
-        kernel_info[info->id] = *info;
+        exclusive_lock lock(resources_mtx);
+        if (kernel_info.insert(info->id, *info) == nullptr) {
+            printf("NvidiaManager: Kernel id %d out of range\n", info->id);
+            return NvidiaManagerExitCode::ERROR;
+        }
         return NvidiaManagerExitCode::OK;
     }
 
     NvidiaManagerExitCode NvidiaManager::assign_buffer(nvidia_buffer *info) {
         printf("NvidiaManager: Assigning buffer %d\n", info->id);
-        buffer_info[info->id] = *info;
+        exclusive_lock lock(resources_mtx);
+        if (buffer_info.insert(info->id, *info) == nullptr) {
+            printf("NvidiaManager: Buffer id %d out of range\n", info->id);
+            return NvidiaManagerExitCode::ERROR;
+        }
         return NvidiaManagerExitCode::OK;
     }
 
     NvidiaManagerExitCode NvidiaManager::assign_event(nvidia_event *info) {
         printf("NvidiaManager: Assigning event %d\n", info->id);
-        event_info[info->id] = *info;
+        exclusive_lock lock(resources_mtx);
+        if (event_info.insert(info->id, *info) == nullptr) {
+            printf("NvidiaManager: Event id %d out of range\n", info->id);
+            return NvidiaManagerExitCode::ERROR;
+        }
         return NvidiaManagerExitCode::OK;
     }
 
     NvidiaManagerExitCode NvidiaManager::deassign_kernel(int kernel_id) {
         printf("NvidiaManager: Deassigning kernel %d\n", kernel_id);
-        kernel_info.erase(kernel_id);
+        exclusive_lock lock(resources_mtx);
+        if (!kernel_info.erase(kernel_id)) {
+            printf("NvidiaManager: Unknown kernel %d\n", kernel_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
         return NvidiaManagerExitCode::OK;
     }
 
     NvidiaManagerExitCode NvidiaManager::deassign_buffer(int buffer_id) {
         printf("NvidiaManager: Deassigning buffer %d\n", buffer_id);
-        buffer_info.erase(buffer_id);
+        exclusive_lock lock(resources_mtx);
+        if (!buffer_info.erase(buffer_id)) {
+            printf("NvidiaManager: Unknown buffer %d\n", buffer_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
         return NvidiaManagerExitCode::OK;
     }
 
     NvidiaManagerExitCode NvidiaManager::deassign_event(int event_id) {
         printf("NvidiaManager: Deassigning event %d\n", event_id);
-        event_info.erase(event_id);
+        exclusive_lock lock(resources_mtx);
+        if (!event_info.erase(event_id)) {
+            printf("NvidiaManager: Unknown event %d\n", event_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
         return NvidiaManagerExitCode::OK;
     }
 
     NvidiaManagerExitCode NvidiaManager::kernel_write(int kernel_id, std::string image_path) {
-        nvidia_kernel &info = kernel_info[kernel_id];
+        FIND_OR_FAIL(nvidia_kernel, info, kernel_info, kernel_id, "kernel");
 
         std::ifstream input_file(image_path, std::ifstream::in | std::ifstream::ate);
 
@@ -100,8 +143,58 @@ namespace hhal {
     }
 
     NvidiaManagerExitCode NvidiaManager::kernel_start(int kernel_id, const Arguments &arguments) {
+        return kernel_start(kernel_id, arguments, nullptr);
+    }
+
+    NvidiaManagerExitCode NvidiaManager::kernel_start(int kernel_id, const Arguments &arguments, completion_t on_completion) {
+        encoded_launch_ptr launch = std::make_shared<encoded_launch>();
+        NvidiaManagerExitCode ec = encode_launch(kernel_id, arguments, *launch);
+        if (ec != NvidiaManagerExitCode::OK) {
+            return ec;
+        }
+
+        thread_pool.push_task(std::bind(&NvidiaManager::launch_kernel, this, launch, on_completion));
+
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::prepare_launch(int launch_id, int kernel_id, const Arguments &arguments) {
+        encoded_launch_ptr launch = std::make_shared<encoded_launch>();
+        NvidiaManagerExitCode ec = encode_launch(kernel_id, arguments, *launch);
+        if (ec != NvidiaManagerExitCode::OK) {
+            return ec;
+        }
+        exclusive_lock lock(resources_mtx);
+        if (prepared_launches.insert(launch_id, launch) == nullptr) {
+            printf("NvidiaManager: Launch id %d out of range\n", launch_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::launch(int launch_id) {
+        return launch(launch_id, nullptr);
+    }
+
+    NvidiaManagerExitCode NvidiaManager::launch(int launch_id, completion_t on_completion) {
+        FIND_OR_FAIL(encoded_launch_ptr, prepared, prepared_launches, launch_id, "launch");
+
+        thread_pool.push_task(std::bind(&NvidiaManager::launch_kernel, this, prepared, on_completion));
+
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::release_launch(int launch_id) {
+        exclusive_lock lock(resources_mtx);
+        if (!prepared_launches.erase(launch_id)) {
+            printf("NvidiaManager: Unknown launch %d\n", launch_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::encode_launch(int kernel_id, const Arguments &arguments, encoded_launch &launch) {
         auto &args = arguments.get_args();
-        int arg_count = args.size();
         size_t arg_array_size = 0;
         size_t arg_scalar_size = 0;
         for(auto &arg: args) {
@@ -123,15 +216,17 @@ namespace hhal {
             }
         }
 
-        char *scalar_allocations = (char*) malloc(arg_scalar_size);
-        char *current_allocation = scalar_allocations;
-        char *arg_array = (char*) malloc(arg_array_size);
-        char *current_arg = arg_array;
+        launch.kernel_id = kernel_id;
+        launch.arg_count = args.size();
+        launch.arg_array.resize(arg_array_size);
+        launch.scalar_allocations.resize(arg_scalar_size);
+        char *current_allocation = launch.scalar_allocations.data();
+        char *current_arg = launch.arg_array.data();
 
         for(auto &arg: args) {
             switch (arg.type) {
                 case ArgumentType::BUFFER: {
-                    auto &b_info = buffer_info[arg.buffer.id];
+                    FIND_OR_FAIL(nvidia_buffer, b_info, buffer_info, arg.buffer.id, "buffer");
                     // If the buffer has the kernel as an output (the kernel will READ from the buffer)
                     // then the buffer is an input to that kernel.
                     auto &kernels_out = b_info.kernels_out;
@@ -151,7 +246,6 @@ namespace hhal {
 
                     current_allocation += scalar.size;
                     current_arg += sizeof(cuda_manager::ScalarArg);
-                    arg_array_size += sizeof(cuda_manager::ScalarArg);
                     break;
                 }
                 default:
@@ -160,39 +254,43 @@ namespace hhal {
             }
         }
 
-        thread_pool.push_task(std::bind(&NvidiaManager::launch_kernel, this, kernel_id, arg_array, arg_count, scalar_allocations));
-
         return NvidiaManagerExitCode::OK;
     }
 
-    void NvidiaManager::launch_kernel(int kernel_id, char *arg_array, int arg_count, char* scalar_allocations) {
-        // Should we add mutexes for the kernel and event maps? They should not be modified after being assigned anyway.
-        nvidia_kernel &info = kernel_info[kernel_id];
+    void NvidiaManager::launch_kernel(encoded_launch_ptr launch, completion_t on_completion) {
+        // Runs on a pool thread, the entries are copied out so the kernel can be deassigned meanwhile
+        int kernel_id = launch->kernel_id;
+        nvidia_kernel info;
+        nvidia_event termination_event;
+        if (!find_entry(kernel_info, kernel_id, info) || !find_entry(event_info, info.termination_event, termination_event)) {
+            printf("[Error] NvidiaManager: Kernel %d or its termination event is no longer assigned\n", kernel_id);
+            if (on_completion) on_completion(NvidiaManagerExitCode::ERROR);
+            return;
+        }
 
         CudaResourceArgs r_args = {info.gpu_id, {info.grid_dim_x, info.grid_dim_y, info.grid_dim_z}, {info.block_dim_x, info.block_dim_y, info.block_dim_z}};
 
-        auto &termination_event = event_info[info.termination_event];
-
 #ifdef PROFILING_MODE
         auto ref = profiling::Profiler::get_instance().start_kernel_execution(kernel_id);
 #endif
-        CudaApiExitCode err = cuda_api.launch_kernel(kernel_id, r_args, arg_array, arg_count);
+        CudaApiExitCode err = cuda_api.launch_kernel(kernel_id, r_args, launch->arg_array.data(), launch->arg_count);
 #ifdef PROFILING_MODE
         ref->finish();
 #endif
 
-        free(arg_array);
-        free(scalar_allocations);
-
         if (err != OK) {
             printf("[Error] NvidiaManager: Error launching kernel\n");
         }
 
         write_sync_register(termination_event.id, 1);
+
+        if (on_completion) {
+            on_completion(err == OK ? NvidiaManagerExitCode::OK : NvidiaManagerExitCode::ERROR);
+        }
     }
 
     NvidiaManagerExitCode NvidiaManager::allocate_memory(int buffer_id) {
-        nvidia_buffer &info = buffer_info[buffer_id];
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
 
         CudaApiExitCode err = cuda_api.allocate_memory(info.mem_id, info.size);
 
@@ -218,7 +316,7 @@ namespace hhal {
     }
 
     NvidiaManagerExitCode NvidiaManager::release_memory(int buffer_id) {
-        nvidia_buffer &info = buffer_info[buffer_id];
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
 
         CudaApiExitCode err = cuda_api.deallocate_memory(info.mem_id);
 
@@ -230,7 +328,7 @@ namespace hhal {
     }
     
     NvidiaManagerExitCode NvidiaManager::release_kernel(int kernel_id) {
-        nvidia_kernel &info = kernel_info[kernel_id];
+        FIND_OR_FAIL(nvidia_kernel, info, kernel_info, kernel_id, "kernel");
 
         CudaApiExitCode err = cuda_api.deallocate_kernel(info.mem_id);
 
@@ -242,7 +340,7 @@ namespace hhal {
     }
 
     NvidiaManagerExitCode NvidiaManager::write_to_memory(int buffer_id, const void *source, size_t size) {
-        nvidia_buffer &info = buffer_info[buffer_id];
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
 
         CudaApiExitCode err = cuda_api.write_memory(info.mem_id, source, size);
 
@@ -254,7 +352,7 @@ namespace hhal {
     }
 
     NvidiaManagerExitCode NvidiaManager::read_from_memory(int buffer_id, void *dest, size_t size) {
-        nvidia_buffer &info = buffer_info[buffer_id];
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
 
         CudaApiExitCode err = cuda_api.read_memory(info.mem_id, dest, size);
 
@@ -265,6 +363,92 @@ namespace hhal {
         return NvidiaManagerExitCode::OK;
     }
 
+    NvidiaManagerExitCode NvidiaManager::write_to_memory(int buffer_id, const void *source, size_t size, size_t offset) {
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
+        if (offset > info.size || size > info.size - offset) {
+            printf("NvidiaManager: write_to_memory: range out of buffer %d: offset=%zu, size=%zu, buffer size=%zu\n",
+                   buffer_id, offset, size, info.size);
+            return NvidiaManagerExitCode::ERROR;
+        }
+        if (offset == 0) {
+            return cuda_api.write_memory(info.mem_id, source, size) == OK ? NvidiaManagerExitCode::OK : NvidiaManagerExitCode::ERROR;
+        }
+
+        std::vector<char> staging(offset + size);
+        if (cuda_api.read_memory(info.mem_id, staging.data(), offset) != OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        memcpy(staging.data() + offset, source, size);
+        if (cuda_api.write_memory(info.mem_id, staging.data(), staging.size()) != OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::read_from_memory(int buffer_id, void *dest, size_t size, size_t offset) {
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
+        if (offset > info.size || size > info.size - offset) {
+            printf("NvidiaManager: read_from_memory: range out of buffer %d: offset=%zu, size=%zu, buffer size=%zu\n",
+                   buffer_id, offset, size, info.size);
+            return NvidiaManagerExitCode::ERROR;
+        }
+        if (offset == 0) {
+            return cuda_api.read_memory(info.mem_id, dest, size) == OK ? NvidiaManagerExitCode::OK : NvidiaManagerExitCode::ERROR;
+        }
+
+        std::vector<char> staging(offset + size);
+        if (cuda_api.read_memory(info.mem_id, staging.data(), staging.size()) != OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        memcpy(dest, staging.data() + offset, size);
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::write_region(int buffer_id, const void *source, const memory_region &region) {
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
+        size_t extent;
+        if (!buffer_extent(region, &extent) || extent > info.size) {
+            printf("NvidiaManager: write_region: region out of buffer %d\n", buffer_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
+
+        // The gaps between rows keep their contents
+        std::vector<char> staging(extent);
+        if (cuda_api.read_memory(info.mem_id, staging.data(), extent) != OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        copy_region(staging.data(), static_cast<char *>(const_cast<void *>(source)), region, true);
+        if (cuda_api.write_memory(info.mem_id, staging.data(), extent) != OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::read_region(int buffer_id, void *dest, const memory_region &region) {
+        FIND_OR_FAIL(nvidia_buffer, info, buffer_info, buffer_id, "buffer");
+        size_t extent;
+        if (!buffer_extent(region, &extent) || extent > info.size) {
+            printf("NvidiaManager: read_region: region out of buffer %d\n", buffer_id);
+            return NvidiaManagerExitCode::ERROR;
+        }
+
+        std::vector<char> staging(extent);
+        if (cuda_api.read_memory(info.mem_id, staging.data(), extent) != OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        copy_region(staging.data(), static_cast<char *>(dest), region, false);
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size) {
+        std::vector<char> staging(size);
+        auto ec = read_from_memory(src_id, staging.data(), size, src_offset);
+        if (ec != NvidiaManagerExitCode::OK) {
+            return ec;
+        }
+        return write_to_memory(dst_id, staging.data(), size, dst_offset);
+    }
+
     NvidiaManagerExitCode NvidiaManager::write_sync_register(int event_id, uint32_t data) {
         auto ec = registry.write_event(event_id, data);
         if (ec != EventRegistryExitCode::OK) {
@@ -281,6 +465,29 @@ namespace hhal {
         return NvidiaManagerExitCode::OK;
     }
 
+    NvidiaManagerExitCode NvidiaManager::try_wait_sync_register(int event_id, uint32_t value, bool *matched) {
+        auto ec = registry.try_read_event(event_id, value, matched);
+        if (ec != EventRegistryExitCode::OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        return NvidiaManagerExitCode::OK;
+    }
+
+    NvidiaManagerExitCode NvidiaManager::wait_sync_register(int event_id, uint32_t value, int timeout_ms) {
+        auto ec = registry.wait_event(event_id, value, timeout_ms);
+        if (ec == EventRegistryExitCode::TIMEOUT) {
+            return NvidiaManagerExitCode::TIMEOUT;
+        }
+        if (ec != EventRegistryExitCode::OK) {
+            return NvidiaManagerExitCode::ERROR;
+        }
+        return NvidiaManagerExitCode::OK;
+    }
+
+    void NvidiaManager::set_event_listener(EventRegistry::listener_t listener) {
+        registry.set_listener(listener);
+    }
+
     NvidiaManagerExitCode NvidiaManager::allocate_event(int event_id) {
         auto ec = registry.add_event(event_id);
         if (ec != EventRegistryExitCode::OK) {
@@ -1,12 +1,18 @@
 #ifndef NVIDIA_MANAGER_H
 #define NVIDIA_MANAGER_H
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
+#include <vector>
 #include <cstdint>
 #include <mutex>
+#include <shared_mutex>
 
 #include "arguments.h"
+#include "handle_table.h"
+#include "types.h"
 #include "nvidia/types.h"
 #include "nvidia/event_registry.h"
 #include "nvidia/thread_pool.h"
@@ -18,11 +24,15 @@ namespace hhal {
 enum class NvidiaManagerExitCode {
     OK,
     ERROR,
+    TIMEOUT,
 };
 
 class NvidiaManager {
 
     public:
+        // Called from the pool thread that ran the kernel, once its termination event is written
+        typedef std::function<void(NvidiaManagerExitCode)> completion_t;
+
         NvidiaManagerExitCode assign_kernel(nvidia_kernel *info);
         NvidiaManagerExitCode assign_buffer(nvidia_buffer *info);
         NvidiaManagerExitCode assign_event(nvidia_event *info);
@@ -34,6 +44,11 @@ class NvidiaManager {
         NvidiaManagerExitCode kernel_write(int kernel_id, std::string image_path);
 
         NvidiaManagerExitCode kernel_start(int kernel_id, const Arguments &arguments);
+        NvidiaManagerExitCode prepare_launch(int launch_id, int kernel_id, const Arguments &arguments);
+        NvidiaManagerExitCode launch(int launch_id);
+        NvidiaManagerExitCode release_launch(int launch_id);
+        NvidiaManagerExitCode kernel_start(int kernel_id, const Arguments &arguments, completion_t on_completion);
+        NvidiaManagerExitCode launch(int launch_id, completion_t on_completion);
 
         NvidiaManagerExitCode allocate_memory(int buffer_id);
         NvidiaManagerExitCode allocate_kernel(int kernel_id);
@@ -45,19 +60,53 @@ class NvidiaManager {
 
         NvidiaManagerExitCode write_to_memory(int buffer_id, const void *source, size_t size);
         NvidiaManagerExitCode read_from_memory(int buffer_id, void *dest, size_t size);
+        // CudaApi transfers start at the base of the buffer, the ones below go through a host copy of the buffer up to
+        // the end of the range. Writes read that part back first, so concurrent writes to the same buffer must not overlap it.
+        NvidiaManagerExitCode write_to_memory(int buffer_id, const void *source, size_t size, size_t offset);
+        NvidiaManagerExitCode read_from_memory(int buffer_id, void *dest, size_t size, size_t offset);
+        NvidiaManagerExitCode write_region(int buffer_id, const void *source, const memory_region &region);
+        NvidiaManagerExitCode read_region(int buffer_id, void *dest, const memory_region &region);
+        // CudaApi has no device to device copy, the range is staged on the host
+        NvidiaManagerExitCode copy_buffer(int src_id, int dst_id, size_t src_offset, size_t dst_offset, size_t size);
         NvidiaManagerExitCode write_sync_register(int event_id, uint32_t data);
         NvidiaManagerExitCode read_sync_register(int event_id, uint32_t *data);
+        NvidiaManagerExitCode try_wait_sync_register(int event_id, uint32_t value, bool *matched);
+        NvidiaManagerExitCode wait_sync_register(int event_id, uint32_t value, int timeout_ms);
 
+        void set_event_listener(EventRegistry::listener_t listener);
        
     private:
-        std::map<int, nvidia_kernel> kernel_info;
-        std::map<int, nvidia_buffer> buffer_info;
-        std::map<int, nvidia_event> event_info;
+        typedef std::shared_lock<std::shared_timed_mutex> shared_lock;
+        typedef std::unique_lock<std::shared_timed_mutex> exclusive_lock;
+
+        // Guards the tables below. Held shared to copy an entry out, also from the pool threads running kernels,
+        // and exclusive only while an entry is inserted or erased.
+        mutable std::shared_timed_mutex resources_mtx;
+
+        HandleTable<nvidia_kernel> kernel_info;
+        HandleTable<nvidia_buffer> buffer_info;
+        HandleTable<nvidia_event> event_info;
+
+        // Argument array in the layout the CUDA API takes, scalar arguments point into scalar_allocations.
+        // Shared with the pool task, so a prepared launch can be released while it runs.
+        struct encoded_launch {
+            int kernel_id;
+            int arg_count;
+            std::vector<char> arg_array;
+            std::vector<char> scalar_allocations;
+        };
+        typedef std::shared_ptr<encoded_launch> encoded_launch_ptr;
+
+        HandleTable<encoded_launch_ptr> prepared_launches;
 
         ThreadPool thread_pool;
         EventRegistry registry;
 
-        void launch_kernel(int kernel_id, char *arg_array, int arg_count, char* scalar_allocations);
+        template <typename T>
+        bool find_entry(const HandleTable<T> &table, int id, T &entry) const;
+
+        NvidiaManagerExitCode encode_launch(int kernel_id, const Arguments &arguments, encoded_launch &launch);
+        void launch_kernel(encoded_launch_ptr launch, completion_t on_completion);
 
         CudaApi cuda_api;
 
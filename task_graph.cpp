@@ -0,0 +1,391 @@
+#include "hhal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+namespace hhal {
+
+int TaskGraph::add_kernel(int launch_id, int kernel_id, const Arguments &arguments) {
+    task_node node = {};
+    node.type = TaskType::KERNEL;
+    node.launch_id = launch_id;
+    node.kernel_id = kernel_id;
+    node.arguments = arguments;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+int TaskGraph::add_write(int buffer_id, const void *source, size_t size) {
+    task_node node = {};
+    node.type = TaskType::WRITE_MEMORY;
+    node.buffer_id = buffer_id;
+    node.source = source;
+    node.size = size;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+int TaskGraph::add_read(int buffer_id, void *dest, size_t size) {
+    task_node node = {};
+    node.type = TaskType::READ_MEMORY;
+    node.buffer_id = buffer_id;
+    node.dest = dest;
+    node.size = size;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+bool TaskGraph::add_dependency(int task, int depends_on) {
+    if (task < 0 || task >= (int) nodes.size()) {
+        printf("[Error] HHAL: Task graph: task %d can not depend on task %d\n", task, depends_on);
+        return false;
+    }
+    nodes[task].after.push_back(depends_on);
+    return true;
+}
+
+/*
+* Dependencies are kept as the successors of every task, laid out contiguously, and the number of tasks each one
+* waits for. Running the graph only copies these counts and reuses the scratch vectors, so it does not allocate.
+*/
+struct HHAL::prepared_graph {
+    std::vector<task_node> nodes;
+    std::vector<int> dependency_count;
+    std::vector<int> successor_begin;    // Successors of task i are successors[successor_begin[i] .. successor_begin[i + 1]]
+    std::vector<int> successors;
+
+    // Scratch state of a run
+    std::vector<int> pending;
+    std::vector<int> ready;
+    std::vector<int> finished;
+
+    // Kernels completed since the runner last looked, pushed by the completion callbacks
+    std::mutex completed_mtx;
+    std::condition_variable completed_cv;
+    std::vector<int> completed;
+    bool failed;
+    // Guarded by completed_mtx: whether a run owns the scratch state, the run completions belong to, and the kernels
+    // started by any run that did not complete yet, which are left running when a run times out
+    bool running = false;
+    unsigned long generation = 0;
+    size_t outstanding = 0;
+};
+
+HHALExitCode HHAL::prepare_graph(int graph_id, const TaskGraph &graph) {
+    auto graph_nodes = graph.get_nodes();
+    int node_count = graph_nodes.size();
+    std::shared_ptr<prepared_graph> prepared = std::make_shared<prepared_graph>();
+
+    // Buffers used by each task, the writes of a task are also listed as reads so they wait for the last writer
+    std::vector<std::vector<int>> reads(node_count);
+    std::vector<std::vector<int>> writes(node_count);
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(units_mtx);
+        if (graphs.contains(graph_id)) {
+            printf("[Error] HHAL: Graph %d already prepared\n", graph_id);
+            return HHALExitCode::ERROR;
+        }
+        for (int i = 0; i < node_count; ++i) {
+            const task_node &node = graph_nodes[i];
+            switch (node.type) {
+                case TaskType::KERNEL: {
+                    if (!kernel_to_unit.contains(node.kernel_id)) {
+                        printf("[Error] HHAL: Graph %d: unknown kernel %d\n", graph_id, node.kernel_id);
+                        return HHALExitCode::ERROR;
+                    }
+                    for (auto &arg: node.arguments.get_args()) {
+                        if (arg.type != ArgumentType::BUFFER) continue;
+                        const buffer_users *users = buffer_kernels.find(arg.buffer.id);
+                        if (users == nullptr) {
+                            printf("[Error] HHAL: Graph %d: unknown buffer %d\n", graph_id, arg.buffer.id);
+                            return HHALExitCode::ERROR;
+                        }
+                        bool is_in = std::find(users->kernels_in.begin(), users->kernels_in.end(), node.kernel_id) != users->kernels_in.end();
+                        bool is_out = std::find(users->kernels_out.begin(), users->kernels_out.end(), node.kernel_id) != users->kernels_out.end();
+                        reads[i].push_back(arg.buffer.id);
+                        if (is_in || !is_out) {
+                            writes[i].push_back(arg.buffer.id);
+                        }
+                    }
+                    break;
+                }
+                case TaskType::WRITE_MEMORY:
+                    reads[i].push_back(node.buffer_id);
+                    writes[i].push_back(node.buffer_id);
+                    break;
+                case TaskType::READ_MEMORY:
+                    reads[i].push_back(node.buffer_id);
+                    break;
+            }
+        }
+    }
+
+    // Every task depends on the last writer of what it uses, writers also on the readers since that write
+    struct buffer_state {
+        int last_writer = -1;
+        std::vector<int> readers;
+    };
+    std::map<int, buffer_state> buffers;
+    // Launches of the same kernel share its termination event, so they run in the order they were added
+    std::map<int, int> last_kernel_task;
+    std::vector<std::vector<int>> dependencies(node_count);
+    for (int i = 0; i < node_count; ++i) {
+        for (int dep: graph_nodes[i].after) {
+            if (dep < 0 || dep >= node_count || dep == i) {
+                printf("[Error] HHAL: Graph %d: task %d can not depend on task %d\n", graph_id, i, dep);
+                return HHALExitCode::ERROR;
+            }
+            dependencies[i].push_back(dep);
+        }
+        if (graph_nodes[i].type == TaskType::KERNEL) {
+            auto last = last_kernel_task.find(graph_nodes[i].kernel_id);
+            if (last != last_kernel_task.end()) {
+                dependencies[i].push_back(last->second);
+            }
+            last_kernel_task[graph_nodes[i].kernel_id] = i;
+        }
+        for (int buffer_id: reads[i]) {
+            buffer_state &state = buffers[buffer_id];
+            if (state.last_writer >= 0) {
+                dependencies[i].push_back(state.last_writer);
+            }
+        }
+        for (int buffer_id: writes[i]) {
+            buffer_state &state = buffers[buffer_id];
+            dependencies[i].insert(dependencies[i].end(), state.readers.begin(), state.readers.end());
+            state.last_writer = i;
+            state.readers.clear();
+        }
+        for (int buffer_id: reads[i]) {
+            buffer_state &state = buffers[buffer_id];
+            if (state.last_writer != i) {
+                state.readers.push_back(i);
+            }
+        }
+        auto &deps = dependencies[i];
+        std::sort(deps.begin(), deps.end());
+        deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+        deps.erase(std::remove(deps.begin(), deps.end(), i), deps.end());
+    }
+
+    prepared->dependency_count.assign(node_count, 0);
+    prepared->successor_begin.assign(node_count + 1, 0);
+    for (int i = 0; i < node_count; ++i) {
+        prepared->dependency_count[i] = dependencies[i].size();
+        for (int dep: dependencies[i]) {
+            prepared->successor_begin[dep + 1]++;
+        }
+    }
+    for (int i = 0; i < node_count; ++i) {
+        prepared->successor_begin[i + 1] += prepared->successor_begin[i];
+    }
+    prepared->successors.resize(prepared->successor_begin[node_count]);
+    std::vector<int> next(prepared->successor_begin.begin(), prepared->successor_begin.end() - 1);
+    for (int i = 0; i < node_count; ++i) {
+        for (int dep: dependencies[i]) {
+            prepared->successors[next[dep]++] = i;
+        }
+    }
+
+    // Explicit dependencies may close a cycle, check that every task can eventually run
+    std::vector<int> pending = prepared->dependency_count;
+    std::vector<int> ready;
+    for (int i = 0; i < node_count; ++i) {
+        if (pending[i] == 0) ready.push_back(i);
+    }
+    int reachable = 0;
+    while (!ready.empty()) {
+        int task = ready.back();
+        ready.pop_back();
+        reachable++;
+        for (int s = prepared->successor_begin[task]; s < prepared->successor_begin[task + 1]; ++s) {
+            if (--pending[prepared->successors[s]] == 0) ready.push_back(prepared->successors[s]);
+        }
+    }
+    if (reachable != node_count) {
+        printf("[Error] HHAL: Graph %d has a dependency cycle\n", graph_id);
+        return HHALExitCode::ERROR;
+    }
+
+    for (int i = 0; i < node_count; ++i) {
+        const task_node &node = graph_nodes[i];
+        if (node.type != TaskType::KERNEL) continue;
+        if (prepare_launch(node.launch_id, node.kernel_id, node.arguments) != HHALExitCode::OK) {
+            printf("[Error] HHAL: Graph %d: could not prepare launch %d\n", graph_id, node.launch_id);
+            for (int j = 0; j < i; ++j) {
+                if (graph_nodes[j].type == TaskType::KERNEL) release_launch(graph_nodes[j].launch_id);
+            }
+            return HHALExitCode::ERROR;
+        }
+        // The prepared launch holds the encoded arguments
+        graph_nodes[i].arguments = Arguments();
+    }
+    prepared->nodes = std::move(graph_nodes);
+    prepared->pending.reserve(node_count);
+    prepared->ready.reserve(node_count);
+    prepared->finished.reserve(node_count);
+    prepared->completed.reserve(node_count);
+
+    std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+    if (graphs.contains(graph_id) || graphs.insert(graph_id, prepared) == nullptr) {
+        lock.unlock();
+        printf("[Error] HHAL: Graph %d already prepared or out of range\n", graph_id);
+        for (auto &node: prepared->nodes) {
+            if (node.type == TaskType::KERNEL) release_launch(node.launch_id);
+        }
+        return HHALExitCode::ERROR;
+    }
+    return HHALExitCode::OK;
+}
+
+HHALExitCode HHAL::run_graph(int graph_id, int timeout_ms) {
+    std::shared_ptr<prepared_graph> graph;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(units_mtx);
+        const std::shared_ptr<prepared_graph> *found = graphs.find(graph_id);
+        if (found == nullptr) {
+            printf("[Error] HHAL: Unknown graph %d\n", graph_id);
+            return HHALExitCode::ERROR;
+        }
+        graph = *found;
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    unsigned long generation;
+    {
+        std::unique_lock<std::mutex> lock(graph->completed_mtx);
+        if (graph->running) {
+            printf("[Error] HHAL: Graph %d is already running\n", graph_id);
+            return HHALExitCode::ERROR;
+        }
+        graph->running = true;
+        // Kernels left running by a run that timed out use the same launches and buffers, wait for them first
+        auto drained = [&graph] { return graph->outstanding == 0; };
+        if (timeout_ms < 0) {
+            graph->completed_cv.wait(lock, drained);
+        } else if (!graph->completed_cv.wait_until(lock, deadline, drained)) {
+            graph->running = false;
+            return HHALExitCode::TIMEOUT;
+        }
+        generation = ++graph->generation;
+        graph->completed.clear();
+        graph->failed = false;
+    }
+
+    size_t node_count = graph->nodes.size();
+    graph->pending = graph->dependency_count;
+    graph->ready.clear();
+    for (size_t i = 0; i < node_count; ++i) {
+        if (graph->pending[i] == 0) graph->ready.push_back(i);
+    }
+
+    size_t done = 0;
+    size_t running = 0;
+    HHALExitCode result = HHALExitCode::OK;
+    auto finish = [&](int task) {
+        done++;
+        for (int s = graph->successor_begin[task]; s < graph->successor_begin[task + 1]; ++s) {
+            if (--graph->pending[graph->successors[s]] == 0) graph->ready.push_back(graph->successors[s]);
+        }
+    };
+
+    while (done < node_count) {
+        // Transfers run here as soon as they are ready, kernels are started and complete on other threads
+        while (!graph->ready.empty() && result == HHALExitCode::OK) {
+            int task = graph->ready.back();
+            graph->ready.pop_back();
+            const task_node &node = graph->nodes[task];
+            HHALExitCode ec = HHALExitCode::ERROR;
+            switch (node.type) {
+                case TaskType::KERNEL: {
+                    {
+                        std::unique_lock<std::mutex> lock(graph->completed_mtx);
+                        graph->outstanding++;
+                    }
+                    ec = launch_async(node.launch_id, [graph, task, generation](HHALExitCode kernel_ec) {
+                        std::unique_lock<std::mutex> lock(graph->completed_mtx);
+                        graph->outstanding--;
+                        // Completions of a run that timed out are not tasks of the current one
+                        if (generation == graph->generation) {
+                            graph->completed.push_back(task);
+                            graph->failed = graph->failed || kernel_ec != HHALExitCode::OK;
+                        }
+                        graph->completed_cv.notify_all();
+                    });
+                    if (ec != HHALExitCode::OK) {
+                        std::unique_lock<std::mutex> lock(graph->completed_mtx);
+                        graph->outstanding--;
+                    }
+                    break;
+                }
+                case TaskType::WRITE_MEMORY:
+                    ec = write_to_memory(node.buffer_id, node.source, node.size);
+                    break;
+                case TaskType::READ_MEMORY:
+                    ec = read_from_memory(node.buffer_id, node.dest, node.size);
+                    break;
+            }
+            if (ec != HHALExitCode::OK) {
+                printf("[Error] HHAL: Graph %d: task %d failed\n", graph_id, task);
+                result = HHALExitCode::ERROR;
+            } else if (node.type == TaskType::KERNEL) {
+                running++;
+            } else {
+                finish(task);
+            }
+        }
+
+        // After a failure, only wait for the kernels already started
+        if (running == 0) break;
+
+        std::unique_lock<std::mutex> lock(graph->completed_mtx);
+        auto has_completed = [&graph] { return !graph->completed.empty(); };
+        if (timeout_ms < 0) {
+            graph->completed_cv.wait(lock, has_completed);
+        } else if (!graph->completed_cv.wait_until(lock, deadline, has_completed)) {
+            graph->running = false;
+            return HHALExitCode::TIMEOUT;
+        }
+        if (graph->failed) {
+            result = HHALExitCode::ERROR;
+        }
+        graph->finished.swap(graph->completed);
+        lock.unlock();
+        for (int task: graph->finished) {
+            running--;
+            finish(task);
+        }
+        graph->finished.clear();
+    }
+
+    std::unique_lock<std::mutex> lock(graph->completed_mtx);
+    graph->running = false;
+    return result;
+}
+
+HHALExitCode HHAL::release_graph(int graph_id) {
+    std::shared_ptr<prepared_graph> graph;
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(units_mtx);
+        std::shared_ptr<prepared_graph> *found = graphs.find(graph_id);
+        if (found == nullptr) {
+            printf("[Error] HHAL: Unknown graph %d\n", graph_id);
+            return HHALExitCode::ERROR;
+        }
+        graph = *found;
+        graphs.erase(graph_id);
+    }
+    HHALExitCode result = HHALExitCode::OK;
+    for (auto &node: graph->nodes) {
+        if (node.type == TaskType::KERNEL && release_launch(node.launch_id) != HHALExitCode::OK) {
+            result = HHALExitCode::ERROR;
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef HHAL_TASK_GRAPH_H
+#define HHAL_TASK_GRAPH_H
+
+#include <cstddef>
+#include <vector>
+
+#include "arguments.h"
+
+namespace hhal {
+
+enum class TaskType {
+    KERNEL,
+    WRITE_MEMORY,
+    READ_MEMORY,
+};
+
+struct task_node {
+    TaskType type;
+    // KERNEL
+    int launch_id;
+    int kernel_id;
+    Arguments arguments;
+    // WRITE_MEMORY and READ_MEMORY, the host memory is accessed every time the graph runs
+    int buffer_id;
+    const void *source;
+    void *dest;
+    size_t size;
+    // Explicit dependencies, on top of the ones derived from the buffers
+    std::vector<int> after;
+};
+
+/*
+* Kernel launches and memory transfers recorded once and run together with HHAL::run_graph, see HHAL::prepare_graph.
+* Dependencies are derived from the buffers each task uses, in the order the tasks are added: a task runs after the
+* last task writing a buffer it uses, and a task writing a buffer also runs after the tasks reading it before.
+* Kernels read the buffers listing them in kernels_out and write those listing them in kernels_in, a buffer listing
+* a kernel in neither is taken as read and written by it. Event arguments do not order tasks. Launches of the same
+* kernel run in the order they were added, since they share its termination event.
+* Adding a task returns its index, to be used with add_dependency.
+*/
+class TaskGraph {
+    public:
+        // The kernel is prepared with launch_id by HHAL::prepare_graph, which takes the launch id until the graph is released
+        int add_kernel(int launch_id, int kernel_id, const Arguments &arguments);
+        // source must still be valid, and hold the data to write, every time the graph runs
+        int add_write(int buffer_id, const void *source, size_t size);
+        int add_read(int buffer_id, void *dest, size_t size);
+
+        // task runs after depends_on finished, on top of what is derived from the buffers. Fails if task was not added,
+        // depends_on is checked by HHAL::prepare_graph, so it may be a task added later
+        bool add_dependency(int task, int depends_on);
+
+        inline const std::vector<task_node> &get_nodes() const {
+            return nodes;
+        }
+
+    private:
+        std::vector<task_node> nodes;
+};
+
+}
+
+#endif
@@ -14,6 +14,13 @@ bool is_exit_code_OK<HHALClientExitCode>(HHALClientExitCode ec) {
 template void write<HHALClient>(HHALClient &hhal, int event_id, uint32_t value);
 template uint32_t read<HHALClient>(HHALClient &hhal, int event_id);
 template uint32_t lock<HHALClient>(HHALClient &hhal, int event_id);
-template void wait<HHALClient>(HHALClient &hhal, int event_id, uint32_t state);
+
+// The daemon parks the wait until the register holds the state, instead of being polled
+template<>
+void wait<HHALClient>(HHALClient &hhal, int event_id, uint32_t state) {
+    if (!is_exit_code_OK(hhal.wait_sync_register(event_id, state))) {
+        printf("Waiting for sync register failed.\n");
+    }
+}
 
 }}
\ No newline at end of file
@@ -19,4 +19,18 @@ template void resource_deallocation<HHALClient>(
     const std::vector<mango_event> &events
 );
 
+template void resource_allocation<HHALClientBatch>(
+    HHALClientBatch &hhal, 
+    const std::vector<registered_kernel> &kernels, 
+    const std::vector<registered_buffer> &buffers, 
+    const std::vector<mango_event> &events
+);
+
+template void resource_deallocation<HHALClientBatch>(
+    HHALClientBatch &hhal, 
+    const std::vector<mango_kernel> &kernels, 
+    const std::vector<mango_buffer> &buffers, 
+    const std::vector<mango_event> &events
+);
+
 }
\ No newline at end of file
@@ -104,14 +104,20 @@ int main(void) {
         events.push_back({b.event, b.b.kernels_in, b.b.kernels_out});
     }
 
-    /* resource allocation */
-    resource_allocation(hhal, {r_kernel_1, r_kernel_2}, r_buffers, events);
+    /* resource allocation, sent to the daemon as a single batch */
+    hhal_daemon::HHALClientBatch setup;
+    gn_rm::resource_allocation(setup, {r_kernel_1, r_kernel_2}, r_buffers, events);
 
     const std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_1_sources = {{hhal::Unit::GN, {hhal::source_type::BINARY, KERNEL_1_PATH}}};
     const std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_2_sources = {{hhal::Unit::GN, {hhal::source_type::BINARY, KERNEL_2_PATH}}};
 
-    hhal.kernel_write(kernel_1.id, kernel_1_sources);
-    hhal.kernel_write(kernel_2.id, kernel_2_sources);
+    setup.kernel_write(kernel_1.id, kernel_1_sources);
+    setup.kernel_write(kernel_2.id, kernel_2_sources);
+
+    std::vector<hhal::HHALExitCode> setup_results;
+    auto setup_ec = hhal.submit(setup, &setup_results);
+    assert(setup_results.size() == setup.size() && "Batch results do not match the recorded operations");
+    assert(setup_ec == hhal_daemon::HHALClientExitCode::OK && "Resource allocation batch failed");
     printf("resource allocation done\n");
 
     /* Execution preparation */
@@ -202,7 +208,9 @@ int main(void) {
         printf("Sample host: second stage of SAXPY correctly performed\n");
     }
 
-    gn_rm::resource_deallocation(hhal, {kernel_1, kernel_2}, buffers, events);
+    hhal_daemon::HHALClientBatch teardown;
+    gn_rm::resource_deallocation(teardown, {kernel_1, kernel_2}, buffers, events);
+    hhal.submit(teardown);
 
     float *expected_3 = new float[n];
 
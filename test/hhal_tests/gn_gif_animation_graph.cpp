@@ -0,0 +1,261 @@
+#include <vector>
+#include <map>
+#include <stdio.h>
+#include <fstream>
+#include <assert.h>
+
+#include "hhal.h"
+
+#include "arguments.h"
+
+#include "mango_arguments.h"
+#include "gn_dummy_rm.h"
+#include "AnimatedGifSaver.h"
+
+using namespace hhal;
+
+#define KERNEL_SCALE_PATH   "gn_kernels/gif_scale_kernel/scale_kernel"
+#define KERNEL_COPY_PATH    "gn_kernels/gif_copy_kernel/copy_kernel"
+#define KERNEL_SMOOTH_PATH  "gn_kernels/gif_smooth_kernel/smooth_kernel"
+#define KSCALE  1
+#define KCOPY   2
+#define KSMOOTH 3
+#define B1 1
+#define B2 2
+#define B3 3
+#define GRAPH 1
+
+typedef unsigned char Byte;
+
+// Lets define a few frames for this little demo...
+
+// red and white RGB pixels
+#define R 255,0,0
+#define W 255,255,255
+
+// ...frames sizes
+const int SX=5;
+const int SY=7;
+
+// ...and, the frames themselves
+// (note: they are defined bottom-to-top (a-la OpenGL) so they appear upside-down).
+
+Byte frame0[SX*SY*3] = {
+    W,W,W,W,W,
+    W,W,R,W,W,
+    W,R,W,R,W,
+    W,R,W,R,W,
+    W,R,W,R,W,
+    W,W,R,W,W,
+    W,W,W,W,W,
+};
+
+Byte frame1[SX*SY*3] = {
+    W,W,W,W,W,
+    W,W,R,W,W,
+    W,W,R,W,W,
+    W,W,R,W,W,
+    W,R,R,W,W,
+    W,W,R,W,W,
+    W,W,W,W,W,
+};
+
+Byte frame2[SX*SY*3]= {
+    W,W,W,W,W,
+    W,R,R,R,W,
+    W,R,W,W,W,
+    W,W,R,W,W,
+    W,W,W,R,W,
+    W,R,R,W,W,
+    W,W,W,W,W,
+};
+
+Byte frame3[SX*SY*3]= {
+    W,W,W,W,W,
+    W,R,R,W,W,
+    W,W,W,R,W,
+    W,W,R,W,W,
+    W,W,W,R,W,
+    W,R,R,W,W,
+    W,W,W,W,W,
+};
+
+/* These variables and functions are added to support the scale & smooth
+ * functionalities.
+ */
+Byte frame[SX*2*SY*2*3];
+Byte sframe[SX*2*SY*2*3];
+
+void double_frame(Byte *out, Byte *in, int X, int Y)
+{
+    int X2=X*2;
+    int Y2=Y*2;
+    for(int x=0; x<X2; x++)
+        for(int y=0; y<Y2; y++)
+            for(int c=0; c<3; c++) {
+                out[y*X2*3+x*3+c]=in[y/2*X*3+x/2*3+c];
+            }
+}
+
+void copy_frame(Byte *out, Byte *in, int X, int Y)
+{
+    for(int x=0; x<X; x++)
+        for(int y=0; y<Y; y++)
+            for(int c=0; c<3; c++)
+                out[y*X*3+x*3+c] =	in[y*X*3+x*3+c];
+}
+
+void smooth_frame(Byte *out, Byte *in, int X, int Y)
+{
+    for(int x=1; x<X-1; x++)
+        for(int y=1; y<Y-1; y++)
+            for(int c=0; c<3; c++) {
+                out[y*X*3+x*3+c]=
+                    (in[y*X*3+x*3+c]+
+                     in[y*X*3+(x-1)*3+c]+
+                     in[y*X*3+(x+1)*3+c]+
+                     in[(y-1)*X*3+x*3+c]+
+                     in[(y+1)*X*3+x*3+c]) / 5;
+            }
+}
+
+
+// Note: it may be necessary to copy ./gn/gn/config.xml to MANGO_ROOT/usr/local/share/config.xml
+
+int main(void) {
+    HHAL hhal;
+
+    AnimatedGifSaver saver(SX*2,SY*2);
+
+    std::ifstream kernel_scale_fd(KERNEL_SCALE_PATH, std::ifstream::in | std::ifstream::ate);
+    assert(kernel_scale_fd.good() && "Scale kernel file does not exist");
+    size_t kernel_scale_size = (size_t) kernel_scale_fd.tellg() + 1;
+    
+    std::ifstream kernel_copy_fd(KERNEL_COPY_PATH, std::ifstream::in | std::ifstream::ate);
+    assert(kernel_copy_fd.good() && "Copy kernel does not exist");
+    size_t kernel_copy_size = (size_t) kernel_copy_fd.tellg() + 1;
+
+    std::ifstream kernel_smooth_fd(KERNEL_SMOOTH_PATH, std::ifstream::in | std::ifstream::ate);
+    assert(kernel_smooth_fd.good() && "Smooth kernel does not exist");
+    size_t kernel_smooth_size = (size_t) kernel_smooth_fd.tellg() + 1;
+
+    mango_kernel kernel_scale = { KSCALE, kernel_scale_size };
+    gn_rm::registered_kernel r_kernel_scale = gn_rm::register_kernel(kernel_scale);
+    mango_kernel kernel_copy = { KCOPY, kernel_copy_size };
+    gn_rm::registered_kernel r_kernel_copy = gn_rm::register_kernel(kernel_copy);
+    mango_kernel kernel_smooth = { KSMOOTH, kernel_smooth_size };
+    gn_rm::registered_kernel r_kernel_smooth = gn_rm::register_kernel(kernel_smooth);
+
+    std::vector<mango_buffer> buffers = {
+        {B1, SX*SY*3*sizeof(Byte),      {},                 {KSCALE}},
+        {B2, SX*2*SY*2*3*sizeof(Byte),  {KSCALE},           {KCOPY, KSMOOTH}},
+        {B3, SX*2*SY*2*3*sizeof(Byte),  {KCOPY, KSMOOTH},   {}},
+    };
+
+    std::vector<gn_rm::registered_buffer> r_buffers;
+    for(auto &b: buffers) {
+        r_buffers.push_back(gn_rm::register_buffer(b));
+    }
+
+    mango_event kernel_scale_termination_event = {r_kernel_scale.kernel_termination_event};
+    mango_event kernel_copy_termination_event = {r_kernel_copy.kernel_termination_event};
+    mango_event kernel_smooth_termination_event = {r_kernel_smooth.kernel_termination_event};
+
+    mango_event sync_ev = {gn_rm::get_new_event_id(), {r_kernel_copy.k.id, r_kernel_smooth.k.id}, {r_kernel_scale.k.id, r_kernel_copy.k.id}};
+    std::vector<mango_event> events;
+    events.push_back(sync_ev);
+    events.push_back({r_kernel_scale.kernel_termination_event, {r_kernel_scale.k.id}, {r_kernel_scale.k.id}});
+    events.push_back({r_kernel_smooth.kernel_termination_event, {r_kernel_smooth.k.id}, {r_kernel_smooth.k.id}});
+    events.push_back({r_kernel_copy.kernel_termination_event, {r_kernel_copy.k.id}, {r_kernel_copy.k.id}});
+    for(auto &b: r_buffers) {
+        events.push_back({b.event, b.b.kernels_in, b.b.kernels_out});
+    }
+
+    /* resource allocation */
+    gn_rm::resource_allocation(hhal, {r_kernel_scale, r_kernel_smooth, r_kernel_copy}, r_buffers, events);
+
+
+    const std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_scale_sources = {{hhal::Unit::GN, {hhal::source_type::BINARY, KERNEL_SCALE_PATH}}};
+    const std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_copy_sources = {{hhal::Unit::GN, {hhal::source_type::BINARY, KERNEL_COPY_PATH}}};
+    const std::map<hhal::Unit, hhal::hhal_kernel_source> kernel_smooth_sources = {{hhal::Unit::GN, {hhal::source_type::BINARY, KERNEL_SMOOTH_PATH}}};
+
+    hhal.kernel_write(kernel_scale.id, kernel_scale_sources);
+    hhal.kernel_write(kernel_copy.id, kernel_copy_sources);
+    hhal.kernel_write(kernel_smooth.id, kernel_smooth_sources);
+    printf("resource allocation done\n");
+
+    /* Execution preparation */
+
+    int sx = SX;
+    int sy = SY;
+    int sx2 = SX*2;
+    int sy2 = SY*2;
+
+    scalar_arg scalar_arg_sx1 = {hhal::ScalarType::INT, sizeof(int32_t)} ;
+    scalar_arg_sx1.aint32 = sx;
+    scalar_arg scalar_arg_sy1 = {hhal::ScalarType::INT, sizeof(int32_t)} ;
+    scalar_arg_sy1.aint32 = sy;
+    scalar_arg scalar_arg_sx2 = {hhal::ScalarType::INT, sizeof(int32_t)} ;
+    scalar_arg_sx2.aint32 = sx2;
+    scalar_arg scalar_arg_sy2 = {hhal::ScalarType::INT, sizeof(int32_t)} ;
+    scalar_arg_sy2.aint32 = sy2;
+
+    Arguments args_k_scale;
+    args_k_scale.add_event({sync_ev.id});
+    args_k_scale.add_buffer({B2});
+    args_k_scale.add_buffer({B1});
+    args_k_scale.add_scalar(scalar_arg_sx1);
+    args_k_scale.add_scalar(scalar_arg_sy1);
+
+    Arguments args_k_copy;
+    args_k_copy.add_event({sync_ev.id});
+    args_k_copy.add_buffer({B3});
+    args_k_copy.add_buffer({B2});
+    args_k_copy.add_scalar(scalar_arg_sx2);
+    args_k_copy.add_scalar(scalar_arg_sy2);
+
+    Arguments args_k_smooth;
+    args_k_smooth.add_event({sync_ev.id});
+    args_k_smooth.add_buffer({B3});
+    args_k_smooth.add_buffer({B2});
+    args_k_smooth.add_scalar(scalar_arg_sx2);
+    args_k_smooth.add_scalar(scalar_arg_sy2);
+    
+    Byte *frames[4] = { frame0, frame1, frame2, frame3 };
+    Byte input[SX*SY*3];
+
+    /* The whole frame pipeline is recorded once, the kernels are ordered by the buffers they share */
+    TaskGraph graph;
+    graph.add_write(B1, input, buffers[0].size);
+    graph.add_kernel(KSCALE, KSCALE, args_k_scale);
+    graph.add_kernel(KCOPY, KCOPY, args_k_copy);
+    graph.add_kernel(KSMOOTH, KSMOOTH, args_k_smooth);
+    graph.add_read(B3, sframe, SX*2*SY*2*3);
+
+    if (hhal.prepare_graph(GRAPH, graph) != HHALExitCode::OK) {
+        printf("Could not prepare the frame graph\n");
+        return 1;
+    }
+
+    for(int i=3; i>=0; i--) {
+        printf("Running frame %d\n", i);
+        copy_frame(input, frames[i], SX, SY);
+
+        if (hhal.run_graph(GRAPH) != HHALExitCode::OK) {
+            printf("Frame %d failed\n", i);
+            return 1;
+        }
+
+        saver.AddFrame(sframe, i+1);
+    }
+
+    hhal.release_graph(GRAPH);
+
+    saver.Save("0123_kernel_graph.gif");
+    
+    gn_rm::resource_deallocation(hhal, {kernel_scale, kernel_smooth, kernel_copy}, buffers, events);
+
+    printf("Gif animation finished! File name: 0123_kernel_graph.gif\n");
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+* Launch latency of GN kernels, from kernel_start to the completion of the kernel.
+*
+* Builds the saxpy2 kernel from source, so its entry is generated by the dynamic compiler and it can run in the
+* kernel executors, then times the same launches with a new process per launch (HHAL_GN_EXECUTORS=0) and with
+* the executors. Every launch is checked against the host result.
+*
+* Usage: gn_launch_bench [launches]
+*/
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "hhal.h"
+
+using namespace hhal;
+
+#define KERNEL_PATH "gn_kernels/saxpy2/saxpy2_source.c"
+#define KID 1
+#define KERNEL_EVENT 1
+#define BX_ID 1
+#define BY_ID 2
+#define BO_ID 3
+#define BX_EVENT 2
+#define BY_EVENT 3
+#define BO_EVENT 4
+#define N 256
+
+#define CHECK(x)                                            \
+    if ((x) != HHALExitCode::OK) {                          \
+        printf("gn_launch_bench: %s failed\n", #x);         \
+        exit(EXIT_FAILURE);                                 \
+    }
+
+typedef std::chrono::steady_clock bench_clock;
+
+static void setup_event(HHAL &hhal, int id) {
+    gn_event event;
+    event.id = id;
+    event.kernels_in = {KID};
+    event.kernels_out = {KID};
+    CHECK(hhal.assign_event(Unit::GN, (hhal_event *) &event));
+    CHECK(hhal.allocate_event(id));
+}
+
+static void setup_buffer(HHAL &hhal, int id, int event, bool output) {
+    gn_buffer buffer;
+    buffer.id = id;
+    buffer.size = N * sizeof(float);
+    buffer.event = event;
+    buffer.kernels_in = output ? std::vector<int>() : std::vector<int>{KID};
+    buffer.kernels_out = output ? std::vector<int>{KID} : std::vector<int>();
+    CHECK(hhal.assign_buffer(Unit::GN, (hhal_buffer *) &buffer));
+    setup_event(hhal, event);
+    CHECK(hhal.allocate_memory(id));
+}
+
+static void release_buffer(HHAL &hhal, int id, int event) {
+    CHECK(hhal.release_memory(id));
+    CHECK(hhal.deassign_buffer(id));
+    CHECK(hhal.release_event(event));
+    CHECK(hhal.deassign_event(event));
+}
+
+// Microseconds per launch, with the given amount of executors per kernel
+static double bench_launches(const char *executors, int launches) {
+    setenv("HHAL_GN_EXECUTORS", executors, 1);
+    HHAL hhal;
+
+    gn_kernel kernel;
+    kernel.id = KID;
+    kernel.termination_event = KERNEL_EVENT;
+    CHECK(hhal.assign_kernel(Unit::GN, (hhal_kernel *) &kernel));
+    CHECK(hhal.allocate_kernel(KID));
+    setup_event(hhal, KERNEL_EVENT);
+    setup_buffer(hhal, BX_ID, BX_EVENT, false);
+    setup_buffer(hhal, BY_ID, BY_EVENT, false);
+    setup_buffer(hhal, BO_ID, BO_EVENT, true);
+    CHECK(hhal.kernel_write(KID, {{Unit::GN, {source_type::SOURCE, KERNEL_PATH}}}));
+
+    std::vector<float> x(N), y(N), o(N);
+    for (int i = 0; i < N; ++i) {
+        x[i] = i;
+        y[i] = 2 * i;
+    }
+    CHECK(hhal.write_to_memory(BX_ID, x.data(), N * sizeof(float)));
+    CHECK(hhal.write_to_memory(BY_ID, y.data(), N * sizeof(float)));
+
+    Arguments arguments;
+    arguments.add_buffer({BX_ID});
+    arguments.add_buffer({BY_ID});
+    arguments.add_buffer({BO_ID});
+    scalar_arg n = {ScalarType::INT, sizeof(int32_t)};
+    n.aint32 = N;
+    arguments.add_scalar(n);
+
+    std::chrono::duration<double, std::micro> elapsed(0);
+    for (int l = 0; l < launches; l++) {
+        o.assign(N, 0);
+        CHECK(hhal.write_to_memory(BO_ID, o.data(), N * sizeof(float)));
+        auto start = bench_clock::now();
+        CHECK(hhal.kernel_start_async(KID, arguments).get());
+        elapsed += bench_clock::now() - start;
+
+        CHECK(hhal.read_from_memory(BO_ID, o.data(), N * sizeof(float)));
+        for (int i = 0; i < N; ++i) {
+            if (o[i] != x[i] + y[i]) {
+                printf("gn_launch_bench: launch %d: incorrect value at %d: got %.2f vs %.2f\n", l, i, o[i], x[i] + y[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    release_buffer(hhal, BO_ID, BO_EVENT);
+    release_buffer(hhal, BY_ID, BY_EVENT);
+    release_buffer(hhal, BX_ID, BX_EVENT);
+    CHECK(hhal.release_event(KERNEL_EVENT));
+    CHECK(hhal.deassign_event(KERNEL_EVENT));
+    CHECK(hhal.release_kernel(KID));
+    CHECK(hhal.deassign_kernel(KID));
+    return elapsed.count() / launches;
+}
+
+int main(int argc, char *argv[]) {
+    int launches = argc > 1 ? atoi(argv[1]) : 1000;
+
+    printf("%d launches\n", launches);
+    // Kernels started as a new process are forked from here
+    fflush(stdout);
+    double process_us = bench_launches("0", launches);
+    printf("%-24s %10.1f us\n", "process per launch", process_us);
+    double executor_us = bench_launches("1", launches);
+    printf("%-24s %10.1f us\n", "executor", executor_us);
+    return 0;
+}
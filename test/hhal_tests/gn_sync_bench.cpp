@@ -0,0 +1,134 @@
+/*
+* Contention on the GN sync registers, with the lock-free registers and with the semaphore compatibility mode
+* (HHAL_GN_SYNC_REGISTERS=semaphore).
+*
+* Every thread first writes and reads back an event of its own, which only contend on the semaphore, then all of
+* them add to the same event, whose final value checks that no write was lost. Last, two threads pass a token back
+* and forth through two events with wait_sync_register, timing the wake up of a blocked waiter.
+*
+* Usage: gn_sync_bench [threads] [iterations]
+*/
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+#include "hhal.h"
+
+using namespace hhal;
+
+#define SHARED_EVENT 1
+#define PING_EVENT 2
+#define PONG_EVENT 3
+#define EVENT_BASE 4
+#define WAIT_TIMEOUT_MS 1000
+
+#define CHECK(x)                                            \
+    if ((x) != HHALExitCode::OK) {                          \
+        printf("gn_sync_bench: %s failed\n", #x);           \
+        exit(EXIT_FAILURE);                                 \
+    }
+
+typedef std::chrono::steady_clock bench_clock;
+
+static void setup_event(HHAL &hhal, int id) {
+    gn_event event;
+    event.id = id;
+    event.kernels_in = {};
+    event.kernels_out = {};
+    CHECK(hhal.assign_event(Unit::GN, (hhal_event *) &event));
+    CHECK(hhal.allocate_event(id));
+}
+
+static void release_event(HHAL &hhal, int id) {
+    CHECK(hhal.release_event(id));
+    CHECK(hhal.deassign_event(id));
+}
+
+// Nanoseconds per register operation, with every thread running f
+template <typename F>
+static double ns_per_op(int threads, int ops_per_thread, F f) {
+    std::vector<std::thread> workers;
+    auto start = bench_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back(f, t);
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+    return elapsed.count() / ((double) threads * ops_per_thread);
+}
+
+static void bench_registers(const char *mode, int threads, int iterations) {
+    setenv("HHAL_GN_SYNC_REGISTERS", mode, 1);
+    HHAL hhal;
+    setup_event(hhal, SHARED_EVENT);
+    setup_event(hhal, PING_EVENT);
+    setup_event(hhal, PONG_EVENT);
+    for (int t = 0; t < threads; t++) {
+        setup_event(hhal, EVENT_BASE + t);
+    }
+
+    double private_ns = ns_per_op(threads, 2 * iterations, [&](int t) {
+        uint32_t value;
+        for (int i = 0; i < iterations; i++) {
+            CHECK(hhal.write_sync_register(EVENT_BASE + t, 1));
+            CHECK(hhal.read_sync_register(EVENT_BASE + t, &value));
+            if (value != 1) {
+                printf("gn_sync_bench: %s: event %d read %u, expected 1\n", mode, EVENT_BASE + t, value);
+                exit(EXIT_FAILURE);
+            }
+        }
+    });
+
+    uint32_t total;
+    CHECK(hhal.read_sync_register(SHARED_EVENT, &total));
+    double shared_ns = ns_per_op(threads, iterations, [&](int) {
+        for (int i = 0; i < iterations; i++) {
+            CHECK(hhal.write_sync_register(SHARED_EVENT, 1));
+        }
+    });
+    CHECK(hhal.read_sync_register(SHARED_EVENT, &total));
+    if (total != (uint32_t) threads * iterations) {
+        printf("gn_sync_bench: %s: shared event read %u, expected %u\n", mode, total, (uint32_t) threads * iterations);
+        exit(EXIT_FAILURE);
+    }
+
+    // Both threads take part in every round trip
+    double round_trip_ns = 2 * ns_per_op(2, iterations, [&](int t) {
+        int wait_on = t == 0 ? PONG_EVENT : PING_EVENT;
+        int write_to = t == 0 ? PING_EVENT : PONG_EVENT;
+        for (int i = 0; i < iterations; i++) {
+            if (t == 0) {
+                CHECK(hhal.write_sync_register(write_to, 1));
+            }
+            CHECK(hhal.wait_sync_register(wait_on, 1, WAIT_TIMEOUT_MS));
+            if (t == 1) {
+                CHECK(hhal.write_sync_register(write_to, 1));
+            }
+        }
+    });
+
+    printf("%-10s %-24s %10.1f ns\n", mode, "own event", private_ns);
+    printf("%-10s %-24s %10.1f ns\n", mode, "shared event", shared_ns);
+    printf("%-10s %-24s %10.1f ns\n", mode, "wait round trip", round_trip_ns);
+
+    for (int t = 0; t < threads; t++) {
+        release_event(hhal, EVENT_BASE + t);
+    }
+    release_event(hhal, PONG_EVENT);
+    release_event(hhal, PING_EVENT);
+    release_event(hhal, SHARED_EVENT);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+
+    printf("%d threads, %d iterations\n", threads, iterations);
+    bench_registers("atomic", threads, iterations);
+    bench_registers("semaphore", threads, iterations);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+* Stress test of HHAL used from many threads at once on the GN.
+*
+* Worker threads each own a buffer and a sync register and check that what they write is what they read back,
+* while another thread keeps assigning, allocating, releasing and deassigning resources of its own and a third
+* one prepares and starts launches of the shared kernel. Exits with failure on the first mismatch or error.
+*
+* Usage: gn_thread_stress [threads] [iterations]
+*/
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "hhal.h"
+
+using namespace hhal;
+
+#define KERNEL_PATH "/bin/true"
+#define KID 1
+#define KERNEL_EVENT 1
+#define WORKER_BASE 100
+#define CHURN_BASE 1000
+#define LAUNCH_ID 1
+#define BUFFER_SIZE 4096
+#define LAUNCHES 50
+
+static std::atomic<int> failures(0);
+
+#define CHECK(x)                                                        \
+    if ((x) != HHALExitCode::OK) {                                      \
+        printf("gn_thread_stress: %s failed at line %d\n", #x, __LINE__); \
+        failures++;                                                     \
+        return;                                                         \
+    }
+
+static HHALExitCode setup_event(HHAL &hhal, int event_id) {
+    gn_event event;
+    event.id = event_id;
+    event.kernels_in = {KID};
+    event.kernels_out = {KID};
+    HHALExitCode ec = hhal.assign_event(Unit::GN, (hhal_event *) &event);
+    if (ec != HHALExitCode::OK) return ec;
+    return hhal.allocate_event(event_id);
+}
+
+static HHALExitCode setup_buffer(HHAL &hhal, int buffer_id, int event_id) {
+    gn_buffer buffer;
+    buffer.id = buffer_id;
+    buffer.size = BUFFER_SIZE;
+    buffer.event = event_id;
+    buffer.kernels_in = {KID};
+    buffer.kernels_out = {};
+    HHALExitCode ec = hhal.assign_buffer(Unit::GN, (hhal_buffer *) &buffer);
+    if (ec != HHALExitCode::OK) return ec;
+    return hhal.allocate_memory(buffer_id);
+}
+
+// Ids of a worker: buffer base, its event base + 1, the register it counts on base + 2
+static void worker(HHAL &hhal, int index, int iterations) {
+    int base = WORKER_BASE + index * 3;
+    CHECK(setup_event(hhal, base + 1));
+    CHECK(setup_event(hhal, base + 2));
+    CHECK(setup_buffer(hhal, base, base + 1));
+
+    std::vector<uint32_t> out(BUFFER_SIZE / sizeof(uint32_t));
+    std::vector<uint32_t> in(out.size());
+    for (int i = 0; i < iterations && failures == 0; i++) {
+        for (size_t j = 0; j < out.size(); j++) {
+            out[j] = (index << 24) ^ (i << 12) ^ j;
+        }
+        CHECK(hhal.write_to_memory(base, out.data(), BUFFER_SIZE));
+        CHECK(hhal.read_from_memory(base, in.data(), BUFFER_SIZE));
+        if (memcmp(out.data(), in.data(), BUFFER_SIZE) != 0) {
+            printf("gn_thread_stress: worker %d read back other data at iteration %d\n", index, i);
+            failures++;
+            return;
+        }
+
+        uint32_t value;
+        CHECK(hhal.write_sync_register(base + 2, i + 1));
+        CHECK(hhal.read_sync_register(base + 2, &value));
+        if (value != (uint32_t) i + 1) {
+            printf("gn_thread_stress: worker %d read register %u instead of %d\n", index, value, i + 1);
+            failures++;
+            return;
+        }
+    }
+
+    CHECK(hhal.release_memory(base));
+    CHECK(hhal.deassign_buffer(base));
+    for (int event_id : {base + 1, base + 2}) {
+        CHECK(hhal.release_event(event_id));
+        CHECK(hhal.deassign_event(event_id));
+    }
+}
+
+static void churn(HHAL &hhal, int iterations) {
+    for (int i = 0; i < iterations && failures == 0; i++) {
+        CHECK(setup_event(hhal, CHURN_BASE + 1));
+        CHECK(setup_buffer(hhal, CHURN_BASE, CHURN_BASE + 1));
+        CHECK(hhal.release_memory(CHURN_BASE));
+        CHECK(hhal.deassign_buffer(CHURN_BASE));
+        CHECK(hhal.release_event(CHURN_BASE + 1));
+        CHECK(hhal.deassign_event(CHURN_BASE + 1));
+    }
+}
+
+static void launcher(HHAL &hhal) {
+    Arguments arguments;
+    for (int i = 0; i < LAUNCHES && failures == 0; i++) {
+        CHECK(hhal.prepare_launch(LAUNCH_ID, KID, arguments));
+        CHECK(hhal.launch(LAUNCH_ID));
+        CHECK(hhal.release_launch(LAUNCH_ID));
+    }
+}
+
+static void run(HHAL &hhal, int threads, int iterations) {
+    gn_kernel kernel;
+    kernel.id = KID;
+    kernel.termination_event = KERNEL_EVENT;
+    CHECK(hhal.assign_kernel(Unit::GN, (hhal_kernel *) &kernel));
+    CHECK(hhal.allocate_kernel(KID));
+    CHECK(setup_event(hhal, KERNEL_EVENT));
+    CHECK(hhal.kernel_write(KID, {{Unit::GN, {source_type::BINARY, KERNEL_PATH}}}));
+
+    std::vector<std::thread> running;
+    for (int i = 0; i < threads; i++) {
+        running.emplace_back(worker, std::ref(hhal), i, iterations);
+    }
+    running.emplace_back(churn, std::ref(hhal), iterations / 10);
+    running.emplace_back(launcher, std::ref(hhal));
+    for (auto &thread : running) {
+        thread.join();
+    }
+
+    CHECK(hhal.release_event(KERNEL_EVENT));
+    CHECK(hhal.deassign_event(KERNEL_EVENT));
+    CHECK(hhal.release_kernel(KID));
+    CHECK(hhal.deassign_kernel(KID));
+}
+
+int main(int argc, char *argv[]) {
+    int threads = argc > 1 ? atoi(argv[1]) : 8;
+    int iterations = argc > 2 ? atoi(argv[2]) : 10000;
+
+    HHAL hhal;
+    run(hhal, threads, iterations);
+
+    if (failures != 0) {
+        printf("gn_thread_stress: FAILED\n");
+        return EXIT_FAILURE;
+    }
+    printf("gn_thread_stress: %d threads, %d iterations each, OK\n", threads, iterations);
+    return EXIT_SUCCESS;
+}
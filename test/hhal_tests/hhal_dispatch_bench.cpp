@@ -0,0 +1,158 @@
+/*
+* Per-call dispatch overhead of HHAL with many live resources.
+*
+* First times the id lookups alone, HandleTable against the std::map it replaced, over 10k random ids.
+* Then assigns 10k kernels, buffers and events on the GN and times the calls that resolve an id on every
+* operation, on the few resources the emulated GN has room to actually allocate.
+*
+* Usage: hhal_dispatch_bench [iterations]
+*/
+#include <chrono>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "hhal.h"
+#include "handle_table.h"
+
+using namespace hhal;
+
+#define LIVE_RESOURCES 10000
+#define KERNEL_BASE 100000
+#define BUFFER_BASE 200000
+#define EVENT_BASE 300000
+#define KID 1
+#define BID 1
+#define EID 1
+#define BUFFER_SIZE 4096
+
+#define CHECK(x)                                            \
+    if ((x) != HHALExitCode::OK) {                          \
+        printf("hhal_dispatch_bench: %s failed\n", #x);     \
+        exit(EXIT_FAILURE);                                 \
+    }
+
+typedef std::chrono::steady_clock bench_clock;
+
+template <typename F>
+static double ns_per_call(int iterations, F f) {
+    auto start = bench_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        f(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = bench_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+static void bench_lookups(int iterations) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> pick_id(0, 1 << 20);
+    std::vector<int> ids(LIVE_RESOURCES);
+    HandleTable<Unit> table;
+    std::map<int, Unit> map;
+    for (int &id : ids) {
+        id = pick_id(rng);
+        table.insert(id, Unit::GN);
+        map[id] = Unit::GN;
+    }
+
+    std::vector<int> order(iterations);
+    std::uniform_int_distribution<int> pick_index(0, LIVE_RESOURCES - 1);
+    for (int &index : order) {
+        index = ids[pick_index(rng)];
+    }
+
+    volatile int found = 0;
+    double table_ns = ns_per_call(iterations, [&](int i) { found += table.find(order[i]) != nullptr; });
+    double map_ns = ns_per_call(iterations, [&](int i) { found += map.find(order[i]) != map.end(); });
+    printf("%-24s %10.1f ns\n", "HandleTable::find", table_ns);
+    printf("%-24s %10.1f ns\n", "std::map::find", map_ns);
+}
+
+static void assign_live_resources(HHAL &hhal) {
+    for (int i = 0; i < LIVE_RESOURCES; i++) {
+        gn_kernel kernel;
+        kernel.id = KERNEL_BASE + i;
+        kernel.termination_event = EVENT_BASE + i;
+        CHECK(hhal.assign_kernel(Unit::GN, (hhal_kernel *) &kernel));
+
+        gn_buffer buffer;
+        buffer.id = BUFFER_BASE + i;
+        buffer.size = BUFFER_SIZE;
+        buffer.event = EVENT_BASE + i;
+        buffer.kernels_in = {KERNEL_BASE + i};
+        buffer.kernels_out = {};
+        CHECK(hhal.assign_buffer(Unit::GN, (hhal_buffer *) &buffer));
+
+        gn_event event;
+        event.id = EVENT_BASE + i;
+        event.kernels_in = {KERNEL_BASE + i};
+        event.kernels_out = {KERNEL_BASE + i};
+        CHECK(hhal.assign_event(Unit::GN, (hhal_event *) &event));
+    }
+}
+
+static void deassign_live_resources(HHAL &hhal) {
+    for (int i = 0; i < LIVE_RESOURCES; i++) {
+        CHECK(hhal.deassign_event(EVENT_BASE + i));
+        CHECK(hhal.deassign_buffer(BUFFER_BASE + i));
+        CHECK(hhal.deassign_kernel(KERNEL_BASE + i));
+    }
+}
+
+static void bench_dispatch(int iterations) {
+    HHAL hhal;
+    assign_live_resources(hhal);
+
+    gn_kernel kernel;
+    kernel.id = KID;
+    kernel.termination_event = EID;
+    CHECK(hhal.assign_kernel(Unit::GN, (hhal_kernel *) &kernel));
+    CHECK(hhal.allocate_kernel(KID));
+
+    gn_event event;
+    event.id = EID;
+    event.kernels_in = {KID};
+    event.kernels_out = {KID};
+    CHECK(hhal.assign_event(Unit::GN, (hhal_event *) &event));
+    CHECK(hhal.allocate_event(EID));
+
+    gn_buffer buffer;
+    buffer.id = BID;
+    buffer.size = BUFFER_SIZE;
+    buffer.event = EID;
+    buffer.kernels_in = {KID};
+    buffer.kernels_out = {};
+    CHECK(hhal.assign_buffer(Unit::GN, (hhal_buffer *) &buffer));
+    CHECK(hhal.allocate_memory(BID));
+
+    uint32_t value;
+    char data[8] = {0};
+    double read_ns = ns_per_call(iterations, [&](int) { hhal.read_sync_register(EID, &value); });
+    double write_ns = ns_per_call(iterations, [&](int) { hhal.write_sync_register(EID, 0); });
+    double memory_ns = ns_per_call(iterations, [&](int) { hhal.write_to_memory(BID, data, sizeof(data)); });
+    double unknown_ns = ns_per_call(iterations, [&](int i) { hhal.read_sync_register(-1 - i, &value); });
+    printf("%-24s %10.1f ns\n", "read_sync_register", read_ns);
+    printf("%-24s %10.1f ns\n", "write_sync_register", write_ns);
+    printf("%-24s %10.1f ns\n", "write_to_memory (8 B)", memory_ns);
+    printf("%-24s %10.1f ns\n", "unknown id", unknown_ns);
+
+    CHECK(hhal.release_memory(BID));
+    CHECK(hhal.deassign_buffer(BID));
+    CHECK(hhal.release_event(EID));
+    CHECK(hhal.deassign_event(EID));
+    CHECK(hhal.release_kernel(KID));
+    CHECK(hhal.deassign_kernel(KID));
+    deassign_live_resources(hhal);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    printf("%d live resources, %d iterations\n", LIVE_RESOURCES, iterations);
+    bench_lookups(iterations);
+    bench_dispatch(iterations);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #ifndef HHAL_TYPES_H
 #define HHAL_TYPES_H
 
+#include <cstddef>
+#include <cstring>
 #include <string>
 
 namespace hhal {
@@ -47,6 +49,58 @@ typedef struct hhal_event_t {
     int id;
 } hhal_event;
 
+/*
+ * Strided part of a buffer, for 2D and 3D transfers such as image tiles.
+ * rows * slices rows of row_size bytes are copied, the first one at offset bytes
+ * past the base of the buffer. Pitches are the distances in bytes between the
+ * start of consecutive rows and slices, in the buffer and in host memory.
+ * Slice pitches are not used when slices is 1.
+ */
+typedef struct memory_region_t {
+    size_t offset;
+    size_t row_size;
+    size_t rows;
+    size_t slices;
+    size_t buffer_row_pitch;
+    size_t buffer_slice_pitch;
+    size_t host_row_pitch;
+    size_t host_slice_pitch;
+} memory_region;
+
+// Offset just past the last byte of a region, false if it is empty or overflows
+inline bool region_extent(size_t offset, size_t row_size, size_t rows, size_t slices, size_t row_pitch,
+                          size_t slice_pitch, size_t *extent) {
+    if (row_size == 0 || rows == 0 || slices == 0) return false;
+    size_t last_row, last_slice, span;
+    return !__builtin_mul_overflow(rows - 1, row_pitch, &last_row) &&
+           !__builtin_mul_overflow(slices - 1, slice_pitch, &last_slice) &&
+           !__builtin_add_overflow(last_row, last_slice, &span) &&
+           !__builtin_add_overflow(span, row_size, &span) &&
+           !__builtin_add_overflow(span, offset, extent);
+}
+
+inline bool buffer_extent(const memory_region &region, size_t *extent) {
+    return region_extent(region.offset, region.row_size, region.rows, region.slices,
+                         region.buffer_row_pitch, region.buffer_slice_pitch, extent);
+}
+
+// Copies a region between the base of a buffer and host memory, both extents must have been checked
+inline void copy_region(char *buffer, char *host, const memory_region &region, bool to_buffer) {
+    for (size_t s = 0; s < region.slices; s++) {
+        char *buffer_row = buffer + region.offset + s * region.buffer_slice_pitch;
+        char *host_row = host + s * region.host_slice_pitch;
+        for (size_t r = 0; r < region.rows; r++) {
+            if (to_buffer) {
+                memcpy(buffer_row, host_row, region.row_size);
+            } else {
+                memcpy(host_row, buffer_row, region.row_size);
+            }
+            buffer_row += region.buffer_row_pitch;
+            host_row += region.host_row_pitch;
+        }
+    }
+}
+
 }
 
 #endif